@@ -0,0 +1,510 @@
+// Benchmark of the wrapper library API. Times every entry point over a
+//   sweep of synthetic datasets (worms x frames x spine points) and
+//   writes the results as JSON, so that runs against different builds
+//   (make bench, make bench-native) can be compared.
+//
+// Usage: bench [-w 1,10] [-f 100,1000] [-p 11,49] [-r repeats]
+//              [-l label] [-o results.json]
+//
+// For each operation the JSON holds p50, p99 and mean latency in
+//   microseconds, calls per second and, for loads and saves, MB/s of
+//   file data. peak_rss_kb is the peak resident size of the process
+//   after each sweep point. The handles the timed calls make are
+//   released after each sample, outside the clock, so it does not grow
+//   with the number of repeats.
+//
+// Loads of the same file after the first would come from the load cache
+//   (wconOct_setLoadCache), so it is off while loads are timed and every
+//   repeat parses the file; load_cached times the hits of the cache on
+//   its own, at the budget the run started with.
+#include "octaveWconPythonWrapper.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <time.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <functional>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "wconJson.h"
+using namespace std;
+
+struct Timing {
+  string name;
+  // nanoseconds per call, one entry per sample
+  vector<double> ns;
+  // file bytes per call, 0 unless a load or save
+  double bytes;
+};
+
+static double nowNs() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec * 1e9 + ts.tv_nsec;
+}
+
+// Handles made by the calls being timed, for timeOp to release
+static vector<WconOctHandle> made;
+
+static void releaseMade() {
+  WconOctError err;
+  for (size_t i=0; i<made.size(); i++) {
+    if (!wconOct_isNullHandle(made[i])) {
+      wconOct_releaseHandle(&err, made[i]);
+    }
+  }
+  made.clear();
+}
+
+// Runs op repeats times, each sample averaging over batch calls. What
+//   op puts in made is released between samples.
+static Timing timeOp(const string &name, int repeats, long batch,
+		     const function<bool()> &op) {
+  Timing result;
+  result.name = name;
+  result.bytes = 0;
+  made.reserve(batch);
+  for (int r=0; r<repeats; r++) {
+    double start = nowNs();
+    for (long b=0; b<batch; b++) {
+      if (!op()) {
+	cerr << "ERROR: " << name << " failed" << endl;
+	result.ns.clear();
+	releaseMade();
+	return result;
+      }
+    }
+    result.ns.push_back((nowNs() - start) / batch);
+    releaseMade();
+  }
+  return result;
+}
+
+static double percentile(vector<double> sorted, double p) {
+  sort(sorted.begin(), sorted.end());
+  size_t rank = (size_t)(p / 100.0 * sorted.size() + 0.5);
+  rank = max((size_t)1, min(rank, sorted.size()));
+  return sorted[rank - 1];
+}
+
+static long fileSize(const string &path) {
+  struct stat st;
+  return (stat(path.c_str(), &st) == 0) ? (long)st.st_size : 0;
+}
+
+static long peakRssKb() {
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+  return usage.ru_maxrss;
+}
+
+static vector<long> parseList(const char *s) {
+  vector<long> values;
+  stringstream in(s);
+  string item;
+  while (getline(in, item, ',')) {
+    values.push_back(atol(item.c_str()));
+  }
+  return values;
+}
+
+/*
+ * Synthetic data: worms crawling along random walks, spines in um and
+ *   time in s so that to_canon has something to convert.
+ */
+
+static unsigned long benchSeed = 12345;
+
+static double nextRandom() {
+  benchSeed = benchSeed * 6364136223846793005UL + 1442695040888963407UL;
+  return (double)(benchSeed >> 11) / 9007199254740992.0;
+}
+
+static void writeRecords(FILE *fp, long worms, long frame0, long frame1,
+			 long points) {
+  for (long w=0; w<worms; w++) {
+    double x0 = 1000.0 * w, y0 = 0.0;
+    fprintf(fp, "%s{\"id\":\"%ld\",\"t\":[", (w > 0) ? "," : "", w + 1);
+    for (long f=frame0; f<frame1; f++) {
+      fprintf(fp, "%s%.3f", (f > frame0) ? "," : "", f * 0.04);
+    }
+    const char *axes[2] = { "x", "y" };
+    for (int a=0; a<2; a++) {
+      fprintf(fp, "],\"%s\":[", axes[a]);
+      for (long f=frame0; f<frame1; f++) {
+	fprintf(fp, "%s[", (f > frame0) ? "," : "");
+	double base = (a == 0) ? x0 + 2.0 * f : y0 + 20.0 * nextRandom();
+	for (long p=0; p<points; p++) {
+	  fprintf(fp, "%s%.2f", (p > 0) ? "," : "",
+		  base + ((a == 0) ? 20.0 * p : 5.0 * nextRandom()));
+	}
+	fprintf(fp, "]");
+      }
+    }
+    fprintf(fp, "]}");
+  }
+}
+
+static void writeHeader(FILE *fp) {
+  fprintf(fp, "{\"units\":{\"t\":\"s\",\"x\":\"um\",\"y\":\"um\"},"
+	  "\"metadata\":{\"who\":\"bench\",\"lab\":{\"name\":\"bench\"}},");
+}
+
+static bool writeDataset(const string &path, long worms, long frames,
+			 long points) {
+  FILE *fp = fopen(path.c_str(), "w");
+  if (fp == NULL) {
+    return false;
+  }
+  writeHeader(fp);
+  fprintf(fp, "\"data\":[");
+  writeRecords(fp, worms, 0, frames, points);
+  fprintf(fp, "]}");
+  return fclose(fp) == 0;
+}
+
+// The same kind of data in two chunks linked through "files"
+static bool writeChunks(const string &base, long worms, long frames,
+			long points) {
+  for (int c=0; c<2; c++) {
+    ostringstream name;
+    name << base << "_" << c << ".wcon";
+    FILE *fp = fopen(name.str().c_str(), "w");
+    if (fp == NULL) {
+      return false;
+    }
+    writeHeader(fp);
+    fprintf(fp, "\"files\":{\"current\":\"%s_%d.wcon\",", base.c_str(), c);
+    if (c == 0) {
+      fprintf(fp, "\"prev\":[],\"next\":[\"%s_1.wcon\"]},", base.c_str());
+    } else {
+      fprintf(fp, "\"prev\":[\"%s_0.wcon\"],\"next\":[]},", base.c_str());
+    }
+    fprintf(fp, "\"data\":[");
+    writeRecords(fp, worms, (c == 0) ? 0 : frames / 2,
+		 (c == 0) ? frames / 2 : frames, points);
+    fprintf(fp, "]}");
+    if (fclose(fp) != 0) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Benchmarks
+ */
+
+static vector<Timing> benchMeasurementUnit(int repeats) {
+  const long batch = 10000;
+  vector<Timing> timings;
+  WconOctError err;
+  WconOctHandle mm = wconOct_static_MeasurementUnit_create(&err, "mm");
+  if (err == FAILED) {
+    return timings;
+  }
+  // Results go somewhere the compiler cannot optimize away
+  volatile double sink = 0.0;
+
+  timings.push_back(timeOp("MeasurementUnit_create", repeats, 100,
+    [&]() {
+      made.push_back(wconOct_static_MeasurementUnit_create(&err, "mm/s^2"));
+      return err == SUCCESS;
+    }));
+  timings.push_back(timeOp("MeasurementUnit_to_canon", repeats, batch,
+    [&]() {
+      sink += wconOct_MeasurementUnit_to_canon(&err, mm, 1.5);
+      return err == SUCCESS;
+    }));
+  timings.push_back(timeOp("MeasurementUnit_from_canon", repeats, batch,
+    [&]() {
+      sink += wconOct_MeasurementUnit_from_canon(&err, mm, 1.5);
+      return err == SUCCESS;
+    }));
+  timings.push_back(timeOp("MeasurementUnit_unit_string", repeats, batch,
+    [&]() {
+      sink += wconOct_MeasurementUnit_unit_string(&err, mm)[0];
+      return err == SUCCESS;
+    }));
+  timings.push_back(timeOp("MeasurementUnit_canonical_unit_string",
+			   repeats, batch,
+    [&]() {
+      sink += wconOct_MeasurementUnit_canonical_unit_string(&err, mm)[0];
+      return err == SUCCESS;
+    }));
+  wconOct_releaseHandle(&err, mm);
+  return timings;
+}
+
+// Leaves the last load in *loaded, releasing what it held before
+static Timing timeLoad(const string &name, const string &path, int repeats,
+		       WconOctHandle *loaded) {
+  WconOctError err;
+  Timing t = timeOp(name, repeats, 1, [&]() {
+      made.push_back(*loaded);
+      *loaded = wconOct_static_WCONWorms_load_from_file(&err, path.c_str());
+      return err == SUCCESS;
+    });
+  t.bytes = fileSize(path);
+  return t;
+}
+
+static Timing timeSave(const string &name, WconOctHandle h,
+		       const string &path, int prettyPrint, int compressed,
+		       int repeats) {
+  WconOctError err;
+  Timing t = timeOp(name, repeats, 1, [&]() {
+      wconOct_WCONWorms_save_to_file(&err, h, path.c_str(), prettyPrint,
+				     compressed);
+      return err == SUCCESS;
+    });
+  t.bytes = fileSize(path);
+  return t;
+}
+
+static vector<Timing> benchDataset(long worms, long frames, long points,
+				   int repeats, double loadCacheMb,
+				   long *datasetBytes) {
+  vector<Timing> timings;
+  WconOctError err;
+  string plain = "bench-data.wcon";
+  string chunkBase = "bench-chunk";
+  if (!writeDataset(plain, worms, frames, points) ||
+      !writeChunks(chunkBase, worms, frames, points)) {
+    cerr << "ERROR: Cannot write the benchmark data" << endl;
+    return timings;
+  }
+  *datasetBytes = fileSize(plain);
+
+  WconOctHandle h = wconOct_makeNullHandle();
+  WconOctHandle other = wconOct_makeNullHandle();
+  timings.push_back(timeLoad("load_plain", plain, repeats, &h));
+  if (wconOct_isNullHandle(h)) {
+    return timings;
+  }
+  timings.push_back(timeLoad("load_chunked", chunkBase + "_0.wcon", repeats,
+			     &other));
+  timings.back().bytes += fileSize(chunkBase + "_1.wcon");
+
+  timings.push_back(timeSave("save_compact", h, "bench-out.wcon", 0, 0,
+			     repeats));
+  timings.push_back(timeSave("save_pretty", h, "bench-out.wcon", 1, 0,
+			     repeats));
+  timings.push_back(timeSave("save_compressed", h, "bench-out.wcon.zip", 0, 1,
+			     repeats));
+  timings.push_back(timeLoad("load_zip", "bench-out.wcon.zip", repeats,
+			     &other));
+  if (loadCacheMb > 0) {
+    wconOct_setLoadCache(&err, loadCacheMb);
+    WconOctHandle cached =
+      wconOct_static_WCONWorms_load_from_file(&err, plain.c_str());
+    timings.push_back(timeLoad("load_cached", plain, repeats, &cached));
+    wconOct_releaseHandle(&err, cached);
+    wconOct_setLoadCache(&err, 0);
+  }
+
+  timings.push_back(timeOp("to_canon", repeats, 1, [&]() {
+	made.push_back(wconOct_WCONWorms_to_canon(&err, h));
+	return err == SUCCESS;
+      }));
+  timings.push_back(timeOp("add", repeats, 1, [&]() {
+	made.push_back(wconOct_WCONWorms_add(&err, h, h));
+	return err == SUCCESS;
+      }));
+  timings.push_back(timeOp("eq", repeats, 1, [&]() {
+	wconOct_WCONWorms_eq(&err, h, other);
+	return err == SUCCESS;
+      }));
+  timings.push_back(timeOp("units", repeats, 1, [&]() {
+	WconOctUnitsDict *dict = wconOct_WCONWorms_units(&err, h);
+	if (err == FAILED) {
+	  return false;
+	}
+	for (int i=0; i<dict->numElements; i++) {
+	  made.push_back(dict->unitsDict[i].value);
+	}
+	wconOct_freeUnitsDict(dict);
+	return true;
+      }));
+  timings.push_back(timeOp("metadata", repeats, 1, [&]() {
+	made.push_back(wconOct_WCONWorms_metadata(&err, h));
+	return err == SUCCESS;
+      }));
+  timings.push_back(timeOp("metadata_json", repeats, 1, [&]() {
+	wconOct_freeString(wconOct_WCONWorms_metadata_json(&err, h));
+	return err == SUCCESS;
+      }));
+  timings.push_back(timeOp("worm_data", repeats, 1, [&]() {
+	wconOct_freeWormData(wconOct_WCONWorms_worm_data(&err, h, 0));
+	return err == SUCCESS;
+      }));
+  // A lookup of an existing handle, and one that stores a new handle
+  timings.push_back(timeOp("handle_lookup", repeats, 100, [&]() {
+	wconOct_WCONWorms_num_worms(&err, h);
+	return err == SUCCESS;
+      }));
+  timings.push_back(timeOp("handle_store", repeats, 100, [&]() {
+	made.push_back(wconOct_WCONWorms_worm_ids(&err, h));
+	return err == SUCCESS;
+      }));
+
+  wconOct_releaseHandle(&err, h);
+  wconOct_releaseHandle(&err, other);
+  unlink(plain.c_str());
+  unlink((chunkBase + "_0.wcon").c_str());
+  unlink((chunkBase + "_1.wcon").c_str());
+  unlink("bench-out.wcon");
+  unlink("bench-out.wcon.zip");
+  return timings;
+}
+
+static void writeTimings(WconJsonWriter &json, const vector<Timing> &timings) {
+  json.beginArray();
+  for (size_t i=0; i<timings.size(); i++) {
+    const Timing &t = timings[i];
+    json.beginObject();
+    json.key("name");
+    json.writeString(t.name);
+    json.key("samples");
+    json.writeInteger(t.ns.size());
+    if (!t.ns.empty()) {
+      double mean = 0.0;
+      for (size_t s=0; s<t.ns.size(); s++) {
+	mean += t.ns[s];
+      }
+      mean /= t.ns.size();
+      double p50 = percentile(t.ns, 50);
+      json.key("p50_us");
+      json.writeNumber(p50 / 1e3);
+      json.key("p99_us");
+      json.writeNumber(percentile(t.ns, 99) / 1e3);
+      json.key("mean_us");
+      json.writeNumber(mean / 1e3);
+      json.key("ops_per_s");
+      json.writeNumber(1e9 / mean);
+      if (t.bytes > 0) {
+	json.key("bytes");
+	json.writeInteger((long long)t.bytes);
+	json.key("mb_per_s");
+	json.writeNumber(t.bytes / (p50 / 1e9) / 1e6);
+      }
+    } else {
+      json.key("failed");
+      json.writeBool(true);
+    }
+    json.endObject();
+  }
+  json.endArray();
+}
+
+static void usage() {
+  cerr << "Usage: bench [-w 1,10] [-f 100,1000] [-p 11,49] [-r repeats]"
+       << " [-l label] [-o results.json]" << endl;
+}
+
+int main(int argc, char **argv) {
+  vector<long> wormCounts = parseList("1,10");
+  vector<long> frameCounts = parseList("100,1000");
+  vector<long> pointCounts = parseList("11,49");
+  int repeats = 20;
+  string label;
+  string outPath;
+
+  int opt;
+  while ((opt = getopt(argc, argv, "w:f:p:r:l:o:")) != -1) {
+    switch (opt) {
+    case 'w': wormCounts = parseList(optarg); break;
+    case 'f': frameCounts = parseList(optarg); break;
+    case 'p': pointCounts = parseList(optarg); break;
+    case 'r': repeats = max(1, atoi(optarg)); break;
+    case 'l': label = optarg; break;
+    case 'o': outPath = optarg; break;
+    default:
+      usage();
+      return -1;
+    }
+  }
+
+  FILE *out = stdout;
+  if (!outPath.empty() && (out = fopen(outPath.c_str(), "w")) == NULL) {
+    cerr << "ERROR: Cannot open " << outPath << endl;
+    return -1;
+  }
+
+  WconOctError err;
+  double start = nowNs();
+  wconOct_initWrapper(&err);
+  double initNs = nowNs() - start;
+  if (err == FAILED) {
+    cerr << "ERROR: Failed to initialize wrapper library." << endl;
+    return -1;
+  }
+  // Off until load_cached turns it back on
+  double loadCacheMb = 0;
+  WconOctMemoryReport *report = wconOct_memoryReport(&err, 0);
+  if (err == SUCCESS) {
+    loadCacheMb = report->cacheBudgetBytes / (1024.0 * 1024.0);
+    wconOct_freeMemoryReport(report);
+  }
+  wconOct_setLoadCache(&err, 0);
+
+  WconJsonWriter json(out, 2);
+  json.beginObject();
+  json.key("label");
+  json.writeString(label);
+  json.key("repeats");
+  json.writeInteger(repeats);
+  json.key("init_us");
+  json.writeNumber(initNs / 1e3);
+  json.key("measurement_unit");
+  writeTimings(json, benchMeasurementUnit(repeats));
+
+  bool failed = false;
+  json.key("sweep");
+  json.beginArray();
+  for (size_t w=0; w<wormCounts.size(); w++) {
+    for (size_t f=0; f<frameCounts.size(); f++) {
+      for (size_t p=0; p<pointCounts.size(); p++) {
+	cerr << "bench: " << wormCounts[w] << " worms x " << frameCounts[f]
+	     << " frames x " << pointCounts[p] << " points" << endl;
+	long datasetBytes = 0;
+	vector<Timing> timings = benchDataset(wormCounts[w], frameCounts[f],
+					      pointCounts[p], repeats,
+					      loadCacheMb, &datasetBytes);
+	json.beginObject();
+	json.key("worms");
+	json.writeInteger(wormCounts[w]);
+	json.key("frames");
+	json.writeInteger(frameCounts[f]);
+	json.key("points");
+	json.writeInteger(pointCounts[p]);
+	json.key("file_bytes");
+	json.writeInteger(datasetBytes);
+	json.key("peak_rss_kb");
+	json.writeInteger(peakRssKb());
+	json.key("ops");
+	writeTimings(json, timings);
+	json.endObject();
+	for (size_t i=0; i<timings.size(); i++) {
+	  failed = failed || timings[i].ns.empty();
+	}
+	failed = failed || timings.empty();
+      }
+    }
+  }
+  json.endArray();
+  json.endObject();
+  json.flush();
+  fprintf(out, "\n");
+  if (out != stdout) {
+    fclose(out);
+  }
+  return failed ? 1 : 0;
+}
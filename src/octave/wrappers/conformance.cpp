@@ -0,0 +1,318 @@
+// Conformance test for the native backend: every WCON file under the
+//   repository's tests/ directory is loaded through the C API. Files
+//   the Python package rejects must be rejected; every other file must
+//   survive a save and reload unchanged (compact and pretty printed,
+//   plain and zipped), and saving the same object twice must produce
+//   identical bytes.
+//
+// With -d the files are loaded through the wcond on $WCOND_SOCKET:
+//   the daemon's first load (parsed) and second (mapped from its
+//   cache) must both equal a local parse, and the daemon must have
+//   served them.
+//
+// Usage: conformance [-d] [tests directory]
+#include "octaveWconPythonWrapper.h"
+#include "wcondProtocol.h"
+
+#include <dirent.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+static bool throughDaemon = false;
+
+// Files (relative to the tests directory) that the Python package
+//   rejects too: some predate the current schema, others exercise
+//   units it does not know.
+static const char *expectedFailures[] = {
+  // "head" must be "L", "R" or "?"
+  "data/spine-head-left.wcon",
+  "data/spine-head-right.wcon",
+  // sex must be "hermaphrodite" or "male", arena.size a number or
+  //   strings, lab a single object
+  "metadata/all-metadata.wcon",
+  "metadata/just-sex.wcon",
+  "metadata/alt-arena-two-dimensions.wcon",
+  "metadata/alt-two-labs.wcon",
+  // the archived chunks use "this" rather than "current"
+  "maximalzipped.wcon.zip",
+  // unit values must be strings, and "files" only allows
+  //   current, prev and next
+  "units/custom/q-is-one.wcon",
+  // not in the unit tables: 'ft', 'foot', 'degree', 'deg', 'radian',
+  //   and capitalized temperature names
+  "units/length/foot.wcon",
+  "units/length/foot2.wcon",
+  "units/angle/degrees2.wcon",
+  "units/angle/degrees3.wcon",
+  "units/angle/milliradians3.wcon",
+  "units/angle/radians2.wcon",
+  "units/temperature/celsius3.wcon",
+  "units/temperature/centigrade2.wcon",
+  "units/temperature/fahrenheit3.wcon",
+  "units/temperature/kelvin3.wcon",
+  NULL
+};
+
+static bool isExpectedFailure(const string &name) {
+  for (const char **p = expectedFailures; *p != NULL; p++) {
+    if (name == *p) {
+      return true;
+    }
+  }
+  return false;
+}
+
+static bool hasSuffix(const string &s, const string &suffix) {
+  return s.size() >= suffix.size() &&
+    s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+static void findFiles(const string &root, const string &sub,
+		      vector<string> &files) {
+  string dirPath = sub.empty() ? root : root + "/" + sub;
+  DIR *dir = opendir(dirPath.c_str());
+  if (dir == NULL) {
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(dir)) != NULL) {
+    string name = entry->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+    string rel = sub.empty() ? name : sub + "/" + name;
+    struct stat st;
+    if (stat((root + "/" + rel).c_str(), &st) != 0) {
+      continue;
+    }
+    if (S_ISDIR(st.st_mode)) {
+      findFiles(root, rel, files);
+    } else if (hasSuffix(name, ".wcon") || hasSuffix(name, ".wcon.zip")) {
+      files.push_back(rel);
+    }
+  }
+  closedir(dir);
+}
+
+static bool readFile(const string &path, string &contents) {
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (fp == NULL) {
+    return false;
+  }
+  char buf[65536];
+  size_t n;
+  contents.clear();
+  while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+    contents.append(buf, n);
+  }
+  fclose(fp);
+  return true;
+}
+
+// Saves handle to path, reloads it and checks the reloaded copy is
+//   equal to the original. Returns an error message, empty on success.
+static string roundTrip(WconOctHandle handle, const char *path,
+			int prettyPrint, int compressed) {
+  WconOctError err;
+  wconOct_WCONWorms_save_to_file(&err, handle, path, prettyPrint, compressed);
+  if (err == FAILED) {
+    return string("save to ") + path + " failed";
+  }
+  WconOctHandle reloaded = wconOct_static_WCONWorms_load_from_file(&err, path);
+  if (err == FAILED) {
+    return string("reload of ") + path + " failed";
+  }
+  int equal = wconOct_WCONWorms_eq(&err, handle, reloaded);
+  if (err == FAILED || !equal) {
+    return string("reloaded ") + path + " differs from the original";
+  }
+  return "";
+}
+
+// Loads path twice more, through wcond and then locally, and checks
+//   both copies equal handle (itself loaded through wcond)
+static string checkDaemon(WconOctHandle handle, const string &path) {
+  WconOctError err;
+  WconOctHandle again =
+    wconOct_static_WCONWorms_load_from_file(&err, path.c_str());
+  if (err == FAILED) {
+    return "second load through wcond failed";
+  }
+  setenv("WCOND_DISABLE", "1", 1);
+  WconOctHandle local =
+    wconOct_static_WCONWorms_load_from_file(&err, path.c_str());
+  unsetenv("WCOND_DISABLE");
+  if (err == FAILED) {
+    return "local load failed";
+  }
+  if (!wconOct_WCONWorms_eq(&err, handle, again) || err == FAILED) {
+    return "second load through wcond differs from the first";
+  }
+  if (!wconOct_WCONWorms_eq(&err, handle, local) || err == FAILED) {
+    return "load through wcond differs from a local parse";
+  }
+  return "";
+}
+
+// STATUS of the wcond on $WCOND_SOCKET, its hits and misses; false if
+//   it does not answer
+static bool daemonStatus(unsigned long &hits, unsigned long &misses) {
+  string path = wcondSocketPath();
+  struct sockaddr_un addr;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return false;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return false;
+  }
+  string reply;
+  bool ok = connect(fd, (struct sockaddr *)&addr, sizeof(addr)) == 0 &&
+    wcondWriteAll(fd, "STATUS\n") && wcondReadLine(fd, reply);
+  close(fd);
+  if (!ok || reply.compare(0, 3, "OK ") != 0) {
+    return false;
+  }
+  istringstream fields(reply.substr(3));
+  string field;
+  hits = misses = 0;
+  while (fields >> field) {
+    if (field.compare(0, 5, "hits=") == 0) {
+      hits = strtoul(field.c_str() + 5, NULL, 10);
+    } else if (field.compare(0, 7, "misses=") == 0) {
+      misses = strtoul(field.c_str() + 7, NULL, 10);
+    }
+  }
+  return true;
+}
+
+static string checkFile(const string &path) {
+  WconOctError err;
+  WconOctHandle handle =
+    wconOct_static_WCONWorms_load_from_file(&err, path.c_str());
+  if (err == FAILED) {
+    return "load failed";
+  }
+  if (throughDaemon) {
+    string msg = checkDaemon(handle, path);
+    if (!msg.empty()) {
+      return msg;
+    }
+  }
+
+  string msg = roundTrip(handle, "conformance-out.wcon", 0, 0);
+  if (msg.empty()) {
+    msg = roundTrip(handle, "conformance-pretty.wcon", 1, 0);
+  }
+  if (msg.empty()) {
+    msg = roundTrip(handle, "conformance-out.wcon.zip", 0, 1);
+  }
+  if (!msg.empty()) {
+    return msg;
+  }
+
+  string first, second;
+  wconOct_WCONWorms_save_to_file(&err, handle, "conformance-out.wcon", 0, 0);
+  if (err == FAILED || !readFile("conformance-out.wcon", first)) {
+    return "save failed";
+  }
+  wconOct_WCONWorms_save_to_file(&err, handle, "conformance-out.wcon", 0, 0);
+  if (err == FAILED || !readFile("conformance-out.wcon", second)) {
+    return "save failed";
+  }
+  if (first != second) {
+    return "saving twice gave different files";
+  }
+  return "";
+}
+
+int main(int argc, char **argv) {
+  int opt;
+  while ((opt = getopt(argc, argv, "d")) != -1) {
+    if (opt == 'd') {
+      throughDaemon = true;
+    } else {
+      cerr << "Usage: conformance [-d] [tests directory]" << endl;
+      return -1;
+    }
+  }
+  string root = (optind < argc) ? argv[optind] : "../../../tests";
+
+  unsigned long hits = 0, misses = 0;
+  if (throughDaemon) {
+    if (!daemonStatus(hits, misses)) {
+      cerr << "ERROR: No wcond on " << wcondSocketPath() << endl;
+      return -1;
+    }
+    // Every load has to reach the daemon
+    WconOctError err;
+    wconOct_setLoadCache(&err, 0);
+  }
+
+  vector<string> files;
+  findFiles(root, "", files);
+  sort(files.begin(), files.end());
+  if (files.empty()) {
+    cerr << "ERROR: No WCON files found under " << root << endl;
+    return -1;
+  }
+
+  int failures = 0;
+  for (size_t i=0; i<files.size(); i++) {
+    string path = root + "/" + files[i];
+    bool expectFailure = isExpectedFailure(files[i]);
+    string msg;
+    if (expectFailure) {
+      WconOctError err;
+      cout << "(expect a load error for " << files[i] << ")" << endl;
+      wconOct_static_WCONWorms_load_from_file(&err, path.c_str());
+      if (err != FAILED) {
+	msg = "invalid file was accepted";
+      }
+    } else {
+      msg = checkFile(path);
+    }
+    if (msg.empty()) {
+      cout << "PASS " << files[i] << endl;
+    } else {
+      cout << "FAIL " << files[i] << ": " << msg << endl;
+      failures++;
+    }
+  }
+
+  unlink("conformance-out.wcon");
+  unlink("conformance-pretty.wcon");
+  unlink("conformance-out.wcon.zip");
+
+  if (throughDaemon) {
+    unsigned long before = hits;
+    if (!daemonStatus(hits, misses)) {
+      cout << "FAIL wcond stopped answering" << endl;
+      failures++;
+    } else if (hits == before) {
+      cout << "FAIL wcond served no load from its cache" << endl;
+      failures++;
+    } else {
+      cout << "wcond: " << hits << " hits, " << misses << " misses" << endl;
+    }
+  }
+
+  cout << files.size() - failures << " of " << files.size()
+       << " files conform" << endl;
+  return failures == 0 ? 0 : 1;
+}
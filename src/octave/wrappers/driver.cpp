@@ -1,8 +1,26 @@
 #include "octaveWconPythonWrapper.h"
 
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <fstream>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "wconZip.h"
 using namespace std;
 
+// Time span of the frames handed out by wconOct_parse_stream
+static int spanFrame(const WconOctParseFrame *frame, void *user) {
+  double *span = (double *)user;
+  span[0] = min(span[0], frame->t);
+  span[1] = max(span[1], frame->t);
+  return 0;
+}
+
 int main(int argc, char **argv) {
   WconOctHandle loadedWCONWormsObjHandle = wconOct_makeNullHandle();
   WconOctHandle canonicalWCONWormsObjHandle = wconOct_makeNullHandle();
@@ -59,6 +77,25 @@ int main(int argc, char **argv) {
     }
   }
 
+  // gzip round trip, compressed on two threads
+  wconOct_WCONWorms_save_compressed(&err, loadedWCONWormsObjHandle,
+				    "wrapperCompressed.wcon.gz", 0, -1, 2);
+  if (err == FAILED) {
+    cout << "Failed to save compressed" << endl;
+  } else {
+    handle =
+      wconOct_static_WCONWorms_load_from_file(&err,
+					      "wrapperCompressed.wcon.gz");
+    if (err == FAILED) {
+      cerr << "Error: Failed to load compressed file" << endl;
+    } else {
+      cout << "Compressed round trip "
+	   << (wconOct_WCONWorms_eq(&err, loadedWCONWormsObjHandle, handle) ?
+	       "matches" : "DIFFERS") << endl;
+      wconOct_releaseHandle(&err, handle);
+    }
+  }
+
   handle = 
     wconOct_static_WCONWorms_load_from_file(&err,
 					    "extra-test-data/minimax-conflict.wcon");
@@ -342,4 +379,407 @@ int main(int argc, char **argv) {
   if (err == FAILED) {
     cerr << "Error: Prior to_canon call failed. Ignore the result." << endl;
   }
+
+  // Asynchronous load of the same file
+  WconOctFuture future = 
+    wconOct_load_async(&err, "../../../tests/minimax.wcon");
+  if (err == FAILED) {
+    cerr << "Error: Failed to start an asynchronous load" << endl;
+  } else {
+    WconOctHandle asyncHandle = wconOct_future_result(&err, future);
+    if (err == FAILED) {
+      cerr << "Error: Asynchronous load failed" << endl;
+    } else {
+      cout << "Asynchronous load gave handle " << asyncHandle 
+	   << ", equal to the first: "
+	   << wconOct_WCONWorms_eq(&err, asyncHandle, 
+				   loadedWCONWormsObjHandle) << endl;
+      wconOct_releaseHandle(&err, asyncHandle);
+    }
+  }
+
+  // Split into linked chunks of at most one frame time each, and back
+  long numChunks = wconOct_WCONWorms_split(&err, loadedWCONWormsObjHandle,
+					   "wrapperSplit", 1e-9, 0, 0);
+  if (err == FAILED) {
+    cerr << "Error: Failed to split" << endl;
+  } else {
+    WconOctHandle rejoinedHandle =
+      wconOct_static_WCONWorms_load_from_file(&err, "wrapperSplit_0.wcon");
+    if (err == FAILED) {
+      cerr << "Error: Failed to load the split chunks" << endl;
+    } else {
+      cout << "Split into " << numChunks << " chunks, rejoined equal: "
+	   << wconOct_WCONWorms_eq(&err, rejoinedHandle,
+				   loadedWCONWormsObjHandle) << endl;
+      wconOct_releaseHandle(&err, rejoinedHandle);
+    }
+
+    // The same chunks again, out of core; the native backend only
+    WconOctHandle pagedHandle =
+      wconOct_static_WCONWorms_load_paged(&err, "wrapperSplit_0.wcon");
+    if (err == FAILED) {
+      cout << "Failed to load the split chunks paged" << endl;
+      // ok to fail
+    } else {
+      cout << "Paged load of the split chunks equal: "
+	   << wconOct_WCONWorms_eq(&err, pagedHandle,
+				   loadedWCONWormsObjHandle) << endl;
+      wconOct_releaseHandle(&err, pagedHandle);
+    }
+
+    // The chunks packed into one archive, copies of which side by side
+    //   are loaded at once; each load unpacks into its own directory
+    vector<string> chunkNames, chunkContents;
+    for (long i=0; i<numChunks; i++) {
+      ostringstream chunkName;
+      chunkName << "wrapperSplit_" << i << ".wcon";
+      ifstream chunkIn(chunkName.str().c_str(), ios::in | ios::binary);
+      chunkNames.push_back(chunkName.str());
+      chunkContents.push_back(string(istreambuf_iterator<char>(chunkIn),
+				     istreambuf_iterator<char>()));
+    }
+    struct tm stamp;
+    memset(&stamp, 0, sizeof(stamp));
+    stamp.tm_year = 116;
+    stamp.tm_mday = 1;
+    const char *archivePaths[] = {"wrapperArchive_0.wcon.zip",
+				  "wrapperArchive_1.wcon.zip",
+				  "wrapperArchive_2.wcon.zip",
+				  "wrapperArchive_3.wcon.zip"};
+    const size_t numArchives = sizeof(archivePaths) / sizeof(char *);
+    for (size_t i=0; i<numArchives; i++) {
+      wconZipWriteEntries(archivePaths[i], chunkNames, chunkContents, stamp);
+    }
+    vector<WconOctHandle> archiveHandles(numArchives);
+    vector<WconOctError> archiveErrs(numArchives);
+    wconOct_load_many(&err, archivePaths, numArchives, &archiveHandles[0],
+		      &archiveErrs[0]);
+    if (err == FAILED) {
+      cerr << "Error: Failed to load the archives together" << endl;
+    } else {
+      bool archivesEqual = true;
+      for (size_t i=0; i<numArchives; i++) {
+	archivesEqual = archivesEqual &&
+	  wconOct_WCONWorms_eq(&err, archiveHandles[i],
+			       loadedWCONWormsObjHandle);
+      }
+      cout << "Archives loaded together equal: " << archivesEqual << endl;
+    }
+    for (size_t i=0; i<numArchives; i++) {
+      if (archiveErrs[i] == SUCCESS) {
+	wconOct_releaseHandle(&err, archiveHandles[i]);
+      }
+    }
+  }
+
+  // Split of a to_canon view of a file timed in ms: the chunks are
+  //   planned in seconds and must be cut in seconds too
+  ofstream millisOut("wrapperMillis.wcon");
+  millisOut << "{\"units\":{\"t\":\"ms\",\"x\":\"mm\",\"y\":\"mm\"},"
+	    << "\"data\":[{\"id\":\"1\",\"t\":[0,500,1000,1500,2000,2500],"
+	    << "\"x\":[[1,2],[1,2],[1,2],[1,2],[1,2],[1,2]],"
+	    << "\"y\":[[3,4],[3,4],[3,4],[3,4],[3,4],[3,4]]}]}" << endl;
+  millisOut.close();
+  WconOctHandle millisHandle =
+    wconOct_static_WCONWorms_load_from_file(&err, "wrapperMillis.wcon");
+  if (err == FAILED) {
+    cerr << "Error: Failed to load wrapperMillis.wcon" << endl;
+  } else {
+    WconOctHandle millisCanonHandle =
+      wconOct_WCONWorms_to_canon(&err, millisHandle);
+    long numMillisChunks = (err == FAILED) ? -1 :
+      wconOct_WCONWorms_split(&err, millisCanonHandle, "wrapperMillis",
+			      1.0, 0, 0);
+    if (err == FAILED) {
+      cerr << "Error: Failed to split the canonical view" << endl;
+    } else {
+      cout << "Split the canonical view into frames of";
+      for (long i=0; i<numMillisChunks; i++) {
+	ostringstream chunkName;
+	chunkName << "wrapperMillis_" << i << ".wcon";
+	WconOctPeek *peek = wconOct_peek(&err, chunkName.str().c_str());
+	if (err == SUCCESS) {
+	  cout << " " << peek->numFrames;
+	  wconOct_freePeek(peek);
+	}
+      }
+      cout << endl;
+      wconOct_releaseHandle(&err, millisCanonHandle);
+    }
+    wconOct_releaseHandle(&err, millisHandle);
+  }
+
+  // Six worms at different frame rates onto one timebase, not filling
+  //   in gaps of more than 4 s
+  WconOctHandle allTimesHandle =
+    wconOct_static_WCONWorms_load_from_file(&err,
+				"../../../tests/examples/all_times.wcon");
+  if (err == FAILED) {
+    cerr << "Error: Failed to load all_times.wcon" << endl;
+  } else {
+    WconOctHandle resampledHandle =
+      wconOct_WCONWorms_resample(&err, allTimesHandle, 1.0, NULL, 0,
+				 WCONOCT_INTERP_CUBIC, 4.0);
+    if (err == FAILED) {
+      cerr << "Error: Failed to resample all_times.wcon" << endl;
+    } else {
+      cout << "Resampled " << wconOct_WCONWorms_num_worms(&err,
+							  resampledHandle)
+	   << " worms onto a 1 s timebase" << endl;
+      wconOct_releaseHandle(&err, resampledHandle);
+    }
+    wconOct_releaseHandle(&err, allTimesHandle);
+  }
+
+  // Spines of the first worm at 11 points each, row major
+  long numSpineFrames =
+    wconOct_WCONWorms_spines(&err, loadedWCONWormsObjHandle, 0, 11, NULL,
+			     NULL, 0, 0, NULL);
+  if (err == FAILED) {
+    cerr << "Error: Failed to count the frames of the first worm" << endl;
+  } else {
+    vector<double> spineX(numSpineFrames * 11), spineY(numSpineFrames * 11);
+    vector<double> spineLength(numSpineFrames);
+    wconOct_WCONWorms_spines(&err, loadedWCONWormsObjHandle, 0, 11,
+			     &spineX[0], &spineY[0], 11, 1, &spineLength[0]);
+    if (err == FAILED) {
+      cerr << "Error: Failed to resample the spines" << endl;
+    } else {
+      cout << "Resampled " << numSpineFrames << " spines, the first "
+	   << spineLength[0] << " long" << endl;
+    }
+  }
+
+  // A copy of the canonical form that holds its own data; with the
+  //   native backend, to_canon only gave a view
+  WconOctHandle materialHandle =
+    wconOct_WCONWorms_materialize(&err, canonicalWCONWormsObjHandle);
+  if (err == FAILED) {
+    cerr << "Error: Failed to materialize handle "
+	 << canonicalWCONWormsObjHandle << endl;
+  } else {
+    cout << "Materialized canonical data is "
+	 << (wconOct_WCONWorms_eq(&err, materialHandle,
+				  canonicalWCONWormsObjHandle) == 1 ?
+	     "" : "NOT ")
+	 << "equivalent to its view" << endl;
+    wconOct_releaseHandle(&err, materialHandle);
+  }
+
+  // Compact storage: float32 spines, which take half the memory
+  WconOctCompactInfo compactInfo;
+  WconOctHandle compactHandle =
+    wconOct_WCONWorms_compact(&err, loadedWCONWormsObjHandle,
+			      WCONOCT_COMPACT_FLOAT32, 0, &compactInfo);
+  if (err == FAILED) {
+    cerr << "Error: Failed to compact the spines" << endl;
+  } else {
+    cout << "Compacted the spines from " << compactInfo.bytesBefore
+	 << " to " << compactInfo.bytesAfter << " bytes, within "
+	 << compactInfo.errorBound << endl;
+    wconOct_releaseHandle(&err, compactHandle);
+  }
+
+  // Locomotion features of every worm
+  WconOctHandle featuresHandle =
+    wconOct_WCONWorms_features(&err, loadedWCONWormsObjHandle);
+  if (err == FAILED) {
+    cerr << "Error: Failed to compute the features" << endl;
+  } else {
+    wconOct_WCONWorms_save_to_file(&err, featuresHandle,
+				   "wrapperFeatures.wcon", 0, 0);
+    if (err == FAILED) {
+      cerr << "Error: Failed to save the features" << endl;
+    } else {
+      cout << "Saved the features of " 
+	   << wconOct_WCONWorms_num_worms(&err, featuresHandle)
+	   << " worms" << endl;
+    }
+    wconOct_releaseHandle(&err, featuresHandle);
+  }
+
+  // Frame cursor over every worm
+  WconOctCursor *cursor = 
+    wconOct_cursor_open(&err, loadedWCONWormsObjHandle, WCONOCT_ALL_WORMS,
+			-INFINITY, INFINITY);
+  if (err == FAILED) {
+    cerr << "Error: Failed to open a cursor" << endl;
+  } else {
+    WconOctFrame frame;
+    long numFrames = 0, numPoints = 0;
+    while (wconOct_cursor_next(&err, cursor, &frame)) {
+      numFrames++;
+      numPoints += frame.numPoints;
+    }
+    if (err == FAILED) {
+      cerr << "Error: Cursor failed after " << numFrames << " frames" << endl;
+    } else {
+      cout << "Cursor read " << numFrames << " frames with " << numPoints
+	   << " points" << endl;
+    }
+    wconOct_cursor_close(cursor);
+  }
+
+  // Time-major scan: the most worms seen at one time
+  WconOctTimeCursor *timeCursor =
+    wconOct_timecursor_open(&err, loadedWCONWormsObjHandle, -INFINITY,
+			    INFINITY);
+  if (err == FAILED) {
+    cerr << "Error: Failed to open a time cursor" << endl;
+  } else {
+    WconOctTimeSlice slice;
+    long numTimes = 0, mostWorms = 0;
+    while (wconOct_timecursor_next(&err, timeCursor, &slice)) {
+      numTimes++;
+      mostWorms = max(mostWorms, slice.numWorms);
+    }
+    if (err == FAILED) {
+      cerr << "Error: Time cursor failed after " << numTimes << " steps"
+	   << endl;
+    } else {
+      cout << "Time cursor read " << numTimes << " time steps, with up to "
+	   << mostWorms << " worms at once" << endl;
+    }
+    wconOct_timecursor_close(timeCursor);
+  }
+
+  // Spatial index: the frames nearest the origin, and those around the
+  //   nearest one
+  WconOctSpatialIndex *spatial =
+    wconOct_spatial_open(&err, loadedWCONWormsObjHandle, 0, 0);
+  if (err == FAILED) {
+    cerr << "Error: Failed to build a spatial index" << endl;
+  } else {
+    WconOctSpatialHits *nearest =
+      wconOct_spatial_nearest(&err, spatial, 0, 0, 3, -INFINITY, INFINITY);
+    if (err == FAILED) {
+      cerr << "Error: Failed to find the nearest frames" << endl;
+    } else if (nearest->numHits > 0) {
+      const WconOctSpatialHit &first = nearest->hits[0];
+      WconOctSpatialHits *around =
+	wconOct_spatial_radius(&err, spatial, first.x, first.y, 1,
+			       -INFINITY, INFINITY);
+      if (err == FAILED) {
+	cerr << "Error: Failed to find the frames around "
+	     << first.wormId << endl;
+      } else {
+	cout << "Nearest the origin: worm " << first.wormId << " at t="
+	     << first.t << ", with " << around->numHits
+	     << " frames within 1 of it" << endl;
+      }
+      wconOct_freeSpatialHits(around);
+    }
+    wconOct_freeSpatialHits(nearest);
+    wconOct_spatial_close(spatial);
+  }
+
+  // Streaming write of two worms, in chunks of at most 32 KB
+  WconOctWriter *writer =
+    wconOct_writer_open(&err, "wrapperStream.wcon",
+			"{\"t\": \"s\", \"x\": \"mm\", \"y\": \"mm\"}",
+			"{\"who\": \"driver\"}", 32768);
+  if (err == FAILED) {
+    cerr << "Error: Failed to open a writer" << endl;
+  } else {
+    double spineX[11], spineY[11];
+    for (int i=0; i<200 && err == SUCCESS; i++) {
+      for (int k=0; k<11; k++) {
+	spineX[k] = 0.1 * k + 0.01 * i;
+	spineY[k] = 0.05 * (i % 7);
+      }
+      wconOct_writer_append(&err, writer, "1", 0.04 * i, spineX, spineY, 11);
+      if (err == SUCCESS) {
+	wconOct_writer_append(&err, writer, "2", 0.04 * i, spineY, spineX, 11);
+      }
+    }
+    if (err == FAILED) {
+      cerr << "Error: Failed to append a frame" << endl;
+    }
+    wconOct_writer_close(&err, writer);
+    if (err == FAILED) {
+      cerr << "Error: Failed to close the writer" << endl;
+    } else {
+      WconOctHandle streamHandle =
+	wconOct_static_WCONWorms_load_from_file(&err, "wrapperStream.wcon");
+      if (err == FAILED) {
+	cerr << "Error: Failed to load the streamed chunks" << endl;
+      } else {
+	cout << "Streamed chunks hold "
+	     << wconOct_WCONWorms_num_worms(&err, streamHandle)
+	     << " worms" << endl;
+	wconOct_releaseHandle(&err, streamHandle);
+      }
+
+      // And once more without loading them
+      WconOctParseCallbacks callbacks;
+      memset(&callbacks, 0, sizeof(callbacks));
+      callbacks.frame = spanFrame;
+      double span[2] = {INFINITY, -INFINITY};
+      long numFrames =
+	wconOct_parse_stream(&err, "wrapperStream.wcon", &callbacks, span);
+      if (err == FAILED) {
+	cerr << "Error: Failed to parse the streamed chunks" << endl;
+      } else {
+	cout << "Parsed " << numFrames << " frames from t=" << span[0]
+	     << " to t=" << span[1] << endl;
+      }
+
+      // And the header and inventory of the first chunk alone
+      WconOctPeek *peek = wconOct_peek(&err, "wrapperStream.wcon");
+      if (err == FAILED) {
+	cerr << "Error: Failed to peek at the streamed chunks" << endl;
+      } else {
+	cout << "Peeked at " << peek->numRecords << " records, "
+	     << peek->numFrames << " frames, from t=" << peek->tMin
+	     << " to t=" << peek->tMax << "; units " << peek->unitsJson
+	     << endl;
+	wconOct_freePeek(peek);
+      }
+    }
+  }
+
+  // Catalog of the test files, in memory only, and a selection from it
+  WconOctCatalog *catalog = wconOct_catalog_open(&err, NULL);
+  long numCataloged = (err == FAILED) ? 0 :
+    wconOct_catalog_scan(&err, catalog, "../../../tests", 0);
+  if (err == FAILED) {
+    cerr << "Error: Failed to catalog the test files" << endl;
+  } else {
+    WconOctCatalogHits *hits =
+      wconOct_catalog_select(&err, catalog,
+			     "numWorms > 1 && metadata.lab");
+    if (err == FAILED) {
+      cerr << "Error: Failed to select from the catalog" << endl;
+    } else {
+      cout << hits->numHits << " of " << numCataloged
+	   << " cataloged test files have a lab and more than one worm"
+	   << endl;
+      wconOct_freeCatalogHits(hits);
+    }
+  }
+  wconOct_catalog_close(catalog);
+
+  // Memory accounting and release
+  WconOctMemoryReport *report = wconOct_memoryReport(&err, 3);
+  if (err == FAILED) {
+    cerr << "Error: Failed to get a memory report" << endl;
+  } else {
+    cout << report->numHandles << " live handles and the load cache hold "
+	 << "about " << report->totalBytes << " bytes" << endl;
+    // minimax.wcon again in the asynchronous load
+    cout << "  load cache: " << report->numCached << " datasets, "
+	 << report->cachedBytes << " bytes, " << report->cacheHits
+	 << " hits, " << report->cacheMisses << " misses" << endl;
+    for (int i=0; i<report->numEntries; i++) {
+      cout << "  handle " << report->entries[i].handle << ": "
+	   << report->entries[i].bytes << " bytes from "
+	   << report->entries[i].createdBy << endl;
+    }
+    wconOct_freeMemoryReport(report);
+  }
+  wconOct_releaseHandle(&err, hoursUnitHandle);
+  if (err == FAILED) {
+    cerr << "Error: Failed to release handle " << hoursUnitHandle << endl;
+  }
 }
@@ -0,0 +1,313 @@
+#include "nativeCompact.h"
+
+#include <float.h>
+#include <limits.h>
+#include <math.h>
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+#include <limits>
+#include <sstream>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+using namespace std;
+
+// Quantized points further than this many quanta from the first point
+//   of their frame are refused, so that every difference fits 4 bytes
+#define COMPACT_MAX_QUANTA (1LL << 30)
+
+namespace {
+
+// Change per unit of the quantity, in canonical units
+double canonicalScale(const NativeWCONWorms &w, const string &key) {
+  const NativeMeasurementUnit *unit = w.unit(key);
+  if (unit == NULL) {
+    throw WconNativeError("No unit for " + key + " to compact it with");
+  }
+  return fabs(unit->toCanon(1.0) - unit->toCanon(0.0));
+}
+
+// The missing point marker of each code width: the most negative code
+template <typename Code>
+Code missingCode() {
+  return numeric_limits<Code>::min();
+}
+
+// out[k] = o + q * acc[k]. Encoding works the same out, so decoding
+//   gives back exactly the values the errors were measured on.
+void scaleRow(const int32_t *acc, long m, double o, double q, double *out) {
+  long k = 0;
+#ifdef __SSE2__
+  __m128d vo = _mm_set1_pd(o), vq = _mm_set1_pd(q);
+  for (; k + 2 <= m; k += 2) {
+    __m128i a = _mm_loadl_epi64((const __m128i *)(acc + k));
+    _mm_storeu_pd(out + k, _mm_add_pd(vo, _mm_mul_pd(vq,
+						     _mm_cvtepi32_pd(a))));
+  }
+#endif
+  for (; k < m; k++) {
+    out[k] = o + q * (double)acc[k];
+  }
+}
+
+void widenRow(const float *in, long m, double *out) {
+  long k = 0;
+#ifdef __SSE2__
+  for (; k + 4 <= m; k += 4) {
+    __m128 f = _mm_loadu_ps(in + k);
+    _mm_storeu_pd(out + k, _mm_cvtps_pd(f));
+    _mm_storeu_pd(out + k + 2, _mm_cvtps_pd(_mm_movehl_ps(f, f)));
+  }
+#endif
+  for (; k < m; k++) {
+    out[k] = (double)in[k];
+  }
+}
+
+// Frames [begin, end) of one coordinate. codes holds numFrames x m
+//   codes of the type Code.
+template <typename Code>
+void decodeQuantized(const vector<unsigned char> &codes,
+		     const vector<double> &origin, long m, double q,
+		     long begin, long end, double *out, long rowStride) {
+  vector<Code> row(m);
+  vector<int32_t> acc(m);
+  for (long i=begin; i<end; i++) {
+    double *dest = out + (i - begin) * rowStride;
+    double o = origin[i];
+    if (isnan(o)) {
+      fill(dest, dest + m, (double)NAN);
+      continue;
+    }
+    memcpy(row.data(), &codes[i * m * sizeof(Code)], m * sizeof(Code));
+    // The running sum is the one step that cannot go wide
+    int32_t sum = 0;
+    bool missing = false;
+    for (long k=0; k<m; k++) {
+      if (row[k] == missingCode<Code>()) {
+	missing = true;
+      } else {
+	sum += row[k];
+      }
+      acc[k] = sum;
+    }
+    scaleRow(acc.data(), m, o, q, dest);
+    for (long k=0; missing && k<m; k++) {
+      if (row[k] == missingCode<Code>()) {
+	dest[k] = NAN;
+      }
+    }
+  }
+}
+
+void decodeFloat(const vector<unsigned char> &codes, long m, long begin,
+		 long end, double *out, long rowStride) {
+  vector<float> row(m);
+  for (long i=begin; i<end; i++) {
+    memcpy(row.data(), &codes[i * m * sizeof(float)], m * sizeof(float));
+    widenRow(row.data(), m, out + (i - begin) * rowStride);
+  }
+}
+
+// One coordinate of a worm as float32. maxError and maxAbs are in the
+//   units of the dataset.
+void encodeFloat(const vector<double> &values, vector<unsigned char> &codes,
+		 double &maxError, double &maxAbs) {
+  vector<float> f(values.size());
+  for (size_t k=0; k<values.size(); k++) {
+    f[k] = (float)values[k];
+    if (!isnan(values[k])) {
+      maxError = max(maxError, fabs(values[k] - (double)f[k]));
+      maxAbs = max(maxAbs, fabs(values[k]));
+    }
+  }
+  codes.resize(f.size() * sizeof(float));
+  if (!f.empty()) {
+    memcpy(&codes[0], f.data(), codes.size());
+  }
+}
+
+// One coordinate of a worm as differences of quanta along each frame,
+//   before they are narrowed. Missing points are LLONG_MIN.
+void quantize(const vector<double> &values, long numFrames, long m,
+	      double q, const string &key, vector<double> &origin,
+	      vector<long long> &deltas, long long &maxDelta,
+	      double &maxError, double &maxAbs) {
+  origin.assign(numFrames, NAN);
+  deltas.resize(values.size());
+  for (long i=0; i<numFrames; i++) {
+    const double *v = &values[i * m];
+    double o = NAN;
+    for (long k=0; k<m && isnan(o); k++) {
+      o = v[k];
+    }
+    origin[i] = o;
+    long long last = 0;
+    for (long k=0; k<m; k++) {
+      if (isnan(v[k])) {
+	deltas[i * m + k] = LLONG_MIN;
+	continue;
+      }
+      double quanta = round((v[k] - o) / q);
+      if (!(fabs(quanta) <= (double)COMPACT_MAX_QUANTA)) {
+	ostringstream msg;
+	msg << "Cannot quantize " << key << " = " << v[k]
+	    << ": too far from the start of the spine for a quantum of " << q
+	    << " (in its units)";
+	throw WconNativeError(msg.str());
+      }
+      long long n = (long long)quanta;
+      deltas[i * m + k] = n - last;
+      maxDelta = max(maxDelta, llabs(n - last));
+      last = n;
+      maxError = max(maxError, fabs(o + q * (double)(int32_t)n - v[k]));
+      maxAbs = max(maxAbs, fabs(v[k]));
+    }
+  }
+}
+
+template <typename Code>
+void narrow(const vector<long long> &deltas, vector<unsigned char> &codes) {
+  vector<Code> c(deltas.size());
+  for (size_t k=0; k<deltas.size(); k++) {
+    c[k] = (deltas[k] == LLONG_MIN) ? missingCode<Code>() : (Code)deltas[k];
+  }
+  codes.resize(c.size() * sizeof(Code));
+  if (!c.empty()) {
+    memcpy(&codes[0], c.data(), codes.size());
+  }
+}
+
+void narrowTo(int width, const vector<long long> &deltas,
+	      vector<unsigned char> &codes) {
+  if (width == 1) {
+    narrow<int8_t>(deltas, codes);
+  } else if (width == 2) {
+    narrow<int16_t>(deltas, codes);
+  } else {
+    narrow<int32_t>(deltas, codes);
+  }
+}
+
+void decodeTo(int width, const vector<unsigned char> &codes,
+	      const vector<double> &origin, long m, double q, long begin,
+	      long end, double *out, long rowStride) {
+  if (width == 1) {
+    decodeQuantized<int8_t>(codes, origin, m, q, begin, end, out, rowStride);
+  } else if (width == 2) {
+    decodeQuantized<int16_t>(codes, origin, m, q, begin, end, out,
+			     rowStride);
+  } else {
+    decodeQuantized<int32_t>(codes, origin, m, q, begin, end, out,
+			     rowStride);
+  }
+}
+
+} // namespace
+
+shared_ptr<const NativeCompactSpines>
+NativeCompactSpines::encode(const NativeWCONWorms &w, WconOctCompactMode mode,
+			    double quantum, WconOctCompactInfo &info) {
+  double scaleX = canonicalScale(w, "x"), scaleY = canonicalScale(w, "y");
+  if (mode == WCONOCT_COMPACT_QUANTIZED &&
+      !(quantum > 0 && scaleX > 0 && scaleY > 0)) {
+    throw WconNativeError("Quantized spines need a quantum above 0");
+  }
+  shared_ptr<NativeCompactSpines> result(new NativeCompactSpines);
+  result->mode = mode;
+  result->quantumX = (mode == WCONOCT_COMPACT_QUANTIZED) ?
+    quantum / scaleX : 0;
+  result->quantumY = (mode == WCONOCT_COMPACT_QUANTIZED) ?
+    quantum / scaleY : 0;
+  result->worms.resize(w.worms.size());
+
+  double errorX = 0, errorY = 0, absX = 0, absY = 0;
+  info.bytesBefore = info.bytesAfter = 0;
+  for (size_t i=0; i<w.worms.size(); i++) {
+    const NativeWorm &worm = w.worms[i];
+    NativeCompactWorm &c = result->worms[i];
+    c.numFrames = worm.numFrames;
+    c.maxPoints = worm.maxPoints;
+    if (mode == WCONOCT_COMPACT_FLOAT32) {
+      c.width = sizeof(float);
+      encodeFloat(worm.x, c.x, errorX, absX);
+      encodeFloat(worm.y, c.y, errorY, absY);
+    } else {
+      vector<long long> dx, dy;
+      long long maxDelta = 0;
+      quantize(worm.x, worm.numFrames, worm.maxPoints, result->quantumX,
+	       "x", c.ox, dx, maxDelta, errorX, absX);
+      quantize(worm.y, worm.numFrames, worm.maxPoints, result->quantumY,
+	       "y", c.oy, dy, maxDelta, errorY, absY);
+      c.width = (maxDelta < 128) ? 1 : (maxDelta < 32768) ? 2 : 4;
+      narrowTo(c.width, dx, c.x);
+      narrowTo(c.width, dy, c.y);
+    }
+    info.bytesBefore += (worm.x.size() + worm.y.size()) * sizeof(double);
+    info.bytesAfter += c.x.size() + c.y.size() +
+      (c.ox.size() + c.oy.size()) * sizeof(double);
+  }
+  info.maxErrorX = errorX * scaleX;
+  info.maxErrorY = errorY * scaleY;
+  double largest = max(absX * scaleX, absY * scaleY);
+  if (mode == WCONOCT_COMPACT_FLOAT32) {
+    // Half a unit in the last place of a float
+    info.errorBound = largest * ldexp(1.0, -24);
+  } else {
+    // Half a quantum, and the rounding of o + q * n
+    info.errorBound = 0.5 * quantum + 4 * DBL_EPSILON * largest;
+  }
+  return result;
+}
+
+shared_ptr<const NativeWCONWorms>
+NativeCompactSpines::strip(const NativeWCONWorms &w) {
+  shared_ptr<NativeWCONWorms> result(new NativeWCONWorms(w));
+  for (size_t i=0; i<result->worms.size(); i++) {
+    vector<double>().swap(result->worms[i].x);
+    vector<double>().swap(result->worms[i].y);
+  }
+  return result;
+}
+
+shared_ptr<const NativeWCONWorms>
+NativeCompactSpines::expand(const NativeWCONWorms &stripped) const {
+  shared_ptr<NativeWCONWorms> result(new NativeWCONWorms(stripped));
+  for (size_t i=0; i<result->worms.size(); i++) {
+    NativeWorm &worm = result->worms[i];
+    worm.x.resize(worm.numFrames * worm.maxPoints);
+    worm.y.resize(worm.numFrames * worm.maxPoints);
+    if (!worm.x.empty()) {
+      decode(i, 0, worm.numFrames, &worm.x[0], &worm.y[0], worm.maxPoints);
+    }
+  }
+  return result;
+}
+
+void NativeCompactSpines::decode(size_t i, long begin, long end, double *x,
+				 double *y, long rowStride) const {
+  const NativeCompactWorm &c = worms[i];
+  if (mode == WCONOCT_COMPACT_FLOAT32) {
+    decodeFloat(c.x, c.maxPoints, begin, end, x, rowStride);
+    decodeFloat(c.y, c.maxPoints, begin, end, y, rowStride);
+  } else {
+    decodeTo(c.width, c.x, c.ox, c.maxPoints, quantumX, begin, end, x,
+	     rowStride);
+    decodeTo(c.width, c.y, c.oy, c.maxPoints, quantumY, begin, end, y,
+	     rowStride);
+  }
+}
+
+size_t NativeCompactSpines::byteSize() const {
+  size_t bytes = sizeof(*this);
+  for (size_t i=0; i<worms.size(); i++) {
+    const NativeCompactWorm &c = worms[i];
+    bytes += sizeof(c) + c.x.capacity() + c.y.capacity() +
+      (c.ox.capacity() + c.oy.capacity()) * sizeof(double);
+  }
+  return bytes;
+}
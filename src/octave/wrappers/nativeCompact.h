@@ -0,0 +1,67 @@
+#ifndef __NATIVE_COMPACT_H_
+#define __NATIVE_COMPACT_H_
+// Compact storage of the spine points of a native dataset, behind
+//   wconOct_WCONWorms_compact.
+//
+// A compact handle keeps a copy of the dataset without x and y, and the
+//   points in one of two encodings:
+//   - float32: each coordinate as a float
+//   - quantized: each coordinate as a multiple of a quantum, relative to
+//     the first point of its frame, stored as the difference from the
+//     point before in 1, 2 or 4 bytes (the fewest every difference of
+//     the worm fits in)
+// Points are decoded on the fly, a frame at a time, with SSE2 where the
+//   compiler has it.
+#include <memory>
+#include <vector>
+
+#include "nativeDataset.h"
+#include "wrapperTypes.h"
+
+struct NativeCompactWorm {
+  NativeCompactWorm() : width(0), numFrames(0), maxPoints(0) {}
+
+  // Bytes per stored coordinate
+  int width;
+  long numFrames;
+  long maxPoints;
+  // Quantized: the first point of each frame, NaN if it has none
+  std::vector<double> ox;
+  std::vector<double> oy;
+  // numFrames x maxPoints codes of width bytes, row major
+  std::vector<unsigned char> x;
+  std::vector<unsigned char> y;
+};
+
+class NativeCompactSpines {
+ public:
+  WconOctCompactMode mode;
+  // Quantized: in the units of x and y of the dataset
+  double quantumX;
+  double quantumY;
+  // As the worms of the dataset
+  std::vector<NativeCompactWorm> worms;
+
+  // Encodes the spines of w. quantum is in canonical units. maxError
+  //   and errorBound of info come out in canonical units. Throws
+  //   WconNativeError if a worm is too long for the quantum.
+  static std::shared_ptr<const NativeCompactSpines>
+    encode(const NativeWCONWorms &w, WconOctCompactMode mode,
+	   double quantum, WconOctCompactInfo &info);
+
+  // w without its spine points, to keep next to the encoding
+  static std::shared_ptr<const NativeWCONWorms>
+    strip(const NativeWCONWorms &w);
+  // The dataset back from strip(w), with the points decoded
+  std::shared_ptr<const NativeWCONWorms>
+    expand(const NativeWCONWorms &stripped) const;
+
+  // Frames [begin, end) of worm i, maxPoints points each, into x and y
+  //   row major (rowStride apart), NaN where there is no point
+  void decode(size_t i, long begin, long end, double *x, double *y,
+	      long rowStride) const;
+
+  size_t byteSize() const;
+};
+
+#endif /* __NATIVE_COMPACT_H_ */
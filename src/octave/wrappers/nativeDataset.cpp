@@ -0,0 +1,1882 @@
+#include "nativeDataset.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <map>
+#include <set>
+#include <sstream>
+
+#include "wconCodec.h"
+#include "wconZip.h"
+using namespace std;
+
+namespace {
+
+/*
+ * Helpers
+ */
+
+// The Python package keys rows by a float index, where NaN matches NaN
+bool sameTime(double a, double b) {
+  return a == b || (isnan(a) && isnan(b));
+}
+
+string formatNumber(double value) {
+  char buf[32];
+  wconJsonFormatDouble(value, buf);
+  return buf;
+}
+
+// Rows [first, last) of a column of width values per row
+template <typename T>
+void copyRows(vector<T> &dest, const vector<T> &src, long first, long last,
+	      long width) {
+  if (!src.empty()) {
+    dest.assign(src.begin() + first * width, src.begin() + last * width);
+  }
+}
+
+// Reorders the rows of a column of width values per row
+template <typename T>
+void permuteRows(vector<T> &column, const vector<long> &order, long width) {
+  if (column.empty()) {
+    return;
+  }
+  vector<T> sorted;
+  sorted.reserve(column.size());
+  for (size_t i=0; i<order.size(); i++) {
+    sorted.insert(sorted.end(), column.begin() + order[i] * width,
+		  column.begin() + (order[i] + 1) * width);
+  }
+  column.swap(sorted);
+}
+
+// NaN sorts last, as in DataFrame.sort_index
+bool timeLess(double a, double b) {
+  if (isnan(a)) {
+    return false;
+  } else if (isnan(b)) {
+    return true;
+  }
+  return a < b;
+}
+
+struct TimeOrder {
+  explicit TimeOrder(const vector<double> &t) : t(t) {}
+  bool operator()(long a, long b) const {
+    return timeLess(t[a], t[b]);
+  }
+  const vector<double> &t;
+};
+
+void sortByTime(NativeWorm &w) {
+  vector<long> order(w.numFrames);
+  for (long i=0; i<w.numFrames; i++) {
+    order[i] = i;
+  }
+  stable_sort(order.begin(), order.end(), TimeOrder(w.t));
+  bool sorted = true;
+  for (long i=0; i<w.numFrames && sorted; i++) {
+    sorted = (order[i] == i);
+  }
+  if (sorted) {
+    return;
+  }
+  permuteRows(w.t, order, 1);
+  permuteRows(w.x, order, w.maxPoints);
+  permuteRows(w.y, order, w.maxPoints);
+  permuteRows(w.aspectSize, order, 1);
+  permuteRows(w.cx, order, 1);
+  permuteRows(w.cy, order, 1);
+  permuteRows(w.ox, order, 1);
+  permuteRows(w.oy, order, 1);
+  permuteRows(w.head, order, 1);
+  permuteRows(w.ventral, order, 1);
+}
+
+void widenPoints(vector<double> &column, long numFrames, long oldWidth,
+		 long newWidth) {
+  vector<double> wide(numFrames * newWidth, NAN);
+  for (long i=0; i<numFrames; i++) {
+    copy(column.begin() + i * oldWidth, column.begin() + (i + 1) * oldWidth,
+	 wide.begin() + i * newWidth);
+  }
+  column.swap(wide);
+}
+
+// Gives dest every column src has, as a pandas concat would
+void widenColumns(NativeWorm &dest, const NativeWorm &src) {
+  if (src.maxPoints > dest.maxPoints) {
+    widenPoints(dest.x, dest.numFrames, dest.maxPoints, src.maxPoints);
+    widenPoints(dest.y, dest.numFrames, dest.maxPoints, src.maxPoints);
+    dest.maxPoints = src.maxPoints;
+  }
+  if (src.hasCentroid() && !dest.hasCentroid()) {
+    dest.cx.assign(dest.numFrames, NAN);
+    dest.cy.assign(dest.numFrames, NAN);
+  }
+  if (src.hasOffset() && !dest.hasOffset()) {
+    dest.ox.assign(dest.numFrames, NAN);
+    dest.oy.assign(dest.numFrames, NAN);
+  }
+  if (src.hasHead() && !dest.hasHead()) {
+    dest.head.assign(dest.numFrames, "");
+  }
+  if (src.hasVentral() && !dest.hasVentral()) {
+    dest.ventral.assign(dest.numFrames, "");
+  }
+}
+
+// Appends row i of src; dest must have all of src's columns
+void appendRow(NativeWorm &dest, const NativeWorm &src, long i) {
+  dest.t.push_back(src.t[i]);
+  for (long k=0; k<dest.maxPoints; k++) {
+    dest.x.push_back(k < src.maxPoints ? src.x[i * src.maxPoints + k] : NAN);
+    dest.y.push_back(k < src.maxPoints ? src.y[i * src.maxPoints + k] : NAN);
+  }
+  dest.aspectSize.push_back(src.aspectSize[i]);
+  if (dest.hasCentroid()) {
+    dest.cx.push_back(src.hasCentroid() ? src.cx[i] : NAN);
+    dest.cy.push_back(src.hasCentroid() ? src.cy[i] : NAN);
+  }
+  if (dest.hasOffset()) {
+    dest.ox.push_back(src.hasOffset() ? src.ox[i] : NAN);
+    dest.oy.push_back(src.hasOffset() ? src.oy[i] : NAN);
+  }
+  if (dest.hasHead()) {
+    dest.head.push_back(src.hasHead() ? src.head[i] : "");
+  }
+  if (dest.hasVentral()) {
+    dest.ventral.push_back(src.hasVentral() ? src.ventral[i] : "");
+  }
+  dest.numFrames++;
+}
+
+bool numberConflicts(double d, double s) {
+  return !isnan(d) && !(d == s);
+}
+
+bool stringConflicts(const string &d, const string &s) {
+  return !d.empty() && d != s;
+}
+
+// A row of dest and the row of src with the same time
+struct RowPair {
+  long dest;
+  long src;
+};
+
+bool rowsConflict(const NativeWorm &dest, const NativeWorm &src,
+		  const RowPair &p) {
+  long points = min(dest.maxPoints, src.maxPoints);
+  for (long k=0; k<points; k++) {
+    if (numberConflicts(dest.x[p.dest * dest.maxPoints + k],
+			src.x[p.src * src.maxPoints + k]) ||
+	numberConflicts(dest.y[p.dest * dest.maxPoints + k],
+			src.y[p.src * src.maxPoints + k])) {
+      return true;
+    }
+  }
+  if (numberConflicts(dest.aspectSize[p.dest], src.aspectSize[p.src])) {
+    return true;
+  }
+  if (dest.hasCentroid() && src.hasCentroid() &&
+      (numberConflicts(dest.cx[p.dest], src.cx[p.src]) ||
+       numberConflicts(dest.cy[p.dest], src.cy[p.src]))) {
+    return true;
+  }
+  if (dest.hasOffset() && src.hasOffset() &&
+      (numberConflicts(dest.ox[p.dest], src.ox[p.src]) ||
+       numberConflicts(dest.oy[p.dest], src.oy[p.src]))) {
+    return true;
+  }
+  if (dest.hasHead() && src.hasHead() &&
+      stringConflicts(dest.head[p.dest], src.head[p.src])) {
+    return true;
+  }
+  if (dest.hasVentral() && src.hasVentral() &&
+      stringConflicts(dest.ventral[p.dest], src.ventral[p.src])) {
+    return true;
+  }
+  return false;
+}
+
+void updateNumber(double &d, double s) {
+  if (!isnan(s)) {
+    d = s;
+  }
+}
+
+void updateString(string &d, const string &s) {
+  if (!s.empty()) {
+    d = s;
+  }
+}
+
+void updateRow(NativeWorm &dest, const NativeWorm &src, const RowPair &p) {
+  long points = min(dest.maxPoints, src.maxPoints);
+  for (long k=0; k<points; k++) {
+    updateNumber(dest.x[p.dest * dest.maxPoints + k],
+		 src.x[p.src * src.maxPoints + k]);
+    updateNumber(dest.y[p.dest * dest.maxPoints + k],
+		 src.y[p.src * src.maxPoints + k]);
+  }
+  updateNumber(dest.aspectSize[p.dest], src.aspectSize[p.src]);
+  if (dest.hasCentroid() && src.hasCentroid()) {
+    updateNumber(dest.cx[p.dest], src.cx[p.src]);
+    updateNumber(dest.cy[p.dest], src.cy[p.src]);
+  }
+  if (dest.hasOffset() && src.hasOffset()) {
+    updateNumber(dest.ox[p.dest], src.ox[p.src]);
+    updateNumber(dest.oy[p.dest], src.oy[p.src]);
+  }
+  if (dest.hasHead() && src.hasHead()) {
+    updateString(dest.head[p.dest], src.head[p.src]);
+  }
+  if (dest.hasVentral() && src.hasVentral()) {
+    updateString(dest.ventral[p.dest], src.ventral[p.src]);
+  }
+}
+
+// wcon_data.df_upsert: adds the rows of src to dest. Values for times
+//   dest already has must agree with dest wherever dest is not null.
+//   dest only gains src's columns if src brings new times.
+void upsert(NativeWorm &dest, const NativeWorm &src) {
+  vector<RowPair> shared;
+  vector<long> newRows;
+  // dest is always sorted by time
+  for (long i=0; i<src.numFrames; i++) {
+    pair<vector<double>::const_iterator, vector<double>::const_iterator>
+      range = equal_range(dest.t.begin(), dest.t.end(), src.t[i], timeLess);
+    if (range.first == range.second) {
+      newRows.push_back(i);
+    }
+    for (vector<double>::const_iterator it = range.first;
+	 it != range.second; ++it) {
+      RowPair p = {(long)(it - dest.t.begin()), i};
+      shared.push_back(p);
+    }
+  }
+
+  if (!newRows.empty()) {
+    widenColumns(dest, src);
+    for (size_t i=0; i<newRows.size(); i++) {
+      appendRow(dest, src, newRows[i]);
+    }
+  }
+
+  for (size_t i=0; i<shared.size(); i++) {
+    if (rowsConflict(dest, src, shared[i])) {
+      throw WconNativeError("Data from this segment conflicted with "
+			    "previously loaded data at t=" +
+			    formatNumber(src.t[shared[i].src]));
+    }
+  }
+  for (size_t i=0; i<shared.size(); i++) {
+    updateRow(dest, src, shared[i]);
+  }
+
+  sortByTime(dest);
+}
+
+// wcon_data.convert_origin: folds the offsets into the coordinates,
+//   leaving x and y relative to the centroid if there is one.
+void convertOrigin(NativeWorm &w) {
+  if (!w.hasOffset()) {
+    return;
+  }
+  for (long i=0; i<w.numFrames; i++) {
+    double ox = isnan(w.ox[i]) ? 0.0 : w.ox[i];
+    double oy = isnan(w.oy[i]) ? 0.0 : w.oy[i];
+    double *x = &w.x[i * w.maxPoints];
+    double *y = &w.y[i * w.maxPoints];
+    for (long k=0; k<w.maxPoints; k++) {
+      x[k] += ox;
+      y[k] += oy;
+    }
+    if (w.hasCentroid()) {
+      w.cx[i] += ox;
+      w.cy[i] += oy;
+      for (long k=0; k<w.maxPoints; k++) {
+	x[k] -= w.cx[i];
+	y[k] -= w.cy[i];
+      }
+    }
+  }
+  vector<double>().swap(w.ox);
+  vector<double>().swap(w.oy);
+}
+
+struct WormOrder {
+  bool operator()(const pair<string, long> &a,
+		  const pair<string, long> &b) const {
+    return a.first < b.first;
+  }
+};
+
+// wcon_data.sort_odict: orders worms by str((id, df)), i.e. by repr(id)
+void sortWorms(vector<NativeWorm> &worms) {
+  vector<pair<string, long> > keys;
+  for (size_t i=0; i<worms.size(); i++) {
+    keys.push_back(make_pair(nativePyRepr(worms[i].id, false) + ",",
+			     (long)i));
+  }
+  stable_sort(keys.begin(), keys.end(), WormOrder());
+  vector<NativeWorm> sorted(worms.size());
+  for (size_t i=0; i<keys.size(); i++) {
+    swap(sorted[i], worms[keys[i].second]);
+  }
+  worms.swap(sorted);
+}
+
+map<string, long> wormIndex(const vector<NativeWorm> &worms) {
+  map<string, long> index;
+  for (size_t i=0; i<worms.size(); i++) {
+    index[worms[i].id] = (long)i;
+  }
+  return index;
+}
+
+/*
+ * Schema checks. Only the parts of wcon_schema.json that constrain
+ *   something are checked; the messages name the offending key.
+ */
+
+void invalid(const string &msg) {
+  throw WconNativeError("File does not match the WCON schema: " + msg);
+}
+
+bool isStringArray(const WconJsonValue &v, size_t minItems) {
+  if (!v.isArray() || v.items.size() < minItems) {
+    return false;
+  }
+  for (size_t i=0; i<v.items.size(); i++) {
+    if (!v.items[i].isString()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+bool isStringOrStringArray(const WconJsonValue &v) {
+  return v.isString() || isStringArray(v, 0);
+}
+
+bool isOneOf(const WconJsonValue &v, const char *const *values) {
+  if (!v.isString()) {
+    return false;
+  }
+  for (; *values != NULL; values++) {
+    if (v.strValue == *values) {
+      return true;
+    }
+  }
+  return false;
+}
+
+void checkStringProperty(const WconJsonValue &obj, const char *key,
+			 const string &where) {
+  const WconJsonValue *v = obj.find(key);
+  if (v != NULL && !v->isString()) {
+    invalid(where + "." + key + " must be a string");
+  }
+}
+
+void checkInterpolate(const WconJsonValue &v) {
+  if (!v.isObject()) {
+    invalid("metadata.interpolate must hold objects");
+  }
+  checkStringProperty(v, "method", "metadata.interpolate");
+  const WconJsonValue *values = v.find("values");
+  if (values != NULL && !isStringOrStringArray(*values)) {
+    invalid("metadata.interpolate.values must be a string or an array "
+	    "of strings");
+  }
+}
+
+void checkSoftware(const WconJsonValue &v) {
+  if (!v.isObject()) {
+    invalid("metadata.software must hold objects");
+  }
+  const WconJsonValue *tracker = v.find("tracker");
+  if (tracker != NULL) {
+    if (!tracker->isObject()) {
+      invalid("metadata.software.tracker must be an object");
+    }
+    checkStringProperty(*tracker, "name", "metadata.software.tracker");
+    checkStringProperty(*tracker, "version", "metadata.software.tracker");
+  }
+  checkStringProperty(v, "featureID", "metadata.software");
+}
+
+void checkMetadata(const WconJsonValue &m) {
+  static const char *const sexes[] = {"hermaphrodite", "male", NULL};
+  static const char *const stages[] = {"L1", "L2", "L3", "L4", "adult",
+				       "dauer", NULL};
+  static const char *const strings[] = {"id", "timestamp", "food", "media",
+					"strain", NULL};
+  static const char *const numbers[] = {"temperature", "humidity", "age",
+					NULL};
+  static const char *const lists[] = {"who", "protocol", NULL};
+
+  if (!m.isObject()) {
+    invalid("metadata must be an object");
+  }
+  for (const char *const *k = strings; *k != NULL; k++) {
+    checkStringProperty(m, *k, "metadata");
+  }
+  for (const char *const *k = numbers; *k != NULL; k++) {
+    const WconJsonValue *v = m.find(*k);
+    if (v != NULL && !v->isNumber()) {
+      invalid(string("metadata.") + *k + " must be a number");
+    }
+  }
+  for (const char *const *k = lists; *k != NULL; k++) {
+    const WconJsonValue *v = m.find(*k);
+    if (v != NULL && !isStringOrStringArray(*v)) {
+      invalid(string("metadata.") + *k +
+	      " must be a string or an array of strings");
+    }
+  }
+  const WconJsonValue *v = m.find("lab");
+  if (v != NULL && !v->isObject()) {
+    invalid("metadata.lab must be an object");
+  }
+  v = m.find("sex");
+  if (v != NULL && !isOneOf(*v, sexes)) {
+    invalid("metadata.sex must be \"hermaphrodite\" or \"male\"");
+  }
+  v = m.find("stage");
+  if (v != NULL && !isOneOf(*v, stages)) {
+    invalid("metadata.stage must be one of L1, L2, L3, L4, adult, dauer");
+  }
+  v = m.find("arena");
+  if (v != NULL) {
+    if (!v->isObject()) {
+      invalid("metadata.arena must be an object");
+    }
+    checkStringProperty(*v, "style", "metadata.arena");
+    checkStringProperty(*v, "orientation", "metadata.arena");
+    const WconJsonValue *size = v->find("size");
+    if (size != NULL && !size->isNumber() && !isStringArray(*size, 2)) {
+      invalid("metadata.arena.size must be a number or an array of at "
+	      "least two strings");
+    }
+  }
+  v = m.find("interpolate");
+  if (v != NULL) {
+    if (v->isArray()) {
+      for (size_t i=0; i<v->items.size(); i++) {
+	checkInterpolate(v->items[i]);
+      }
+    } else {
+      checkInterpolate(*v);
+    }
+  }
+  v = m.find("software");
+  if (v != NULL) {
+    if (v->isArray()) {
+      for (size_t i=0; i<v->items.size(); i++) {
+	checkSoftware(v->items[i]);
+      }
+    } else {
+      checkSoftware(*v);
+    }
+  }
+}
+
+void checkUnits(const WconJsonValue &u) {
+  if (!u.isObject()) {
+    invalid("units must be an object");
+  }
+  for (size_t i=0; i<u.members.size(); i++) {
+    if (!u.members[i].second.isString()) {
+      invalid("units." + u.members[i].first + " must be a string");
+    }
+  }
+  static const char *const required[] = {"t", "x", "y", NULL};
+  for (const char *const *k = required; *k != NULL; k++) {
+    if (u.find(*k) == NULL) {
+      invalid(string("units must have an entry for ") + *k);
+    }
+  }
+}
+
+// The "files" object, with prev and next always as arrays
+struct ChunkFiles {
+  ChunkFiles() : present(false) {}
+  bool present;
+  string current;
+  vector<string> prev;
+  vector<string> next;
+};
+
+void readChunkLinks(const WconJsonValue &v, const char *key,
+		    vector<string> &out) {
+  if (v.isNull()) {
+    return;
+  } else if (v.isString()) {
+    // A bare file name stands for a one-element array
+    if (!v.strValue.empty()) {
+      out.push_back(v.strValue);
+    }
+    return;
+  } else if (v.isArray()) {
+    for (size_t i=0; i<v.items.size(); i++) {
+      if (!v.items[i].isString() || v.items[i].strValue.empty()) {
+	invalid(string("files.") + key + " must hold non-empty strings");
+      }
+      out.push_back(v.items[i].strValue);
+    }
+    return;
+  }
+  invalid(string("files.") + key +
+	  " must be null, a string or an array of strings");
+}
+
+void readChunkFiles(const WconJsonValue &v, ChunkFiles &files) {
+  if (!v.isObject()) {
+    invalid("files must be an object");
+  }
+  files.present = true;
+  bool haveCurrent = false;
+  for (size_t i=0; i<v.members.size(); i++) {
+    const string &k = v.members[i].first;
+    const WconJsonValue &m = v.members[i].second;
+    if (k == "current") {
+      if (!m.isString()) {
+	invalid("files.current must be a string");
+      }
+      files.current = m.strValue;
+      haveCurrent = true;
+    } else if (k == "prev") {
+      readChunkLinks(m, "prev", files.prev);
+    } else if (k == "next") {
+      readChunkLinks(m, "next", files.next);
+    } else {
+      invalid("files may not contain " + nativePyRepr(k, false));
+    }
+  }
+  if (!haveCurrent) {
+    invalid("files must have an entry for current");
+  }
+}
+
+/*
+ * Data records
+ */
+
+// x or y: one row of values per frame
+struct PointRows {
+  PointRows() : present(false) {}
+  bool present;
+  vector<double> values;
+  vector<long> lengths;
+};
+
+// head or ventral; bare values apply to every frame
+struct LabelSeries {
+  LabelSeries() : present(false), bare(false) {}
+  bool present;
+  bool bare;
+  vector<string> values;
+};
+
+struct DataRecord {
+  DataRecord() : hasId(false), hasT(false), hasCentroidX(false),
+		 hasCentroidY(false), hasOffsetX(false),
+		 hasOffsetY(false) {}
+  bool hasId;
+  string id;
+  bool hasT;
+  vector<double> t;
+  bool hasCentroidX, hasCentroidY, hasOffsetX, hasOffsetY;
+  vector<double> cx, cy, ox, oy;
+  PointRows x, y;
+  LabelSeries head, ventral;
+};
+
+double readNullableNumber(WconJsonReader &reader, const string &where) {
+  WconJsonReader::Token tok = reader.peek();
+  if (tok == WconJsonReader::TOKEN_NUMBER) {
+    return reader.readNumber();
+  } else if (tok == WconJsonReader::TOKEN_NULL) {
+    reader.readNull();
+    return NAN;
+  }
+  invalid(where + " must hold numbers or null");
+  return NAN;
+}
+
+void readNumbers(WconJsonReader &reader, const string &where,
+		 vector<double> &out) {
+  if (reader.peek() != WconJsonReader::TOKEN_ARRAY) {
+    invalid(where + " must be an array of numbers");
+  }
+  reader.beginArray();
+  while (reader.nextItem()) {
+    out.push_back(readNullableNumber(reader, where));
+  }
+}
+
+// Either an array of numbers (one point per frame) or an array of
+//   arrays of numbers; an empty array would be both, so it is neither.
+void readPointRows(WconJsonReader &reader, const string &where,
+		   PointRows &out) {
+  if (reader.peek() != WconJsonReader::TOKEN_ARRAY) {
+    invalid(where + " must be an array");
+  }
+  out.present = true;
+  reader.beginArray();
+  int nested = -1;
+  while (reader.nextItem()) {
+    bool isArray = (reader.peek() == WconJsonReader::TOKEN_ARRAY);
+    if (nested == -1) {
+      nested = isArray ? 1 : 0;
+    } else if (nested != (isArray ? 1 : 0)) {
+      invalid(where + " must be an array of numbers or an array of arrays");
+    }
+    if (isArray) {
+      size_t before = out.values.size();
+      readNumbers(reader, where, out.values);
+      out.lengths.push_back((long)(out.values.size() - before));
+    } else {
+      out.values.push_back(readNullableNumber(reader, where));
+      out.lengths.push_back(1);
+    }
+  }
+  if (nested == -1) {
+    invalid(where + " may not be empty");
+  }
+}
+
+void readLabel(WconJsonReader &reader, const string &where,
+	       const char *const *allowed, vector<string> &out) {
+  WconJsonReader::Token tok = reader.peek();
+  if (tok == WconJsonReader::TOKEN_NULL) {
+    reader.readNull();
+    out.push_back("");
+    return;
+  } else if (tok == WconJsonReader::TOKEN_STRING) {
+    string s;
+    reader.readString(s);
+    for (const char *const *a = allowed; *a != NULL; a++) {
+      if (s == *a) {
+	out.push_back(s);
+	return;
+      }
+    }
+  }
+  string msg = where + " must be null or one of";
+  for (const char *const *a = allowed; *a != NULL; a++) {
+    msg += string(" ") + *a;
+  }
+  invalid(msg);
+}
+
+void readLabels(WconJsonReader &reader, const string &where,
+		const char *const *allowed, LabelSeries &out) {
+  out.present = true;
+  if (reader.peek() == WconJsonReader::TOKEN_ARRAY) {
+    reader.beginArray();
+    while (reader.nextItem()) {
+      readLabel(reader, where, allowed, out.values);
+    }
+  } else {
+    out.bare = true;
+    readLabel(reader, where, allowed, out.values);
+  }
+}
+
+bool isNumberArray(const WconJsonValue &v, bool nullable) {
+  if (!v.isArray()) {
+    return false;
+  }
+  for (size_t i=0; i<v.items.size(); i++) {
+    if (!v.items[i].isNumber() && !(nullable && v.items[i].isNull())) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Keys that are validated but not otherwise used
+void checkOtherDataKey(const string &key, const WconJsonValue &v) {
+  if (key == "px" || key == "py") {
+    bool flat = isNumberArray(v, true);
+    bool nested = v.isArray();
+    for (size_t i=0; nested && i<v.items.size(); i++) {
+      nested = isNumberArray(v.items[i], true);
+    }
+    if (flat == nested) {
+      invalid("data." + key + " must be an array of numbers or an array "
+	      "of arrays");
+    }
+  } else if (key == "ptail") {
+    if (!v.isNumber() && !v.isNull() && !isNumberArray(v, true)) {
+      invalid("data.ptail must be a number or an array of numbers");
+    }
+  } else if (key == "walk") {
+    if (!v.isArray()) {
+      invalid("data.walk must be an array");
+    }
+    for (size_t i=0; i<v.items.size(); i++) {
+      const WconJsonValue &w = v.items[i];
+      if (!w.isObject()) {
+	invalid("data.walk must hold objects");
+      }
+      const WconJsonValue *px = w.find("px");
+      if (px != NULL && (!isNumberArray(*px, false) || px->items.size() < 3)) {
+	invalid("data.walk.px must be an array of at least three numbers");
+      }
+      const WconJsonValue *n = w.find("n");
+      if (n != NULL && !n->isNumber() &&
+	  !(isNumberArray(*n, false) && n->items.size() >= 2)) {
+	invalid("data.walk.n must be a number or an array of at least two "
+		"numbers");
+      }
+      checkStringProperty(w, "4", "data.walk");
+    }
+  }
+}
+
+void readDataRecord(WconJsonReader &reader, DataRecord &rec) {
+  static const char *const heads[] = {"L", "R", "?", NULL};
+  static const char *const ventrals[] = {"CW", "CCW", "?", NULL};
+
+  if (reader.peek() != WconJsonReader::TOKEN_OBJECT) {
+    invalid("data must hold objects");
+  }
+  reader.beginObject();
+  set<string> seen;
+  string key;
+  while (reader.nextMember(key)) {
+    if (!seen.insert(key).second) {
+      throw WconNativeError("Duplicate key: " + nativePyRepr(key, false));
+    }
+    string where = "data." + key;
+    if (key == "id") {
+      if (reader.peek() != WconJsonReader::TOKEN_STRING) {
+	invalid("data.id must be a string");
+      }
+      reader.readString(rec.id);
+      rec.hasId = true;
+    } else if (key == "t") {
+      readNumbers(reader, where, rec.t);
+      rec.hasT = true;
+    } else if (key == "x") {
+      readPointRows(reader, where, rec.x);
+    } else if (key == "y") {
+      readPointRows(reader, where, rec.y);
+    } else if (key == "cx") {
+      readNumbers(reader, where, rec.cx);
+      rec.hasCentroidX = true;
+    } else if (key == "cy") {
+      readNumbers(reader, where, rec.cy);
+      rec.hasCentroidY = true;
+    } else if (key == "ox") {
+      readNumbers(reader, where, rec.ox);
+      rec.hasOffsetX = true;
+    } else if (key == "oy") {
+      readNumbers(reader, where, rec.oy);
+      rec.hasOffsetY = true;
+    } else if (key == "head") {
+      readLabels(reader, where, heads, rec.head);
+    } else if (key == "ventral") {
+      readLabels(reader, where, ventrals, rec.ventral);
+    } else {
+      WconJsonValue v;
+      reader.readValue(v);
+      checkOtherDataKey(key, v);
+    }
+  }
+  if (!rec.hasId || !rec.hasT || !rec.x.present || !rec.y.present) {
+    invalid("data records must have id, t, x and y");
+  }
+}
+
+// wcon_data._validate_time_series_data and the staging part of
+//   _obtain_time_series_data_frame, for one record
+void recordToWorm(DataRecord &rec, long index, NativeWorm &w) {
+  if (rec.hasCentroidX != rec.hasCentroidY) {
+    throw WconNativeError("cx and cy must be given together");
+  }
+  if (rec.hasOffsetX != rec.hasOffsetY) {
+    throw WconNativeError("ox and oy must be given together");
+  }
+
+  long n = (long)rec.t.size();
+  vector<long> frames;
+  frames.push_back((long)rec.x.lengths.size());
+  frames.push_back((long)rec.y.lengths.size());
+  const vector<double> *scalars[] = {&rec.cx, &rec.cy, &rec.ox, &rec.oy};
+  const bool present[] = {rec.hasCentroidX, rec.hasCentroidY,
+			  rec.hasOffsetX, rec.hasOffsetY};
+  for (int i=0; i<4; i++) {
+    if (present[i]) {
+      if (scalars[i]->empty()) {
+	throw WconNativeError("Empty array in data segment " +
+			      nativePyRepr(rec.id, false));
+      }
+      frames.push_back((long)scalars[i]->size());
+    }
+  }
+  LabelSeries *labels[] = {&rec.head, &rec.ventral};
+  for (int i=0; i<2; i++) {
+    if (!labels[i]->present) {
+      continue;
+    }
+    if (labels[i]->bare) {
+      labels[i]->values.assign(n, labels[i]->values[0]);
+    } else if (labels[i]->values.empty()) {
+      throw WconNativeError("Empty array in data segment " +
+			    nativePyRepr(rec.id, false));
+    }
+    frames.push_back((long)labels[i]->values.size());
+  }
+  for (size_t i=0; i<frames.size(); i++) {
+    if (frames[i] != n) {
+      throw WconNativeError("Error: Elements must have all have the same "
+			    "number of timeframes.");
+    }
+  }
+
+  w.id = rec.id;
+  w.numFrames = n;
+  w.maxPoints = 0;
+  for (long i=0; i<n; i++) {
+    if (rec.x.lengths[i] != rec.y.lengths[i]) {
+      throw WconNativeError("Error: Aspects x and y, etc. must have same "
+			    "length for data segment " +
+			    formatNumber((double)index) + " and time index " +
+			    formatNumber(rec.t[i]));
+    }
+    w.maxPoints = max(w.maxPoints, rec.x.lengths[i]);
+  }
+  w.t.swap(rec.t);
+  w.x.assign(n * w.maxPoints, NAN);
+  w.y.assign(n * w.maxPoints, NAN);
+  w.aspectSize.resize(n);
+  size_t offset = 0;
+  for (long i=0; i<n; i++) {
+    long len = rec.x.lengths[i];
+    copy(rec.x.values.begin() + offset, rec.x.values.begin() + offset + len,
+	 w.x.begin() + i * w.maxPoints);
+    copy(rec.y.values.begin() + offset, rec.y.values.begin() + offset + len,
+	 w.y.begin() + i * w.maxPoints);
+    w.aspectSize[i] = (double)len;
+    offset += len;
+  }
+  w.cx.swap(rec.cx);
+  w.cy.swap(rec.cy);
+  w.ox.swap(rec.ox);
+  w.oy.swap(rec.oy);
+  w.head.swap(rec.head.values);
+  w.ventral.swap(rec.ventral.values);
+  sortByTime(w);
+}
+
+// Adds one record to the worms loaded so far, or hands it to sink
+void addRecord(WconJsonReader &reader, long index, vector<NativeWorm> &worms,
+	       map<string, long> &byId, NativeRecordSink *sink) {
+  DataRecord rec;
+  readDataRecord(reader, rec);
+  NativeWorm segment;
+  recordToWorm(rec, index, segment);
+  if (sink != NULL) {
+    convertOrigin(segment);
+    sink->record(segment);
+    return;
+  }
+  map<string, long>::iterator it = byId.find(segment.id);
+  if (it == byId.end()) {
+    byId[segment.id] = (long)worms.size();
+    worms.push_back(NativeWorm());
+    swap(worms.back(), segment);
+  } else {
+    upsert(worms[it->second], segment);
+  }
+}
+
+void readData(WconJsonReader &reader, vector<NativeWorm> &worms,
+	      NativeRecordSink *sink) {
+  map<string, long> byId;
+  WconJsonReader::Token tok = reader.peek();
+  if (tok == WconJsonReader::TOKEN_OBJECT) {
+    addRecord(reader, 0, worms, byId, sink);
+  } else if (tok == WconJsonReader::TOKEN_ARRAY) {
+    reader.beginArray();
+    long index = 0;
+    while (reader.nextItem()) {
+      addRecord(reader, index++, worms, byId, sink);
+    }
+  } else {
+    invalid("data must be an object or an array");
+  }
+}
+
+// WCONWorms.load, minus the "files" handling which needs a path. With a
+//   sink, the records go to it and w gets no worms.
+void loadStream(WconJsonSource *source, NativeWCONWorms &w,
+		ChunkFiles &files, NativeRecordSink *sink = NULL) {
+  WconJsonReader reader(source);
+  if (reader.peek() != WconJsonReader::TOKEN_OBJECT) {
+    invalid("the root must be an object");
+  }
+  reader.beginObject();
+  set<string> seen;
+  string key;
+  bool haveUnits = false;
+  bool haveData = false;
+  WconJsonValue unitsValue;
+  while (reader.nextMember(key)) {
+    if (!seen.insert(key).second) {
+      throw WconNativeError("Duplicate key: " + nativePyRepr(key, false));
+    }
+    if (key == "data") {
+      readData(reader, w.worms, sink);
+      haveData = true;
+    } else if (key == "units") {
+      reader.readValue(unitsValue);
+      checkUnits(unitsValue);
+      haveUnits = true;
+    } else if (key == "metadata") {
+      reader.readValue(w.metadata);
+      checkMetadata(w.metadata);
+      w.hasMetadata = true;
+    } else if (key == "files") {
+      WconJsonValue v;
+      reader.readValue(v);
+      readChunkFiles(v, files);
+    } else {
+      // Custom top-level keys are ignored, but still have to parse
+      WconJsonValue v;
+      reader.readValue(v);
+    }
+  }
+  reader.expectEnd();
+  if (!haveUnits || !haveData) {
+    invalid("units and data are required");
+  }
+
+  for (size_t i=0; i<unitsValue.members.size(); i++) {
+    const string &k = unitsValue.members[i].first;
+    if (k == "aspect_size") {
+      continue;
+    }
+    w.units.push_back(make_pair(k, NativeMeasurementUnit::create(
+				  unitsValue.members[i].second.strValue)));
+  }
+  // aspect_size is generated while loading, and is dimensionless
+  w.units.push_back(make_pair(string("aspect_size"),
+			      NativeMeasurementUnit::create("")));
+
+  for (size_t i=0; i<w.worms.size(); i++) {
+    convertOrigin(w.worms[i]);
+  }
+  sortWorms(w.worms);
+
+  for (size_t i=0; i<w.worms.size(); i++) {
+    w.checkDataUnits(w.worms[i].id, w.worms[i].hasCentroid());
+  }
+}
+
+/*
+ * Files
+ */
+
+string joinPath(const string &dir, const string &name) {
+  if (dir.empty() || dir[dir.size() - 1] == '/') {
+    return dir + name;
+  }
+  return dir + "/" + name;
+}
+
+// os.path.normpath
+string normPath(const string &path) {
+  bool absolute = !path.empty() && path[0] == '/';
+  vector<string> parts;
+  size_t start = 0;
+  while (start <= path.size()) {
+    size_t end = path.find('/', start);
+    if (end == string::npos) {
+      end = path.size();
+    }
+    string part = path.substr(start, end - start);
+    if (part == "..") {
+      if (!parts.empty() && parts.back() != "..") {
+	parts.pop_back();
+      } else if (!absolute) {
+	parts.push_back(part);
+      }
+    } else if (!part.empty() && part != ".") {
+      parts.push_back(part);
+    }
+    start = end + 1;
+  }
+  string result = absolute ? "/" : "";
+  for (size_t i=0; i<parts.size(); i++) {
+    result += (i > 0 ? "/" : "") + parts[i];
+  }
+  return result.empty() ? "." : result;
+}
+
+// os.path.dirname(os.path.abspath(path))
+string absoluteDir(const string &path) {
+  string abs = path;
+  if (abs.empty() || abs[0] != '/') {
+    char cwd[PATH_MAX];
+    if (getcwd(cwd, sizeof(cwd)) == NULL) {
+      throw WconNativeError(string("Cannot get working directory: ") +
+			    strerror(errno));
+    }
+    abs = joinPath(cwd, path);
+  }
+  abs = normPath(abs);
+  size_t slash = abs.rfind('/');
+  return slash == 0 ? "/" : abs.substr(0, slash);
+}
+
+void makeDirs(const string &path) {
+  size_t pos = 0;
+  while ((pos = path.find('/', pos + 1)) != string::npos) {
+    mkdir(path.substr(0, pos).c_str(), 0777);
+  }
+  if (mkdir(path.c_str(), 0777) != 0 && errno != EEXIST) {
+    throw WconNativeError("Cannot create " + path + ": " + strerror(errno));
+  }
+}
+
+// shutil.rmtree(path, ignore_errors=True)
+void removeTree(const string &path) {
+  DIR *dir = opendir(path.c_str());
+  if (dir != NULL) {
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+      string name = entry->d_name;
+      if (name == "." || name == "..") {
+	continue;
+      }
+      string child = joinPath(path, name);
+      struct stat st;
+      if (lstat(child.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+	removeTree(child);
+      } else {
+	unlink(child.c_str());
+      }
+    }
+    closedir(dir);
+  }
+  rmdir(path.c_str());
+}
+
+// Where ZipFile.extract puts an entry: no absolute paths, no ".."
+string extractedPath(const string &dir, const string &name) {
+  string result = dir;
+  size_t start = 0;
+  while (start <= name.size()) {
+    size_t end = name.find('/', start);
+    if (end == string::npos) {
+      end = name.size();
+    }
+    string part = name.substr(start, end - start);
+    if (!part.empty() && part != "." && part != "..") {
+      result = joinPath(result, part);
+    }
+    start = end + 1;
+  }
+  return result;
+}
+
+void writeFile(const string &path, const string &contents) {
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (fp == NULL) {
+    throw WconNativeError("Cannot open " + path + ": " + strerror(errno));
+  }
+  size_t n = fwrite(contents.data(), 1, contents.size(), fp);
+  if (fclose(fp) != 0 || n != contents.size()) {
+    throw WconNativeError("Cannot write " + path + ": " + strerror(errno));
+  }
+}
+
+shared_ptr<NativeWCONWorms> loadFromFile(const string &path, bool loadPrev,
+					 bool loadNext, NativeRecordSink *sink);
+bool metadataEqual(const NativeWCONWorms &a, const NativeWCONWorms &b);
+
+// Loads the first file of a multi-file archive from a scratch directory
+//   next to it, with all its chunks, then removes the directory. The
+//   directory is new for each call, since archives in the same
+//   directory may be loaded at once (load_many, load_async, wcond).
+shared_ptr<NativeWCONWorms> loadFromArchive(const string &path,
+					    const vector<string> &names,
+					    NativeRecordSink *sink) {
+  string pattern = joinPath(absoluteDir(path), "_zip_archive_XXXXXX");
+  vector<char> buffer(pattern.begin(), pattern.end());
+  buffer.push_back('\0');
+  if (mkdtemp(&buffer[0]) == NULL) {
+    throw WconNativeError("Cannot create a scratch directory next to " +
+			  path + ": " + strerror(errno));
+  }
+  string archivePath = &buffer[0];
+  try {
+    for (size_t i=0; i<names.size(); i++) {
+      string target = extractedPath(archivePath, names[i]);
+      if (!names[i].empty() && names[i][names[i].size() - 1] == '/') {
+	makeDirs(target);
+	continue;
+      }
+      size_t slash = target.rfind('/');
+      if (slash != string::npos && slash > archivePath.size()) {
+	makeDirs(target.substr(0, slash));
+      }
+      string contents;
+      wconZipRead(path, i, contents);
+      writeFile(target, contents);
+    }
+    shared_ptr<NativeWCONWorms> w =
+      loadFromFile(extractedPath(archivePath, names[0]), true, true, sink);
+    removeTree(archivePath);
+    return w;
+  } catch (...) {
+    removeTree(archivePath);
+    throw;
+  }
+}
+
+// The units and metadata of two chunks loaded into a sink, which has
+//   the data of both in their own units
+shared_ptr<NativeWCONWorms> joinChunks(shared_ptr<NativeWCONWorms> w1,
+				       const NativeWCONWorms &w2) {
+  if (!metadataEqual(*w1, w2)) {
+    throw WconNativeError("Metadata conflicts between worms to be merged.");
+  }
+  set<pair<string, string> > units1, units2;
+  for (size_t i=0; i<w1->units.size(); i++) {
+    units1.insert(make_pair(w1->units[i].first,
+			    w1->units[i].second->unitString()));
+  }
+  for (size_t i=0; i<w2.units.size(); i++) {
+    units2.insert(make_pair(w2.units[i].first,
+			    w2.units[i].second->unitString()));
+  }
+  if (units1 != units2) {
+    throw WconNativeError("Chunks in different units cannot be loaded "
+			  "record by record");
+  }
+  return w1;
+}
+
+// WCONWorms.load_from_file
+shared_ptr<NativeWCONWorms> loadFromFile(const string &path, bool loadPrev,
+					 bool loadNext, NativeRecordSink *sink) {
+  shared_ptr<NativeWCONWorms> current(new NativeWCONWorms);
+  ChunkFiles files;
+  WconCodec codec = wconCodecDetect(path);
+
+  if (wconZipIsArchive(path)) {
+    vector<string> names;
+    wconZipList(path, names);
+    if (names.empty()) {
+      throw WconNativeError("Filename " + path + " is a zip archive, which "
+			    "is fine, but the archive does not contain any "
+			    "files.");
+    } else if (names.size() > 1) {
+      return loadFromArchive(path, names, sink);
+    }
+    string contents;
+    wconZipRead(path, 0, contents);
+    WconJsonMemorySource source(contents.data(), contents.size());
+    loadStream(&source, *current, files, sink);
+  } else if (codec != WCON_CODEC_NONE) {
+    // Decompressed straight into the parser, a buffer at a time
+    WconCodecSource source(path, codec);
+    loadStream(&source, *current, files, sink);
+  } else {
+    FILE *fp = fopen(path.c_str(), "rb");
+    if (fp == NULL) {
+      throw WconNativeError("Cannot open " + path + ": " + strerror(errno));
+    }
+    try {
+      WconJsonFileSource source(fp);
+      loadStream(&source, *current, files, sink);
+    } catch (...) {
+      fclose(fp);
+      throw;
+    }
+    fclose(fp);
+  }
+
+  if (sink != NULL) {
+    sink->file(path);
+  }
+  if (!files.present || (files.prev.empty() && files.next.empty())) {
+    return current;
+  }
+
+  // The other chunks are named relative to the part of the path
+  //   before the current file's name
+  size_t nameOffset = path.find(files.current);
+  if (nameOffset == string::npos) {
+    throw WconNativeError("Mismatch between the filename given in the "
+			  "file \"" + files.current + "\" and the file we "
+			  "loaded from \"" + path + "\".");
+  }
+  string pathString = path.substr(0, nameOffset);
+  if (loadPrev && !files.prev.empty()) {
+    shared_ptr<NativeWCONWorms> w =
+      loadFromFile(pathString + files.prev[0], true, false, sink);
+    current = (sink == NULL) ? NativeWCONWorms::merge(*current, *w) :
+      joinChunks(current, *w);
+  }
+  if (loadNext && !files.next.empty()) {
+    shared_ptr<NativeWCONWorms> w =
+      loadFromFile(pathString + files.next[0], false, true, sink);
+    current = (sink == NULL) ? NativeWCONWorms::merge(*current, *w) :
+      joinChunks(current, *w);
+  }
+  return current;
+}
+
+/*
+ * Saving
+ */
+
+void writeNumbers(WconJsonWriter &writer, const vector<double> &values) {
+  writer.beginArray();
+  for (size_t i=0; i<values.size(); i++) {
+    writer.writeNumber(values[i]);
+  }
+  writer.endArray();
+}
+
+void writeLabels(WconJsonWriter &writer, const vector<string> &values) {
+  writer.beginArray();
+  for (size_t i=0; i<values.size(); i++) {
+    if (values[i].empty()) {
+      writer.writeNull();
+    } else {
+      writer.writeString(values[i]);
+    }
+  }
+  writer.endArray();
+}
+
+// Spines are cut back to their real lengths
+void writePoints(WconJsonWriter &writer, const NativeWorm &w,
+		 const vector<double> &values) {
+  writer.beginArray();
+  for (long i=0; i<w.numFrames; i++) {
+    writer.beginArray();
+    long n = (long)w.aspectSize[i];
+    for (long k=0; k<n && k<w.maxPoints; k++) {
+      writer.writeNumber(values[i * w.maxPoints + k]);
+    }
+    writer.endArray();
+  }
+  writer.endArray();
+}
+
+// wcon_data._data_segment_as_odict
+void writeWorm(WconJsonWriter &writer, const NativeWorm &w,
+	       const vector<string> &featureNames) {
+  writer.beginObject();
+  writer.key("id");
+  writer.writeString(w.id);
+  writer.key("t");
+  writeNumbers(writer, w.t);
+  if (w.hasCentroid()) {
+    writer.key("cx");
+    writeNumbers(writer, w.cx);
+    writer.key("cy");
+    writeNumbers(writer, w.cy);
+  }
+  if (w.hasHead()) {
+    writer.key("head");
+    writeLabels(writer, w.head);
+  }
+  if (w.hasVentral()) {
+    writer.key("ventral");
+    writeLabels(writer, w.ventral);
+  }
+  writer.key("x");
+  writePoints(writer, w, w.x);
+  writer.key("y");
+  writePoints(writer, w, w.y);
+  for (size_t f=0; f<featureNames.size(); f++) {
+    writer.key(featureNames[f]);
+    writeNumbers(writer, w.features[f]);
+  }
+  writer.endObject();
+}
+
+// pandas.util.testing.assert_almost_equal with the default 5 decimals
+bool almostEqual(double a, double b) {
+  if (isnan(a) || isnan(b)) {
+    return isnan(a) && isnan(b);
+  } else if (a == b) {
+    return true;
+  } else if (isinf(a) || isinf(b)) {
+    return false;
+  } else if (fabs(a) < 1e-5) {
+    return fabs(a - b) < 0.5e-5;
+  }
+  return fabs(1.0 - b / a) < 0.5e-5;
+}
+
+bool allAlmostEqual(const vector<double> &a, const vector<double> &b) {
+  if (a.size() != b.size()) {
+    return false;
+  }
+  for (size_t i=0; i<a.size(); i++) {
+    if (!almostEqual(a[i], b[i])) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// wcon_parser.pd_equals on two worms in canonical units
+bool wormsEqual(const NativeWorm &a, const NativeWorm &b) {
+  if (a.numFrames != b.numFrames || a.maxPoints != b.maxPoints ||
+      a.hasCentroid() != b.hasCentroid() || a.hasHead() != b.hasHead() ||
+      a.hasVentral() != b.hasVentral() || a.hasOffset() != b.hasOffset()) {
+    return false;
+  }
+  for (long i=0; i<a.numFrames; i++) {
+    if (!sameTime(a.t[i], b.t[i])) {
+      return false;
+    }
+  }
+  return allAlmostEqual(a.x, b.x) && allAlmostEqual(a.y, b.y) &&
+    allAlmostEqual(a.aspectSize, b.aspectSize) &&
+    allAlmostEqual(a.cx, b.cx) && allAlmostEqual(a.cy, b.cy) &&
+    allAlmostEqual(a.ox, b.ox) && allAlmostEqual(a.oy, b.oy) &&
+    a.head == b.head && a.ventral == b.ventral;
+}
+
+bool metadataEqual(const NativeWCONWorms &a, const NativeWCONWorms &b) {
+  if (a.hasMetadata != b.hasMetadata) {
+    return false;
+  }
+  return !a.hasMetadata || nativeJsonEqual(a.metadata, b.metadata);
+}
+
+template <typename T>
+size_t vectorBytes(const vector<T> &v) {
+  return v.capacity() * sizeof(T);
+}
+
+size_t stringBytes(const vector<string> &v) {
+  size_t bytes = vectorBytes(v);
+  for (size_t i=0; i<v.size(); i++) {
+    bytes += v[i].capacity();
+  }
+  return bytes;
+}
+
+size_t jsonBytes(const WconJsonValue &v) {
+  size_t bytes = sizeof(v) + v.strValue.capacity() +
+    v.items.capacity() * sizeof(WconJsonValue) +
+    v.members.capacity() * sizeof(v.members[0]);
+  // jsonBytes(item) counts the item itself again; close enough
+  for (size_t i=0; i<v.items.size(); i++) {
+    bytes += jsonBytes(v.items[i]);
+  }
+  for (size_t i=0; i<v.members.size(); i++) {
+    bytes += v.members[i].first.capacity() + jsonBytes(v.members[i].second);
+  }
+  return bytes;
+}
+
+bool isCanonical(const NativeWCONWorms &w) {
+  for (size_t i=0; i<w.units.size(); i++) {
+    if (!w.units[i].second->isCanonical()) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// Decodes one UTF-8 sequence; invalid bytes come back as themselves
+unsigned long nextCodePoint(const string &s, size_t &i) {
+  unsigned char c = (unsigned char)s[i++];
+  int extra = 0;
+  unsigned long cp = c;
+  if (c >= 0xF0 && c < 0xF8) {
+    cp = c & 0x07;
+    extra = 3;
+  } else if (c >= 0xE0 && c < 0xF0) {
+    cp = c & 0x0F;
+    extra = 2;
+  } else if (c >= 0xC0 && c < 0xE0) {
+    cp = c & 0x1F;
+    extra = 1;
+  }
+  for (int k=0; k<extra && i < s.size() && (s[i] & 0xC0) == 0x80; k++) {
+    cp = (cp << 6) | (s[i++] & 0x3F);
+  }
+  return cp;
+}
+
+} // namespace
+
+string nativePyRepr(const string &s, bool asciiOnly) {
+  char quote = (s.find('\'') != string::npos &&
+		s.find('"') == string::npos) ? '"' : '\'';
+  string out(1, quote);
+  size_t i = 0;
+  while (i < s.size()) {
+    size_t start = i;
+    unsigned long cp = nextCodePoint(s, i);
+    char buf[24];
+    if (cp == (unsigned long)quote || cp == '\\') {
+      out += '\\';
+      out += (char)cp;
+    } else if (cp == '\t') {
+      out += "\\t";
+    } else if (cp == '\n') {
+      out += "\\n";
+    } else if (cp == '\r') {
+      out += "\\r";
+    } else if (cp < 0x20 || cp == 0x7f) {
+      snprintf(buf, sizeof(buf), "\\x%02lx", cp);
+      out += buf;
+    } else if (cp < 0x7f) {
+      out += (char)cp;
+    } else if (!asciiOnly && cp >= 0xa0) {
+      out.append(s, start, i - start);
+    } else if (cp < 0x100) {
+      snprintf(buf, sizeof(buf), "\\x%02lx", cp);
+      out += buf;
+    } else if (cp < 0x10000) {
+      snprintf(buf, sizeof(buf), "\\u%04lx", cp);
+      out += buf;
+    } else {
+      snprintf(buf, sizeof(buf), "\\U%08lx", cp);
+      out += buf;
+    }
+  }
+  out += quote;
+  return out;
+}
+
+bool nativeJsonEqual(const WconJsonValue &a, const WconJsonValue &b) {
+  // In Python, True == 1 and False == 0
+  bool aNumeric = a.isNumber() || a.type == WconJsonValue::JSON_BOOL;
+  bool bNumeric = b.isNumber() || b.type == WconJsonValue::JSON_BOOL;
+  if (aNumeric && bNumeric) {
+    double x = a.isNumber() ? a.numValue : (a.boolValue ? 1.0 : 0.0);
+    double y = b.isNumber() ? b.numValue : (b.boolValue ? 1.0 : 0.0);
+    return x == y;
+  }
+  if (a.type != b.type) {
+    return false;
+  }
+  switch (a.type) {
+  case WconJsonValue::JSON_STRING:
+    return a.strValue == b.strValue;
+  case WconJsonValue::JSON_ARRAY:
+    if (a.items.size() != b.items.size()) {
+      return false;
+    }
+    for (size_t i=0; i<a.items.size(); i++) {
+      if (!nativeJsonEqual(a.items[i], b.items[i])) {
+	return false;
+      }
+    }
+    return true;
+  case WconJsonValue::JSON_OBJECT:
+    if (a.members.size() != b.members.size()) {
+      return false;
+    }
+    for (size_t i=0; i<a.members.size(); i++) {
+      const WconJsonValue *other = b.find(a.members[i].first);
+      if (other == NULL || !nativeJsonEqual(a.members[i].second, *other)) {
+	return false;
+      }
+    }
+    return true;
+  default:
+    return true;
+  }
+}
+
+shared_ptr<NativeWCONWorms> NativeWCONWorms::loadFromFile(const string &path) {
+  return ::loadFromFile(path, true, true, NULL);
+}
+
+shared_ptr<NativeWCONWorms>
+NativeWCONWorms::loadRecords(const string &path, NativeRecordSink &sink) {
+  return ::loadFromFile(path, true, true, &sink);
+}
+
+void NativeWCONWorms::checkDataUnits(const string &wormId,
+				     bool hasCentroid) const {
+  vector<string> missing;
+  if (hasCentroid) {
+    if (unit("cx") == NULL) missing.push_back("cx");
+    if (unit("cy") == NULL) missing.push_back("cy");
+  }
+  if (!missing.empty()) {
+    string msg = "In worm " + wormId + ", the following data keys are "
+      "missing entries in the \"units\" object: {";
+    for (size_t j=0; j<missing.size(); j++) {
+      msg += (j > 0 ? ", " : "") + nativePyRepr(missing[j], false);
+    }
+    throw WconNativeError(msg + "}");
+  }
+}
+
+void NativeWCONWorms::dropFeatures() {
+  for (size_t i=units.size(); i-- > 0; ) {
+    if (find(featureNames.begin(), featureNames.end(), units[i].first) !=
+	featureNames.end()) {
+      units.erase(units.begin() + i);
+    }
+  }
+  featureNames.clear();
+  for (size_t i=0; i<worms.size(); i++) {
+    worms[i].features.clear();
+  }
+}
+
+const NativeMeasurementUnit *NativeWCONWorms::unit(const string &key) const {
+  for (size_t i=0; i<units.size(); i++) {
+    if (units[i].first == key) {
+      return units[i].second.get();
+    }
+  }
+  return NULL;
+}
+
+size_t NativeWCONWorms::byteSize() const {
+  size_t bytes = sizeof(*this) + jsonBytes(metadata) + vectorBytes(units);
+  for (size_t i=0; i<worms.size(); i++) {
+    const NativeWorm &w = worms[i];
+    bytes += sizeof(w) + w.id.capacity() + vectorBytes(w.t) +
+      vectorBytes(w.x) + vectorBytes(w.y) + vectorBytes(w.aspectSize) +
+      vectorBytes(w.cx) + vectorBytes(w.cy) + vectorBytes(w.ox) +
+      vectorBytes(w.oy) + stringBytes(w.head) + stringBytes(w.ventral) +
+      vectorBytes(w.features);
+    for (size_t f=0; f<w.features.size(); f++) {
+      bytes += vectorBytes(w.features[f]);
+    }
+  }
+  return bytes;
+}
+
+long NativeWCONWorms::findWorm(const string &id) const {
+  for (size_t i=0; i<worms.size(); i++) {
+    if (worms[i].id == id) {
+      return (long)i;
+    }
+  }
+  return -1;
+}
+
+shared_ptr<NativeWCONWorms> NativeWCONWorms::timeSlice(double t0,
+						       double t1) const {
+  shared_ptr<NativeWCONWorms> w(new NativeWCONWorms);
+  w->units = units;
+  w->hasMetadata = hasMetadata;
+  w->metadata = metadata;
+  w->featureNames = featureNames;
+  for (size_t i=0; i<worms.size(); i++) {
+    const NativeWorm &src = worms[i];
+    long first = lower_bound(src.t.begin(), src.t.end(), t0, timeLess) -
+      src.t.begin();
+    long last = lower_bound(src.t.begin(), src.t.end(), t1, timeLess) -
+      src.t.begin();
+    if (first >= last) {
+      continue;
+    }
+    w->worms.push_back(NativeWorm());
+    copyFrames(i, first, last, w->worms.back());
+  }
+  return w;
+}
+
+void NativeWCONWorms::copyFrames(size_t i, long first, long last,
+				 NativeWorm &dest) const {
+  const NativeWorm &src = worms[i];
+  dest.id = src.id;
+  dest.numFrames = last - first;
+  dest.maxPoints = src.maxPoints;
+  copyRows(dest.t, src.t, first, last, 1);
+  copyRows(dest.x, src.x, first, last, src.maxPoints);
+  copyRows(dest.y, src.y, first, last, src.maxPoints);
+  copyRows(dest.aspectSize, src.aspectSize, first, last, 1);
+  copyRows(dest.cx, src.cx, first, last, 1);
+  copyRows(dest.cy, src.cy, first, last, 1);
+  copyRows(dest.head, src.head, first, last, 1);
+  copyRows(dest.ventral, src.ventral, first, last, 1);
+  dest.features.resize(src.features.size());
+  for (size_t f=0; f<src.features.size(); f++) {
+    copyRows(dest.features[f], src.features[f], first, last, 1);
+  }
+}
+
+NativeCanonView::NativeCanonView(const NativeWCONWorms &w)
+  : featureNames(w.featureNames) {
+  for (size_t i=0; i<w.units.size(); i++) {
+    units.push_back(make_pair(w.units[i].first,
+			      w.units[i].second->canonicalUnit()));
+    if (!w.units[i].second->isCanonical()) {
+      from.push_back(w.units[i]);
+    }
+  }
+}
+
+const NativeMeasurementUnit *
+NativeCanonView::conversion(const string &key) const {
+  for (size_t i=0; i<from.size(); i++) {
+    if (from[i].first == key) {
+      return from[i].second.get();
+    }
+  }
+  return NULL;
+}
+
+void NativeCanonView::apply(const NativeMeasurementUnit &u, const double *in,
+			    size_t n, double *out) {
+  for (size_t i=0; i<n; i++) {
+    out[i] = u.toCanon(in[i]);
+  }
+}
+
+void NativeCanonView::convertWorm(NativeWorm &worm) const {
+  for (size_t i=0; i<from.size(); i++) {
+    const string &key = from[i].first;
+    vector<double> *column = NULL;
+    if (key == "t") {
+      column = &worm.t;
+    } else if (key == "x") {
+      column = &worm.x;
+    } else if (key == "y") {
+      column = &worm.y;
+    } else if (key == "cx") {
+      column = &worm.cx;
+    } else if (key == "cy") {
+      column = &worm.cy;
+    } else if (key == "aspect_size") {
+      column = &worm.aspectSize;
+    } else {
+      size_t f = find(featureNames.begin(), featureNames.end(), key) -
+	featureNames.begin();
+      if (f < worm.features.size()) {
+	column = &worm.features[f];
+      }
+    }
+    if (column != NULL && !column->empty()) {
+      apply(*from[i].second, &(*column)[0], column->size(), &(*column)[0]);
+    }
+  }
+}
+
+shared_ptr<NativeWCONWorms> NativeWCONWorms::toCanon() const {
+  NativeCanonView view(*this);
+  shared_ptr<NativeWCONWorms> w(new NativeWCONWorms);
+  w->hasMetadata = hasMetadata;
+  w->metadata = metadata;
+  w->units = view.units;
+  w->worms = worms;
+  w->featureNames = featureNames;
+  for (size_t j=0; j<w->worms.size(); j++) {
+    view.convertWorm(w->worms[j]);
+  }
+  return w;
+}
+
+shared_ptr<NativeWCONWorms> NativeWCONWorms::merge(const NativeWCONWorms &w1,
+						   const NativeWCONWorms &w2) {
+  if (!metadataEqual(w1, w2)) {
+    throw WconNativeError("Metadata conflicts between worms to be merged.");
+  }
+  shared_ptr<NativeWCONWorms> w1c = w1.toCanon();
+  shared_ptr<NativeWCONWorms> w2c = w2.toCanon();
+  // The upsert works row by row on the tracked data only
+  w1c->dropFeatures();
+  w2c->dropFeatures();
+
+  map<string, long> index = wormIndex(w1c->worms);
+  for (size_t i=0; i<w2c->worms.size(); i++) {
+    NativeWorm &worm = w2c->worms[i];
+    map<string, long>::iterator it = index.find(worm.id);
+    if (it == index.end()) {
+      w1c->worms.push_back(NativeWorm());
+      swap(w1c->worms.back(), worm);
+      continue;
+    }
+    // Same argument order as WCONWorms.merge: w2's data is the
+    //   destination and w1's is upserted into it
+    try {
+      upsert(worm, w1c->worms[it->second]);
+    } catch (const WconNativeError &e) {
+      throw WconNativeError("Data conflicts between worms to be merged on "
+			    "worm " + worm.id + ": " + e.what());
+    }
+    swap(w1c->worms[it->second], worm);
+  }
+  sortWorms(w1c->worms);
+
+  w1c->hasMetadata = w2c->hasMetadata;
+  swap(w1c->metadata, w2c->metadata);
+  return w1c;
+}
+
+bool NativeWCONWorms::operator==(const NativeWCONWorms &other) const {
+  if (worms.size() != other.worms.size()) {
+    return false;
+  }
+  // Worms are converted to canonical units a pair at a time
+  NativeCanonView view1(*this), view2(other);
+  bool canonical1 = isCanonical(*this), canonical2 = isCanonical(other);
+  map<string, long> index = wormIndex(other.worms);
+  for (size_t i=0; i<worms.size(); i++) {
+    map<string, long>::iterator it = index.find(worms[i].id);
+    if (it == index.end()) {
+      return false;
+    }
+    NativeWorm c1, c2;
+    const NativeWorm *w1 = &worms[i];
+    const NativeWorm *w2 = &other.worms[it->second];
+    if (!canonical1) {
+      c1 = *w1;
+      view1.convertWorm(c1);
+      w1 = &c1;
+    }
+    if (!canonical2) {
+      c2 = *w2;
+      view2.convertWorm(c2);
+      w2 = &c2;
+    }
+    if (!wormsEqual(*w1, *w2)) {
+      return false;
+    }
+  }
+  return metadataEqual(*this, other);
+}
+
+void NativeWCONWorms::write(WconJsonWriter &writer,
+			    const NativeWormSource *source) const {
+  writer.beginObject();
+
+  // Canonical unit strings, sorted, without the generated aspect_size
+  writer.key("units");
+  vector<pair<string, string> > unitStrings;
+  for (size_t i=0; i<units.size(); i++) {
+    if (units[i].first != "aspect_size") {
+      unitStrings.push_back(make_pair(units[i].first,
+				      units[i].second->canonicalUnitString()));
+    }
+  }
+  sort(unitStrings.begin(), unitStrings.end());
+  writer.beginObject();
+  for (size_t i=0; i<unitStrings.size(); i++) {
+    writer.key(unitStrings[i].first);
+    writer.writeString(unitStrings[i].second);
+  }
+  writer.endObject();
+
+  // Empty metadata is left out, as it is falsy in Python
+  if (hasMetadata && !metadata.members.empty()) {
+    writer.key("metadata");
+    writer.writeValue(metadata, true);
+  }
+
+  if (files.isObject()) {
+    writer.key("files");
+    writer.writeValue(files);
+  }
+
+  // Converted to canonical units a worm at a time
+  NativeCanonView view(*this);
+  bool canonical = isCanonical(*this);
+  writer.key("data");
+  writer.beginArray();
+  for (size_t i=0; i<worms.size(); i++) {
+    if (canonical && source == NULL) {
+      writeWorm(writer, worms[i], featureNames);
+      continue;
+    }
+    NativeWorm worm;
+    if (source == NULL) {
+      worm = worms[i];
+    } else {
+      source->fetch(*this, i, worm);
+    }
+    if (!canonical) {
+      view.convertWorm(worm);
+    }
+    writeWorm(writer, worm, featureNames);
+  }
+  writer.endArray();
+
+  writer.endObject();
+}
+
+void NativeWCONWorms::saveToFile(const string &path, bool prettyPrint,
+				 bool compressed, int level, int numThreads,
+				 const NativeWormSource *source) const {
+  if (path.empty()) {
+    throw WconNativeError("Cannot save to an empty path");
+  }
+  if (compressed && wconCodecForName(path) != WCON_CODEC_NONE) {
+    WconCodecSink sink(path, wconCodecForName(path), level, numThreads);
+    WconJsonWriter writer(sink, prettyPrint ? 4 : -1);
+    write(writer, source);
+    writer.flush();
+    sink.close();
+    return;
+  }
+  if (compressed) {
+    string suffix = path.size() >= 4 ? path.substr(path.size() - 4) : "";
+    for (size_t i=0; i<suffix.size(); i++) {
+      suffix[i] = (char)toupper((unsigned char)suffix[i]);
+    }
+    if (suffix != ".ZIP") {
+      throw WconNativeError("A compressed file like " + path + " must "
+			    "have an extension ending in '.zip', '.gz' or "
+			    "'.zst'");
+    }
+    WconJsonWriter writer(NULL, prettyPrint ? 4 : -1);
+    write(writer, source);
+    // The entry is named after the path, as ZipFile.write names it
+    string entryName = normPath(path);
+    while (!entryName.empty() && entryName[0] == '/') {
+      entryName.erase(0, 1);
+    }
+    string temp = path + ".TEMP";
+    wconZipWrite(temp, entryName, writer.text());
+    if (rename(temp.c_str(), path.c_str()) != 0) {
+      throw WconNativeError("Cannot rename " + temp + " to " + path + ": " +
+			    strerror(errno));
+    }
+    return;
+  }
+
+  FILE *fp = fopen(path.c_str(), "w");
+  if (fp == NULL) {
+    throw WconNativeError("Cannot open " + path + ": " + strerror(errno));
+  }
+  try {
+    WconJsonWriter writer(fp, prettyPrint ? 4 : -1);
+    write(writer, source);
+    writer.flush();
+  } catch (...) {
+    fclose(fp);
+    throw;
+  }
+  if (fclose(fp) != 0) {
+    throw WconNativeError("Cannot write " + path + ": " + strerror(errno));
+  }
+}
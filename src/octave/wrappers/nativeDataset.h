@@ -0,0 +1,181 @@
+#ifndef __NATIVE_DATASET_H_
+#define __NATIVE_DATASET_H_
+// Native port of wcon.WCONWorms (src/Python/wcon/wcon_parser.py and
+//   wcon_data.py) for the Python-free build of the wrapper library.
+//
+// The semantics follow the Python package: the same subset of the
+//   schema is enforced, data segments of one worm are merged with the
+//   same upsert rules, offsets are folded into the coordinates on load,
+//   and files are saved in canonical form with the same layout, down to
+//   the byte.
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "nativeUnits.h"
+#include "wconJson.h"
+
+// The time series of one worm; the counterpart of one DataFrame of
+//   WCONWorms.data_as_odict. Optional quantities are empty when absent,
+//   and missing values are NaN (or "" for head and ventral).
+struct NativeWorm {
+  NativeWorm() : numFrames(0), maxPoints(0) {}
+
+  std::string id;
+  long numFrames;
+  // Columns of x and y: the longest spine of the worm. Shorter spines
+  //   are padded with NaN, and aspectSize holds the real lengths.
+  long maxPoints;
+  std::vector<double> t;
+  std::vector<double> x; // numFrames x maxPoints, row major
+  std::vector<double> y;
+  std::vector<double> aspectSize;
+  std::vector<double> cx;
+  std::vector<double> cy;
+  // Only present while loading, until the offsets are folded in
+  std::vector<double> ox;
+  std::vector<double> oy;
+  std::vector<std::string> head;
+  std::vector<std::string> ventral;
+  // Custom per-frame quantities, one column for each of
+  //   NativeWCONWorms::featureNames
+  std::vector<std::vector<double> > features;
+
+  bool hasCentroid() const { return !cx.empty(); }
+  bool hasOffset() const { return !ox.empty(); }
+  bool hasHead() const { return !head.empty(); }
+  bool hasVentral() const { return !ventral.empty(); }
+};
+
+class NativeWCONWorms;
+
+// Receives the data records of NativeWCONWorms::loadRecords as they are
+//   read, in place of having them merged into worms
+class NativeRecordSink {
+ public:
+  virtual ~NativeRecordSink() {}
+  // Each file read, chunks included, once its records are in
+  virtual void file(const std::string &path) = 0;
+  // One data record as a worm of its own: sorted by time, with its
+  //   offsets folded in, in the units of its file
+  virtual void record(NativeWorm &segment) = 0;
+};
+
+// Where write() gets the worms of a dataset whose columns are kept
+//   elsewhere (nativePaged.h), one worm at a time
+class NativeWormSource {
+ public:
+  virtual ~NativeWormSource() {}
+  // Worm i of w, with all of its columns, into worm
+  virtual void fetch(const NativeWCONWorms &w, size_t i,
+		     NativeWorm &worm) const = 0;
+};
+
+// Units by data key, in file order, as in WCONWorms.units.
+typedef std::vector<std::pair<std::string,
+  std::shared_ptr<const NativeMeasurementUnit> > > NativeUnitsList;
+
+class NativeWCONWorms {
+ public:
+  NativeWCONWorms() : hasMetadata(false) {}
+
+  NativeUnitsList units;
+  bool hasMetadata;
+  WconJsonValue metadata;
+  // Sorted by id, in the order of WCONWorms.worm_ids
+  std::vector<NativeWorm> worms;
+  // "files" links written out by write() when set; like the Python
+  //   package, loading follows them but does not keep them
+  WconJsonValue files;
+  // Custom data keys added by wconOct_WCONWorms_features, each with an
+  //   entry in units. write() puts them after x and y in every data
+  //   record; loading does not read them back, as the Python package
+  //   ignores custom keys.
+  std::vector<std::string> featureNames;
+
+  // WCONWorms.load_from_file, following "files" links to other chunks
+  //   and unpacking zip archives. Throws on any failure.
+  static std::shared_ptr<NativeWCONWorms>
+    loadFromFile(const std::string &path);
+  // loadFromFile with the data records handed to sink as they come; the
+  //   result has the units and metadata but no worms. Every chunk must
+  //   have the same units and metadata. Throws on any failure.
+  static std::shared_ptr<NativeWCONWorms>
+    loadRecords(const std::string &path, NativeRecordSink &sink);
+
+  // WCONWorms.save_to_file. Compressed files ending in .gz or .zst are
+  //   written by wconCodec, with level and numThreads as it takes them;
+  //   other compressed files are zip archives. The worms come from
+  //   source if there is one.
+  void saveToFile(const std::string &path, bool prettyPrint,
+		  bool compressed, int level = -1, int numThreads = 0,
+		  const NativeWormSource *source = NULL) const;
+  // WCONWorms.as_ordered_dict, written straight out as JSON
+  void write(WconJsonWriter &writer,
+	     const NativeWormSource *source = NULL) const;
+
+  // The frames with t0 <= t < t1, dropping worms with none
+  std::shared_ptr<NativeWCONWorms> timeSlice(double t0, double t1) const;
+  // Frames [first, last) of worm i into dest, with the columns the worm
+  //   has here (not the points of a stripped one)
+  void copyFrames(size_t i, long first, long last, NativeWorm &dest) const;
+  // WCONWorms.to_canon
+  std::shared_ptr<NativeWCONWorms> toCanon() const;
+  // WCONWorms.merge (the + operator)
+  static std::shared_ptr<NativeWCONWorms> merge(const NativeWCONWorms &w1,
+						const NativeWCONWorms &w2);
+  // WCONWorms.__eq__: data equal after unit conversion, and metadata
+  //   equal.
+  bool operator==(const NativeWCONWorms &other) const;
+
+  // Removes the features and their units, for operations that do not
+  //   carry them over
+  void dropFeatures();
+  // NULL if there is no unit for key
+  const NativeMeasurementUnit *unit(const std::string &key) const;
+  // Position of the worm in worms, or -1
+  long findWorm(const std::string &id) const;
+  // Throws unless every data key of a worm has units (head and ventral
+  //   need none)
+  void checkDataUnits(const std::string &wormId, bool hasCentroid) const;
+  // Approximate heap bytes held, for wconOct_memoryReport. The
+  //   MeasurementUnits are not counted, being small and shared.
+  size_t byteSize() const;
+};
+
+// A dataset as seen in canonical units, without converting it: the
+//   conversion of each column is the toCanon of its unit (affine in
+//   every case), applied to values as they are read. toCanon() is this
+//   applied to every column.
+class NativeCanonView {
+ public:
+  explicit NativeCanonView(const NativeWCONWorms &w);
+
+  // The units the dataset has in canonical units
+  NativeUnitsList units;
+
+  // The unit column key is converted from; NULL if it is canonical
+  //   already. key is a data key (t, x, cx, aspect_size...) or one of
+  //   featureNames.
+  const NativeMeasurementUnit *conversion(const std::string &key) const;
+  // n values from in, converted with u, to out; in may be out
+  static void apply(const NativeMeasurementUnit &u, const double *in,
+		    size_t n, double *out);
+  // Converts every column of worm, a worm of the dataset, in place
+  void convertWorm(NativeWorm &worm) const;
+
+ private:
+  // Units of the dataset that are not canonical, and its features
+  NativeUnitsList from;
+  std::vector<std::string> featureNames;
+};
+
+// Python's repr() of a str; with asciiOnly, ascii() instead.
+std::string nativePyRepr(const std::string &s, bool asciiOnly);
+
+// Python's == on the values json.loads produces: key order does not
+//   matter, and 1 == 1.0.
+bool nativeJsonEqual(const WconJsonValue &a, const WconJsonValue &b);
+
+#endif /* __NATIVE_DATASET_H_ */
@@ -0,0 +1,114 @@
+#include "nativeInternal.h"
+#include "wrapperMemory.h"
+#include "wrapperTimeMajor.h"
+
+#include <iostream>
+#include <unordered_map>
+#include <utility>
+
+#include <limits.h>
+#include <stdlib.h> // for rand
+#include <mutex>
+using namespace std;
+
+// Same keying scheme as the handles of the Python backend (see
+//   wrapperInternal.cpp), so handles look alike to front ends.
+unordered_map<unsigned int, NativeObject> nativeHandles;
+unsigned int totalActiveNativeObjects = 0;
+// Handles are stored and released from the async workers too. Lookups
+//   hand out pointers into the map, which stay valid until the handle
+//   is released.
+static mutex nativeHandlesLock;
+
+// What a handle keeps alive. Views of a dataset (metadata, data,
+//   worm_ids, and to_canon results) are charged nothing, since the
+//   dataset is charged to its own handle; they do keep it alive after
+//   that handle is released.
+static size_t nativeInternalObjectBytes(const NativeObject &object) {
+  switch (object.kind) {
+  case NativeObject::WCONWORMS:
+    if (object.canon != NULL) {
+      return 0;
+    }
+    return object.worms->byteSize() +
+      ((object.compact == NULL) ? 0 : object.compact->byteSize()) +
+      ((object.paged == NULL) ? 0 : object.paged->byteSize());
+  case NativeObject::MEASUREMENT_UNIT:
+    return sizeof(*object.unit) + object.unit->unitString().capacity() +
+      object.unit->canonicalUnitString().capacity();
+  default:
+    return 0;
+  }
+}
+
+WconOctHandle nativeInternalStoreObject(const NativeObject &object,
+					bool charged) {
+  lock_guard<mutex> guard(nativeHandlesLock);
+  if (totalActiveNativeObjects >= INT_MAX) {
+    cerr << "ERROR: Out of room for new native objects" << endl;
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  // Keys collide with the special handles only if rand() says so;
+  //   retry on those as on any other key already in use.
+  for (;;) {
+    unsigned int randkey = rand()%INT_MAX;
+    if ((int)randkey == WCONOCT_NULL_HANDLE ||
+	(int)randkey == WCONOCT_NONE_HANDLE) {
+      continue;
+    }
+    if (nativeHandles.find(randkey) == nativeHandles.end()) {
+      nativeHandles.insert(make_pair(randkey, object));
+      totalActiveNativeObjects++;
+      wconOctMemoryTrack(randkey,
+			 charged ? nativeInternalObjectBytes(object) : 0);
+      return randkey;
+    }
+  }
+}
+
+const NativeObject *nativeInternalGetObject(WconOctHandle handle,
+					    NativeObject::Kind kind) {
+  if (handle == WCONOCT_NULL_HANDLE) {
+    cerr << "ERROR: Trying to access a NULL handle." << endl;
+    return NULL;
+  } else if (handle == WCONOCT_NONE_HANDLE) {
+    cerr << "ERROR: None is not a valid wrapper access object." << endl;
+    return NULL;
+  }
+
+  lock_guard<mutex> guard(nativeHandlesLock);
+  unordered_map<unsigned int, NativeObject>::const_iterator result =
+    nativeHandles.find((unsigned int)handle);
+  if (result == nativeHandles.end()) {
+    return NULL;
+  } else if (result->second.kind != kind) {
+    cerr << "ERROR: Handle " << handle << " refers to another kind of object."
+	 << endl;
+    return NULL;
+  }
+  return &(result->second);
+}
+
+bool nativeInternalReleaseObject(WconOctHandle handle) {
+  lock_guard<mutex> guard(nativeHandlesLock);
+  unordered_map<unsigned int, NativeObject>::iterator found =
+    nativeHandles.find((unsigned int)handle);
+  if (handle == WCONOCT_NULL_HANDLE || handle == WCONOCT_NONE_HANDLE ||
+      found == nativeHandles.end()) {
+    return false;
+  }
+  nativeHandles.erase(found);
+  totalActiveNativeObjects--;
+  wconOctMemoryUntrack(handle);
+  wconOctTimeMajorForget(handle);
+  return true;
+}
+
+void nativeInternalCheckErrorVariable(WconOctError *err) {
+  // passing a NULL value is strictly forbidden.
+  if (err == NULL) {
+    cerr << "ERROR: Error return variable may not be NULL. Shutting Down!"
+	 << endl;
+  }
+}
@@ -0,0 +1,54 @@
+#ifndef __NATIVE_INTERNAL_H_
+#define __NATIVE_INTERNAL_H_
+// For internal (non-API) functionality of the native backend; the
+//   counterpart of wrapperInternal.h, without Python.
+#include <memory>
+
+#include "nativeCompact.h"
+#include "nativeDataset.h"
+#include "nativePaged.h"
+#include "wrapperTypes.h"
+
+// Special handle return values. These must stay the same as in
+//   wrapperInternal.h, since front ends test for them.
+#define WCONOCT_NULL_HANDLE -1337
+#define WCONOCT_NONE_HANDLE -42
+
+// What a handle refers to. Python hands out attributes (metadata,
+//   data, worm_ids) as objects of their own; here they are views of
+//   the dataset they came from, which they keep alive.
+struct NativeObject {
+  enum Kind {
+    WCONWORMS,
+    MEASUREMENT_UNIT,
+    METADATA,
+    DATA,
+    WORM_IDS
+  };
+
+  Kind kind;
+  std::shared_ptr<const NativeWCONWorms> worms;
+  std::shared_ptr<const NativeMeasurementUnit> unit;
+  // The spine points of a compact WCONWORMS, whose worms then have none
+  std::shared_ptr<const NativeCompactSpines> compact;
+  // The numeric columns of a paged WCONWORMS, whose worms then have none
+  std::shared_ptr<const NativePagedStore> paged;
+  // Set on a WCONWORMS from to_canon, whose worms (and compact or paged)
+  //   are those of the handle it came from, in their own units
+  std::shared_ptr<const NativeCanonView> canon;
+};
+
+// Internal functions
+// charged false leaves the handle charged nothing, for datasets that
+//   the load cache is charged for
+WconOctHandle nativeInternalStoreObject(const NativeObject &object,
+					bool charged = true);
+// NULL (with a message) if the handle is invalid or of another kind
+const NativeObject *nativeInternalGetObject(WconOctHandle handle,
+					    NativeObject::Kind kind);
+// false if there is no such handle
+bool nativeInternalReleaseObject(WconOctHandle handle);
+
+// Internal Checks
+void nativeInternalCheckErrorVariable(WconOctError *err);
+#endif /* __NATIVE_INTERNAL_H_ */
@@ -0,0 +1,610 @@
+#include "nativePaged.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <list>
+#include <map>
+#include <mutex>
+#include <unordered_map>
+#include <utility>
+using namespace std;
+
+#define PAGE_MB (1024.0 * 1024.0)
+#define PAGE_CACHE_DEFAULT_MB 256
+// Tails of pages still being filled are written out early, short, past
+//   this many bytes or the cache budget, whichever is more
+#define PAGE_TAILS_MIN_BYTES (8 * 1024 * 1024)
+
+namespace {
+
+struct CachedPage {
+  shared_ptr<const vector<double> > values;
+  list<unsigned long long>::iterator lru;
+};
+
+mutex cacheLock;
+unordered_map<unsigned long long, CachedPage> cachePages;
+// Most recently used first
+list<unsigned long long> cacheOrder;
+size_t cacheBytes = 0;
+// Read from the environment on first use
+double cacheBudget = -1.0;
+double cacheHits = 0.0;
+double cacheMisses = 0.0;
+// Spill files of the live stores
+double spillBytes = 0.0;
+long nextSerial = 0;
+
+// With cacheLock held
+double currentBudget() {
+  if (cacheBudget < 0.0) {
+    const char *env = getenv("WCONOCT_PAGE_CACHE_MB");
+    cacheBudget = ((env != NULL) ? atof(env) : PAGE_CACHE_DEFAULT_MB) *
+      PAGE_MB;
+    if (cacheBudget < 0.0) {
+      cacheBudget = 0.0;
+    }
+  }
+  return cacheBudget;
+}
+
+// With cacheLock held. Pages in use stay alive with their readers.
+void evictPages() {
+  double budget = currentBudget();
+  while (!cacheOrder.empty() && (double)cacheBytes > budget) {
+    unordered_map<unsigned long long, CachedPage>::iterator it =
+      cachePages.find(cacheOrder.back());
+    cacheBytes -= it->second.values->size() * sizeof(double);
+    cachePages.erase(it);
+    cacheOrder.pop_back();
+  }
+}
+
+unsigned long long pageKey(long serial, long page) {
+  return ((unsigned long long)serial << 40) | (unsigned long long)page;
+}
+
+string spillDir() {
+  const char *dirs[] = {getenv("WCONOCT_PAGE_DIR"), getenv("TMPDIR")};
+  for (int i=0; i<2; i++) {
+    if (dirs[i] != NULL && dirs[i][0] != '\0') {
+      return dirs[i];
+    }
+  }
+  return "/tmp";
+}
+
+// Repr order, as sortWorms in nativeDataset.cpp
+struct PagedWormOrder {
+  bool operator()(const pair<string, size_t> &a,
+		  const pair<string, size_t> &b) const {
+    return a.first < b.first;
+  }
+};
+
+} // namespace
+
+// Takes the records of loadRecords into the pages of a store. A worm
+//   goes into runs of records in time order; a record that does not
+//   fit at the end of the last run starts a new one, and finish() puts
+//   the runs in order, as long as they do not overlap.
+class NativePagedBuilder : public NativeRecordSink {
+ public:
+  explicit NativePagedBuilder(NativePagedStore &store)
+    : numFiles(0), store(store), tailBytes(0) {
+    lock_guard<mutex> guard(cacheLock);
+    tailLimit = max((size_t)currentBudget(), (size_t)PAGE_TAILS_MIN_BYTES);
+  }
+
+  long numFiles;
+
+  void file(const string &) {
+    numFiles++;
+  }
+  void record(NativeWorm &segment);
+  // The runs into the store, and the worms without their columns into
+  //   stripped, in the order of loadFromFile
+  void finish(NativeWCONWorms &stripped);
+
+ private:
+  struct Run {
+    Run() : tFirst(NAN), tLast(NAN), numFrames(0) {}
+    double tFirst;
+    double tLast;
+    long numFrames;
+    // Pages written, by column
+    vector<long> pages[NATIVE_PAGED_COLUMNS];
+    // Points in each page of NATIVE_PAGED_SIZE
+    vector<long> sizePoints;
+    // Values not in a page yet
+    vector<double> tails[NATIVE_PAGED_COLUMNS];
+    // Empty where no record of the worm has them so far
+    vector<string> head;
+    vector<string> ventral;
+  };
+  struct Worm {
+    Worm() : open(false), maxPoints(0), hasCentroid(false) {}
+    string id;
+    vector<Run> runs;
+    // The last run takes more records
+    bool open;
+    long maxPoints;
+    bool hasCentroid;
+  };
+
+  NativePagedStore &store;
+  map<string, size_t> byId;
+  vector<Worm> worms;
+  size_t tailBytes;
+  size_t tailLimit;
+
+  void append(Run &run, int column, double value) {
+    run.tails[column].push_back(value);
+    tailBytes += sizeof(double);
+    if (run.tails[column].size() >= WCONOCT_PAGE_VALUES) {
+      writePage(run, column);
+    }
+  }
+  void writePage(Run &run, int column);
+  bool continuesRun(const Worm &worm, double t) const;
+  void closeRun(Worm &worm);
+  void flushTails();
+};
+
+void NativePagedBuilder::writePage(Run &run, int column) {
+  vector<double> &tail = run.tails[column];
+  if (tail.empty()) {
+    return;
+  }
+  const char *data = (const char *)&tail[0];
+  size_t size = tail.size() * sizeof(double);
+  long long offset = (long long)store.fileBytes;
+  for (size_t done=0; done<size; ) {
+    ssize_t n = pwrite(store.fd, data + done, size - done, offset + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      throw WconNativeError(string("Cannot write the page file: ") +
+			    strerror(errno));
+    }
+    done += n;
+  }
+  if (column == NATIVE_PAGED_SIZE) {
+    double points = 0.0;
+    for (size_t i=0; i<tail.size(); i++) {
+      points += tail[i];
+    }
+    run.sizePoints.push_back((long)points);
+  }
+  run.pages[column].push_back((long)store.pageOffset.size());
+  store.pageOffset.push_back(offset);
+  store.pageCount.push_back((long)tail.size());
+  store.fileBytes += size;
+  {
+    lock_guard<mutex> guard(cacheLock);
+    spillBytes += size;
+  }
+  tailBytes -= size;
+  tail.clear();
+}
+
+void NativePagedBuilder::closeRun(Worm &worm) {
+  if (worm.open) {
+    Run &run = worm.runs.back();
+    for (int c=0; c<NATIVE_PAGED_COLUMNS; c++) {
+      writePage(run, c);
+      vector<double>().swap(run.tails[c]);
+    }
+    worm.open = false;
+  }
+}
+
+// Short pages for every worm, to bring the memory back down
+void NativePagedBuilder::flushTails() {
+  for (size_t w=0; w<worms.size(); w++) {
+    if (worms[w].open) {
+      Run &run = worms[w].runs.back();
+      for (int c=0; c<NATIVE_PAGED_COLUMNS; c++) {
+	writePage(run, c);
+	vector<double>().swap(run.tails[c]);
+      }
+    }
+  }
+}
+
+// Whether a record from t on goes at the end of the last run: after it,
+//   and before the start of any later run. Chunks loaded backwards from
+//   the middle of a chain come in as runs out of order.
+bool NativePagedBuilder::continuesRun(const Worm &worm, double t) const {
+  const Run &last = worm.runs.back();
+  if (!(last.tLast < t)) {
+    return false;
+  }
+  for (size_t r=0; r+1<worm.runs.size(); r++) {
+    double first = worm.runs[r].tFirst;
+    if (last.tLast < first && first <= t) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void NativePagedBuilder::record(NativeWorm &segment) {
+  for (long i=0; i<segment.numFrames; i++) {
+    if (isnan(segment.t[i])) {
+      throw WconNativeError("Worm " + segment.id + " has a frame without "
+			    "a time, which cannot be loaded out of core");
+    } else if (i > 0 && !(segment.t[i - 1] < segment.t[i])) {
+      throw WconNativeError("The frames of a record of worm " + segment.id +
+			    " are not in time order, which only "
+			    "load_from_file can sort");
+    }
+  }
+  map<string, size_t>::iterator found = byId.find(segment.id);
+  if (found == byId.end()) {
+    found = byId.insert(make_pair(segment.id, worms.size())).first;
+    worms.push_back(Worm());
+    worms.back().id = segment.id;
+  }
+  Worm &worm = worms[found->second];
+  long n = segment.numFrames;
+  if (n == 0) {
+    return;
+  }
+  if (!worm.open || !continuesRun(worm, segment.t[0])) {
+    closeRun(worm);
+    worm.runs.push_back(Run());
+    worm.runs.back().tFirst = segment.t[0];
+    worm.open = true;
+  }
+  Run &run = worm.runs.back();
+  run.tLast = segment.t[n - 1];
+  worm.maxPoints = max(worm.maxPoints, segment.maxPoints);
+  worm.hasCentroid = worm.hasCentroid || segment.hasCentroid();
+
+  long m = segment.maxPoints;
+  for (long i=0; i<n; i++) {
+    append(run, NATIVE_PAGED_T, segment.t[i]);
+    append(run, NATIVE_PAGED_CX, segment.hasCentroid() ? segment.cx[i] : NAN);
+    append(run, NATIVE_PAGED_CY, segment.hasCentroid() ? segment.cy[i] : NAN);
+    long size = (long)segment.aspectSize[i];
+    append(run, NATIVE_PAGED_SIZE, (double)size);
+    for (long k=0; k<size; k++) {
+      append(run, NATIVE_PAGED_X, segment.x[i * m + k]);
+      append(run, NATIVE_PAGED_Y, segment.y[i * m + k]);
+    }
+  }
+  vector<string> *labels[] = {&run.head, &run.ventral};
+  vector<string> *values[] = {&segment.head, &segment.ventral};
+  for (int l=0; l<2; l++) {
+    if (!values[l]->empty()) {
+      labels[l]->resize(run.numFrames);
+      labels[l]->insert(labels[l]->end(), values[l]->begin(),
+			values[l]->end());
+    } else if (!labels[l]->empty()) {
+      labels[l]->resize(run.numFrames + n);
+    }
+  }
+  run.numFrames += n;
+  if (tailBytes > tailLimit) {
+    flushTails();
+  }
+}
+
+void NativePagedBuilder::finish(NativeWCONWorms &stripped) {
+  vector<pair<string, size_t> > keys;
+  for (size_t w=0; w<worms.size(); w++) {
+    keys.push_back(make_pair(nativePyRepr(worms[w].id, false) + ",", w));
+  }
+  stable_sort(keys.begin(), keys.end(), PagedWormOrder());
+
+  for (size_t j=0; j<keys.size(); j++) {
+    Worm &worm = worms[keys[j].second];
+    closeRun(worm);
+    stripped.checkDataUnits(worm.id, worm.hasCentroid);
+    vector<pair<double, size_t> > order;
+    for (size_t r=0; r<worm.runs.size(); r++) {
+      order.push_back(make_pair(worm.runs[r].tFirst, r));
+    }
+    sort(order.begin(), order.end());
+
+    stripped.worms.push_back(NativeWorm());
+    NativeWorm &out = stripped.worms.back();
+    out.id = worm.id;
+    out.maxPoints = worm.maxPoints;
+    store.worms.push_back(NativePagedWorm());
+    NativePagedWorm &paged = store.worms.back();
+    paged.hasCentroid = worm.hasCentroid;
+    bool hasHead = false, hasVentral = false;
+    for (size_t r=0; r<worm.runs.size(); r++) {
+      hasHead = hasHead || !worm.runs[r].head.empty();
+      hasVentral = hasVentral || !worm.runs[r].ventral.empty();
+    }
+
+    long points = 0;
+    for (size_t k=0; k<order.size(); k++) {
+      Run &run = worm.runs[order[k].second];
+      if (k > 0 && !(worm.runs[order[k - 1].second].tLast < run.tFirst)) {
+	throw WconNativeError("The records of worm " + worm.id + " overlap "
+			      "in time, which only load_from_file can "
+			      "merge");
+      }
+      for (int c=0; c<NATIVE_PAGED_COLUMNS; c++) {
+	NativePagedRun &column = paged.columns[c];
+	for (size_t p=0; p<run.pages[c].size(); p++) {
+	  long page = run.pages[c][p];
+	  column.first.push_back(column.pages.empty() ? 0 :
+				 column.first.back() +
+				 store.pageCount[column.pages.back()]);
+	  column.pages.push_back(page);
+	}
+      }
+      for (size_t p=0; p<run.sizePoints.size(); p++) {
+	paged.pointsBefore.push_back(points);
+	points += run.sizePoints[p];
+      }
+      if (hasHead) {
+	run.head.resize(run.numFrames);
+	out.head.insert(out.head.end(), run.head.begin(), run.head.end());
+      }
+      if (hasVentral) {
+	run.ventral.resize(run.numFrames);
+	out.ventral.insert(out.ventral.end(), run.ventral.begin(),
+			   run.ventral.end());
+      }
+      out.numFrames += run.numFrames;
+    }
+    for (int c=0; c<NATIVE_PAGED_COLUMNS; c++) {
+      NativePagedRun &column = paged.columns[c];
+      column.length = column.pages.empty() ? 0 :
+	column.first.back() + store.pageCount[column.pages.back()];
+    }
+    vector<Run>().swap(worm.runs);
+  }
+}
+
+/*
+ * The store
+ */
+
+NativePagedStore::NativePagedStore() : fd(-1), fileBytes(0.0) {
+  lock_guard<mutex> guard(cacheLock);
+  serial = nextSerial++;
+}
+
+NativePagedStore::~NativePagedStore() {
+  if (fd >= 0) {
+    close(fd);
+  }
+  lock_guard<mutex> guard(cacheLock);
+  for (size_t p=0; p<pageOffset.size(); p++) {
+    unordered_map<unsigned long long, CachedPage>::iterator it =
+      cachePages.find(pageKey(serial, (long)p));
+    if (it != cachePages.end()) {
+      cacheBytes -= it->second.values->size() * sizeof(double);
+      cacheOrder.erase(it->second.lru);
+      cachePages.erase(it);
+    }
+  }
+  spillBytes -= fileBytes;
+}
+
+shared_ptr<const NativePagedStore>
+NativePagedStore::load(const string &path,
+		       shared_ptr<NativeWCONWorms> &stripped, bool &chunked) {
+  shared_ptr<NativePagedStore> store(new NativePagedStore);
+  string dir = spillDir();
+  string name = dir + "/wconoct-pages-XXXXXX";
+  vector<char> buf(name.begin(), name.end());
+  buf.push_back('\0');
+  store->fd = mkstemp(&buf[0]);
+  if (store->fd < 0) {
+    throw WconNativeError("Cannot create a page file in " + dir + ": " +
+			  strerror(errno));
+  }
+  // Gone with the last descriptor, however the process ends
+  unlink(&buf[0]);
+
+  NativePagedBuilder builder(*store);
+  stripped = NativeWCONWorms::loadRecords(path, builder);
+  builder.finish(*stripped);
+  chunked = builder.numFiles > 1;
+  return store;
+}
+
+shared_ptr<const vector<double> > NativePagedStore::page(long p) const {
+  unsigned long long key = pageKey(serial, p);
+  {
+    lock_guard<mutex> guard(cacheLock);
+    unordered_map<unsigned long long, CachedPage>::iterator it =
+      cachePages.find(key);
+    if (it != cachePages.end()) {
+      cacheOrder.splice(cacheOrder.begin(), cacheOrder, it->second.lru);
+      cacheHits++;
+      return it->second.values;
+    }
+    cacheMisses++;
+  }
+
+  // Read without the lock, so that other pages can be had meanwhile
+  shared_ptr<vector<double> > values(new vector<double>(pageCount[p]));
+  char *data = (char *)&(*values)[0];
+  size_t size = values->size() * sizeof(double);
+  for (size_t done=0; done<size; ) {
+    ssize_t n = pread(fd, data + done, size - done, pageOffset[p] + done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      throw WconNativeError(string("Cannot read the page file: ") +
+			    ((n == 0) ? "unexpected end" : strerror(errno)));
+    }
+    done += n;
+  }
+
+  lock_guard<mutex> guard(cacheLock);
+  unordered_map<unsigned long long, CachedPage>::iterator it =
+    cachePages.find(key);
+  if (it != cachePages.end()) {
+    return it->second.values;
+  }
+  CachedPage &cached = cachePages[key];
+  cached.values = values;
+  cacheOrder.push_front(key);
+  cached.lru = cacheOrder.begin();
+  cacheBytes += size;
+  evictPages();
+  return values;
+}
+
+void NativePagedStore::readValues(size_t i, NativePagedColumn column,
+				  long begin, long end, double *out) const {
+  if (begin >= end) {
+    return;
+  }
+  const NativePagedRun &run = worms[i].columns[column];
+  size_t k = upper_bound(run.first.begin(), run.first.end(), begin) -
+    run.first.begin() - 1;
+  while (begin < end) {
+    shared_ptr<const vector<double> > values = page(run.pages[k]);
+    long from = begin - run.first[k];
+    long n = min(end - begin, (long)values->size() - from);
+    memcpy(out, &(*values)[from], n * sizeof(double));
+    out += n;
+    begin += n;
+    k++;
+  }
+}
+
+void NativePagedStore::decode(const NativeWCONWorms &stripped, size_t i,
+			      long begin, long end, double *x, double *y,
+			      long rowStride) const {
+  long m = stripped.worms[i].maxPoints;
+  if (begin >= end || m == 0) {
+    return;
+  }
+  long n = end - begin;
+  vector<double> sizes(n);
+  readValues(i, NATIVE_PAGED_SIZE, begin, end, &sizes[0]);
+
+  // The first point of frame begin: the points before its page, and
+  //   those of the frames before it in the page
+  const NativePagedWorm &worm = worms[i];
+  const NativePagedRun &run = worm.columns[NATIVE_PAGED_SIZE];
+  size_t k = upper_bound(run.first.begin(), run.first.end(), begin) -
+    run.first.begin() - 1;
+  long start = worm.pointsBefore[k];
+  if (begin > run.first[k]) {
+    vector<double> before(begin - run.first[k]);
+    readValues(i, NATIVE_PAGED_SIZE, run.first[k], begin, &before[0]);
+    for (size_t f=0; f<before.size(); f++) {
+      start += (long)before[f];
+    }
+  }
+  long total = 0;
+  for (long f=0; f<n; f++) {
+    total += (long)sizes[f];
+  }
+
+  vector<double> px(total), py(total);
+  if (total > 0) {
+    readValues(i, NATIVE_PAGED_X, start, start + total, &px[0]);
+    readValues(i, NATIVE_PAGED_Y, start, start + total, &py[0]);
+  }
+  long offset = 0;
+  for (long f=0; f<n; f++) {
+    long size = (long)sizes[f];
+    double *rowX = x + f * rowStride;
+    double *rowY = y + f * rowStride;
+    for (long p=0; p<m; p++) {
+      rowX[p] = (p < size) ? px[offset + p] : NAN;
+      rowY[p] = (p < size) ? py[offset + p] : NAN;
+    }
+    offset += size;
+  }
+}
+
+void NativePagedStore::read(const NativeWCONWorms &stripped, size_t i,
+			    long begin, long end, NativeWorm &out) const {
+  const NativeWorm &worm = stripped.worms[i];
+  long n = max(end - begin, 0L);
+  out.id = worm.id;
+  out.numFrames = n;
+  out.maxPoints = worm.maxPoints;
+  out.t.resize(n);
+  out.aspectSize.resize(n);
+  if (n > 0) {
+    readValues(i, NATIVE_PAGED_T, begin, end, &out.t[0]);
+    readValues(i, NATIVE_PAGED_SIZE, begin, end, &out.aspectSize[0]);
+  }
+  if (worms[i].hasCentroid) {
+    out.cx.resize(n);
+    out.cy.resize(n);
+    if (n > 0) {
+      readValues(i, NATIVE_PAGED_CX, begin, end, &out.cx[0]);
+      readValues(i, NATIVE_PAGED_CY, begin, end, &out.cy[0]);
+    }
+  } else {
+    out.cx.clear();
+    out.cy.clear();
+  }
+  out.x.resize(n * worm.maxPoints);
+  out.y.resize(n * worm.maxPoints);
+  if (!out.x.empty()) {
+    decode(stripped, i, begin, end, &out.x[0], &out.y[0], worm.maxPoints);
+  }
+}
+
+void NativePagedStore::fetch(const NativeWCONWorms &stripped, size_t i,
+			     NativeWorm &worm) const {
+  read(stripped, i, 0, stripped.worms[i].numFrames, worm);
+  worm.head = stripped.worms[i].head;
+  worm.ventral = stripped.worms[i].ventral;
+}
+
+shared_ptr<const NativeWCONWorms>
+NativePagedStore::expand(const NativeWCONWorms &stripped) const {
+  shared_ptr<NativeWCONWorms> w(new NativeWCONWorms(stripped));
+  for (size_t i=0; i<w->worms.size(); i++) {
+    read(stripped, i, 0, stripped.worms[i].numFrames, w->worms[i]);
+  }
+  return w;
+}
+
+size_t NativePagedStore::byteSize() const {
+  size_t bytes = sizeof(*this) + pageOffset.capacity() * sizeof(long long) +
+    pageCount.capacity() * sizeof(long) +
+    worms.capacity() * sizeof(NativePagedWorm);
+  for (size_t i=0; i<worms.size(); i++) {
+    for (int c=0; c<NATIVE_PAGED_COLUMNS; c++) {
+      bytes += (worms[i].columns[c].pages.capacity() +
+		worms[i].columns[c].first.capacity()) * sizeof(long);
+    }
+    bytes += worms[i].pointsBefore.capacity() * sizeof(long);
+  }
+  return bytes;
+}
+
+void nativePageCacheInfo(WconOctPageCacheInfo &info) {
+  lock_guard<mutex> guard(cacheLock);
+  info.capBytes = currentBudget();
+  info.bytes = (double)cacheBytes;
+  info.numPages = (long)cachePages.size();
+  info.diskBytes = spillBytes;
+  info.hits = cacheHits;
+  info.misses = cacheMisses;
+}
+
+bool nativePageCacheSetBudget(double bytes) {
+  if (bytes < 0.0) {
+    return false;
+  }
+  lock_guard<mutex> guard(cacheLock);
+  cacheBudget = bytes;
+  evictPages();
+  return true;
+}
@@ -0,0 +1,122 @@
+#ifndef __NATIVE_PAGED_H_
+#define __NATIVE_PAGED_H_
+// Out-of-core storage of a native dataset, behind
+//   wconOct_static_WCONWorms_load_paged.
+//
+// A paged handle keeps the dataset in memory without its numeric
+//   columns: ids, frame counts, units, metadata, and head and ventral
+//   where the file has them. The columns go to a spill file on local
+//   disk ($WCONOCT_PAGE_DIR, else $TMPDIR, else /tmp), removed as soon
+//   as it is opened, in pages of up to WCONOCT_PAGE_VALUES values:
+//   - per frame: t, cx, cy (NaN for worms without a centroid) and the
+//     number of points
+//   - per point: x and y, each frame with only its own points
+// Pages are read back through one LRU cache for the whole process,
+//   held under a budget (wconOct_setPageCache). Loading goes record by
+//   record, so a worm has to come in time order within a file and
+//   across its chunks, and only a page per column of the worms still
+//   being read is in memory at a time.
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "nativeDataset.h"
+#include "wrapperTypes.h"
+
+#define WCONOCT_PAGE_VALUES 8192
+
+enum NativePagedColumn {
+  NATIVE_PAGED_T,
+  NATIVE_PAGED_CX,
+  NATIVE_PAGED_CY,
+  NATIVE_PAGED_SIZE,
+  NATIVE_PAGED_X,
+  NATIVE_PAGED_Y,
+  NATIVE_PAGED_COLUMNS
+};
+
+// The pages of one column of one worm, in order
+struct NativePagedRun {
+  NativePagedRun() : length(0) {}
+
+  // Into the pages of the store
+  std::vector<long> pages;
+  // Index of the first value of each page within the column
+  std::vector<long> first;
+  long length;
+};
+
+struct NativePagedWorm {
+  NativePagedWorm() : hasCentroid(false) {}
+
+  bool hasCentroid;
+  NativePagedRun columns[NATIVE_PAGED_COLUMNS];
+  // Points before the first frame of each page of NATIVE_PAGED_SIZE
+  std::vector<long> pointsBefore;
+};
+
+class NativePagedStore : public NativeWormSource {
+ public:
+  ~NativePagedStore();
+
+  // As in the worms of the stripped dataset
+  std::vector<NativePagedWorm> worms;
+
+  // Loads path record by record into a new store, and the rest of the
+  //   dataset into stripped. chunked is set if it took more than one
+  //   file, which loadFromFile would have converted to canonical units.
+  //   Throws WconNativeError.
+  static std::shared_ptr<const NativePagedStore>
+    load(const std::string &path,
+	 std::shared_ptr<NativeWCONWorms> &stripped, bool &chunked);
+
+  // Frames [begin, end) of worm i of stripped into out: t, aspectSize,
+  //   x and y (maxPoints per row, NaN padded), and cx and cy if the worm
+  //   has a centroid. head and ventral are left alone.
+  void read(const NativeWCONWorms &stripped, size_t i, long begin,
+	    long end, NativeWorm &out) const;
+  // Only the spine points of frames [begin, end), maxPoints each, into x
+  //   and y row major (rowStride apart)
+  void decode(const NativeWCONWorms &stripped, size_t i, long begin,
+	      long end, double *x, double *y, long rowStride) const;
+  void fetch(const NativeWCONWorms &stripped, size_t i,
+	     NativeWorm &worm) const;
+  // The dataset back from stripped, with every column read in
+  std::shared_ptr<const NativeWCONWorms>
+    expand(const NativeWCONWorms &stripped) const;
+
+  // Heap bytes of the page tables; the pages themselves are charged to
+  //   the cache
+  size_t byteSize() const;
+  // Bytes of the spill file
+  double diskBytes() const { return fileBytes; }
+
+ private:
+  NativePagedStore();
+
+  friend class NativePagedBuilder;
+
+  // Serial number, telling the pages of stores apart in the cache
+  long serial;
+  int fd;
+  double fileBytes;
+  // Where each page is in the spill file and how many values it holds
+  std::vector<long long> pageOffset;
+  std::vector<long> pageCount;
+
+  // Values [begin, end) of a column of worm i into out
+  void readValues(size_t i, NativePagedColumn column, long begin, long end,
+		  double *out) const;
+  // The page of the spill file, through the cache
+  std::shared_ptr<const std::vector<double> > page(long p) const;
+
+  NativePagedStore(const NativePagedStore &);
+  NativePagedStore &operator=(const NativePagedStore &);
+};
+
+// What wconOct_pageCacheInfo reports
+void nativePageCacheInfo(WconOctPageCacheInfo &info);
+// The budget of the cache; false if bytes is negative
+bool nativePageCacheSetBudget(double bytes);
+
+#endif /* __NATIVE_PAGED_H_ */
@@ -0,0 +1,371 @@
+#include "nativeResample.h"
+
+#include <ctype.h>
+#include <math.h>
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <thread>
+
+using namespace std;
+
+namespace {
+
+// Relative to the interval between two frames: targets this close to a
+//   frame take it over, so that k*dt matches frame times with rounding
+#define RESAMPLE_TOLERANCE 1e-9
+
+bool isCubicMethod(const string &method) {
+  string m = method;
+  for (size_t i=0; i<m.size(); i++) {
+    m[i] = (char)tolower((unsigned char)m[i]);
+  }
+  return m.find("cubic") != string::npos || m.find("spline") != string::npos;
+}
+
+bool listsKey(const WconJsonValue *values, const string &key) {
+  if (values == NULL) {
+    return true;
+  } else if (values->isString()) {
+    return values->strValue == key;
+  }
+  for (size_t i=0; i<values->items.size(); i++) {
+    if (values->items[i].isString() && values->items[i].strValue == key) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// The method metadata.interpolate gives for key; an entry without
+//   "values" covers every key. Linear if there is none.
+WconOctInterpolation metadataMethod(const NativeWCONWorms &w,
+				    const string &key) {
+  const WconJsonValue *interp =
+    w.hasMetadata ? w.metadata.find("interpolate") : NULL;
+  if (interp == NULL) {
+    return WCONOCT_INTERP_LINEAR;
+  }
+  vector<const WconJsonValue *> entries;
+  if (interp->isArray()) {
+    for (size_t i=0; i<interp->items.size(); i++) {
+      entries.push_back(&interp->items[i]);
+    }
+  } else {
+    entries.push_back(interp);
+  }
+  for (size_t i=0; i<entries.size(); i++) {
+    const WconJsonValue *method = entries[i]->find("method");
+    if (method != NULL && method->isString() &&
+	listsKey(entries[i]->find("values"), key)) {
+      return isCubicMethod(method->strValue) ? WCONOCT_INTERP_CUBIC :
+	WCONOCT_INTERP_LINEAR;
+    }
+  }
+  return WCONOCT_INTERP_LINEAR;
+}
+
+// Methods for the keys that are interpolated
+struct KeyMethods {
+  bool x;
+  bool y;
+  bool cx;
+  bool cy;
+};
+
+// One worm, with its frames up to the first without a time
+struct ResampleSource {
+  const NativeWorm *worm;
+  long n;
+  // gapAfter[i]: no interpolating between frames i and i+1
+  vector<bool> gapAfter;
+};
+
+// A quantity with a value every stride doubles, at time t
+double interpolate(const ResampleSource &src, const double *col,
+		   long stride, long i, double tau, bool cubic) {
+  const vector<double> &t = src.worm->t;
+  double v0 = col[i * stride], v1 = col[(i + 1) * stride];
+  if (isnan(v0) || isnan(v1)) {
+    return NAN;
+  }
+  double h = t[i + 1] - t[i];
+  double u = (tau - t[i]) / h;
+  if (!cubic) {
+    return v0 + (v1 - v0) * u;
+  }
+  // Cubic Hermite, with slopes from the neighbouring frames where there
+  //   are some on the same side of any gap, as Catmull-Rom does
+  double secant = (v1 - v0) / h;
+  double m0 = secant, m1 = secant;
+  if (i > 0 && !src.gapAfter[i - 1] && !isnan(col[(i - 1) * stride])) {
+    m0 = (v1 - col[(i - 1) * stride]) / (t[i + 1] - t[i - 1]);
+  }
+  if (i + 2 < src.n && !src.gapAfter[i + 1] &&
+      !isnan(col[(i + 2) * stride])) {
+    m1 = (col[(i + 2) * stride] - v0) / (t[i + 2] - t[i]);
+  }
+  double u2 = u * u, u3 = u2 * u;
+  return (2 * u3 - 3 * u2 + 1) * v0 + (u3 - 2 * u2 + u) * h * m0 +
+    (-2 * u3 + 3 * u2) * v1 + (u3 - u2) * h * m1;
+}
+
+double aspectSizeOf(const NativeWorm &w, long i) {
+  double size = w.aspectSize[i];
+  return isnan(size) ? 0 : size;
+}
+
+// Frame i of src as a frame of dest at time tau
+void copyFrame(NativeWorm &dest, const NativeWorm &src, long i, double tau) {
+  dest.t.push_back(tau);
+  dest.x.insert(dest.x.end(), src.x.begin() + i * src.maxPoints,
+		src.x.begin() + (i + 1) * src.maxPoints);
+  dest.y.insert(dest.y.end(), src.y.begin() + i * src.maxPoints,
+		src.y.begin() + (i + 1) * src.maxPoints);
+  dest.aspectSize.push_back(src.aspectSize[i]);
+  if (src.hasCentroid()) {
+    dest.cx.push_back(src.cx[i]);
+    dest.cy.push_back(src.cy[i]);
+  }
+  if (src.hasHead()) {
+    dest.head.push_back(src.head[i]);
+  }
+  if (src.hasVentral()) {
+    dest.ventral.push_back(src.ventral[i]);
+  }
+  dest.numFrames++;
+}
+
+// A frame of dest at time tau, between frames i and i+1 of the source
+void interpolateFrame(NativeWorm &dest, const ResampleSource &src, long i,
+		      double tau, const KeyMethods &cubic) {
+  const NativeWorm &w = *src.worm;
+  dest.t.push_back(tau);
+  double points = min(aspectSizeOf(w, i), aspectSizeOf(w, i + 1));
+  for (long k=0; k<w.maxPoints; k++) {
+    if (k < points) {
+      dest.x.push_back(interpolate(src, &w.x[k], w.maxPoints, i, tau,
+				   cubic.x));
+      dest.y.push_back(interpolate(src, &w.y[k], w.maxPoints, i, tau,
+				   cubic.y));
+    } else {
+      dest.x.push_back(NAN);
+      dest.y.push_back(NAN);
+    }
+  }
+  dest.aspectSize.push_back(points);
+  if (w.hasCentroid()) {
+    dest.cx.push_back(interpolate(src, &w.cx[0], 1, i, tau, cubic.cx));
+    dest.cy.push_back(interpolate(src, &w.cy[0], 1, i, tau, cubic.cy));
+  }
+  // Labels from the nearer frame
+  long nearer = (tau - w.t[i] <= w.t[i + 1] - tau) ? i : i + 1;
+  if (w.hasHead()) {
+    dest.head.push_back(w.head[nearer]);
+  }
+  if (w.hasVentral()) {
+    dest.ventral.push_back(w.ventral[nearer]);
+  }
+  dest.numFrames++;
+}
+
+// The targets within the time span of the worm
+void wormTargets(const ResampleSource &src, const NativeResampleOptions &opts,
+		 vector<double> &targets) {
+  double first = src.worm->t[0], last = src.worm->t[src.n - 1];
+  if (opts.dt > 0) {
+    double k0 = ceil(first / opts.dt - RESAMPLE_TOLERANCE);
+    double k1 = floor(last / opts.dt + RESAMPLE_TOLERANCE);
+    for (double k=k0; k<=k1; k++) {
+      // + 0 turns the -0 that ceil can give into 0
+      targets.push_back(k * opts.dt + 0.0);
+    }
+    return;
+  }
+  double slack = (last - first) * RESAMPLE_TOLERANCE;
+  vector<double>::const_iterator from =
+    lower_bound(opts.times.begin(), opts.times.end(), first - slack);
+  vector<double>::const_iterator to =
+    upper_bound(opts.times.begin(), opts.times.end(), last + slack);
+  targets.assign(from, to);
+}
+
+void resampleWorm(const NativeWorm &worm, const NativeResampleOptions &opts,
+		  const KeyMethods &cubic, NativeWorm &dest) {
+  ResampleSource src;
+  src.worm = &worm;
+  src.n = 0;
+  while (src.n < worm.numFrames && !isnan(worm.t[src.n])) {
+    src.n++;
+  }
+  dest.id = worm.id;
+  dest.numFrames = 0;
+  dest.maxPoints = worm.maxPoints;
+  if (src.n == 0) {
+    return;
+  }
+  for (long i=0; i+1<src.n; i++) {
+    src.gapAfter.push_back(opts.maxGap > 0 &&
+			   worm.t[i + 1] - worm.t[i] > opts.maxGap);
+  }
+  src.gapAfter.push_back(true);
+
+  vector<double> targets;
+  wormTargets(src, opts, targets);
+  // The first frame of the interval each target is in
+  long i = 0;
+  for (size_t j=0; j<targets.size(); j++) {
+    double tau = targets[j];
+    while (i + 1 < src.n && worm.t[i + 1] <= tau) {
+      i++;
+    }
+    if (i + 1 >= src.n) {
+      // At or just past the last frame
+      copyFrame(dest, worm, src.n - 1, tau);
+      continue;
+    }
+    double h = worm.t[i + 1] - worm.t[i];
+    if (tau - worm.t[i] <= h * RESAMPLE_TOLERANCE) {
+      copyFrame(dest, worm, i, tau);
+    } else if (worm.t[i + 1] - tau <= h * RESAMPLE_TOLERANCE) {
+      copyFrame(dest, worm, i + 1, tau);
+    } else if (tau < worm.t[i]) {
+      // Just before the first frame
+      copyFrame(dest, worm, 0, tau);
+    } else if (!src.gapAfter[i]) {
+      interpolateFrame(dest, src, i, tau, cubic);
+    }
+  }
+  if (!worm.hasCentroid()) {
+    dest.cx.clear();
+    dest.cy.clear();
+  }
+}
+
+void resampleBatch(const NativeWCONWorms *w, const NativeResampleOptions *opts,
+		   const KeyMethods *cubic, atomic<size_t> *next,
+		   vector<NativeWorm> *out, exception_ptr *failure) {
+  try {
+    for (size_t i = (*next)++; i < w->worms.size(); i = (*next)++) {
+      resampleWorm(w->worms[i], *opts, *cubic, (*out)[i]);
+    }
+  } catch (...) {
+    *failure = current_exception();
+  }
+}
+
+// metadata.interpolate for the result: what each key went through
+WconJsonValue interpolateMetadata(const KeyMethods &cubic) {
+  const char *keys[] = {"x", "y", "cx", "cy"};
+  bool isCubic[] = {cubic.x, cubic.y, cubic.cx, cubic.cy};
+  WconJsonValue entries;
+  entries.type = WconJsonValue::JSON_ARRAY;
+  for (int m=0; m<2; m++) {
+    WconJsonValue values;
+    values.type = WconJsonValue::JSON_ARRAY;
+    for (int k=0; k<4; k++) {
+      if (isCubic[k] == (m == 1)) {
+	values.items.push_back(WconJsonValue());
+	values.items.back().type = WconJsonValue::JSON_STRING;
+	values.items.back().strValue = keys[k];
+      }
+    }
+    if (values.items.empty()) {
+      continue;
+    }
+    WconJsonValue entry, method;
+    entry.type = WconJsonValue::JSON_OBJECT;
+    method.type = WconJsonValue::JSON_STRING;
+    method.strValue = (m == 1) ? "cubic" : "linear";
+    entry.members.push_back(make_pair(string("method"), method));
+    entry.members.push_back(make_pair(string("values"), values));
+    entries.items.push_back(entry);
+  }
+  return entries;
+}
+
+} // namespace
+
+shared_ptr<NativeWCONWorms>
+nativeResample(const NativeWCONWorms &w, const NativeResampleOptions &opts) {
+  if (!(opts.dt > 0) && opts.times.empty()) {
+    throw WconNativeError("Resampling needs a dt above 0 or target times");
+  }
+  if (!(opts.maxGap >= 0)) {
+    throw WconNativeError("The largest gap to interpolate across may not be "
+			  "negative");
+  }
+  NativeResampleOptions sorted = opts;
+  for (size_t i=0; i<sorted.times.size(); i++) {
+    if (isnan(sorted.times[i])) {
+      throw WconNativeError("Target times may not be NaN");
+    }
+  }
+  sort(sorted.times.begin(), sorted.times.end());
+  sorted.times.erase(unique(sorted.times.begin(), sorted.times.end()),
+		     sorted.times.end());
+
+  KeyMethods cubic;
+  WconOctInterpolation methods[4];
+  const char *keys[] = {"x", "y", "cx", "cy"};
+  for (int k=0; k<4; k++) {
+    methods[k] = (opts.method == WCONOCT_INTERP_FROM_METADATA) ?
+      metadataMethod(w, keys[k]) : opts.method;
+  }
+  cubic.x = (methods[0] == WCONOCT_INTERP_CUBIC);
+  cubic.y = (methods[1] == WCONOCT_INTERP_CUBIC);
+  cubic.cx = (methods[2] == WCONOCT_INTERP_CUBIC);
+  cubic.cy = (methods[3] == WCONOCT_INTERP_CUBIC);
+
+  vector<NativeWorm> out(w.worms.size());
+  atomic<size_t> next(0);
+  size_t numThreads = (size_t)max(1L, opts.threads);
+  numThreads = max((size_t)1, min(numThreads, w.worms.size()));
+  vector<exception_ptr> failures(numThreads);
+  vector<thread> threads;
+  for (size_t t=1; t<numThreads; t++) {
+    threads.push_back(thread(resampleBatch, &w, &sorted, &cubic, &next, &out,
+			     &failures[t]));
+  }
+  resampleBatch(&w, &sorted, &cubic, &next, &out, &failures[0]);
+  for (size_t t=0; t<threads.size(); t++) {
+    threads[t].join();
+  }
+  for (size_t t=0; t<failures.size(); t++) {
+    if (failures[t]) {
+      rethrow_exception(failures[t]);
+    }
+  }
+
+  shared_ptr<NativeWCONWorms> result(new NativeWCONWorms);
+  // Features are not resampled, so their units go too
+  for (size_t i=0; i<w.units.size(); i++) {
+    if (find(w.featureNames.begin(), w.featureNames.end(),
+	     w.units[i].first) == w.featureNames.end()) {
+      result->units.push_back(w.units[i]);
+    }
+  }
+  result->hasMetadata = true;
+  if (w.hasMetadata) {
+    result->metadata = w.metadata;
+  } else {
+    result->metadata.type = WconJsonValue::JSON_OBJECT;
+  }
+  vector<pair<string, WconJsonValue> > &members = result->metadata.members;
+  for (size_t i=0; i<members.size(); i++) {
+    if (members[i].first == "interpolate") {
+      members.erase(members.begin() + i);
+      break;
+    }
+  }
+  members.push_back(make_pair(string("interpolate"),
+			      interpolateMetadata(cubic)));
+  for (size_t i=0; i<out.size(); i++) {
+    if (out[i].numFrames > 0) {
+      result->worms.push_back(NativeWorm());
+      swap(result->worms.back(), out[i]);
+    }
+  }
+  return result;
+}
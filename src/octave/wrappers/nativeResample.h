@@ -0,0 +1,38 @@
+#ifndef __NATIVE_RESAMPLE_H_
+#define __NATIVE_RESAMPLE_H_
+// Resampling of a native dataset onto new frame times, behind
+//   wconOct_WCONWorms_resample.
+//
+// Every worm is resampled within its own time span; nothing is
+//   extrapolated. A frame at a target time is taken over as it is, and
+//   between two frames spine points and centroids are interpolated (the
+//   spine keeps the points both frames have), while head and ventral
+//   come from the nearer frame. Features are left out.
+#include <memory>
+#include <vector>
+
+#include "nativeDataset.h"
+#include "wrapperTypes.h"
+
+struct NativeResampleOptions {
+  NativeResampleOptions() : dt(0), method(WCONOCT_INTERP_FROM_METADATA),
+			    maxGap(0), threads(1) {}
+
+  // With dt > 0 the targets are the multiples of dt, which puts worms
+  //   and files on one timebase; otherwise they are times, sorted.
+  double dt;
+  std::vector<double> times;
+  WconOctInterpolation method;
+  // Frames further apart than this are not interpolated between, and
+  //   no frames come out in the gap; 0 for no limit
+  double maxGap;
+  // Worms are resampled on this many threads
+  long threads;
+};
+
+// Times and maxGap are in the time units of the dataset. Throws
+//   WconNativeError.
+std::shared_ptr<NativeWCONWorms>
+nativeResample(const NativeWCONWorms &w, const NativeResampleOptions &opts);
+
+#endif /* __NATIVE_RESAMPLE_H_ */
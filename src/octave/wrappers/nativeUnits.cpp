@@ -0,0 +1,503 @@
+#include "nativeUnits.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "wconJson.h"
+using namespace std;
+
+namespace {
+
+struct UnitEntry {
+  const char *name;
+  double value;
+};
+
+// The tables of MeasurementUnitAtom, in the same order
+const UnitEntry siPrefixes[] = {
+  {"", 1},
+  {"c", 1e-2}, {"centi", 1e-2},
+  {"m", 1e-3}, {"milli", 1e-3},
+  {"u", 1e-6}, {"\xC2\xB5", 1e-6}, {"\xCE\xBC", 1e-6}, {"micro", 1e-6},
+  {"n", 1e-9}, {"nano", 1e-9},
+  {"k", 1e+3}, {"kilo", 1e+3},
+  {"M", 1e+6}, {"mega", 1e+6},
+  {"G", 1e+9}, {"giga", 1e+9},
+  {NULL, 0}
+};
+
+const UnitEntry temporalUnits[] = {
+  {"s", 1}, {"sec", 1}, {"second", 1}, {"seconds", 1},
+  {"min", 60}, {"minute", 60}, {"minutes", 60},
+  {"h", 60*60}, {"hr", 60*60}, {"hour", 60*60}, {"hours", 60*60},
+  {"d", 60*60*24}, {"day", 60*60*24}, {"days", 60*60*24},
+  {NULL, 0}
+};
+
+const UnitEntry spatialUnits[] = {
+  {"in", 0.0254}, {"inch", 0.0254}, {"inches", 0.0254},
+  {"m", 1}, {"metre", 1}, {"meter", 1}, {"metres", 1}, {"meters", 1},
+  {"micron", 1e-6}, {"microns", 1e-6},
+  {NULL, 0}
+};
+
+const UnitEntry angularUnits[] = {
+  {"radians", 1}, {"rad", 1}, {"r", 1},
+  {"degrees", M_PI / 180},
+  {NULL, 0}
+};
+
+struct TemperatureEntry {
+  const char *name;
+  NativeMeasurementUnit::Temperature kind;
+};
+
+const TemperatureEntry temperatureUnits[] = {
+  {"F", NativeMeasurementUnit::TEMPERATURE_FAHRENHEIT},
+  {"fahrenheit", NativeMeasurementUnit::TEMPERATURE_FAHRENHEIT},
+  {"K", NativeMeasurementUnit::TEMPERATURE_KELVIN},
+  {"kelvin", NativeMeasurementUnit::TEMPERATURE_KELVIN},
+  {"C", NativeMeasurementUnit::TEMPERATURE_CELSIUS},
+  {"celsius", NativeMeasurementUnit::TEMPERATURE_CELSIUS},
+  {"centigrade", NativeMeasurementUnit::TEMPERATURE_CELSIUS},
+  {NULL, NativeMeasurementUnit::TEMPERATURE_NONE}
+};
+
+const UnitEntry dimensionlessUnits[] = {
+  {"percent", 0.01}, {"%", 0.01}, {"", 1},
+  {NULL, 0}
+};
+
+const UnitEntry *findEntry(const UnitEntry *table, const string &name) {
+  for (; table->name != NULL; table++) {
+    if (name == table->name) {
+      return table;
+    }
+  }
+  return NULL;
+}
+
+const TemperatureEntry *findTemperature(const string &name) {
+  for (const TemperatureEntry *e = temperatureUnits; e->name != NULL; e++) {
+    if (name == e->name) {
+      return e;
+    }
+  }
+  return NULL;
+}
+
+bool isSuffix(const string &s) {
+  return findEntry(temporalUnits, s) || findEntry(spatialUnits, s) ||
+    findEntry(angularUnits, s) || findTemperature(s) ||
+    findEntry(dimensionlessUnits, s);
+}
+
+// len() of a Python str
+size_t codePoints(const string &s) {
+  size_t n = 0;
+  for (size_t i=0; i<s.size(); i++) {
+    if (((unsigned char)s[i] & 0xC0) != 0x80) {
+      n++;
+    }
+  }
+  return n;
+}
+
+string replaceAll(string s, const string &from, const string &to) {
+  size_t pos = 0;
+  while ((pos = s.find(from, pos)) != string::npos) {
+    s.replace(pos, from.size(), to);
+    pos += to.size();
+  }
+  return s;
+}
+
+double celsiusToCanon(NativeMeasurementUnit::Temperature kind, double x) {
+  // scipy.constants F2C and K2C
+  switch (kind) {
+  case NativeMeasurementUnit::TEMPERATURE_FAHRENHEIT:
+    return (x - 32) / 1.8;
+  case NativeMeasurementUnit::TEMPERATURE_KELVIN:
+    return x - 273.15;
+  default:
+    return x;
+  }
+}
+
+double celsiusFromCanon(NativeMeasurementUnit::Temperature kind, double x) {
+  // scipy.constants C2F and C2K
+  switch (kind) {
+  case NativeMeasurementUnit::TEMPERATURE_FAHRENHEIT:
+    return x * 1.8 + 32;
+  case NativeMeasurementUnit::TEMPERATURE_KELVIN:
+    return x + 273.15;
+  default:
+    return x;
+  }
+}
+
+string invalidUnit(const string &unitStr) {
+  return "Error: '" + unitStr + "' is not a valid unit";
+}
+
+} // namespace
+
+// Recursive descent over the subset of Python expressions that
+//   MeasurementUnit.create accepts from ast.parse: names, numbers,
+//   parentheses and the binary operators + - * / **.
+class NativeUnitParser {
+ public:
+  typedef NativeMeasurementUnit Unit;
+
+  explicit NativeUnitParser(const string &text) : text(text), pos(0) {}
+
+  Unit parse() {
+    if (!text.empty() && (text[0] == ' ' || text[0] == '\t')) {
+      fail("unexpected indent");
+    }
+    Unit u = parseSum();
+    skipSpace();
+    if (pos != text.size()) {
+      fail("invalid syntax");
+    }
+    return u;
+  }
+
+  static Unit atom(const string &unitString);
+
+ private:
+  const string &text;
+  size_t pos;
+
+  void fail(const string &why) {
+    throw WconNativeError(invalidUnit(text) + " (" + why + ")");
+  }
+
+  void skipSpace() {
+    while (pos < text.size() && (text[pos] == ' ' || text[pos] == '\t')) {
+      pos++;
+    }
+  }
+
+  static bool isNameStart(unsigned char c) {
+    return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z') || c == '_' ||
+      c >= 0x80;
+  }
+
+  static bool isNameChar(unsigned char c) {
+    return isNameStart(c) || (c >= '0' && c <= '9');
+  }
+
+  // Operator at pos, without consuming it. Empty at the end of input.
+  string peekOperator() {
+    skipSpace();
+    if (pos >= text.size()) {
+      return "";
+    }
+    if (text.compare(pos, 2, "**") == 0) {
+      return "**";
+    }
+    if (text.compare(pos, 2, "//") == 0) {
+      return "//";
+    }
+    return text.substr(pos, 1);
+  }
+
+  Unit parseSum() {
+    Unit u = parseProduct();
+    for (;;) {
+      string op = peekOperator();
+      if (op != "+" && op != "-") {
+	return u;
+      }
+      pos++;
+      u = combine(u, parseProduct(), op[0]);
+    }
+  }
+
+  Unit parseProduct() {
+    Unit u = parseFactor();
+    for (;;) {
+      string op = peekOperator();
+      if (op == "//" || op == "%" || op == "@") {
+	fail("unsupported operator " + op);
+      }
+      if (op != "*" && op != "/") {
+	return u;
+      }
+      pos++;
+      u = combine(u, parseFactor(), op[0]);
+    }
+  }
+
+  Unit parseFactor() {
+    string op = peekOperator();
+    if (op == "+" || op == "-" || op == "~") {
+      // ast.UnaryOp, which MeasurementUnit cannot build
+      fail("unary operators are not supported");
+    }
+    Unit u = parseAtom();
+    if (peekOperator() == "**") {
+      pos += 2;
+      // right associative, and binds tighter than a unary operator
+      //   on its left but not on its right
+      u = combine(u, parseFactor(), '^');
+    }
+    return u;
+  }
+
+  Unit parseAtom() {
+    skipSpace();
+    if (pos >= text.size()) {
+      fail("unexpected end of expression");
+    }
+    unsigned char c = text[pos];
+    if (c == '(') {
+      pos++;
+      Unit u = parseSum();
+      skipSpace();
+      if (pos >= text.size() || text[pos] != ')') {
+	fail("unbalanced parentheses");
+      }
+      pos++;
+      return u;
+    }
+    if ((c >= '0' && c <= '9') ||
+	(c == '.' && pos + 1 < text.size() &&
+	 text[pos+1] >= '0' && text[pos+1] <= '9')) {
+      return parseNumber();
+    }
+    if (isNameStart(c)) {
+      size_t start = pos;
+      while (pos < text.size() && isNameChar(text[pos])) {
+	pos++;
+      }
+      // Python identifiers are NFKC normalized: MICRO SIGN becomes
+      //   GREEK SMALL LETTER MU
+      return atom(replaceAll(text.substr(start, pos - start),
+			     "\xC2\xB5", "\xCE\xBC"));
+    }
+    fail("invalid syntax");
+    return Unit();
+  }
+
+  Unit parseNumber() {
+    size_t start = pos;
+    bool isFloat = false;
+    while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+      pos++;
+    }
+    if (pos < text.size() && text[pos] == '.') {
+      isFloat = true;
+      pos++;
+      while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+	pos++;
+      }
+    }
+    if (pos < text.size() && (text[pos] == 'e' || text[pos] == 'E')) {
+      size_t mark = pos++;
+      if (pos < text.size() && (text[pos] == '+' || text[pos] == '-')) {
+	pos++;
+      }
+      if (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+	isFloat = true;
+	while (pos < text.size() && text[pos] >= '0' && text[pos] <= '9') {
+	  pos++;
+	}
+      } else {
+	pos = mark;
+      }
+    }
+    if (pos < text.size() && isNameChar(text[pos])) {
+      fail("invalid decimal literal");
+    }
+    string literal = text.substr(start, pos - start);
+    double n = strtod(literal.c_str(), NULL);
+    string repr;
+    if (isFloat) {
+      char buf[32];
+      if (isinf(n)) {
+	strcpy(buf, "inf");
+      } else {
+	wconJsonFormatDouble(n, buf);
+      }
+      repr = buf;
+    } else {
+      if (literal.size() > 1 && literal[0] == '0' &&
+	  literal.find_first_not_of('0') != string::npos) {
+	fail("leading zeros in decimal integer literals are not permitted");
+      }
+      repr = (n == 0) ? "0" : literal;
+    }
+    if (n == 0) {
+      // A unit cannot have zero in the expression
+      fail("zero in unit expression");
+    }
+    Unit u;
+    u.unitStr = repr;
+    u.canonicalStr = "1";
+    u.factor = n;
+    return u;
+  }
+
+  Unit combine(const Unit &l, const Unit &r, char op) {
+    double a = l.toCanon(1);
+    double b = r.toCanon(1);
+    double scalar = 0;
+    const char *symbol = "";
+    switch (op) {
+    case '+': scalar = a + b; symbol = "+"; break;
+    case '-': scalar = a - b; symbol = "-"; break;
+    case '*': scalar = a * b; symbol = "*"; break;
+    case '/':
+      if (b == 0) {
+	fail("division by zero");
+      }
+      scalar = a / b;
+      symbol = "/";
+      break;
+    case '^':
+      if (a == 0 && b < 0) {
+	fail("division by zero");
+      }
+      scalar = pow(a, b);
+      if (isnan(scalar)) {
+	// Python would produce a complex number
+	fail("complex result");
+      }
+      symbol = "**";
+      break;
+    }
+    Unit u;
+    u.factor = scalar;
+    u.unitStr = l.unitStr + symbol + r.unitStr;
+    if (l.canonicalStr == "1" && r.canonicalStr == "1") {
+      // str(oper(1, 1)) on Python ints
+      static const char *ones[] = {"2", "0", "1", "1.0", "1"};
+      u.canonicalStr = ones[strchr("+-*/^", op) - "+-*/^"];
+    } else {
+      u.canonicalStr = l.canonicalStr + symbol + r.canonicalStr;
+    }
+    return u;
+  }
+};
+
+NativeMeasurementUnit::NativeMeasurementUnit()
+  : factor(1), prefixFactor(1), temperature(TEMPERATURE_NONE) {
+}
+
+// MeasurementUnitAtom
+NativeMeasurementUnit NativeUnitParser::atom(const string &name) {
+  Unit u;
+  u.unitStr = replaceAll(name, "_in", "in");
+  if (!u.unitStr.empty() && u.unitStr[0] == '@') {
+    // Custom units are their own canonical form
+    u.canonicalStr = u.unitStr;
+    return u;
+  }
+
+  string prefix, suffix;
+  if (isSuffix(u.unitStr)) {
+    suffix = u.unitStr;
+  } else {
+    // The longest matching SI prefix wins
+    long longest = -1;
+    for (const UnitEntry *e = siPrefixes + 1; e->name != NULL; e++) {
+      long len = (long)strlen(e->name);
+      if (len > longest && u.unitStr.compare(0, len, e->name) == 0) {
+	prefix = e->name;
+	suffix = u.unitStr.substr(len);
+	longest = len;
+      }
+    }
+    if (longest == -1 || !isSuffix(suffix)) {
+      throw WconNativeError(invalidUnit(u.unitStr));
+    }
+  }
+
+  // Abbreviated and full versions must not be mixed
+  size_t plen = codePoints(prefix);
+  size_t slen = codePoints(suffix);
+  if (slen > 3) {
+    if (plen > 0 && plen <= 3 && prefix != "day") {
+      throw WconNativeError("Error with '" + u.unitStr + "': suffix is a "
+			    "full word but prefix is not.");
+    }
+  } else if (plen > 3 || prefix == "day") {
+    throw WconNativeError("Error with '" + u.unitStr + "': suffix is an "
+			  "abbreviation but prefix is the full word.");
+  }
+
+  string canonicalPrefix;
+  const UnitEntry *entry;
+  const TemperatureEntry *temperature;
+  if ((entry = findEntry(temporalUnits, suffix)) != NULL) {
+    u.canonicalStr = "s";
+    u.factor = entry->value;
+  } else if ((entry = findEntry(spatialUnits, suffix)) != NULL) {
+    canonicalPrefix = "m";
+    u.canonicalStr = "mm";
+    u.factor = entry->value;
+  } else if ((entry = findEntry(angularUnits, suffix)) != NULL) {
+    u.canonicalStr = "r";
+    u.factor = entry->value;
+  } else if ((temperature = findTemperature(suffix)) != NULL) {
+    u.canonicalStr = "C";
+    u.temperature = temperature->kind;
+  } else {
+    entry = findEntry(dimensionlessUnits, suffix);
+    u.canonicalStr = "";
+    u.factor = entry->value;
+  }
+  u.prefixFactor = findEntry(siPrefixes, prefix)->value /
+    findEntry(siPrefixes, canonicalPrefix)->value;
+  return u;
+}
+
+shared_ptr<const NativeMeasurementUnit>
+NativeMeasurementUnit::create(const string &unitStr) {
+  shared_ptr<NativeMeasurementUnit> result;
+  if (unitStr.empty() || unitStr[0] == '@') {
+    result.reset(new NativeMeasurementUnit(NativeUnitParser::atom(unitStr)));
+  } else if (unitStr.find('@') != string::npos) {
+    throw WconNativeError(invalidUnit(unitStr));
+  } else {
+    string expr = replaceAll(unitStr, "%", "percent");
+    expr = replaceAll(expr, "^", "**");
+    NativeUnitParser parser(expr);
+    result.reset(new NativeMeasurementUnit(parser.parse()));
+    result->canonicalStr = replaceAll(result->canonicalStr, "1*", "");
+    if (result->canonicalStr == "1" || result->canonicalStr == "1.0") {
+      result->canonicalStr = "";
+    }
+  }
+  result->unitStr = replaceAll(result->unitStr, "**", "^");
+  result->canonicalStr = replaceAll(result->canonicalStr, "**", "^");
+  return result;
+}
+
+double NativeMeasurementUnit::toCanon(double x) const {
+  if (temperature != TEMPERATURE_NONE) {
+    return celsiusToCanon(temperature, x) * prefixFactor;
+  }
+  return (x * factor) * prefixFactor;
+}
+
+double NativeMeasurementUnit::fromCanon(double x) const {
+  if (temperature != TEMPERATURE_NONE) {
+    return celsiusFromCanon(temperature, x) / prefixFactor;
+  }
+  return (x / factor) / prefixFactor;
+}
+
+shared_ptr<const NativeMeasurementUnit>
+NativeMeasurementUnit::canonicalUnit() const {
+  return create(canonicalStr);
+}
+
+bool NativeMeasurementUnit::operator==(const NativeMeasurementUnit &other)
+  const {
+  return toCanon(10) == other.toCanon(10) &&
+    toCanon(100) == other.toCanon(100);
+}
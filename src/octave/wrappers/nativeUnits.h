@@ -0,0 +1,70 @@
+#ifndef __NATIVE_UNITS_H_
+#define __NATIVE_UNITS_H_
+// Native port of wcon.MeasurementUnit (src/Python/wcon/measurement_unit.py)
+//   for the Python-free build of the wrapper library.
+//
+// Unit expressions are parsed with the same grammar, tables and string
+//   manipulations as the Python version, so conversions and canonical
+//   unit strings come out identical to it, quirks included (for example
+//   the canonical form of 'mm^2' is 'mm^1', because numbers have the
+//   canonical unit '1').
+#include <memory>
+#include <stdexcept>
+#include <string>
+
+// Everything the native backend rejects (bad units, invalid files,
+//   conflicting data) is reported with this exception, and turned into
+//   FAILED at the C API boundary.
+class WconNativeError : public std::runtime_error {
+ public:
+  explicit WconNativeError(const std::string &msg)
+    : std::runtime_error(msg) {}
+};
+
+class NativeMeasurementUnit {
+ public:
+  // MeasurementUnit.create. Throws WconNativeError on invalid input.
+  static std::shared_ptr<const NativeMeasurementUnit>
+    create(const std::string &unitStr);
+
+  double toCanon(double x) const;
+  double fromCanon(double x) const;
+
+  // As the Python properties, with '**' written as '^'
+  const std::string &unitString() const { return unitStr; }
+  const std::string &canonicalUnitString() const { return canonicalStr; }
+  bool isCanonical() const { return unitStr == canonicalStr; }
+
+  // MeasurementUnit.canonical_unit
+  std::shared_ptr<const NativeMeasurementUnit> canonicalUnit() const;
+
+  // MeasurementUnit.__eq__: same result for to_canon(10) and
+  //   to_canon(100).
+  bool operator==(const NativeMeasurementUnit &other) const;
+  bool operator!=(const NativeMeasurementUnit &other) const {
+    return !(*this == other);
+  }
+
+  enum Temperature {
+    TEMPERATURE_NONE,
+    TEMPERATURE_CELSIUS,
+    TEMPERATURE_FAHRENHEIT,
+    TEMPERATURE_KELVIN
+  };
+
+ private:
+  NativeMeasurementUnit();
+
+  std::string unitStr;
+  std::string canonicalStr;
+  // to_canon(x) is (x*factor)*prefixFactor, with the temperature
+  //   conversion in place of the multiplication by factor for
+  //   temperature atoms.
+  double factor;
+  double prefixFactor;
+  Temperature temperature;
+
+  friend class NativeUnitParser;
+};
+
+#endif /* __NATIVE_UNITS_H_ */
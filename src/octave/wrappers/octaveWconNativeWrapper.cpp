@@ -0,0 +1,82 @@
+#include "octaveWconPythonWrapper.h"
+
+#include <iostream>
+#include <stdlib.h> // for srand and rand
+using namespace std;
+
+#include "nativeInternal.h"
+#include "wrapperStats.h"
+
+// Support methods of the native backend. There is no interpreter to
+//   start, so initialization only seeds the handle generator, the same
+//   way the Python backend does.
+extern "C" void wconOct_initWrapper(WconOctError *err) {
+  static bool isInitialized = false;
+
+  nativeInternalCheckErrorVariable(err);
+  if (!isInitialized) {
+    // Recorded once, as with the Python backend
+    WconOctStatScope stat(WCONOCT_STAT_INIT_WRAPPER, err);
+    srand(1337);
+    isInitialized = true;
+  }
+
+  *err = SUCCESS;
+  return;
+}
+
+extern "C" int wconOct_isNullHandle(WconOctHandle handle) {
+  WconOctStatScope stat(WCONOCT_STAT_IS_NULL_HANDLE, NULL, true);
+  if (handle == WCONOCT_NULL_HANDLE) {
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+extern "C" WconOctHandle wconOct_makeNullHandle() {
+  WconOctStatScope stat(WCONOCT_STAT_MAKE_NULL_HANDLE, NULL, true);
+  return WCONOCT_NULL_HANDLE;
+}
+
+extern "C" int wconOct_isNoneHandle(WconOctHandle handle) {
+  WconOctStatScope stat(WCONOCT_STAT_IS_NONE_HANDLE, NULL, true);
+  if (handle == WCONOCT_NONE_HANDLE) {
+    return 1;
+  } else {
+    return 0;
+  }
+}
+
+extern "C" void wconOct_freeString(char *str) {
+  WconOctStatScope stat(WCONOCT_STAT_FREE_STRING, NULL, true);
+  delete [] str;
+}
+
+extern "C" void wconOct_freeUnitsDict(WconOctUnitsDict *dictionary) {
+  WconOctStatScope stat(WCONOCT_STAT_FREE_UNITS_DICT, NULL, true);
+  if (dictionary == NULL) {
+    return;
+  }
+  for (int i=0; i<dictionary->numElements; i++) {
+    delete [] dictionary->unitsDict[i].key;
+  }
+  delete [] dictionary->unitsDict;
+  delete dictionary;
+}
+
+extern "C" void wconOct_releaseHandle(WconOctError *err,
+				      WconOctHandle handle) {
+  WconOctStatScope stat(WCONOCT_STAT_RELEASE_HANDLE, err);
+  wconOct_initWrapper(err);
+  if (*err == FAILED) {
+    cerr << "ERROR: Failed to initialize wrapper library." << endl;
+    return;
+  }
+  if (!nativeInternalReleaseObject(handle)) {
+    cerr << "ERROR: No live object with handle " << handle << endl;
+    *err = FAILED;
+    return;
+  }
+  *err = SUCCESS;
+}
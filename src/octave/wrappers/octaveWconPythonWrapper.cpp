@@ -8,10 +8,234 @@ using namespace std;
 
 // Included here because we need declarations from Python.h
 #include "wrapperInternal.h"
+#include "wrapperStats.h"
 
 PyObject *wrapperGlobalModule=NULL;
 PyObject *wrapperGlobalWCONWormsClassObj=NULL;
 PyObject *wrapperGlobalMeasurementUnitClassObj=NULL;
+PyObject *wrapperGlobalJsonDumpsFunc=NULL;
+PyObject *wrapperGlobalSizeofFunc=NULL;
+PyObject *wrapperGlobalSplitChunkFunc=NULL;
+PyObject *wrapperGlobalResampleFunc=NULL;
+PyObject *wrapperGlobalWithFeaturesFunc=NULL;
+PyObject *wrapperGlobalLoadTextFunc=NULL;
+
+// Approximate bytes an object keeps alive, for the memory report:
+//   DataFrames and numpy arrays report their buffers, containers and
+//   plain objects are followed a few levels down.
+static const char *wrapperSizeofSource =
+  "import sys\n"
+  "def wconoct_sizeof(obj, depth=0):\n"
+  "    if hasattr(obj, 'memory_usage'):\n"
+  "        return int(obj.memory_usage(deep=True).sum())\n"
+  "    if hasattr(obj, 'nbytes'):\n"
+  "        return int(obj.nbytes)\n"
+  "    n = sys.getsizeof(obj)\n"
+  "    if depth > 4:\n"
+  "        return n\n"
+  "    if isinstance(obj, dict):\n"
+  "        return n + sum(wconoct_sizeof(k, depth+1) +\n"
+  "                       wconoct_sizeof(v, depth+1)\n"
+  "                       for k, v in obj.items())\n"
+  "    if isinstance(obj, (list, tuple)):\n"
+  "        return n + sum(wconoct_sizeof(v, depth+1) for v in obj)\n"
+  "    if hasattr(obj, '__dict__'):\n"
+  "        return n + wconoct_sizeof(vars(obj), depth+1)\n"
+  "    return n\n";
+
+// Writes the frames of w with t0 <= t < t1 as one chunk of
+//   wconOct_WCONWorms_split, with its "files" links, the way save_to_file
+//   would write them.
+static const char *wrapperSplitSource =
+  "import json, os, zipfile\n"
+  "from collections import OrderedDict\n"
+  "def wconoct_split_chunk(w, t0, t1, path, current, prev, next,\n"
+  "                        compressed):\n"
+  "    chunk = type(w)()\n"
+  "    chunk.units = w.units\n"
+  "    chunk.metadata = w.metadata\n"
+  "    chunk._data = OrderedDict()\n"
+  "    for worm_id, df in w.data_as_odict.items():\n"
+  "        rows = df[(df.index >= t0) & (df.index < t1)]\n"
+  "        if len(rows) > 0:\n"
+  "            chunk._data[worm_id] = rows\n"
+  "    od = chunk.as_ordered_dict\n"
+  "    od['files'] = OrderedDict([('current', current),\n"
+  "                               ('prev', [prev] if prev else []),\n"
+  "                               ('next', [next] if next else [])])\n"
+  "    with open(path, 'w') as outfile:\n"
+  "        json.dump(od, outfile)\n"
+  "    if compressed:\n"
+  "        zf = zipfile.ZipFile(path + '.TEMP', 'w', zipfile.ZIP_DEFLATED)\n"
+  "        zf.write(path)\n"
+  "        zf.close()\n"
+  "        os.rename(path + '.TEMP', path)\n";
+
+// wconOct_WCONWorms_resample on the DataFrames of data_as_odict, to the
+//   same rules as nativeResample: method is a WconOctInterpolation.
+static const char *wrapperResampleSource =
+  "import numpy as np, pandas as pd\n"
+  "from collections import OrderedDict\n"
+  "def wconoct_resample_cubic(w, key, method):\n"
+  "    if method != 0:\n"
+  "        return method == 2\n"
+  "    md = w.metadata if isinstance(w.metadata, dict) else {}\n"
+  "    entries = md.get('interpolate', [])\n"
+  "    if not isinstance(entries, list):\n"
+  "        entries = [entries]\n"
+  "    for e in entries:\n"
+  "        m = e.get('method') if isinstance(e, dict) else None\n"
+  "        v = e.get('values') if isinstance(e, dict) else None\n"
+  "        if isinstance(m, str) and (v is None or v == key or\n"
+  "                                   (isinstance(v, list) and key in v)):\n"
+  "            return 'cubic' in m.lower() or 'spline' in m.lower()\n"
+  "    return False\n"
+  "def wconoct_resample_targets(t, dt, times):\n"
+  "    if dt > 0:\n"
+  "        k = np.arange(np.ceil(t[0] / dt - 1e-9),\n"
+  "                      np.floor(t[-1] / dt + 1e-9) + 1)\n"
+  "        return k * dt + 0.0\n"
+  "    slack = (t[-1] - t[0]) * 1e-9\n"
+  "    return times[(times >= t[0] - slack) & (times <= t[-1] + slack)]\n"
+  "def wconoct_resample_worm(df, dt, times, cubic, max_gap):\n"
+  "    df = df[~np.isnan(df.index.values.astype(float))]\n"
+  "    t = df.index.values.astype(float)\n"
+  "    T = wconoct_resample_targets(t, dt, times)\n"
+  "    if len(t) < 2:\n"
+  "        i = np.zeros(len(T), dtype=int)\n"
+  "        src, copy, keep = i, np.ones(len(T), dtype=bool), T == T\n"
+  "        h = u = np.ones(len(T))\n"
+  "        gap = np.ones(1, dtype=bool)\n"
+  "    else:\n"
+  "        gap = np.append((max_gap > 0) & (np.diff(t) > max_gap), True)\n"
+  "        i = np.clip(np.searchsorted(t, T, 'right') - 1, 0, len(t) - 2)\n"
+  "        h = t[i + 1] - t[i]\n"
+  "        at0 = T - t[i] <= h * 1e-9\n"
+  "        at1 = t[i + 1] - T <= h * 1e-9\n"
+  "        copy = at0 | at1\n"
+  "        nearer = np.where(T - t[i] <= t[i + 1] - T, i, i + 1)\n"
+  "        src = np.where(at0, i, np.where(at1, i + 1, nearer))\n"
+  "        keep = copy | ~gap[i]\n"
+  "        u = (T - t[i]) / h\n"
+  "    i, src, copy = i[keep], src[keep], copy[keep]\n"
+  "    h, u, T = h[keep], u[keep], T[keep]\n"
+  "    j = np.minimum(i + 1, len(t) - 1)\n"
+  "    def interp(v, is_cubic):\n"
+  "        v0, v1 = v[i], v[j]\n"
+  "        if not is_cubic:\n"
+  "            out = v0 + (v1 - v0) * u\n"
+  "        else:\n"
+  "            secant = (v1 - v0) / h\n"
+  "            ip = np.maximum(i - 1, 0)\n"
+  "            jn = np.minimum(i + 2, len(t) - 1)\n"
+  "            ok0 = (i > 0) & ~gap[ip] & ~np.isnan(v[ip])\n"
+  "            ok1 = (i + 2 < len(t)) & ~gap[j] & ~np.isnan(v[jn])\n"
+  "            with np.errstate(invalid='ignore', divide='ignore'):\n"
+  "                m0 = np.where(ok0, (v1 - v[ip]) / (t[j] - t[ip]),\n"
+  "                              secant)\n"
+  "                m1 = np.where(ok1, (v[jn] - v0) / (t[jn] - t[i]),\n"
+  "                              secant)\n"
+  "            u2, u3 = u * u, u * u * u\n"
+  "            out = ((2*u3 - 3*u2 + 1) * v0 + (u3 - 2*u2 + u) * h * m0 +\n"
+  "                   (-2*u3 + 3*u2) * v1 + (u3 - u2) * h * m1)\n"
+  "        return np.where(copy, v[src], out)\n"
+  "    columns = OrderedDict()\n"
+  "    for col in df.columns:\n"
+  "        v = df[col].values\n"
+  "        key = col[1]\n"
+  "        if key == 'aspect_size':\n"
+  "            s = np.nan_to_num(v.astype(float))\n"
+  "            columns[col] = np.where(copy, v[src],\n"
+  "                                    np.minimum(s[i], s[j]))\n"
+  "        elif key in cubic and v.dtype.kind in 'fi':\n"
+  "            columns[col] = interp(v.astype(float), cubic[key])\n"
+  "        else:\n"
+  "            columns[col] = v[src]\n"
+  "    out = pd.DataFrame(columns, index=pd.Index(T, name=df.index.name),\n"
+  "                       columns=df.columns)\n"
+  "    sizes = [c for c in df.columns if c[1] == 'aspect_size']\n"
+  "    if sizes:\n"
+  "        size = out[sizes[0]].values\n"
+  "        for col in df.columns:\n"
+  "            if col[1] in ('x', 'y'):\n"
+  "                out.loc[~copy & ~(col[2] < size), col] = np.nan\n"
+  "    return out\n"
+  "def wconoct_resample(w, dt, times, method, max_gap):\n"
+  "    times = np.unique(np.array(times, dtype=float))\n"
+  "    cubic = dict((k, wconoct_resample_cubic(w, k, method))\n"
+  "                 for k in ('x', 'y', 'cx', 'cy', 'ox', 'oy'))\n"
+  "    result = type(w)()\n"
+  "    result.units = w.units\n"
+  "    metadata = OrderedDict()\n"
+  "    if isinstance(w.metadata, dict):\n"
+  "        metadata.update(w.metadata)\n"
+  "    entries = []\n"
+  "    for name, is_cubic in (('linear', False), ('cubic', True)):\n"
+  "        values = [k for k in ('x', 'y', 'cx', 'cy')\n"
+  "                  if cubic[k] == is_cubic]\n"
+  "        if values:\n"
+  "            entries.append(OrderedDict([('method', name),\n"
+  "                                        ('values', values)]))\n"
+  "    metadata['interpolate'] = entries\n"
+  "    result.metadata = metadata\n"
+  "    result._data = OrderedDict()\n"
+  "    for worm_id, df in w.data_as_odict.items():\n"
+  "        rows = wconoct_resample_worm(df, dt, times, cubic, max_gap)\n"
+  "        if len(rows) > 0:\n"
+  "            result._data[worm_id] = rows\n"
+  "    return result\n";
+
+// WCONWorms.load of text decompressed by wconCodec (gzip or zstd), which
+//   load_from_file cannot read. A stream has no name to resolve "files"
+//   links against, so they are not followed.
+static const char *wrapperLoadTextSource =
+  "import io\n"
+  "def wconoct_load_text(cls, text):\n"
+  "    return cls.load(io.StringIO(text))\n";
+
+// wconOct_WCONWorms_features for the Python backend: a copy of w with
+//   the feature columns added, of a subclass that writes them out as
+//   custom keys, which WCONWorms.as_ordered_dict leaves out.
+static const char *wrapperFeaturesSource =
+  "from collections import OrderedDict\n"
+  "wconoct_feature_classes = {}\n"
+  "def wconoct_feature_class(base):\n"
+  "    if getattr(base, 'wconoct_features', False):\n"
+  "        return base\n"
+  "    if base not in wconoct_feature_classes:\n"
+  "        class WCONWormsWithFeatures(base):\n"
+  "            wconoct_features = True\n"
+  "            @property\n"
+  "            def as_ordered_dict(self):\n"
+  "                od = base.as_ordered_dict.fget(self)\n"
+  "                canon = self.to_canon\n"
+  "                for record in od['data']:\n"
+  "                    df = canon._data[record['id']]\n"
+  "                    rows = df.loc[record['t']]\n"
+  "                    for key in OrderedDict.fromkeys(\n"
+  "                            df.columns.get_level_values('key')):\n"
+  "                        if str(key).startswith('@'):\n"
+  "                            column = rows.loc[:, (record['id'], key, 0)]\n"
+  "                            record[key] = [float(v) for v in column]\n"
+  "                return od\n"
+  "        wconoct_feature_classes[base] = WCONWormsWithFeatures\n"
+  "    return wconoct_feature_classes[base]\n"
+  "def wconoct_with_features(w, names, units, columns):\n"
+  "    from wcon import MeasurementUnit\n"
+  "    result = wconoct_feature_class(type(w))()\n"
+  "    result.units = OrderedDict((k, u) for k, u in w.units.items()\n"
+  "                               if k not in names)\n"
+  "    for name, unit in zip(names, units):\n"
+  "        result.units[name] = MeasurementUnit.create(unit)\n"
+  "    result.metadata = w.metadata\n"
+  "    result._data = OrderedDict()\n"
+  "    for worm_id, worm_columns in zip(w.worm_ids, columns):\n"
+  "        df = w.data_as_odict[worm_id]\n"
+  "        df = df.drop(columns=[c for c in df.columns if c[1] in names])\n"
+  "        for name, values in zip(names, worm_columns):\n"
+  "            df[(worm_id, name, 0)] = values\n"
+  "        result._data[worm_id] = df\n"
+  "    return result\n";
 
 // Am exposing this as a wrapper interface method
 //   because it is conceivable a user or some 
@@ -29,13 +253,19 @@ extern "C" void wconOct_initWrapper(WconOctError *err) {
   //     an initialized runtime, like isNullHandle.
   wrapInternalCheckErrorVariable(err);
   if (!isInitialized) {
+    // Only the call that starts the interpreter is recorded, all of it
+    //   as Python time
+    WconOctStatScope stat(WCONOCT_STAT_INIT_WRAPPER, err);
+    WconOctPythonTimer pythonTime;
     cout << "Initializing Embedded Python Interpreter" << endl;
     // initializing random number generator
     srand(1337);
     Py_Initialize();
     PyRun_SimpleString("import sys; sys.path.append('../../Python')\n");
     
-    wrapperGlobalModule = PyImport_Import(PyUnicode_FromString("wcon"));
+    PyObject *pModuleName = PyUnicode_FromString("wcon");
+    wrapperGlobalModule = PyImport_Import(pModuleName);
+    Py_XDECREF(pModuleName);
     pErr = PyErr_Occurred();
     if (pErr != NULL) {
       PyErr_Print();
@@ -66,6 +296,70 @@ extern "C" void wconOct_initWrapper(WconOctError *err) {
       *err = FAILED;
       return;
     }
+
+    // json.dumps is how we hand nested dicts (metadata) across
+    //   to the front ends.
+    PyObject *jsonModule = PyImport_ImportModule("json");
+    if (jsonModule != NULL) {
+      wrapperGlobalJsonDumpsFunc = 
+	PyObject_GetAttrString(jsonModule,"dumps");
+      Py_DECREF(jsonModule);
+    }
+    pErr = PyErr_Occurred();
+    if (pErr != NULL) {
+      PyErr_Print();
+      Py_XDECREF(wrapperGlobalModule);
+      Py_XDECREF(wrapperGlobalWCONWormsClassObj);
+      Py_XDECREF(wrapperGlobalMeasurementUnitClassObj);
+      Py_XDECREF(wrapperGlobalJsonDumpsFunc);
+      *err = FAILED;
+      return;
+    }
+    // Helpers written in Python. Without them handles are charged
+    //   nothing and split, resample, features and compressed loads
+    //   fail, which is no reason to fail here.
+    PyObject *helperGlobals = PyDict_New();
+    if (helperGlobals != NULL) {
+      PyDict_SetItemString(helperGlobals, "__builtins__",
+			   PyEval_GetBuiltins());
+      PyObject *pResult = PyRun_String(wrapperSizeofSource, Py_file_input,
+				       helperGlobals, helperGlobals);
+      Py_XDECREF(pResult);
+      wrapperGlobalSizeofFunc =
+	PyDict_GetItemString(helperGlobals, "wconoct_sizeof");
+      Py_XINCREF(wrapperGlobalSizeofFunc);
+      pResult = PyRun_String(wrapperSplitSource, Py_file_input,
+			     helperGlobals, helperGlobals);
+      Py_XDECREF(pResult);
+      wrapperGlobalSplitChunkFunc =
+	PyDict_GetItemString(helperGlobals, "wconoct_split_chunk");
+      Py_XINCREF(wrapperGlobalSplitChunkFunc);
+      pResult = PyRun_String(wrapperResampleSource, Py_file_input,
+			     helperGlobals, helperGlobals);
+      Py_XDECREF(pResult);
+      wrapperGlobalResampleFunc =
+	PyDict_GetItemString(helperGlobals, "wconoct_resample");
+      Py_XINCREF(wrapperGlobalResampleFunc);
+      pResult = PyRun_String(wrapperFeaturesSource, Py_file_input,
+			     helperGlobals, helperGlobals);
+      Py_XDECREF(pResult);
+      wrapperGlobalWithFeaturesFunc =
+	PyDict_GetItemString(helperGlobals, "wconoct_with_features");
+      Py_XINCREF(wrapperGlobalWithFeaturesFunc);
+      pResult = PyRun_String(wrapperLoadTextSource, Py_file_input,
+			     helperGlobals, helperGlobals);
+      Py_XDECREF(pResult);
+      wrapperGlobalLoadTextFunc =
+	PyDict_GetItemString(helperGlobals, "wconoct_load_text");
+      Py_XINCREF(wrapperGlobalLoadTextFunc);
+      Py_DECREF(helperGlobals);
+    }
+    if (PyErr_Occurred() != NULL) {
+      PyErr_Print();
+    }
+    // Let go of the GIL that Py_Initialize took, so that the async
+    //   workers can get it; entry points take it as they need it.
+    PyEval_SaveThread();
     isInitialized = true;
   }
 
@@ -74,6 +368,7 @@ extern "C" void wconOct_initWrapper(WconOctError *err) {
 }
 
 extern "C" int wconOct_isNullHandle(WconOctHandle handle) {
+  WconOctStatScope stat(WCONOCT_STAT_IS_NULL_HANDLE, NULL, true);
   if (handle == WCONOCT_NULL_HANDLE) {
     return 1;
   } else {
@@ -82,10 +377,12 @@ extern "C" int wconOct_isNullHandle(WconOctHandle handle) {
 }
 
 extern "C" WconOctHandle wconOct_makeNullHandle() {
+  WconOctStatScope stat(WCONOCT_STAT_MAKE_NULL_HANDLE, NULL, true);
   return WCONOCT_NULL_HANDLE;
 }
 
 extern "C" int wconOct_isNoneHandle(WconOctHandle handle) {
+  WconOctStatScope stat(WCONOCT_STAT_IS_NONE_HANDLE, NULL, true);
   if (handle == WCONOCT_NONE_HANDLE) {
     return 1;
   } else {
@@ -93,3 +390,37 @@ extern "C" int wconOct_isNoneHandle(WconOctHandle handle) {
   }
 }
 
+
+extern "C" void wconOct_freeString(char *str) {
+  WconOctStatScope stat(WCONOCT_STAT_FREE_STRING, NULL, true);
+  delete [] str;
+}
+
+extern "C" void wconOct_freeUnitsDict(WconOctUnitsDict *dictionary) {
+  WconOctStatScope stat(WCONOCT_STAT_FREE_UNITS_DICT, NULL, true);
+  if (dictionary == NULL) {
+    return;
+  }
+  for (int i=0; i<dictionary->numElements; i++) {
+    delete [] dictionary->unitsDict[i].key;
+  }
+  delete [] dictionary->unitsDict;
+  delete dictionary;
+}
+
+extern "C" void wconOct_releaseHandle(WconOctError *err,
+				      WconOctHandle handle) {
+  WconOctStatScope stat(WCONOCT_STAT_RELEASE_HANDLE, err);
+  wconOct_initWrapper(err);
+  if (*err == FAILED) {
+    cerr << "ERROR: Failed to initialize wrapper library." << endl;
+    return;
+  }
+  WrapInternalGIL gil;
+  if (!wrapInternalReleaseReference(handle)) {
+    cerr << "ERROR: No live object with handle " << handle << endl;
+    *err = FAILED;
+    return;
+  }
+  *err = SUCCESS;
+}
@@ -1,6 +1,8 @@
 #ifndef __OCTAVE_WCON_PYTHON_WRAPPER_H_
 #define __OCTAVE_WCON_PYTHON_WRAPPER_H_
 
+#include <stddef.h>
+
 #include "wrapperTypes.h"
 
 #ifdef __cplusplus
@@ -12,18 +14,66 @@ void wconOct_initWrapper(WconOctError *err);
 int wconOct_isNullHandle(WconOctHandle handle);
 WconOctHandle wconOct_makeNullHandle();
 int wconOct_isNoneHandle(WconOctHandle handle);
+void wconOct_freeString(char *str);
+void wconOct_freeUnitsDict(WconOctUnitsDict *dictionary);
+void wconOct_freeWormData(WconOctWormData *wormData);
 
 /* WCONWorms */
+/* A file loaded before, and unchanged since (same inode, size and
+   mtime), comes from the load cache (wconOct_setLoadCache): the new
+   handle shares the dataset with the others on it. */
 WconOctHandle wconOct_static_WCONWorms_load_from_file(WconOctError *err,
 						     const char *wconpath);
+/* Loads n files in one call, in parallel where the backend can. out[i]
+   and per_file_err[i] are what load_from_file would have given for
+   paths[i]; a failure does not stop the rest, but leaves *err FAILED.
+   Datasets loaded together share their MeasurementUnit objects, but
+   for those from the load cache, which are left as they are. */
+void wconOct_load_many(WconOctError *err, const char **paths, size_t n,
+		       WconOctHandle *out, WconOctError *per_file_err);
+/* Loads a file out of core, for recordings larger than memory: the
+   numeric columns go to a page file on local disk and are read back a
+   page at a time through a cache under a budget (wconOct_setPageCache),
+   so the handle itself holds little more than ids, units and metadata.
+   worm_data, worm_frames, points, cursors and save read it like any
+   other; eq, the time-major cursor and operations that make a new
+   dataset from it (add, resample, features, compact, materialize) read
+   it all into memory first. The
+   records of a worm must not overlap in time, within a file or across
+   its chunks, and chunks must share their units. Native backend only. */
+WconOctHandle wconOct_static_WCONWorms_load_paged(WconOctError *err,
+						  const char *wconpath);
+/* Files are loaded from plain WCON text, zip archives, or gzip or zstd
+   compressed text (.wcon.gz, .wcon.zst), told apart by their first
+   bytes. Compressed output is a zip archive, or gzip or zstd for a
+   path ending in .gz or .zst. save_compressed also takes the
+   compression level (-1 for the default of the codec) and the number
+   of threads compressing the output in blocks (0 for one per core, up
+   to 8); for zip archives it is save_to_file. zstd needs a library
+   built with WCONOCT_HAVE_ZSTD. */
 void wconOct_WCONWorms_save_to_file(WconOctError *err,
 				    const WconOctHandle selfHandle,
 				    const char *output_path,
 				    int pretty_print,
 				    int compressed);
+void wconOct_WCONWorms_save_compressed(WconOctError *err,
+				       const WconOctHandle selfHandle,
+				       const char *output_path,
+				       int pretty_print,
+				       int level, int numThreads);
 
+/* The dataset in canonical units. The native backend returns a view
+   that shares the data of selfHandle and converts each column as it
+   is read (worm_data, points, cursors), saved or compared, so it costs
+   next to no memory; everything else that makes a new dataset from it
+   converts it first. */
 WconOctHandle wconOct_WCONWorms_to_canon(WconOctError *err,
 					const WconOctHandle selfHandle);
+/* A WCONWorms that holds its own data: a to_canon view converted, a
+   compact handle decoded. Any other handle comes back as a new handle
+   on the same data, as does every handle of the Python backend. */
+WconOctHandle wconOct_WCONWorms_materialize(WconOctError *err,
+					    const WconOctHandle selfHandle);
 WconOctHandle wconOct_WCONWorms_add(WconOctError *err,
 					      const WconOctHandle selfHandle,
 					      const WconOctHandle handle);
@@ -42,6 +92,246 @@ WconOctHandle wconOct_WCONWorms_worm_ids(WconOctError *err,
 					const WconOctHandle selfHandle);
 WconOctHandle wconOct_WCONWorms_data_as_odict(WconOctError *err,
 					     const WconOctHandle selfHandle);
+/* Metadata as JSON text, or NULL (with SUCCESS) if there is none.
+   Release with wconOct_freeString. */
+char *wconOct_WCONWorms_metadata_json(WconOctError *err,
+				      const WconOctHandle selfHandle);
+/* Numeric data of the worm at position wormIndex in worm_ids.
+   Release with wconOct_freeWormData. */
+WconOctWormData *wconOct_WCONWorms_worm_data(WconOctError *err,
+					     const WconOctHandle selfHandle,
+					     long wormIndex);
+/* Number of frames of the worm at position wormIndex in worm_ids */
+long wconOct_WCONWorms_num_frames(WconOctError *err,
+				  const WconOctHandle selfHandle,
+				  long wormIndex);
+/* worm_data for frames firstFrame to firstFrame + numFrames - 1 only,
+   which must be frames of the worm; row 0 of each view is frame
+   firstFrame. For reading a long worm a window at a time. */
+WconOctWormData *wconOct_WCONWorms_worm_frames(WconOctError *err,
+					       const WconOctHandle selfHandle,
+					       long wormIndex,
+					       long firstFrame,
+					       long numFrames);
+
+/* A new WCONWorms with its spine points stored compactly: as float32,
+   or with WCONOCT_COMPACT_QUANTIZED as multiples of quantum (in
+   canonical units, e.g. 0.001 for 1 um) relative to the first point of
+   each frame, delta encoded along the spine in 1, 2 or 4 bytes. Points
+   are decoded on the fly, so the handle works as any other; operations
+   that make a new dataset from it give an ordinary one. The sizes
+   before and after and the error bounds, in canonical units, go to
+   *info unless it is NULL. Native backend only. */
+WconOctHandle wconOct_WCONWorms_compact(WconOctError *err,
+					const WconOctHandle selfHandle,
+					WconOctCompactMode mode,
+					double quantum,
+					WconOctCompactInfo *info);
+/* Spine points of frames firstFrame to firstFrame + numFrames - 1 of
+   the worm at position wormIndex in worm_ids, decoded into x and y row
+   major, one row of as many points as the longest spine of the worm
+   per frame, NaN padded. Returns that number of points; with x and y
+   NULL nothing is written. */
+long wconOct_WCONWorms_points(WconOctError *err,
+			      const WconOctHandle selfHandle,
+			      long wormIndex, long firstFrame, long numFrames,
+			      double *x, double *y);
+
+/* Writes a WCONWorms out as chunks, outputBase_0.wcon,
+   outputBase_1.wcon... (.wcon.zip with compressed), linked through
+   "files" so that loading the first loads them all. A chunk ends before
+   the first frame that would make it span more than chunkSeconds, or
+   take more than about chunkBytes on disk; 0 is no limit. The native
+   backend writes the chunks in parallel ($WCONOCT_SPLIT_THREADS). Returns
+   the number of chunks written. */
+long wconOct_WCONWorms_split(WconOctError *err,
+			     const WconOctHandle selfHandle,
+			     const char *outputBase,
+			     double chunkSeconds,
+			     double chunkBytes,
+			     int compressed);
+
+/* A new WCONWorms with each worm resampled onto a common timebase:
+   the multiples of dt within the time span of the worm when dt > 0,
+   otherwise the times (numTimes of them) within it. Spines and
+   centroids are interpolated by method, and head and ventral taken
+   from the nearer frame; nothing is extrapolated. No frames come out
+   between two frames more than maxGap apart (0 for no limit). Times
+   are in the time units of the handle, and the units stay the same.
+   The native backend resamples worms in parallel
+   ($WCONOCT_RESAMPLE_THREADS). */
+WconOctHandle wconOct_WCONWorms_resample(WconOctError *err,
+					 const WconOctHandle selfHandle,
+					 double dt,
+					 const double *times, long numTimes,
+					 WconOctInterpolation method,
+					 double maxGap);
+
+/* Spines of the worm at position wormIndex in worm_ids, resampled to
+   numPoints (2 or more) points equally spaced along their arc length,
+   from the first point of the spine to the last. Point k of frame i goes to
+   x[i*rowStride + k*colStride] and y[...], so the caller picks the
+   layout (rowStride numPoints, colStride 1 for row major; rowStride 1,
+   colStride numFrames for column major), and the length of the spine
+   to length[i] unless length is NULL. Frames without points, or with a
+   NaN point, come out as NaN. Returns the number of frames; with x and
+   y NULL nothing is written, which tells the caller how much to
+   allocate. Long worms are done in parallel ($WCONOCT_SPINE_THREADS). */
+long wconOct_WCONWorms_spines(WconOctError *err,
+			      const WconOctHandle selfHandle,
+			      long wormIndex, long numPoints,
+			      double *x, double *y,
+			      long rowStride, long colStride,
+			      double *length);
+
+/* A new WCONWorms with locomotion features added to every worm as
+   custom data keys, one value per frame: @wconoct_speed,
+   @wconoct_path_length (distance travelled since the first frame),
+   @wconoct_angular_velocity (of the tail to head axis, signed),
+   @wconoct_curvature (mean absolute curvature along the spine) and
+   @wconoct_head_swing (bend between the head and the body, unsigned).
+   Positions are centroids where there are some, otherwise spine
+   midpoints, and the first point of a spine is taken as the head. The
+   features get units from those of x and t (mm/s, mm, rad/s, 1/mm, rad
+   for mm and s), and save_to_file writes them into each data record;
+   merge and resample leave them out. Worms are done in parallel
+   ($WCONOCT_FEATURE_THREADS). */
+WconOctHandle wconOct_WCONWorms_features(WconOctError *err,
+					 const WconOctHandle selfHandle);
+
+/* Cursor over the frames of a WCONWorms, worm by worm in worm_ids
+   order and by time within a worm, limited to one worm (or
+   WCONOCT_ALL_WORMS) and to t0 <= t <= t1 (use -INFINITY and INFINITY
+   for all). next returns 1 with *frame filled in, or 0 at the end;
+   it only allocates to move on to the next worm or window of 65536
+   frames. The handle must stay live until the cursor is closed. */
+WconOctCursor *wconOct_cursor_open(WconOctError *err,
+				   const WconOctHandle selfHandle,
+				   const char *wormId, double t0, double t1);
+int wconOct_cursor_next(WconOctError *err, WconOctCursor *cursor,
+			WconOctFrame *frame);
+void wconOct_cursor_close(WconOctCursor *cursor);
+
+/* Cursor over the time steps of a WCONWorms with t0 <= t <= t1, each
+   with every worm present at it (see WconOctTimeSlice). The first
+   cursor on a handle transposes its data into a time-major layout, in
+   parallel ($WCONOCT_TIME_MAJOR_THREADS), which is cached on the handle
+   until it is released and charged to it in the memory report; the
+   cursor keeps the layout alive, so the handle may be released first.
+   next returns 1 with *slice filled in, or 0 at the end; seek moves the
+   cursor to the first time step at or after t, so that seek then next
+   gives all worms at time t. */
+WconOctTimeCursor *wconOct_timecursor_open(WconOctError *err,
+					   const WconOctHandle selfHandle,
+					   double t0, double t1);
+void wconOct_timecursor_seek(WconOctError *err, WconOctTimeCursor *cursor,
+			     double t);
+int wconOct_timecursor_next(WconOctError *err, WconOctTimeCursor *cursor,
+			    WconOctTimeSlice *slice);
+void wconOct_timecursor_close(WconOctTimeCursor *cursor);
+
+/* Spatial index over the positions of every frame of a dataset (the
+   centroid, otherwise the midpoint of the spine), in a grid of square
+   cells cellSize across, one grid per bucketSeconds of time; 0 for
+   either picks a size from the data. The index holds a copy of the
+   positions, so the handle may be released afterwards. Queries return
+   the frames with t0 <= t <= t1 and the position
+   - range: within x0 <= x <= x1, y0 <= y <= y1
+   - radius: no further than radius from (x, y)
+   - nearest: the k nearest to (x, y), nearest first
+   range and radius hits are in worm_ids order, then by frame. Their
+   cost follows the number of frames near the query, not the size of the
+   dataset. Hits are released with wconOct_freeSpatialHits, before the
+   index is closed. */
+WconOctSpatialIndex *wconOct_spatial_open(WconOctError *err,
+					  const WconOctHandle selfHandle,
+					  double cellSize,
+					  double bucketSeconds);
+WconOctSpatialHits *wconOct_spatial_range(WconOctError *err,
+					  const WconOctSpatialIndex *index,
+					  double x0, double x1,
+					  double y0, double y1,
+					  double t0, double t1);
+WconOctSpatialHits *wconOct_spatial_radius(WconOctError *err,
+					   const WconOctSpatialIndex *index,
+					   double x, double y, double radius,
+					   double t0, double t1);
+WconOctSpatialHits *wconOct_spatial_nearest(WconOctError *err,
+					    const WconOctSpatialIndex *index,
+					    double x, double y, long k,
+					    double t0, double t1);
+void wconOct_freeSpatialHits(WconOctSpatialHits *hits);
+void wconOct_spatial_close(WconOctSpatialIndex *index);
+
+/* Streaming writer: frames are appended one at a time and written out
+   as data records as they fill up (64 frames of a worm, or 1024 frames
+   in all), so memory stays the same however long the recording.
+   units and metadata are JSON objects as in a WCON file; metadata may
+   be NULL. With maxChunkBytes > 0 the recording rolls over to a new
+   file before one would grow past it: path, then name_1.ext,
+   name_2.ext... next to it, linked through "files" so that loading
+   path loads them all. Frames of a worm should come in time order.
+   close writes out the rest and frees the writer; the files are only
+   complete after it. */
+WconOctWriter *wconOct_writer_open(WconOctError *err, const char *path,
+				   const char *unitsJson,
+				   const char *metadataJson,
+				   size_t maxChunkBytes);
+void wconOct_writer_append(WconOctError *err, WconOctWriter *writer,
+			   const char *wormId, double t,
+			   const double *x, const double *y, long n);
+void wconOct_writer_close(WconOctError *err, WconOctWriter *writer);
+
+/* Event-driven parse of a WCON file, plain or compressed, without
+   building a WCONWorms: callbacks get the units, metadata and custom
+   fields as they come, and each data record as recordBegin, one frame
+   call per frame in file order, then recordEnd. Records of a worm
+   split over several records come as they are; nothing is merged or
+   sorted. Chunks linked through "files" follow, as load does: the
+   chunks before path going back, then those after it going forward,
+   each announced through the file callback (by entry name inside a
+   multi-entry archive). Memory follows the largest data record, not
+   the size of the input. Returns the number of frames handed out. */
+long wconOct_parse_stream(WconOctError *err, const char *path,
+			  const WconOctParseCallbacks *callbacks,
+			  void *user);
+
+/* Inventory of a WCON file, plain or compressed, without loading it: the
+   units, metadata and "files" links, and counts of its data records,
+   worms and frames with their time range. Only the ids and times of
+   the records are read; the rest of the data is skipped over by
+   matching brackets, unchecked. Released with wconOct_freePeek. */
+WconOctPeek *wconOct_peek(WconOctError *err, const char *path);
+void wconOct_freePeek(WconOctPeek *peek);
+
+/* Catalog of the WCON files (.wcon, .wcon.zip, .wcon.gz, .wcon.zst)
+   under directory trees, for choosing files before loading any. open
+   reads the index at indexPath, if there is one yet; with indexPath
+   NULL the catalog lives in memory only. scan peeks, on numThreads
+   threads (0 for one per core up to 8), at the files under root that
+   are new or whose size or mtime changed, drops those that went away,
+   saves the index if anything changed and returns the number of files
+   peeked at. select returns the files, in path order, that match
+   every clause of a query joined by &&, each clause a field alone (it
+   exists) or
+     field op value, with op one of == != < <= > >= ~ (contains)
+   Fields are units.*, metadata.* and files.* as dotted paths into the
+   JSON of the file, and path, chain, chainIndex, numRecords, numWorms,
+   numFrames, tMin and tMax. A value compares as a number if both sides
+   are numbers and as text otherwise; "quoted" values are text, and
+   empty text must be quoted (""). A clause holds if any value of the
+   field satisfies it, looking into arrays. NULL or "" selects every
+   file that could be read. Hits are good until the next scan or close,
+   and are released with wconOct_freeCatalogHits. */
+WconOctCatalog *wconOct_catalog_open(WconOctError *err,
+				     const char *indexPath);
+long wconOct_catalog_scan(WconOctError *err, WconOctCatalog *catalog,
+			  const char *root, int numThreads);
+WconOctCatalogHits *wconOct_catalog_select(WconOctError *err,
+					   const WconOctCatalog *catalog,
+					   const char *query);
+void wconOct_freeCatalogHits(WconOctCatalogHits *hits);
+void wconOct_catalog_close(WconOctCatalog *catalog);
 
 /* MeasurementUnit */
 WconOctHandle wconOct_static_MeasurementUnit_create(WconOctError *err,
@@ -57,6 +347,65 @@ const char *wconOct_MeasurementUnit_unit_string(WconOctError *err,
 const char *wconOct_MeasurementUnit_canonical_unit_string(WconOctError *err,
 							  const WconOctHandle selfHandle);
 
+/* Asynchronous load and save, run on a pool of worker threads
+   ($WCONOCT_ASYNC_WORKERS, 2 by default). Each returns a future at
+   once; poll and wait report its state, and result waits for it to
+   finish, hands over the WCONWorms handle of a load (a NULL handle for
+   a save) and frees the future. Every future must be passed to result
+   eventually. cancel stops a future that has not started, and discards
+   the result of a running load; it returns 1 if it did either. A
+   handle must not be released while a save of it is pending. With the
+   Python backend the work is still serialized by the GIL, but the
+   caller is not held up. */
+WconOctFuture wconOct_load_async(WconOctError *err, const char *wconpath);
+WconOctFuture wconOct_save_async(WconOctError *err,
+				 const WconOctHandle selfHandle,
+				 const char *output_path,
+				 int pretty_print,
+				 int compressed);
+WconOctFutureState wconOct_future_poll(WconOctError *err,
+				       WconOctFuture future);
+/* Waits at most timeoutSeconds, or for good if it is negative */
+WconOctFutureState wconOct_future_wait(WconOctError *err,
+				       WconOctFuture future,
+				       double timeoutSeconds);
+int wconOct_future_cancel(WconOctError *err, WconOctFuture future);
+WconOctHandle wconOct_future_result(WconOctError *err, WconOctFuture future);
+
+/* Statistics: calls, errors and latencies of every API function since
+   the library was loaded or last reset. The snapshot is released with
+   wconOct_freeStats, the JSON text (with the full histograms) with
+   wconOct_freeString. */
+WconOctStats *wconOct_stats_snapshot(WconOctError *err);
+void wconOct_freeStats(WconOctStats *snapshot);
+char *wconOct_stats_snapshot_json(WconOctError *err);
+void wconOct_stats_reset(WconOctError *err);
+
+/* Memory: every live handle is charged the approximate bytes it keeps
+   alive. releaseHandle drops a handle for good; using it afterwards is
+   an error. The report lists the maxEntries largest handles and is
+   released with wconOct_freeMemoryReport. With a cap (in MB, 0 for
+   none; the default comes from $WCONOCT_MEMORY_CAP_MB) load_from_file,
+   to_canon and add fail once their result would take the total over
+   it. */
+void wconOct_releaseHandle(WconOctError *err, WconOctHandle handle);
+WconOctMemoryReport *wconOct_memoryReport(WconOctError *err,
+					  int maxEntries);
+void wconOct_freeMemoryReport(WconOctMemoryReport *report);
+void wconOct_setMemoryCap(WconOctError *err, double megabytes);
+/* Budget of the load cache in MB, 0 to turn it off (the default comes
+   from $WCONOCT_LOAD_CACHE_MB, else 256). It keeps the datasets that
+   load_from_file and load_many loaded, for later loads of the same
+   files, and is charged for them in place of the handles that share
+   them. The least recently used ones that no handle holds go once it
+   is over budget, or to make room under the memory cap. */
+void wconOct_setLoadCache(WconOctError *err, double megabytes);
+/* Budget of the cache of pages read back for load_paged datasets, in MB
+   (the default comes from $WCONOCT_PAGE_CACHE_MB, else 256), shared by
+   all of them; least recently used pages go first. Native backend only. */
+void wconOct_setPageCache(WconOctError *err, double megabytes);
+void wconOct_pageCacheInfo(WconOctError *err, WconOctPageCacheInfo *info);
+
 #ifdef __cplusplus
 }
 #endif /* __cplusplus */
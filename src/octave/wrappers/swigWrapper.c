@@ -24,6 +24,14 @@ int isNoneHandle(int handle) {
   return (wconOct_isNoneHandle(testHandle));
 }
 
+void release(int handle) {
+  WconOctError err;
+  wconOct_releaseHandle(&err,(WconOctHandle)handle);
+  if (err == FAILED) {
+    fprintf(stderr,"Warning: release failed\n");
+  }
+}
+
 /* WCONWorms */
 int load_from_file(const char *path) {
   WconOctError err;
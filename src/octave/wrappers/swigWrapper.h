@@ -6,6 +6,7 @@
 void initWrapper();
 int isNullHandle(int handle);
 int isNoneHandle(int handle);
+void release(int handle);
 
 int load_from_file(const char *path);
 void save_to_file(int selfHandle, const char *path);
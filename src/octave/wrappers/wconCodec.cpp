@@ -0,0 +1,411 @@
+#include "wconCodec.h"
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+#include <thread>
+#include <vector>
+
+#include <zlib.h>
+#ifdef WCONOCT_HAVE_ZSTD
+#include <zstd.h>
+#endif
+using namespace std;
+
+// Uncompressed bytes per block of output: big enough that the header and
+//   the lost history at each block cost well under 1%
+#define CODEC_BLOCK_SIZE (1 << 20)
+// Compressed bytes read from the file at a time
+#define CODEC_INPUT_SIZE (1 << 16)
+
+namespace {
+
+const char *codecName(WconCodec codec) {
+  return (codec == WCON_CODEC_GZIP) ? "gzip" : "zstd";
+}
+
+void codecRequireZstd(const string &path) {
+#ifndef WCONOCT_HAVE_ZSTD
+  throw WconCodecError(path + " is zstd compressed, but this library was "
+		       "built without zstd (WCONOCT_HAVE_ZSTD)");
+#else
+  (void)path;
+#endif
+}
+
+// One block as a complete gzip member
+void gzipBlock(const char *in, size_t len, int level, string &out) {
+  z_stream strm;
+  memset(&strm, 0, sizeof(strm));
+  // 16 + MAX_WBITS: a gzip header and trailer around the deflate stream
+  if (deflateInit2(&strm, level < 0 ? Z_DEFAULT_COMPRESSION : level,
+		   Z_DEFLATED, 16 + MAX_WBITS, 8,
+		   Z_DEFAULT_STRATEGY) != Z_OK) {
+    throw WconCodecError("zlib initialization failed");
+  }
+  out.resize(deflateBound(&strm, (uLong)len) + 32);
+  strm.next_in = (Bytef *)in;
+  strm.avail_in = (uInt)len;
+  strm.next_out = (Bytef *)&out[0];
+  strm.avail_out = (uInt)out.size();
+  int rc = deflate(&strm, Z_FINISH);
+  size_t produced = strm.total_out;
+  deflateEnd(&strm);
+  if (rc != Z_STREAM_END) {
+    throw WconCodecError("gzip compression failed");
+  }
+  out.resize(produced);
+}
+
+#ifdef WCONOCT_HAVE_ZSTD
+// One block as a complete zstd frame
+void zstdBlock(const char *in, size_t len, int level, string &out) {
+  out.resize(ZSTD_compressBound(len));
+  size_t produced = ZSTD_compress(&out[0], out.size(), in, len,
+				  level < 0 ? ZSTD_CLEVEL_DEFAULT : level);
+  if (ZSTD_isError(produced)) {
+    throw WconCodecError(string("zstd compression failed: ") +
+			 ZSTD_getErrorName(produced));
+  }
+  out.resize(produced);
+}
+#endif
+
+// Compresses blocks[i] into out[i] for i = first, first + step, ...;
+//   the first failure is kept in error
+void codecCompressBlocks(const vector<string> *blocks, size_t first,
+			 size_t step, WconCodec codec, int level,
+			 vector<string> *out, string *error) {
+#ifndef WCONOCT_HAVE_ZSTD
+  // Always gzip: zstd output is refused before any block is made
+  (void)codec;
+#endif
+  try {
+    for (size_t i=first; i<blocks->size(); i+=step) {
+      const string &block = (*blocks)[i];
+#ifdef WCONOCT_HAVE_ZSTD
+      if (codec == WCON_CODEC_ZSTD) {
+	zstdBlock(block.data(), block.size(), level, (*out)[i]);
+	continue;
+      }
+#endif
+      gzipBlock(block.data(), block.size(), level, (*out)[i]);
+    }
+  } catch (const exception &e) {
+    *error = e.what();
+  }
+}
+
+} // namespace
+
+WconCodec wconCodecDetect(const string &path) {
+  FILE *fp = fopen(path.c_str(), "rb");
+  if (fp == NULL) {
+    return WCON_CODEC_NONE;
+  }
+  unsigned char magic[4] = {0, 0, 0, 0};
+  size_t n = fread(magic, 1, sizeof(magic), fp);
+  fclose(fp);
+  if (n >= 2 && magic[0] == 0x1F && magic[1] == 0x8B) {
+    return WCON_CODEC_GZIP;
+  } else if (n == 4 && magic[0] == 0x28 && magic[1] == 0xB5 &&
+	     magic[2] == 0x2F && magic[3] == 0xFD) {
+    return WCON_CODEC_ZSTD;
+  }
+  return WCON_CODEC_NONE;
+}
+
+WconCodec wconCodecForName(const string &path) {
+  string lower = path;
+  for (size_t i=0; i<lower.size(); i++) {
+    lower[i] = (char)tolower((unsigned char)lower[i]);
+  }
+  size_t dot = lower.rfind('.');
+  string ext = (dot == string::npos) ? "" : lower.substr(dot);
+  return (ext == ".gz") ? WCON_CODEC_GZIP :
+    (ext == ".zst") ? WCON_CODEC_ZSTD : WCON_CODEC_NONE;
+}
+
+struct WconCodecSource::State {
+  State() : fp(NULL), codec(WCON_CODEC_NONE), atEof(false),
+	    inFrame(false) {}
+
+  FILE *fp;
+  string path;
+  WconCodec codec;
+  vector<unsigned char> input;
+  bool atEof;
+  // Inside a member or frame, which must end before the file does
+  bool inFrame;
+  z_stream strm;
+#ifdef WCONOCT_HAVE_ZSTD
+  ZSTD_DStream *dstream;
+  ZSTD_inBuffer in;
+#endif
+
+  // More compressed bytes; false at the end of the file
+  size_t fill() {
+    size_t n = atEof ? 0 : fread(&input[0], 1, input.size(), fp);
+    if (n == 0) {
+      if (ferror(fp)) {
+	throw WconCodecError("Cannot read " + path + ": " + strerror(errno));
+      }
+      atEof = true;
+    }
+    return n;
+  }
+};
+
+WconCodecSource::WconCodecSource(const string &path, WconCodec codec)
+  : state(new State) {
+  state->path = path;
+  state->codec = codec;
+  state->input.resize(CODEC_INPUT_SIZE);
+  try {
+    if (codec == WCON_CODEC_ZSTD) {
+      codecRequireZstd(path);
+    } else if (codec != WCON_CODEC_GZIP) {
+      throw WconCodecError(path + " is neither gzip nor zstd compressed");
+    }
+    state->fp = fopen(path.c_str(), "rb");
+    if (state->fp == NULL) {
+      throw WconCodecError("Cannot open " + path + ": " + strerror(errno));
+    }
+#ifdef WCONOCT_HAVE_ZSTD
+    if (codec == WCON_CODEC_ZSTD) {
+      state->dstream = ZSTD_createDStream();
+      if (state->dstream == NULL ||
+	  ZSTD_isError(ZSTD_initDStream(state->dstream))) {
+	ZSTD_freeDStream(state->dstream);
+	throw WconCodecError("zstd initialization failed");
+      }
+      state->in.src = &state->input[0];
+      state->in.size = state->in.pos = 0;
+      return;
+    }
+#endif
+    memset(&state->strm, 0, sizeof(state->strm));
+    if (inflateInit2(&state->strm, 16 + MAX_WBITS) != Z_OK) {
+      throw WconCodecError("zlib initialization failed");
+    }
+  } catch (...) {
+    if (state->fp != NULL) {
+      fclose(state->fp);
+    }
+    delete state;
+    throw;
+  }
+}
+
+WconCodecSource::~WconCodecSource() {
+#ifdef WCONOCT_HAVE_ZSTD
+  if (state->codec == WCON_CODEC_ZSTD) {
+    ZSTD_freeDStream(state->dstream);
+  } else {
+    inflateEnd(&state->strm);
+  }
+#else
+  inflateEnd(&state->strm);
+#endif
+  fclose(state->fp);
+  delete state;
+}
+
+size_t WconCodecSource::read(char *buf, size_t len) {
+  State &s = *state;
+#ifdef WCONOCT_HAVE_ZSTD
+  if (s.codec == WCON_CODEC_ZSTD) {
+    ZSTD_outBuffer out = {buf, len, 0};
+    while (out.pos < out.size) {
+      if (s.in.pos == s.in.size) {
+	s.in.size = s.fill();
+	s.in.pos = 0;
+	if (s.in.size == 0) {
+	  break;
+	}
+      }
+      size_t rc = ZSTD_decompressStream(s.dstream, &out, &s.in);
+      if (ZSTD_isError(rc)) {
+	throw WconCodecError("Bad zstd data in " + s.path + ": " +
+			     ZSTD_getErrorName(rc));
+      }
+      // 0 when a frame is done; the next one starts by itself
+      s.inFrame = (rc != 0);
+    }
+    if (out.pos == 0 && s.inFrame) {
+      throw WconCodecError("Truncated zstd file " + s.path);
+    }
+    return out.pos;
+  }
+#endif
+  s.strm.next_out = (Bytef *)buf;
+  s.strm.avail_out = (uInt)len;
+  while (s.strm.avail_out > 0) {
+    if (s.strm.avail_in == 0) {
+      s.strm.avail_in = (uInt)s.fill();
+      s.strm.next_in = &s.input[0];
+      if (s.strm.avail_in == 0) {
+	break;
+      }
+    }
+    if (!s.inFrame) {
+      // Another member after the last one
+      inflateReset(&s.strm);
+      s.inFrame = true;
+    }
+    int rc = inflate(&s.strm, Z_NO_FLUSH);
+    if (rc == Z_STREAM_END) {
+      s.inFrame = false;
+    } else if (rc != Z_OK) {
+      throw WconCodecError("Bad gzip data in " + s.path + ": " +
+			   (s.strm.msg != NULL ? s.strm.msg : "inflate failed"));
+    }
+  }
+  size_t produced = len - s.strm.avail_out;
+  if (produced == 0 && s.inFrame) {
+    throw WconCodecError("Truncated gzip file " + s.path);
+  }
+  return produced;
+}
+
+struct WconCodecSink::State {
+  State() : fp(NULL), codec(WCON_CODEC_NONE), level(-1), numThreads(1),
+	    written(false) {}
+
+  FILE *fp;
+  string path;
+  string temp;
+  WconCodec codec;
+  int level;
+  size_t numThreads;
+  // Full blocks waiting to be compressed, the last one filling up
+  vector<string> pending;
+  // Anything at all has been compressed
+  bool written;
+};
+
+WconCodecSink::WconCodecSink(const string &path, WconCodec codec, int level,
+			     int numThreads)
+  : state(new State) {
+  State &s = *state;
+  s.path = path;
+  s.temp = path + ".TEMP";
+  s.codec = codec;
+  s.level = level;
+  size_t cores = thread::hardware_concurrency();
+  s.numThreads = (numThreads > 0) ? (size_t)numThreads :
+    max((size_t)1, min(cores, (size_t)8));
+  try {
+    if (codec == WCON_CODEC_ZSTD) {
+      codecRequireZstd(path);
+    } else if (codec != WCON_CODEC_GZIP) {
+      throw WconCodecError("Cannot compress " + path + ": not a .gz or "
+			   ".zst file");
+    }
+#ifdef WCONOCT_HAVE_ZSTD
+    int maxLevel = (codec == WCON_CODEC_ZSTD) ? ZSTD_maxCLevel() : 9;
+#else
+    int maxLevel = 9;
+#endif
+    if (level > maxLevel) {
+      char msg[64];
+      sprintf(msg, " compression levels go up to %d", maxLevel);
+      throw WconCodecError(codecName(codec) + string(msg));
+    }
+    s.fp = fopen(s.temp.c_str(), "wb");
+    if (s.fp == NULL) {
+      throw WconCodecError("Cannot open " + s.temp + ": " + strerror(errno));
+    }
+  } catch (...) {
+    delete state;
+    throw;
+  }
+}
+
+WconCodecSink::~WconCodecSink() {
+  if (state->fp != NULL) {
+    fclose(state->fp);
+    remove(state->temp.c_str());
+  }
+  delete state;
+}
+
+void WconCodecSink::write(const char *buf, size_t len) {
+  State &s = *state;
+  if (s.fp == NULL) {
+    throw WconCodecError("Write to " + s.path + " after it was closed");
+  }
+  while (len > 0) {
+    if (s.pending.empty() || s.pending.back().size() == CODEC_BLOCK_SIZE) {
+      if (s.pending.size() == s.numThreads) {
+	compressPending();
+      }
+      s.pending.push_back(string());
+      s.pending.back().reserve(CODEC_BLOCK_SIZE);
+    }
+    string &block = s.pending.back();
+    size_t n = min(len, (size_t)CODEC_BLOCK_SIZE - block.size());
+    block.append(buf, n);
+    buf += n;
+    len -= n;
+  }
+}
+
+// The pending blocks on up to numThreads threads, written out in order
+void WconCodecSink::compressPending() {
+  State &s = *state;
+  size_t count = min(s.numThreads, s.pending.size());
+  vector<string> out(s.pending.size());
+  vector<string> errors(count);
+  vector<thread> threads;
+  for (size_t t=1; t<count; t++) {
+    threads.push_back(thread(codecCompressBlocks, &s.pending, t, count,
+			     s.codec, s.level, &out, &errors[t]));
+  }
+  codecCompressBlocks(&s.pending, 0, count, s.codec, s.level, &out,
+		      &errors[0]);
+  for (size_t t=0; t<threads.size(); t++) {
+    threads[t].join();
+  }
+  for (size_t t=0; t<count; t++) {
+    if (!errors[t].empty()) {
+      throw WconCodecError(errors[t]);
+    }
+  }
+  for (size_t i=0; i<out.size(); i++) {
+    if (fwrite(out[i].data(), 1, out[i].size(), s.fp) != out[i].size()) {
+      throw WconCodecError("Cannot write " + s.temp + ": " +
+			   strerror(errno));
+    }
+  }
+  s.pending.clear();
+  s.written = true;
+}
+
+void WconCodecSink::close() {
+  State &s = *state;
+  if (s.fp == NULL) {
+    return;
+  }
+  if (!s.pending.empty() || !s.written) {
+    // An empty file still gets one (empty) member or frame
+    if (s.pending.empty()) {
+      s.pending.push_back(string());
+    }
+    compressPending();
+  }
+  FILE *fp = s.fp;
+  s.fp = NULL;
+  if (fclose(fp) != 0) {
+    remove(s.temp.c_str());
+    throw WconCodecError("Cannot write " + s.temp + ": " + strerror(errno));
+  }
+  if (rename(s.temp.c_str(), s.path.c_str()) != 0) {
+    remove(s.temp.c_str());
+    throw WconCodecError("Cannot rename " + s.temp + " to " + s.path + ": " +
+			 strerror(errno));
+  }
+}
@@ -0,0 +1,77 @@
+#ifndef __WCON_CODEC_H_
+#define __WCON_CODEC_H_
+// gzip and zstd compressed WCON files (.wcon.gz, .wcon.zst): the WCON
+//   text as one compressed stream, where wconZip has archives of
+//   entries. Files are told apart by their magic bytes, not their names.
+//   zlib does gzip; zstd needs libzstd and WCONOCT_HAVE_ZSTD, without
+//   which zstd files are recognized but refused.
+//
+// Output is cut into blocks that are compressed on several threads,
+//   each block its own gzip member or zstd frame. Both formats define a
+//   file of several as the concatenation of their contents, so gzip,
+//   zstd and this reader all see a single stream.
+#include <stdexcept>
+#include <string>
+
+#include "wconJson.h"
+
+enum WconCodec {
+  WCON_CODEC_NONE,
+  WCON_CODEC_GZIP,
+  WCON_CODEC_ZSTD
+};
+
+class WconCodecError : public std::runtime_error {
+ public:
+  explicit WconCodecError(const std::string &msg)
+    : std::runtime_error(msg) {}
+};
+
+// By the first bytes of the file: NONE for plain text and zip archives,
+//   and for files that cannot be opened
+WconCodec wconCodecDetect(const std::string &path);
+// By the extension, .gz or .zst (in any case), for output
+WconCodec wconCodecForName(const std::string &path);
+
+// The decompressed text of path, a buffer at a time. Checksums are
+//   checked as the end of each member or frame goes by.
+class WconCodecSource : public WconJsonSource {
+ public:
+  WconCodecSource(const std::string &path, WconCodec codec);
+  ~WconCodecSource();
+
+  size_t read(char *buf, size_t len);
+
+ private:
+  struct State;
+  State *state;
+
+  WconCodecSource(const WconCodecSource &);
+  WconCodecSource &operator=(const WconCodecSource &);
+};
+
+// Compresses what is written to it into path. level < 0 is the default
+//   of the codec; numThreads <= 0 is one per core, up to 8. Output goes
+//   to a file next to path, renamed to path by close(); without a
+//   close() it is removed.
+class WconCodecSink : public WconJsonSink {
+ public:
+  WconCodecSink(const std::string &path, WconCodec codec, int level,
+		int numThreads);
+  ~WconCodecSink();
+
+  void write(const char *buf, size_t len);
+  // Compresses and writes out the rest. Throws WconCodecError.
+  void close();
+
+ private:
+  struct State;
+  State *state;
+
+  void compressPending();
+
+  WconCodecSink(const WconCodecSink &);
+  WconCodecSink &operator=(const WconCodecSink &);
+};
+
+#endif /* __WCON_CODEC_H_ */
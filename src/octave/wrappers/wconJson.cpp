@@ -0,0 +1,780 @@
+#include "wconJson.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <sstream>
+using namespace std;
+
+#define WCON_JSON_BUFFER_SIZE 65536
+
+const WconJsonValue *WconJsonValue::find(const string &key) const {
+  if (type != JSON_OBJECT) {
+    return NULL;
+  }
+  for (size_t i=0; i<members.size(); i++) {
+    if (members[i].first == key) {
+      return &(members[i].second);
+    }
+  }
+  return NULL;
+}
+
+size_t WconJsonMemorySource::read(char *buf, size_t max) {
+  size_t n = len - pos;
+  if (n > max) {
+    n = max;
+  }
+  memcpy(buf, text + pos, n);
+  pos += n;
+  return n;
+}
+
+size_t WconJsonFileSource::read(char *buf, size_t max) {
+  return fread(buf, 1, max, fp);
+}
+
+WconJsonReader::WconJsonReader(WconJsonSource *source)
+  : source(source), buffer(WCON_JSON_BUFFER_SIZE + 1), pos(0), len(0),
+    consumed(0), atEof(false) {
+}
+
+void WconJsonReader::fail(const string &msg) {
+  ostringstream os;
+  os << "JSON parse error at byte " << offset() << ": " << msg;
+  throw WconJsonError(os.str());
+}
+
+bool WconJsonReader::fill() {
+  if (atEof) {
+    return false;
+  }
+  consumed += (long)len;
+  pos = 0;
+  len = source->read(&buffer[0], buffer.size() - 1);
+  // The NUL after the data stops the scans of skipValue
+  buffer[len] = '\0';
+  if (len == 0) {
+    atEof = true;
+    return false;
+  }
+  return true;
+}
+
+int WconJsonReader::peekChar() {
+  if (pos >= len && !fill()) {
+    return -1;
+  }
+  return (unsigned char)buffer[pos];
+}
+
+int WconJsonReader::getChar() {
+  if (pos >= len && !fill()) {
+    return -1;
+  }
+  return (unsigned char)buffer[pos++];
+}
+
+void WconJsonReader::skipWhitespace() {
+  for (;;) {
+    while (pos < len) {
+      char c = buffer[pos];
+      if (c != ' ' && c != '\n' && c != '\r' && c != '\t') {
+	return;
+      }
+      pos++;
+    }
+    if (!fill()) {
+      return;
+    }
+  }
+}
+
+void WconJsonReader::expectChar(char c) {
+  skipWhitespace();
+  int got = getChar();
+  if (got != (unsigned char)c) {
+    fail(string("expected '") + c + "'");
+  }
+}
+
+void WconJsonReader::expectLiteral(const char *literal) {
+  for (const char *p = literal; *p; p++) {
+    if (getChar() != (unsigned char)*p) {
+      fail(string("invalid literal, expected ") + literal);
+    }
+  }
+}
+
+WconJsonReader::Token WconJsonReader::peek() {
+  skipWhitespace();
+  int c = peekChar();
+  switch (c) {
+  case -1:
+    return TOKEN_END;
+  case '{':
+    return TOKEN_OBJECT;
+  case '[':
+    return TOKEN_ARRAY;
+  case '"':
+    return TOKEN_STRING;
+  case 't':
+  case 'f':
+    return TOKEN_BOOL;
+  case 'n':
+    return TOKEN_NULL;
+  default:
+    // Python's json module accepts NaN and +/-Infinity, and the Python
+    //   writer emits NaN for missing spine points, so we do too.
+    if (c == '-' || c == 'N' || c == 'I' || (c >= '0' && c <= '9')) {
+      return TOKEN_NUMBER;
+    }
+    fail(string("unexpected character '") + (char)c + "'");
+  }
+  return TOKEN_END;
+}
+
+bool WconJsonReader::beginElement(char closer) {
+  skipWhitespace();
+  if (firstElement.empty()) {
+    fail("no open container");
+  }
+  if (peekChar() == (unsigned char)closer) {
+    getChar();
+    firstElement.pop_back();
+    return false;
+  }
+  if (firstElement.back()) {
+    firstElement.back() = false;
+  } else {
+    expectChar(',');
+  }
+  return true;
+}
+
+void WconJsonReader::beginObject() {
+  expectChar('{');
+  firstElement.push_back(true);
+}
+
+bool WconJsonReader::nextMember(string &key) {
+  if (!beginElement('}')) {
+    return false;
+  }
+  if (peek() != TOKEN_STRING) {
+    fail("object keys must be strings");
+  }
+  readString(key);
+  expectChar(':');
+  return true;
+}
+
+void WconJsonReader::beginArray() {
+  expectChar('[');
+  firstElement.push_back(true);
+}
+
+bool WconJsonReader::nextItem() {
+  return beginElement(']');
+}
+
+double WconJsonReader::readNumber(bool *isInteger) {
+  char token[64];
+  size_t n = 0;
+  bool integral = true;
+
+  skipWhitespace();
+  int c = peekChar();
+  if (c == 'N') {
+    expectLiteral("NaN");
+    if (isInteger) *isInteger = false;
+    return NAN;
+  }
+  bool negative = false;
+  if (c == '-') {
+    token[n++] = (char)getChar();
+    negative = true;
+    c = peekChar();
+  }
+  if (c == 'I') {
+    expectLiteral("Infinity");
+    if (isInteger) *isInteger = false;
+    return negative ? -INFINITY : INFINITY;
+  }
+  for (;;) {
+    c = peekChar();
+    if ((c >= '0' && c <= '9') || c == '+' || c == '-') {
+      // fall through
+    } else if (c == '.' || c == 'e' || c == 'E') {
+      integral = false;
+    } else {
+      break;
+    }
+    if (n >= sizeof(token) - 1) {
+      fail("numeric literal too long");
+    }
+    token[n++] = (char)getChar();
+  }
+  token[n] = '\0';
+  if (n == 0 || (n == 1 && negative)) {
+    fail("malformed number");
+  }
+  char *end = NULL;
+  errno = 0;
+  double value = strtod(token, &end);
+  if (*end != '\0') {
+    fail(string("malformed number '") + token + "'");
+  }
+  if (isInteger) {
+    *isInteger = integral;
+  }
+  return value;
+}
+
+static void appendUtf8(string &out, unsigned long cp) {
+  if (cp < 0x80) {
+    out += (char)cp;
+  } else if (cp < 0x800) {
+    out += (char)(0xC0 | (cp >> 6));
+    out += (char)(0x80 | (cp & 0x3F));
+  } else if (cp < 0x10000) {
+    out += (char)(0xE0 | (cp >> 12));
+    out += (char)(0x80 | ((cp >> 6) & 0x3F));
+    out += (char)(0x80 | (cp & 0x3F));
+  } else {
+    out += (char)(0xF0 | (cp >> 18));
+    out += (char)(0x80 | ((cp >> 12) & 0x3F));
+    out += (char)(0x80 | ((cp >> 6) & 0x3F));
+    out += (char)(0x80 | (cp & 0x3F));
+  }
+}
+
+void WconJsonReader::readString(string &out) {
+  out.clear();
+  expectChar('"');
+  for (;;) {
+    // Copy runs of plain characters straight out of the buffer
+    size_t start = pos;
+    while (pos < len && buffer[pos] != '"' && buffer[pos] != '\\') {
+      pos++;
+    }
+    out.append(&buffer[0] + start, pos - start);
+    int c = getChar();
+    if (c == -1) {
+      fail("unterminated string");
+    } else if (c == '"') {
+      return;
+    } else if (c == '\\') {
+      int e = getChar();
+      switch (e) {
+      case '"': out += '"'; break;
+      case '\\': out += '\\'; break;
+      case '/': out += '/'; break;
+      case 'b': out += '\b'; break;
+      case 'f': out += '\f'; break;
+      case 'n': out += '\n'; break;
+      case 'r': out += '\r'; break;
+      case 't': out += '\t'; break;
+      case 'u': {
+	unsigned long cp = 0;
+	for (int i=0; i<4; i++) {
+	  int h = getChar();
+	  cp <<= 4;
+	  if (h >= '0' && h <= '9') cp |= h - '0';
+	  else if (h >= 'a' && h <= 'f') cp |= h - 'a' + 10;
+	  else if (h >= 'A' && h <= 'F') cp |= h - 'A' + 10;
+	  else fail("bad \\u escape");
+	}
+	if (cp >= 0xD800 && cp < 0xDC00) {
+	  // surrogate pair
+	  if (getChar() != '\\' || getChar() != 'u') {
+	    fail("unpaired surrogate");
+	  }
+	  unsigned long lo = 0;
+	  for (int i=0; i<4; i++) {
+	    int h = getChar();
+	    lo <<= 4;
+	    if (h >= '0' && h <= '9') lo |= h - '0';
+	    else if (h >= 'a' && h <= 'f') lo |= h - 'a' + 10;
+	    else if (h >= 'A' && h <= 'F') lo |= h - 'A' + 10;
+	    else fail("bad \\u escape");
+	  }
+	  cp = 0x10000 + ((cp - 0xD800) << 10) + (lo - 0xDC00);
+	}
+	appendUtf8(out, cp);
+	break;
+      }
+      default:
+	fail("bad escape sequence");
+      }
+    }
+  }
+}
+
+bool WconJsonReader::readBool() {
+  skipWhitespace();
+  if (peekChar() == 't') {
+    expectLiteral("true");
+    return true;
+  }
+  expectLiteral("false");
+  return false;
+}
+
+void WconJsonReader::readNull() {
+  skipWhitespace();
+  expectLiteral("null");
+}
+
+void WconJsonReader::skipValue() {
+  Token tok = peek();
+  if (tok == TOKEN_NUMBER) {
+    readNumber();
+    return;
+  } else if (tok == TOKEN_BOOL) {
+    readBool();
+    return;
+  } else if (tok == TOKEN_NULL) {
+    readNull();
+    return;
+  } else if (tok == TOKEN_END) {
+    fail("unexpected end of input");
+  }
+
+  // Strings and containers: scan for the matching close without
+  //   decoding anything. Containers opened here never touch
+  //   firstElement, so the caller's state is left as it was.
+  long depth = 0;
+  bool inString = false;
+  for (;;) {
+    if (pos >= len && !fill()) {
+      fail("unexpected end of input");
+    }
+    while (pos < len) {
+      // Jump over the bytes that open and close nothing. strcspn stops
+      //   at the NUL after the data, or at one inside it.
+      pos += strcspn(&buffer[pos], inString ? "\"\\" : "\"[]{}");
+      if (pos >= len) {
+	break;
+      }
+      char c = buffer[pos++];
+      if (inString) {
+	if (c == '\\') {
+	  if (pos >= len && !fill()) {
+	    fail("unterminated string");
+	  }
+	  pos++;
+	} else if (c == '"') {
+	  inString = false;
+	  if (depth == 0) {
+	    return;
+	  }
+	}
+      } else if (c == '"') {
+	inString = true;
+      } else if (c == '[' || c == '{') {
+	depth++;
+      } else if (c == ']' || c == '}') {
+	depth--;
+	if (depth == 0) {
+	  return;
+	}
+      }
+    }
+  }
+}
+
+void WconJsonReader::readValue(WconJsonValue &out) {
+  out = WconJsonValue();
+  switch (peek()) {
+  case TOKEN_NULL:
+    readNull();
+    out.type = WconJsonValue::JSON_NULL;
+    break;
+  case TOKEN_BOOL:
+    out.type = WconJsonValue::JSON_BOOL;
+    out.boolValue = readBool();
+    break;
+  case TOKEN_NUMBER:
+    out.type = WconJsonValue::JSON_NUMBER;
+    out.numValue = readNumber(&out.isInteger);
+    break;
+  case TOKEN_STRING:
+    out.type = WconJsonValue::JSON_STRING;
+    readString(out.strValue);
+    break;
+  case TOKEN_ARRAY:
+    out.type = WconJsonValue::JSON_ARRAY;
+    beginArray();
+    while (nextItem()) {
+      out.items.push_back(WconJsonValue());
+      readValue(out.items.back());
+    }
+    break;
+  case TOKEN_OBJECT: {
+    out.type = WconJsonValue::JSON_OBJECT;
+    string key;
+    beginObject();
+    while (nextMember(key)) {
+      if (out.find(key) != NULL) {
+	fail("Duplicate key: '" + key + "'");
+      }
+      out.members.push_back(make_pair(key, WconJsonValue()));
+      readValue(out.members.back().second);
+    }
+    break;
+  }
+  case TOKEN_END:
+    fail("unexpected end of input");
+  }
+}
+
+void WconJsonReader::expectEnd() {
+  if (peek() != TOKEN_END) {
+    fail("trailing characters after JSON value");
+  }
+}
+
+void wconJsonParse(const char *text, size_t len, WconJsonValue &out) {
+  WconJsonMemorySource source(text, len);
+  WconJsonReader reader(&source);
+  reader.readValue(out);
+  reader.expectEnd();
+}
+
+void wconJsonParseFile(const char *path, WconJsonValue &out) {
+  FILE *fp = fopen(path, "rb");
+  if (fp == NULL) {
+    throw WconJsonError(string("Cannot open ") + path + ": " +
+			strerror(errno));
+  }
+  try {
+    WconJsonFileSource source(fp);
+    WconJsonReader reader(&source);
+    reader.readValue(out);
+    reader.expectEnd();
+  } catch (...) {
+    fclose(fp);
+    throw;
+  }
+  fclose(fp);
+}
+
+int wconJsonFormatDouble(double value, char *buf) {
+  if (isnan(value)) {
+    strcpy(buf, "NaN");
+    return 3;
+  } else if (isinf(value)) {
+    strcpy(buf, value < 0 ? "-Infinity" : "Infinity");
+    return (int)strlen(buf);
+  }
+
+  // Shortest of 15, 16 or 17 significant digits that reads back
+  //   exactly. If the shortest representation has fewer than 15
+  //   digits, rounding to 15 yields it padded with zeros.
+  char sci[40];
+  int precision;
+  for (precision = 15; precision < 17; precision++) {
+    snprintf(sci, sizeof(sci), "%.*e", precision - 1, value);
+    if (strtod(sci, NULL) == value) {
+      break;
+    }
+  }
+  if (precision == 17) {
+    snprintf(sci, sizeof(sci), "%.16e", value);
+  }
+
+  // sci is [-]d.ddde[+-]XX
+  const char *p = sci;
+  bool negative = (*p == '-');
+  if (negative) {
+    p++;
+  }
+  char digits[20];
+  int ndigits = 0;
+  for (; *p != 'e'; p++) {
+    if (*p != '.') {
+      digits[ndigits++] = *p;
+    }
+  }
+  int exponent = atoi(p + 1);
+  while (ndigits > 1 && digits[ndigits-1] == '0') {
+    ndigits--;
+  }
+
+  // Same switch-over points as float.__repr__
+  char *q = buf;
+  if (negative) {
+    *q++ = '-';
+  }
+  if (exponent >= -4 && exponent < 16) {
+    if (exponent >= 0) {
+      for (int i=0; i<=exponent; i++) {
+	*q++ = (i < ndigits) ? digits[i] : '0';
+      }
+      *q++ = '.';
+      if (ndigits > exponent + 1) {
+	for (int i=exponent+1; i<ndigits; i++) {
+	  *q++ = digits[i];
+	}
+      } else {
+	*q++ = '0';
+      }
+    } else {
+      *q++ = '0';
+      *q++ = '.';
+      for (int i=0; i<-exponent-1; i++) {
+	*q++ = '0';
+      }
+      for (int i=0; i<ndigits; i++) {
+	*q++ = digits[i];
+      }
+    }
+    *q = '\0';
+  } else {
+    *q++ = digits[0];
+    if (ndigits > 1) {
+      *q++ = '.';
+      for (int i=1; i<ndigits; i++) {
+	*q++ = digits[i];
+      }
+    }
+    sprintf(q, "e%c%02d", exponent < 0 ? '-' : '+',
+	    exponent < 0 ? -exponent : exponent);
+  }
+  return (int)strlen(buf);
+}
+
+#define WCON_JSON_FLUSH_SIZE 65536
+
+WconJsonWriter::WconJsonWriter(FILE *fp, int indent)
+  : fp(fp), sink(NULL), indent(indent), afterKey(false) {
+}
+
+WconJsonWriter::WconJsonWriter(WconJsonSink &sink, int indent)
+  : fp(NULL), sink(&sink), indent(indent), afterKey(false) {
+}
+
+WconJsonWriter::~WconJsonWriter() {
+  // Errors can only be reported by an explicit flush()
+  if (fp != NULL && !out.empty()) {
+    fwrite(out.data(), 1, out.size(), fp);
+  }
+}
+
+void WconJsonWriter::flush() {
+  if (sink != NULL && !out.empty()) {
+    sink->write(out.data(), out.size());
+    out.clear();
+    return;
+  }
+  if (fp == NULL || out.empty()) {
+    return;
+  }
+  size_t n = fwrite(out.data(), 1, out.size(), fp);
+  out.clear();
+  if (n == 0 || ferror(fp)) {
+    throw WconJsonError(string("Write failed: ") + strerror(errno));
+  }
+}
+
+void WconJsonWriter::maybeFlush() {
+  if ((fp != NULL || sink != NULL) && out.size() >= WCON_JSON_FLUSH_SIZE) {
+    flush();
+  }
+}
+
+void WconJsonWriter::newline() {
+  out += '\n';
+  out.append(indent * counts.size(), ' ');
+}
+
+void WconJsonWriter::beginElement() {
+  if (afterKey) {
+    afterKey = false;
+    return;
+  }
+  if (counts.empty()) {
+    return;
+  }
+  if (counts.back() > 0) {
+    out += (indent >= 0) ? "," : ", ";
+  }
+  if (indent >= 0) {
+    newline();
+  }
+  counts.back()++;
+}
+
+void WconJsonWriter::endContainer(char closer) {
+  long n = counts.back();
+  counts.pop_back();
+  if (n > 0 && indent >= 0) {
+    newline();
+  }
+  out += closer;
+  maybeFlush();
+}
+
+void WconJsonWriter::beginObject() {
+  beginElement();
+  out += '{';
+  counts.push_back(0);
+}
+
+void WconJsonWriter::key(const string &k) {
+  beginElement();
+  appendString(k);
+  out += ": ";
+  afterKey = true;
+}
+
+void WconJsonWriter::endObject() {
+  endContainer('}');
+}
+
+void WconJsonWriter::beginArray() {
+  beginElement();
+  out += '[';
+  counts.push_back(0);
+}
+
+void WconJsonWriter::endArray() {
+  endContainer(']');
+}
+
+void WconJsonWriter::writeNumber(double value) {
+  char buf[32];
+  beginElement();
+  out.append(buf, wconJsonFormatDouble(value, buf));
+}
+
+void WconJsonWriter::writeInteger(long long value) {
+  char buf[32];
+  beginElement();
+  out.append(buf, snprintf(buf, sizeof(buf), "%lld", value));
+}
+
+void WconJsonWriter::writeBool(bool value) {
+  beginElement();
+  out += value ? "true" : "false";
+}
+
+void WconJsonWriter::writeNull() {
+  beginElement();
+  out += "null";
+}
+
+static void appendEscape(string &out, unsigned long cp) {
+  char buf[8];
+  snprintf(buf, sizeof(buf), "\\u%04lx", cp);
+  out += buf;
+}
+
+void WconJsonWriter::writeString(const string &value) {
+  beginElement();
+  appendString(value);
+}
+
+void WconJsonWriter::appendString(const string &value) {
+  out += '"';
+  const unsigned char *p = (const unsigned char *)value.data();
+  const unsigned char *end = p + value.size();
+  while (p < end) {
+    unsigned char c = *p;
+    if (c >= 0x20 && c < 0x7f && c != '"' && c != '\\') {
+      const unsigned char *start = p;
+      while (p < end && *p >= 0x20 && *p < 0x7f && *p != '"' && *p != '\\') {
+	p++;
+      }
+      out.append((const char *)start, p - start);
+      continue;
+    }
+    p++;
+    switch (c) {
+    case '"': out += "\\\""; continue;
+    case '\\': out += "\\\\"; continue;
+    case '\n': out += "\\n"; continue;
+    case '\r': out += "\\r"; continue;
+    case '\t': out += "\\t"; continue;
+    case '\b': out += "\\b"; continue;
+    case '\f': out += "\\f"; continue;
+    }
+    unsigned long cp = c;
+    int extra = 0;
+    if (c >= 0xF0 && c < 0xF8) {
+      cp = c & 0x07;
+      extra = 3;
+    } else if (c >= 0xE0) {
+      cp = c & 0x0F;
+      extra = 2;
+    } else if (c >= 0xC0) {
+      cp = c & 0x1F;
+      extra = 1;
+    }
+    for (int i=0; i<extra && p < end && (*p & 0xC0) == 0x80; i++) {
+      cp = (cp << 6) | (*p++ & 0x3F);
+    }
+    if (cp >= 0x10000) {
+      cp -= 0x10000;
+      appendEscape(out, 0xD800 + (cp >> 10));
+      appendEscape(out, 0xDC00 + (cp & 0x3FF));
+    } else {
+      appendEscape(out, cp);
+    }
+  }
+  out += '"';
+}
+
+static bool memberLess(const pair<string, WconJsonValue> *a,
+		       const pair<string, WconJsonValue> *b) {
+  return a->first < b->first;
+}
+
+void WconJsonWriter::writeValue(const WconJsonValue &value, bool sortKeys) {
+  switch (value.type) {
+  case WconJsonValue::JSON_NULL:
+    writeNull();
+    break;
+  case WconJsonValue::JSON_BOOL:
+    writeBool(value.boolValue);
+    break;
+  case WconJsonValue::JSON_NUMBER:
+    if (value.isInteger && fabs(value.numValue) < 9.2e18) {
+      writeInteger((long long)value.numValue);
+    } else {
+      writeNumber(value.numValue);
+    }
+    break;
+  case WconJsonValue::JSON_STRING:
+    writeString(value.strValue);
+    break;
+  case WconJsonValue::JSON_ARRAY:
+    beginArray();
+    for (size_t i=0; i<value.items.size(); i++) {
+      writeValue(value.items[i], sortKeys);
+    }
+    endArray();
+    break;
+  case WconJsonValue::JSON_OBJECT: {
+    vector<const pair<string, WconJsonValue> *> members;
+    for (size_t i=0; i<value.members.size(); i++) {
+      members.push_back(&value.members[i]);
+    }
+    if (sortKeys) {
+      stable_sort(members.begin(), members.end(), memberLess);
+    }
+    beginObject();
+    for (size_t i=0; i<members.size(); i++) {
+      key(members[i]->first);
+      writeValue(members[i]->second, sortKeys);
+    }
+    endObject();
+    break;
+  }
+  }
+  maybeFlush();
+}
@@ -0,0 +1,211 @@
+#ifndef __WCON_JSON_H_
+#define __WCON_JSON_H_
+// Minimal JSON support for code that has to look inside WCON text
+//   without going through Python (e.g. metadata handed back as JSON
+//   text, or the Octave front end building native structs).
+//
+// The reader is a pull parser over a refillable byte source so that
+//   callers which only want part of a document do not have to build
+//   the whole tree. WconJsonValue is the tree form, with object members
+//   kept in document order.
+#include <stdio.h>
+
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+class WconJsonError : public std::runtime_error {
+ public:
+  explicit WconJsonError(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+class WconJsonValue {
+ public:
+  enum Type {
+    JSON_NULL,
+    JSON_BOOL,
+    JSON_NUMBER,
+    JSON_STRING,
+    JSON_ARRAY,
+    JSON_OBJECT
+  };
+
+  WconJsonValue() : type(JSON_NULL), boolValue(false), numValue(0.0),
+		    isInteger(false) {}
+
+  Type type;
+  bool boolValue;
+  double numValue;
+  // true if the number was written without a fraction or exponent,
+  //   so that metadata like "temperature":22 is written back as 22.
+  bool isInteger;
+  std::string strValue;
+  std::vector<WconJsonValue> items;
+  std::vector<std::pair<std::string, WconJsonValue> > members;
+
+  bool isNull() const { return type == JSON_NULL; }
+  bool isNumber() const { return type == JSON_NUMBER; }
+  bool isString() const { return type == JSON_STRING; }
+  bool isArray() const { return type == JSON_ARRAY; }
+  bool isObject() const { return type == JSON_OBJECT; }
+
+  // NULL if this is not an object or the key is absent
+  const WconJsonValue *find(const std::string &key) const;
+};
+
+// Byte source feeding a WconJsonReader. read() returns 0 at end of input.
+class WconJsonSource {
+ public:
+  virtual ~WconJsonSource() {}
+  virtual size_t read(char *buf, size_t len) = 0;
+};
+
+class WconJsonMemorySource : public WconJsonSource {
+ public:
+  WconJsonMemorySource(const char *text, size_t len)
+    : text(text), len(len), pos(0) {}
+  size_t read(char *buf, size_t max);
+ private:
+  const char *text;
+  size_t len;
+  size_t pos;
+};
+
+class WconJsonFileSource : public WconJsonSource {
+ public:
+  // Does not take ownership of fp
+  explicit WconJsonFileSource(FILE *fp) : fp(fp) {}
+  size_t read(char *buf, size_t max);
+ private:
+  FILE *fp;
+};
+
+class WconJsonReader {
+ public:
+  enum Token {
+    TOKEN_NULL,
+    TOKEN_BOOL,
+    TOKEN_NUMBER,
+    TOKEN_STRING,
+    TOKEN_ARRAY,
+    TOKEN_OBJECT,
+    TOKEN_END
+  };
+
+  explicit WconJsonReader(WconJsonSource *source);
+
+  // Type of the next value, without consuming it.
+  Token peek();
+
+  // Containers. nextMember/nextItem return false once the closing
+  //   bracket has been consumed.
+  void beginObject();
+  bool nextMember(std::string &key);
+  void beginArray();
+  bool nextItem();
+
+  double readNumber(bool *isInteger = NULL);
+  void readString(std::string &out);
+  bool readBool();
+  void readNull();
+
+  // Skips the next value by bracket matching, without decoding it.
+  void skipValue();
+
+  // Reads the next value as a tree. Duplicate object keys are
+  //   rejected, as they are by the Python implementation.
+  void readValue(WconJsonValue &out);
+
+  // Fails unless only whitespace remains.
+  void expectEnd();
+
+  // Bytes consumed so far, for error messages.
+  long offset() const { return consumed + (long)pos; }
+
+ private:
+  WconJsonSource *source;
+  std::vector<char> buffer;
+  size_t pos;
+  size_t len;
+  long consumed;
+  bool atEof;
+  // one entry per open container: true until its first element is seen
+  std::vector<bool> firstElement;
+
+  bool fill();
+  int peekChar();
+  int getChar();
+  void skipWhitespace();
+  void expectChar(char c);
+  void expectLiteral(const char *literal);
+  bool beginElement(char closer);
+  void fail(const std::string &msg);
+};
+
+// Convenience wrappers; both throw WconJsonError on malformed input.
+void wconJsonParse(const char *text, size_t len, WconJsonValue &out);
+void wconJsonParseFile(const char *path, WconJsonValue &out);
+
+// Byte sink for a WconJsonWriter, for output that is not a plain file.
+//   write() throws on failure.
+class WconJsonSink {
+ public:
+  virtual ~WconJsonSink() {}
+  virtual void write(const char *buf, size_t len) = 0;
+};
+
+// Writes JSON the way Python's json.dump does, so that files written
+//   here are byte-identical to those written by the Python package:
+//   ', ' and ': ' separators when compact, and one element per line
+//   with ',' separators when indented, floats in repr() form and
+//   non-ASCII characters escaped.
+//
+// Output goes to fp or sink if given (flushed in blocks), otherwise it
+//   accumulates and is returned by text(). A sink only gets what is
+//   left over at the end from an explicit flush().
+class WconJsonWriter {
+ public:
+  explicit WconJsonWriter(FILE *fp = NULL, int indent = -1);
+  explicit WconJsonWriter(WconJsonSink &sink, int indent = -1);
+  ~WconJsonWriter();
+
+  void beginObject();
+  void key(const std::string &k);
+  void endObject();
+  void beginArray();
+  void endArray();
+
+  void writeNumber(double value);
+  void writeInteger(long long value);
+  void writeString(const std::string &value);
+  void writeBool(bool value);
+  void writeNull();
+  // Writes a tree, with object members sorted by key if sortKeys.
+  void writeValue(const WconJsonValue &value, bool sortKeys = false);
+
+  // Writes out anything buffered. Throws WconJsonError on I/O errors.
+  void flush();
+  const std::string &text() const { return out; }
+
+ private:
+  FILE *fp;
+  WconJsonSink *sink;
+  int indent;
+  std::string out;
+  // one entry per open container: number of elements written so far
+  std::vector<long> counts;
+  bool afterKey;
+
+  void beginElement();
+  void appendString(const std::string &value);
+  void endContainer(char closer);
+  void newline();
+  void maybeFlush();
+};
+
+// Python's repr() of a float (json.dumps spelling for non-finite
+//   values). buf must hold at least 32 characters. Returns the length.
+int wconJsonFormatDouble(double value, char *buf);
+
+#endif /* __WCON_JSON_H_ */
@@ -0,0 +1,110 @@
+#include "octaveWconPythonWrapper.h"
+
+#include <iostream>
+#include <exception>
+using namespace std;
+
+#include "nativeInternal.h"
+#include "wrapperStats.h"
+
+// *****************************************************************
+// ********************** MeasurementUnit Class (native backend)
+
+static const NativeMeasurementUnit *nativeInternalGetUnit(WconOctError *err,
+					      WconOctHandle selfHandle) {
+  wconOct_initWrapper(err);
+  if (*err == FAILED) {
+    cerr << "Failed to initialize wrapper library." << endl;
+    return NULL;
+  }
+  const NativeObject *self =
+    nativeInternalGetObject(selfHandle, NativeObject::MEASUREMENT_UNIT);
+  if (self == NULL) {
+    cerr << "ERROR: Failed to acquire object instance using handle "
+	 << selfHandle << endl;
+    *err = FAILED;
+    return NULL;
+  }
+  return self->unit.get();
+}
+
+extern "C"
+WconOctHandle wconOct_static_MeasurementUnit_create(WconOctError *err,
+						   const char *unitStr) {
+  WconOctStatScope stat(WCONOCT_STAT_MU_CREATE, err);
+  wconOct_initWrapper(err);
+  if (*err == FAILED) {
+    cerr << "Failed to initialize wrapper library." << endl;
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  NativeObject unit;
+  unit.kind = NativeObject::MEASUREMENT_UNIT;
+  try {
+    unit.unit = NativeMeasurementUnit::create(unitStr);
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  WconOctHandle result = nativeInternalStoreObject(unit);
+  if (result == WCONOCT_NULL_HANDLE) {
+    cerr << "ERROR: failed to store object reference in wrapper." << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+  *err = SUCCESS;
+  return result;
+}
+
+extern "C"
+double wconOct_MeasurementUnit_to_canon(WconOctError *err,
+					const WconOctHandle selfHandle,
+					const double val) {
+  WconOctStatScope stat(WCONOCT_STAT_MU_TO_CANON, err, true);
+  const NativeMeasurementUnit *unit = nativeInternalGetUnit(err, selfHandle);
+  if (unit == NULL) {
+    return -1.0;
+  }
+  *err = SUCCESS;
+  return unit->toCanon(val);
+}
+
+extern "C"
+double wconOct_MeasurementUnit_from_canon(WconOctError *err,
+					  const WconOctHandle selfHandle,
+					  const double val) {
+  WconOctStatScope stat(WCONOCT_STAT_MU_FROM_CANON, err, true);
+  const NativeMeasurementUnit *unit = nativeInternalGetUnit(err, selfHandle);
+  if (unit == NULL) {
+    return -1.0;
+  }
+  *err = SUCCESS;
+  return unit->fromCanon(val);
+}
+
+// The strings belong to the unit, and live as long as its handle
+extern "C"
+const char *wconOct_MeasurementUnit_unit_string(WconOctError *err,
+						const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_MU_UNIT_STRING, err, true);
+  const NativeMeasurementUnit *unit = nativeInternalGetUnit(err, selfHandle);
+  if (unit == NULL) {
+    return NULL;
+  }
+  *err = SUCCESS;
+  return unit->unitString().c_str();
+}
+
+extern "C"
+const char *wconOct_MeasurementUnit_canonical_unit_string(WconOctError *err,
+						const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_MU_CANONICAL_UNIT_STRING, err, true);
+  const NativeMeasurementUnit *unit = nativeInternalGetUnit(err, selfHandle);
+  if (unit == NULL) {
+    return NULL;
+  }
+  *err = SUCCESS;
+  return unit->canonicalUnitString().c_str();
+}
@@ -0,0 +1,1209 @@
+#include "octaveWconPythonWrapper.h"
+
+#include <iostream>
+#include <stdlib.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <map>
+#include <thread>
+#include <vector>
+using namespace std;
+
+#include "nativeInternal.h"
+#include "nativeResample.h"
+#include "wcondProtocol.h"
+#include "wrapperStats.h"
+#include "wrapperLoadCache.h"
+#include "wrapperMemory.h"
+#include "wrapperSplit.h"
+#include "wrapperFeatures.h"
+
+// *****************************************************************
+// ********************** WCONWorms Class (native backend)
+//
+// Errors from the native code come up as exceptions; every entry point
+//   catches them here, reports them the way the Python backend reports
+//   Python exceptions, and returns FAILED.
+
+static char *nativeInternalCopyString(const string &s) {
+  char *result = new char[s.size()+1];
+  memcpy(result, s.c_str(), s.size()+1);
+  return result;
+}
+
+// Checks the error variable and looks up a WCONWorms handle. NULL with
+//   *err set to FAILED if either fails.
+static const NativeObject *nativeInternalGetWorms(WconOctError *err,
+						  WconOctHandle selfHandle) {
+  wconOct_initWrapper(err);
+  if (*err == FAILED) {
+    cerr << "Failed to initialize wrapper library." << endl;
+    return NULL;
+  }
+  const NativeObject *self =
+    nativeInternalGetObject(selfHandle, NativeObject::WCONWORMS);
+  if (self == NULL) {
+    cerr << "ERROR: Failed to acquire object instance using handle "
+	 << selfHandle << endl;
+    *err = FAILED;
+  }
+  return self;
+}
+
+static WconOctHandle nativeInternalStoreView(WconOctError *err,
+					     NativeObject::Kind kind,
+					     const NativeObject *self) {
+  NativeObject view;
+  view.kind = kind;
+  view.worms = self->worms;
+  WconOctHandle result = nativeInternalStoreObject(view);
+  if (wconOct_isNullHandle(result)) {
+    cerr << "ERROR: Failed to store object reference" << endl;
+    *err = FAILED;
+  } else {
+    *err = SUCCESS;
+  }
+  return result;
+}
+
+static WconOctHandle nativeInternalStoreWorms(WconOctError *err,
+				shared_ptr<const NativeWCONWorms> worms,
+				bool charged = true) {
+  NativeObject object;
+  object.kind = NativeObject::WCONWORMS;
+  object.worms = worms;
+  WconOctHandle result = nativeInternalStoreObject(object, charged);
+  if (wconOct_isNullHandle(result)) {
+    cerr << "ERROR: Failed to store object reference" << endl;
+    *err = FAILED;
+  } else {
+    *err = SUCCESS;
+  }
+  return result;
+}
+
+// The dataset of a WCONWorms with its columns, decoded first if the
+//   handle is compact and read in if it is paged, but in the units it
+//   was loaded in. Enough for eq, which goes to canonical units a worm
+//   at a time.
+static shared_ptr<const NativeWCONWorms>
+nativeInternalStoredWorms(const NativeObject *self) {
+  if (self->compact != NULL) {
+    return self->compact->expand(*(self->worms));
+  } else if (self->paged != NULL) {
+    return self->paged->expand(*(self->worms));
+  }
+  return self->worms;
+}
+
+// Bytes a WCONWorms takes once it is all in memory, for the memory cap
+static size_t nativeInternalDataBytes(WconOctHandle handle,
+				      const NativeObject *self) {
+  return wconOctMemoryBytes(handle) +
+    ((self->paged == NULL) ? 0 : (size_t)self->paged->diskBytes());
+}
+
+// save_to_file; a paged dataset is read in a worm at a time
+static void nativeInternalSave(const NativeObject *self, const char *path,
+			       bool prettyPrint, bool compressed,
+			       int level, int numThreads) {
+  if (self->paged != NULL) {
+    self->worms->saveToFile(path, prettyPrint, compressed, level,
+			    numThreads, self->paged.get());
+  } else {
+    nativeInternalStoredWorms(self)->saveToFile(path, prettyPrint,
+						compressed, level,
+						numThreads);
+  }
+}
+
+// The dataset of a WCONWorms as it is seen through the API: decoded,
+//   and converted to canonical units if the handle came from to_canon
+static shared_ptr<const NativeWCONWorms>
+nativeInternalFullWorms(const NativeObject *self) {
+  shared_ptr<const NativeWCONWorms> worms = nativeInternalStoredWorms(self);
+  return (self->canon == NULL) ? worms : worms->toCanon();
+}
+
+// Through wcond when it is running, which has usually parsed the file
+//   already
+static shared_ptr<NativeWCONWorms> nativeInternalLoad(const char *path) {
+  shared_ptr<NativeWCONWorms> worms;
+  if (!wcondClientLoad(path, worms)) {
+    worms = NativeWCONWorms::loadFromFile(path);
+  }
+  return worms;
+}
+
+// A dataset in the load cache, shared by the handles of its loads
+class NativeInternalCachedLoad : public WconOctCachedLoad {
+ public:
+  explicit NativeInternalCachedLoad(shared_ptr<const NativeWCONWorms> worms)
+    : worms(worms) {}
+  bool inUse() const { return worms.use_count() > 1; }
+
+  shared_ptr<const NativeWCONWorms> worms;
+};
+
+// The dataset the load cache has for path, NULL on a miss
+static shared_ptr<const NativeWCONWorms>
+nativeInternalCachedLoad(const char *path, WconOctLoadCacheKey &key) {
+  shared_ptr<WconOctCachedLoad> cached = wconOctLoadCacheFind(path, key);
+  if (cached == NULL) {
+    return shared_ptr<const NativeWCONWorms>();
+  }
+  return static_pointer_cast<NativeInternalCachedLoad>(cached)->worms;
+}
+
+// A handle on what the file of key loaded into: from the cache (hit),
+//   or just loaded and then cached, once the handle holds it so that
+//   the cache never sees it idle
+static WconOctHandle
+nativeInternalStoreLoad(WconOctError *err, const WconOctLoadCacheKey &key,
+			shared_ptr<const NativeWCONWorms> worms, bool hit) {
+  WconOctHandle result = nativeInternalStoreWorms(err, worms, false);
+  if (*err == FAILED || hit) {
+    return result;
+  }
+  shared_ptr<WconOctCachedLoad> value(new NativeInternalCachedLoad(worms));
+  if (!wconOctLoadCacheInsert(key, value, worms->byteSize())) {
+    wconOctMemoryGrow(result, worms->byteSize());
+  }
+  return result;
+}
+
+extern "C"
+WconOctHandle wconOct_static_WCONWorms_load_from_file(WconOctError *err,
+						     const char *wconpath) {
+  WconOctStatScope stat(WCONOCT_STAT_LOAD_FROM_FILE, err);
+  wconOct_initWrapper(err); // just hand off user error variable
+  if (*err == FAILED) {
+    cerr << "ERROR: Failed to initialize wrapper library." << endl;
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  try {
+    WconOctLoadCacheKey key;
+    shared_ptr<const NativeWCONWorms> cached =
+      nativeInternalCachedLoad(wconpath, key);
+    if (cached != NULL) {
+      return nativeInternalStoreLoad(err, key, cached, true);
+    }
+    if (!wconOctMemoryAdmit(wconOctMemoryFileSize(wconpath))) {
+      *err = FAILED;
+      return WCONOCT_NULL_HANDLE;
+    }
+    return nativeInternalStoreLoad(err, key, nativeInternalLoad(wconpath),
+				   false);
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+}
+
+// Not through wcond, which would hold the whole dataset; no memory cap
+//   either, since the columns stay on disk
+extern "C"
+WconOctHandle wconOct_static_WCONWorms_load_paged(WconOctError *err,
+						  const char *wconpath) {
+  WconOctStatScope stat(WCONOCT_STAT_LOAD_PAGED, err);
+  wconOct_initWrapper(err);
+  if (*err == FAILED) {
+    cerr << "ERROR: Failed to initialize wrapper library." << endl;
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  try {
+    NativeObject object;
+    object.kind = NativeObject::WCONWORMS;
+    shared_ptr<NativeWCONWorms> stripped;
+    bool chunked = false;
+    object.paged = NativePagedStore::load(wconpath, stripped, chunked);
+    object.worms = stripped;
+    // load_from_file merges chunks in canonical units
+    if (chunked) {
+      object.canon.reset(new NativeCanonView(*stripped));
+    }
+    WconOctHandle result = nativeInternalStoreObject(object);
+    if (wconOct_isNullHandle(result)) {
+      cerr << "ERROR: Failed to store object reference" << endl;
+      *err = FAILED;
+    } else {
+      *err = SUCCESS;
+    }
+    return result;
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+}
+
+// $envName, or one per core up to 8, for n pieces of work. No more files
+//   than that are being parsed or written at once, which bounds the
+//   memory they take.
+static size_t nativeInternalThreads(const char *envName, size_t n) {
+  size_t count = thread::hardware_concurrency();
+  count = (count == 0) ? 1 : min(count, (size_t)8);
+  const char *env = getenv(envName);
+  if (env != NULL && atol(env) > 0) {
+    count = (size_t)atol(env);
+  }
+  return max((size_t)1, min(count, n));
+}
+
+// A file of load_many, from the load cache or loaded by a worker; both
+//   NULL if it failed. pendingSize is what it added to pendingBytes.
+struct NativeInternalManyResult {
+  WconOctLoadCacheKey key;
+  shared_ptr<const NativeWCONWorms> cached;
+  shared_ptr<NativeWCONWorms> loaded;
+  size_t pendingSize;
+
+  NativeInternalManyResult() : pendingSize(0) {}
+};
+
+// Parses paths[next..] on one thread of load_many
+static void nativeInternalLoadBatch(const char **paths, size_t n,
+				    atomic<size_t> *next,
+				    atomic<size_t> *pendingBytes,
+				    vector<NativeInternalManyResult> *results) {
+  for (size_t i = (*next)++; i < n; i = (*next)++) {
+    if (paths[i] == NULL) {
+      cerr << "ERROR: load_many: path " << i << " is NULL" << endl;
+      continue;
+    }
+    NativeInternalManyResult &result = (*results)[i];
+    try {
+      result.cached = nativeInternalCachedLoad(paths[i], result.key);
+      if (result.cached != NULL) {
+	continue;
+      }
+      // Counts the files parsed so far in this batch, which are not
+      //   charged to any handle yet
+      size_t size = wconOctMemoryFileSize(paths[i]);
+      if (!wconOctMemoryAdmit(*pendingBytes + size)) {
+	continue;
+      }
+      *pendingBytes += size;
+      result.pendingSize = size;
+      result.loaded = nativeInternalLoad(paths[i]);
+    } catch (const exception &e) {
+      cerr << "ERROR: " << e.what() << endl;
+      // Nothing is held for a file that failed
+      *pendingBytes -= result.pendingSize;
+      result.pendingSize = 0;
+    }
+  }
+}
+
+extern "C"
+void wconOct_load_many(WconOctError *err, const char **paths, size_t n,
+		       WconOctHandle *out, WconOctError *per_file_err) {
+  WconOctStatScope stat(WCONOCT_STAT_LOAD_MANY, err);
+  wconOct_initWrapper(err);
+  if (*err == FAILED) {
+    cerr << "ERROR: Failed to initialize wrapper library." << endl;
+    return;
+  }
+  if (n > 0 && (paths == NULL || out == NULL || per_file_err == NULL)) {
+    cerr << "ERROR: load_many needs paths, out and per_file_err" << endl;
+    *err = FAILED;
+    return;
+  }
+
+  vector<NativeInternalManyResult> results(n);
+  atomic<size_t> next(0), pendingBytes(0);
+  size_t numThreads = nativeInternalThreads("WCONOCT_LOAD_THREADS", n);
+  vector<thread> threads;
+  for (size_t t=1; t<numThreads; t++) {
+    threads.push_back(thread(nativeInternalLoadBatch, paths, n, &next,
+			     &pendingBytes, &results));
+  }
+  nativeInternalLoadBatch(paths, n, &next, &pendingBytes, &results);
+  for (size_t t=0; t<threads.size(); t++) {
+    threads[t].join();
+  }
+
+  // One unit object for each unit string across the files loaded here
+  //   (not those from the cache, which others may be reading), and
+  //   handles stored on this thread so that the memory report has them
+  //   from load_many
+  map<string, shared_ptr<const NativeMeasurementUnit> > sharedUnits;
+  *err = SUCCESS;
+  for (size_t i=0; i<n; i++) {
+    out[i] = WCONOCT_NULL_HANDLE;
+    per_file_err[i] = FAILED;
+    NativeInternalManyResult &result = results[i];
+    if (result.cached != NULL) {
+      out[i] = nativeInternalStoreLoad(&per_file_err[i], result.key,
+				       result.cached, true);
+    } else if (result.loaded != NULL) {
+      NativeUnitsList &units = result.loaded->units;
+      for (size_t u=0; u<units.size(); u++) {
+	shared_ptr<const NativeMeasurementUnit> &shared =
+	  sharedUnits[units[u].second->unitString()];
+	if (!shared) {
+	  shared = units[u].second;
+	}
+	units[u].second = shared;
+      }
+      out[i] = nativeInternalStoreLoad(&per_file_err[i], result.key,
+				       result.loaded, false);
+      // Charged to its handle now, if it got one
+      pendingBytes -= result.pendingSize;
+    }
+    result.cached.reset();
+    result.loaded.reset();
+    if (per_file_err[i] == FAILED) {
+      *err = FAILED;
+    }
+  }
+}
+
+extern "C"
+void wconOct_WCONWorms_save_to_file(WconOctError *err,
+				    const WconOctHandle selfHandle,
+				    const char *output_path,
+				    int pretty_print,
+				    int compressed) {
+  WconOctStatScope stat(WCONOCT_STAT_SAVE_TO_FILE, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return;
+  }
+
+  try {
+    nativeInternalSave(self, output_path, pretty_print != 0,
+		       compressed != 0, -1, 0);
+    *err = SUCCESS;
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+  }
+}
+
+extern "C"
+void wconOct_WCONWorms_save_compressed(WconOctError *err,
+				       const WconOctHandle selfHandle,
+				       const char *output_path,
+				       int pretty_print,
+				       int level, int numThreads) {
+  WconOctStatScope stat(WCONOCT_STAT_SAVE_COMPRESSED, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return;
+  }
+
+  try {
+    nativeInternalSave(self, output_path, pretty_print != 0, true, level,
+		       numThreads);
+    *err = SUCCESS;
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+  }
+}
+
+// Frame k of worm i as the API sees it, read alone from a paged handle
+static double nativeInternalFrameTime(const NativeObject &self, size_t i,
+				      long k) {
+  double t;
+  if (self.paged != NULL) {
+    NativeWorm frame;
+    self.paged->read(*(self.worms), i, k, k + 1, frame);
+    t = frame.t[0];
+  } else {
+    t = self.worms->worms[i].t[k];
+  }
+  const NativeMeasurementUnit *unit =
+    (self.canon == NULL) ? NULL : self.canon->conversion("t");
+  return (unit == NULL) ? t : unit->toCanon(t);
+}
+
+// The first frame of worm i at t or later, as lower_bound would find it
+static long nativeInternalFrameBound(const NativeObject &self, size_t i,
+				     double t) {
+  long first = 0, count = self.worms->worms[i].numFrames;
+  while (count > 0) {
+    long step = count / 2;
+    if (nativeInternalFrameTime(self, i, first + step) < t) {
+      first += step + 1;
+      count -= step + 1;
+    } else {
+      count = step;
+    }
+  }
+  return first;
+}
+
+// Frames [first, last) of worm i as the API sees it, with every column
+static void nativeInternalReadFrames(const NativeObject &self, size_t i,
+				     long first, long last,
+				     NativeWorm &frames) {
+  self.worms->copyFrames(i, first, last, frames);
+  if (self.paged != NULL) {
+    self.paged->read(*(self.worms), i, first, last, frames);
+  } else if (self.compact != NULL) {
+    long m = frames.maxPoints;
+    frames.x.resize((last - first) * m);
+    frames.y.resize((last - first) * m);
+    if (!frames.x.empty()) {
+      self.compact->decode(i, first, last, &frames.x[0], &frames.y[0], m);
+    }
+  }
+  if (self.canon != NULL) {
+    self.canon->convertWorm(frames);
+  }
+}
+
+// The frames with t0 <= t < t1 as the API sees them. Only those are
+//   read, so that splitting a paged, compact or to_canon handle never
+//   needs more than a chunk of it in memory.
+static shared_ptr<NativeWCONWorms>
+nativeInternalTimeSlice(const NativeObject &self, double t0, double t1) {
+  const NativeWCONWorms &stored = *(self.worms);
+  shared_ptr<NativeWCONWorms> w(new NativeWCONWorms);
+  w->units = (self.canon == NULL) ? stored.units : self.canon->units;
+  w->hasMetadata = stored.hasMetadata;
+  w->metadata = stored.metadata;
+  w->featureNames = stored.featureNames;
+  for (size_t i=0; i<stored.worms.size(); i++) {
+    long first = nativeInternalFrameBound(self, i, t0);
+    long last = nativeInternalFrameBound(self, i, t1);
+    if (first >= last) {
+      continue;
+    }
+    w->worms.push_back(NativeWorm());
+    nativeInternalReadFrames(self, i, first, last, w->worms.back());
+  }
+  return w;
+}
+
+// Writes chunks[next..] on one thread of split. Failures are counted
+//   in failed.
+static void nativeInternalSplitBatch(NativeObject self,
+				     const vector<WconOctSplitChunk> *chunks,
+				     bool compressed, atomic<size_t> *next,
+				     atomic<size_t> *failed) {
+  for (size_t i = (*next)++; i < chunks->size(); i = (*next)++) {
+    const WconOctSplitChunk &chunk = (*chunks)[i];
+    try {
+      shared_ptr<NativeWCONWorms> part =
+	nativeInternalTimeSlice(self, chunk.t0, chunk.t1);
+      WconJsonValue &files = part->files;
+      files.type = WconJsonValue::JSON_OBJECT;
+      files.members.resize(3);
+      files.members[0].first = "current";
+      files.members[0].second.type = WconJsonValue::JSON_STRING;
+      files.members[0].second.strValue = chunk.current;
+      files.members[1].first = "prev";
+      files.members[2].first = "next";
+      const string *links[] = {&chunk.prev, &chunk.next};
+      for (int k=0; k<2; k++) {
+	WconJsonValue &link = files.members[k + 1].second;
+	link.type = WconJsonValue::JSON_ARRAY;
+	if (!links[k]->empty()) {
+	  link.items.resize(1);
+	  link.items[0].type = WconJsonValue::JSON_STRING;
+	  link.items[0].strValue = *links[k];
+	}
+      }
+      part->saveToFile(chunk.path, false, compressed);
+    } catch (const exception &e) {
+      cerr << "ERROR: " << chunk.path << ": " << e.what() << endl;
+      (*failed)++;
+    }
+  }
+}
+
+// Chunks are written side by side on $WCONOCT_SPLIT_THREADS threads,
+//   each cut from the handle as the API sees it (the chunk times were
+//   planned through worm_frames and units, which are canonical on a
+//   to_canon view)
+bool wconOctSplitWrite(WconOctHandle selfHandle,
+		       const vector<WconOctSplitChunk> &chunks,
+		       bool compressed) {
+  const NativeObject *self =
+    nativeInternalGetObject(selfHandle, NativeObject::WCONWORMS);
+  if (self == NULL) {
+    return false;
+  }
+  atomic<size_t> next(0), failed(0);
+  size_t numThreads = nativeInternalThreads("WCONOCT_SPLIT_THREADS",
+					    chunks.size());
+  vector<thread> threads;
+  for (size_t t=1; t<numThreads; t++) {
+    threads.push_back(thread(nativeInternalSplitBatch, *self, &chunks,
+			     compressed, &next, &failed));
+  }
+  nativeInternalSplitBatch(*self, &chunks, compressed, &next, &failed);
+  for (size_t t=0; t<threads.size(); t++) {
+    threads[t].join();
+  }
+  return failed == 0;
+}
+
+// A copy of the dataset with the features in it, replacing any it had
+WconOctHandle wconOctFeaturesAttach(WconOctError *err,
+				    WconOctHandle selfHandle,
+				    const WconOctFeatureSet &features) {
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return WCONOCT_NULL_HANDLE;
+  }
+  if (!wconOctMemoryAdmit(nativeInternalDataBytes(selfHandle, self))) {
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  try {
+    shared_ptr<NativeWCONWorms> w(
+      new NativeWCONWorms(*nativeInternalFullWorms(self)));
+    w->dropFeatures();
+    // Units left over from features saved and loaded again
+    for (size_t i=w->units.size(); i-- > 0; ) {
+      if (find(features.names.begin(), features.names.end(),
+	       w->units[i].first) != features.names.end()) {
+	w->units.erase(w->units.begin() + i);
+      }
+    }
+    w->featureNames = features.names;
+    for (size_t f=0; f<features.names.size(); f++) {
+      w->units.push_back(make_pair(features.names[f],
+			   NativeMeasurementUnit::create(features.units[f])));
+    }
+    for (size_t i=0; i<w->worms.size(); i++) {
+      w->worms[i].features = features.columns[i];
+    }
+    return nativeInternalStoreWorms(err, w);
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+}
+
+extern "C"
+WconOctHandle wconOct_WCONWorms_to_canon(WconOctError *err,
+					const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_TO_CANON, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  // A view: the data stays where it is, and is converted as it is read
+  try {
+    NativeObject object = *self;
+    if (object.canon == NULL) {
+      object.canon.reset(new NativeCanonView(*(self->worms)));
+    }
+    WconOctHandle result = nativeInternalStoreObject(object);
+    if (wconOct_isNullHandle(result)) {
+      cerr << "ERROR: Failed to store object reference" << endl;
+      *err = FAILED;
+    } else {
+      *err = SUCCESS;
+    }
+    return result;
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+}
+
+extern "C"
+WconOctHandle wconOct_WCONWorms_materialize(WconOctError *err,
+					    const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_MATERIALIZE, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return WCONOCT_NULL_HANDLE;
+  }
+  if ((self->canon != NULL || self->compact != NULL ||
+       self->paged != NULL) &&
+      !wconOctMemoryAdmit(nativeInternalDataBytes(selfHandle, self))) {
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  try {
+    return nativeInternalStoreWorms(err, nativeInternalFullWorms(self));
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+}
+
+extern "C"
+WconOctHandle wconOct_WCONWorms_resample(WconOctError *err,
+					 const WconOctHandle selfHandle,
+					 double dt,
+					 const double *times, long numTimes,
+					 WconOctInterpolation method,
+					 double maxGap) {
+  WconOctStatScope stat(WCONOCT_STAT_RESAMPLE, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return WCONOCT_NULL_HANDLE;
+  }
+  if (numTimes < 0 || (numTimes > 0 && times == NULL)) {
+    cerr << "ERROR: resample needs numTimes times" << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  NativeResampleOptions opts;
+  opts.dt = dt;
+  if (!(dt > 0)) {
+    opts.times.assign(times, times + numTimes);
+  }
+  opts.method = method;
+  opts.maxGap = maxGap;
+  opts.threads = (long)nativeInternalThreads("WCONOCT_RESAMPLE_THREADS",
+					     self->worms->worms.size());
+  // The result is usually about as big as the input
+  if (!wconOctMemoryAdmit(nativeInternalDataBytes(selfHandle, self))) {
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  try {
+    return nativeInternalStoreWorms(err,
+		   nativeResample(*nativeInternalFullWorms(self), opts));
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+}
+
+extern "C"
+WconOctHandle wconOct_WCONWorms_add(WconOctError *err,
+				    const WconOctHandle selfHandle,
+				    const WconOctHandle handle) {
+  WconOctStatScope stat(WCONOCT_STAT_ADD, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return WCONOCT_NULL_HANDLE;
+  }
+  const NativeObject *other = nativeInternalGetWorms(err, handle);
+  if (other == NULL) {
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  if (!wconOctMemoryAdmit(nativeInternalDataBytes(selfHandle, self) +
+			  nativeInternalDataBytes(handle, other))) {
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  try {
+    return nativeInternalStoreWorms(err,
+		   NativeWCONWorms::merge(*nativeInternalFullWorms(self),
+					  *nativeInternalFullWorms(other)));
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+}
+
+extern "C"
+int wconOct_WCONWorms_eq(WconOctError *err,
+			 const WconOctHandle selfHandle,
+			 const WconOctHandle handle) {
+  WconOctStatScope stat(WCONOCT_STAT_EQ, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return 0;
+  }
+  const NativeObject *other = nativeInternalGetWorms(err, handle);
+  if (other == NULL) {
+    return 0;
+  }
+
+  try {
+    int result = (*nativeInternalStoredWorms(self) ==
+		  *nativeInternalStoredWorms(other)) ? 1 : 0;
+    *err = SUCCESS;
+    return result;
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+    return 0;
+  }
+}
+
+extern "C"
+WconOctUnitsDict *wconOct_WCONWorms_units(WconOctError *err,
+					  const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_UNITS, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return NULL;
+  }
+
+  // Keys are spelled as the Python backend spells them, i.e. as
+  //   ascii() of the key, quotes included.
+  const NativeUnitsList &units =
+    (self->canon == NULL) ? self->worms->units : self->canon->units;
+  int num = (int)units.size();
+  WconOctUnitsKeyValue *retKeyValueArray = new WconOctUnitsKeyValue[num];
+  for (int idx=0; idx<num; idx++) {
+    NativeObject unit;
+    unit.kind = NativeObject::MEASUREMENT_UNIT;
+    unit.unit = units[idx].second;
+    WconOctHandle muHandle = nativeInternalStoreObject(unit);
+    if (muHandle == WCONOCT_NULL_HANDLE) {
+      cerr << "ERROR: units index " << idx
+	   << " :Failed to store object reference in wrapper." << endl;
+      for (int i=0; i<idx; i++) {
+	delete [] retKeyValueArray[i].key;
+      }
+      delete [] retKeyValueArray;
+      *err = FAILED;
+      return NULL;
+    }
+    retKeyValueArray[idx].value = muHandle;
+    retKeyValueArray[idx].key =
+      nativeInternalCopyString(nativePyRepr(units[idx].first, true));
+  }
+  WconOctUnitsDict *result = new WconOctUnitsDict;
+  result->numElements = num;
+  result->unitsDict = retKeyValueArray;
+  *err = SUCCESS;
+  return result;
+}
+
+extern "C"
+WconOctHandle wconOct_WCONWorms_metadata(WconOctError *err,
+					const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_METADATA, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  if (!self->worms->hasMetadata) {
+    *err = SUCCESS;
+    return WCONOCT_NONE_HANDLE;
+  }
+  return nativeInternalStoreView(err, NativeObject::METADATA, self);
+}
+
+extern "C"
+WconOctHandle wconOct_WCONWorms_data(WconOctError *err,
+				     const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_DATA, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  // WCONWorms.data is None when there are no worms
+  if (self->worms->worms.empty()) {
+    *err = SUCCESS;
+    return WCONOCT_NONE_HANDLE;
+  }
+  return nativeInternalStoreView(err, NativeObject::DATA, self);
+}
+
+extern "C"
+long wconOct_WCONWorms_num_worms(WconOctError *err,
+				 const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_NUM_WORMS, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return -1;
+  }
+
+  *err = SUCCESS;
+  return (long)self->worms->worms.size();
+}
+
+extern "C"
+WconOctHandle wconOct_WCONWorms_worm_ids(WconOctError *err,
+					const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_WORM_IDS, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  return nativeInternalStoreView(err, NativeObject::WORM_IDS, self);
+}
+
+extern "C"
+WconOctHandle wconOct_WCONWorms_data_as_odict(WconOctError *err,
+					     const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_DATA_AS_ODICT, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  return nativeInternalStoreView(err, NativeObject::DATA, self);
+}
+
+extern "C"
+char *wconOct_WCONWorms_metadata_json(WconOctError *err,
+				      const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_METADATA_JSON, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return NULL;
+  }
+
+  if (!self->worms->hasMetadata) {
+    *err = SUCCESS;
+    return NULL;
+  }
+  try {
+    // As json.dumps: members in file order, compact separators
+    WconJsonWriter writer;
+    writer.writeValue(self->worms->metadata);
+    *err = SUCCESS;
+    return nativeInternalCopyString(writer.text());
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+    return NULL;
+  }
+}
+
+// Only the points are encoded; everything else stays as it is
+extern "C"
+WconOctHandle wconOct_WCONWorms_compact(WconOctError *err,
+					const WconOctHandle selfHandle,
+					WconOctCompactMode mode,
+					double quantum,
+					WconOctCompactInfo *info) {
+  WconOctStatScope stat(WCONOCT_STAT_COMPACT, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  try {
+    shared_ptr<const NativeWCONWorms> worms = nativeInternalFullWorms(self);
+    WconOctCompactInfo compactInfo;
+    NativeObject object;
+    object.kind = NativeObject::WCONWORMS;
+    object.compact = NativeCompactSpines::encode(*worms, mode, quantum,
+						 compactInfo);
+    object.worms = NativeCompactSpines::strip(*worms);
+    WconOctHandle result = nativeInternalStoreObject(object);
+    if (wconOct_isNullHandle(result)) {
+      cerr << "ERROR: Failed to store object reference" << endl;
+      *err = FAILED;
+      return result;
+    }
+    if (info != NULL) {
+      *info = compactInfo;
+    }
+    *err = SUCCESS;
+    return result;
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+}
+
+extern "C"
+long wconOct_WCONWorms_points(WconOctError *err,
+			      const WconOctHandle selfHandle,
+			      long wormIndex, long firstFrame, long numFrames,
+			      double *x, double *y) {
+  WconOctStatScope stat(WCONOCT_STAT_POINTS, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return 0;
+  }
+  const vector<NativeWorm> &worms = self->worms->worms;
+  if (wormIndex < 0 || wormIndex >= (long)worms.size()) {
+    cerr << "ERROR: Worm index " << wormIndex << " out of range" << endl;
+    *err = FAILED;
+    return 0;
+  }
+  const NativeWorm &worm = worms[wormIndex];
+  if ((x == NULL) != (y == NULL) || firstFrame < 0 || numFrames < 0 ||
+      firstFrame + numFrames > worm.numFrames) {
+    cerr << "ERROR: points needs both x and y or neither, and frames "
+	 << "within the " << worm.numFrames << " of the worm" << endl;
+    *err = FAILED;
+    return 0;
+  }
+  if (x != NULL && worm.maxPoints > 0) {
+    long end = firstFrame + numFrames;
+    if (self->compact != NULL) {
+      self->compact->decode(wormIndex, firstFrame, end, x, y,
+			    worm.maxPoints);
+    } else if (self->paged != NULL) {
+      self->paged->decode(*(self->worms), wormIndex, firstFrame, end, x, y,
+			  worm.maxPoints);
+    } else {
+      size_t begin = firstFrame * worm.maxPoints;
+      size_t count = numFrames * worm.maxPoints;
+      copy(worm.x.begin() + begin, worm.x.begin() + begin + count, x);
+      copy(worm.y.begin() + begin, worm.y.begin() + begin + count, y);
+    }
+    const NativeMeasurementUnit *unitX =
+      (self->canon == NULL) ? NULL : self->canon->conversion("x");
+    const NativeMeasurementUnit *unitY =
+      (self->canon == NULL) ? NULL : self->canon->conversion("y");
+    if (unitX != NULL) {
+      NativeCanonView::apply(*unitX, x, numFrames * worm.maxPoints, x);
+    }
+    if (unitY != NULL) {
+      NativeCanonView::apply(*unitY, y, numFrames * worm.maxPoints, y);
+    }
+  }
+  *err = SUCCESS;
+  return worm.maxPoints;
+}
+
+// Keeps the dataset behind the views of a WconOctWormData alive, even
+//   if its handle goes away first.
+struct NativeInternalWormDataOwner {
+  shared_ptr<const NativeWCONWorms> worms;
+  // Columns that do not point into the dataset: read from the pages of
+  //   a paged handle, decoded from a compact one, converted for a
+  //   to_canon one
+  NativeWorm frames;
+  vector<double> t, x, y, cx, cy, aspectSize;
+};
+
+static void nativeInternalSetView(WconOctArrayView *view,
+				  const vector<double> &values,
+				  long rows, long cols) {
+  view->data = values.empty() ? NULL : &values[0];
+  view->rows = values.empty() ? 0 : rows;
+  view->cols = values.empty() ? 0 : cols;
+  view->rowStride = cols;
+  view->colStride = 1;
+}
+
+// Rows [first, first + rows) of a column of cols values per row, as
+//   seen through the API, into view: straight into the dataset when
+//   nothing needs converting, else copied into converted. values that
+//   hold just those rows already (read or decoded) start at first 0.
+static void nativeInternalSetColumn(const NativeObject *self,
+				    const string &key,
+				    const vector<double> &values,
+				    long first, long rows, long cols,
+				    vector<double> &converted,
+				    WconOctArrayView *view) {
+  const NativeMeasurementUnit *unit =
+    (self->canon == NULL) ? NULL : self->canon->conversion(key);
+  if (values.empty()) {
+    nativeInternalSetView(view, values, rows, cols);
+  } else if (unit == NULL) {
+    view->data = &values[0] + first * cols;
+    view->rows = rows;
+    view->cols = cols;
+    view->rowStride = cols;
+    view->colStride = 1;
+  } else {
+    converted.resize(rows * cols);
+    if (!converted.empty()) {
+      NativeCanonView::apply(*unit, &values[0] + first * cols,
+			     converted.size(), &converted[0]);
+    }
+    view->data = converted.empty() ? NULL : &converted[0];
+    view->rows = rows;
+    view->cols = cols;
+    view->rowStride = cols;
+    view->colStride = 1;
+  }
+}
+
+// worm_data and worm_frames. No copies: the views point straight into
+//   the dataset, except for the columns of a paged handle, the points of
+//   a compact one and the converted columns of a to_canon one. The worm
+//   and the frames must be in range.
+static WconOctWormData *
+nativeInternalWormFrames(const NativeObject *self, long wormIndex,
+			 long firstFrame, long numFrames) {
+  const NativeWorm &worm = self->worms->worms[wormIndex];
+  long m = worm.maxPoints;
+  NativeInternalWormDataOwner *owner = new NativeInternalWormDataOwner;
+  owner->worms = self->worms;
+  NativeWorm &frames = owner->frames;
+  // Where each column is, and the row of the window in it
+  const NativeWorm *columns = &worm, *points = &worm;
+  long first = firstFrame, pointsFirst = firstFrame;
+  try {
+    if (self->paged != NULL) {
+      self->paged->read(*(self->worms), wormIndex, firstFrame,
+			firstFrame + numFrames, frames);
+      columns = points = &frames;
+      first = pointsFirst = 0;
+    } else if (self->compact != NULL) {
+      frames.x.resize(numFrames * m);
+      frames.y.resize(numFrames * m);
+      if (!frames.x.empty()) {
+	self->compact->decode(wormIndex, firstFrame, firstFrame + numFrames,
+			      &frames.x[0], &frames.y[0], m);
+      }
+      points = &frames;
+      pointsFirst = 0;
+    }
+  } catch (...) {
+    delete owner;
+    throw;
+  }
+
+  WconOctWormData *result = new WconOctWormData;
+  result->owner = owner;
+  result->id = nativeInternalCopyString(worm.id);
+  result->numFrames = numFrames;
+  nativeInternalSetColumn(self, "t", columns->t, first, numFrames, 1,
+			  owner->t, &(result->t));
+  nativeInternalSetColumn(self, "x", points->x, pointsFirst, numFrames, m,
+			  owner->x, &(result->x));
+  nativeInternalSetColumn(self, "y", points->y, pointsFirst, numFrames, m,
+			  owner->y, &(result->y));
+  nativeInternalSetColumn(self, "cx", columns->cx, first, numFrames, 1,
+			  owner->cx, &(result->cx));
+  nativeInternalSetColumn(self, "cy", columns->cy, first, numFrames, 1,
+			  owner->cy, &(result->cy));
+  nativeInternalSetColumn(self, "aspect_size", columns->aspectSize, first,
+			  numFrames, 1, owner->aspectSize,
+			  &(result->aspectSize));
+  return result;
+}
+
+// The worm at wormIndex, or NULL with *err FAILED
+static const NativeWorm *nativeInternalGetWorm(WconOctError *err,
+					       const NativeObject *self,
+					       long wormIndex) {
+  const vector<NativeWorm> &worms = self->worms->worms;
+  if (wormIndex < 0 || wormIndex >= (long)worms.size()) {
+    cerr << "ERROR: Worm index " << wormIndex << " out of range" << endl;
+    *err = FAILED;
+    return NULL;
+  }
+  return &worms[wormIndex];
+}
+
+extern "C"
+WconOctWormData *wconOct_WCONWorms_worm_data(WconOctError *err,
+					     const WconOctHandle selfHandle,
+					     long wormIndex) {
+  WconOctStatScope stat(WCONOCT_STAT_WORM_DATA, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return NULL;
+  }
+  const NativeWorm *worm = nativeInternalGetWorm(err, self, wormIndex);
+  if (worm == NULL) {
+    return NULL;
+  }
+
+  try {
+    WconOctWormData *result =
+      nativeInternalWormFrames(self, wormIndex, 0, worm->numFrames);
+    *err = SUCCESS;
+    return result;
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+    return NULL;
+  }
+}
+
+extern "C"
+long wconOct_WCONWorms_num_frames(WconOctError *err,
+				  const WconOctHandle selfHandle,
+				  long wormIndex) {
+  WconOctStatScope stat(WCONOCT_STAT_NUM_FRAMES, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return -1;
+  }
+  const NativeWorm *worm = nativeInternalGetWorm(err, self, wormIndex);
+  if (worm == NULL) {
+    return -1;
+  }
+  *err = SUCCESS;
+  return worm->numFrames;
+}
+
+extern "C"
+WconOctWormData *wconOct_WCONWorms_worm_frames(WconOctError *err,
+					       const WconOctHandle selfHandle,
+					       long wormIndex,
+					       long firstFrame,
+					       long numFrames) {
+  WconOctStatScope stat(WCONOCT_STAT_WORM_FRAMES, err);
+  const NativeObject *self = nativeInternalGetWorms(err, selfHandle);
+  if (self == NULL) {
+    return NULL;
+  }
+  const NativeWorm *worm = nativeInternalGetWorm(err, self, wormIndex);
+  if (worm == NULL) {
+    return NULL;
+  }
+  if (firstFrame < 0 || numFrames < 0 ||
+      firstFrame + numFrames > worm->numFrames) {
+    cerr << "ERROR: worm_frames needs frames within the "
+	 << worm->numFrames << " of the worm" << endl;
+    *err = FAILED;
+    return NULL;
+  }
+
+  try {
+    WconOctWormData *result =
+      nativeInternalWormFrames(self, wormIndex, firstFrame, numFrames);
+    *err = SUCCESS;
+    return result;
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+    return NULL;
+  }
+}
+
+extern "C" void wconOct_freeWormData(WconOctWormData *wormData) {
+  WconOctStatScope stat(WCONOCT_STAT_FREE_WORM_DATA, NULL, true);
+  if (wormData == NULL) {
+    return;
+  }
+  delete (NativeInternalWormDataOwner *)wormData->owner;
+  delete [] wormData->id;
+  delete wormData;
+}
+
+extern "C" void wconOct_setPageCache(WconOctError *err, double megabytes) {
+  if (err == NULL) {
+    return;
+  }
+  if (!nativePageCacheSetBudget(megabytes * 1024.0 * 1024.0)) {
+    cerr << "ERROR: Page cache budget may not be negative" << endl;
+    *err = FAILED;
+    return;
+  }
+  *err = SUCCESS;
+}
+
+extern "C" void wconOct_pageCacheInfo(WconOctError *err,
+				      WconOctPageCacheInfo *info) {
+  if (err == NULL) {
+    return;
+  }
+  if (info == NULL) {
+    cerr << "ERROR: pageCacheInfo needs somewhere to put the info" << endl;
+    *err = FAILED;
+    return;
+  }
+  nativePageCacheInfo(*info);
+  *err = SUCCESS;
+}
@@ -6,6 +6,7 @@
 using namespace std;
 
 #include "wrapperInternal.h"
+#include "wrapperStats.h"
 
 extern PyObject *wrapperGlobalMeasurementUnitClassObj;
 
@@ -14,6 +15,7 @@ extern PyObject *wrapperGlobalMeasurementUnitClassObj;
 extern "C" 
 WconOctHandle wconOct_static_MeasurementUnit_create(WconOctError *err,
 						   const char *unitStr) {
+  WconOctStatScope stat(WCONOCT_STAT_MU_CREATE, err);
   PyObject *pErr, *pFunc;
 
   wconOct_initWrapper(err);
@@ -21,10 +23,11 @@ WconOctHandle wconOct_static_MeasurementUnit_create(WconOctError *err,
     cerr << "Failed to initialize wrapper library." << endl;
     return WCONOCT_NULL_HANDLE;
   }
+  WrapInternalGIL gil;
 
   pFunc = 
-    PyObject_GetAttrString(wrapperGlobalMeasurementUnitClassObj,
-			   "create");
+    WCONOCT_PYTHON(PyObject_GetAttrString(wrapperGlobalMeasurementUnitClassObj,
+			   "create"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -35,9 +38,11 @@ WconOctHandle wconOct_static_MeasurementUnit_create(WconOctError *err,
 
   if (PyCallable_Check(pFunc) == 1) {
     PyObject *pValue;
-    pValue = PyObject_CallFunctionObjArgs(pFunc, 
-					  PyUnicode_FromString(unitStr), 
-					  NULL);
+    // The argument is ours to release once the call returns
+    PyObject *pUnitStr = PyUnicode_FromString(unitStr);
+    pValue = WCONOCT_PYTHON(PyObject_CallFunctionObjArgs(pFunc, pUnitStr,
+							 NULL));
+    Py_XDECREF(pUnitStr);
     Py_DECREF(pFunc);
     pErr = PyErr_Occurred();
     if (pErr != NULL) {
@@ -79,6 +84,7 @@ extern "C"
 double wconOct_MeasurementUnit_to_canon(WconOctError *err,
 					const WconOctHandle selfHandle,
 					const double val) {
+  WconOctStatScope stat(WCONOCT_STAT_MU_TO_CANON, err, true);
   PyObject *MeasurementUnit_instance=NULL;
   PyObject *pErr, *pFunc;
 
@@ -87,6 +93,7 @@ double wconOct_MeasurementUnit_to_canon(WconOctError *err,
     cerr << "Failed to initialize wrapper library." << endl;
     return -1.0;
   }
+  WrapInternalGIL gil;
 
   MeasurementUnit_instance = wrapInternalGetReference(selfHandle);
   if (MeasurementUnit_instance == NULL) {
@@ -97,7 +104,7 @@ double wconOct_MeasurementUnit_to_canon(WconOctError *err,
   }
 
   pFunc = 
-    PyObject_GetAttrString(MeasurementUnit_instance,"to_canon");
+    WCONOCT_PYTHON(PyObject_GetAttrString(MeasurementUnit_instance,"to_canon"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -108,9 +115,9 @@ double wconOct_MeasurementUnit_to_canon(WconOctError *err,
 
   if (PyCallable_Check(pFunc) == 1) {
     PyObject *pValue;
-    pValue = PyObject_CallFunctionObjArgs(pFunc, 
-					    PyFloat_FromDouble(val),
-					    NULL);
+    PyObject *pVal = PyFloat_FromDouble(val);
+    pValue = WCONOCT_PYTHON(PyObject_CallFunctionObjArgs(pFunc, pVal, NULL));
+    Py_XDECREF(pVal);
     Py_DECREF(pFunc);
     pErr = PyErr_Occurred();
     if (pErr != NULL) {
@@ -150,6 +157,7 @@ extern "C"
 double wconOct_MeasurementUnit_from_canon(WconOctError *err,
 					  const WconOctHandle selfHandle,
 					  const double val) {
+  WconOctStatScope stat(WCONOCT_STAT_MU_FROM_CANON, err, true);
   PyObject *MeasurementUnit_instance=NULL;
   PyObject *pErr, *pFunc;
 
@@ -158,6 +166,7 @@ double wconOct_MeasurementUnit_from_canon(WconOctError *err,
     cerr << "Failed to initialize wrapper library." << endl;
     return -1.0;
   }
+  WrapInternalGIL gil;
 
   MeasurementUnit_instance = wrapInternalGetReference(selfHandle);
   if (MeasurementUnit_instance == NULL) {
@@ -168,7 +177,8 @@ double wconOct_MeasurementUnit_from_canon(WconOctError *err,
   }
 
   pFunc = 
-    PyObject_GetAttrString(MeasurementUnit_instance,"from_canon");
+    WCONOCT_PYTHON(PyObject_GetAttrString(MeasurementUnit_instance,
+					  "from_canon"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -179,9 +189,9 @@ double wconOct_MeasurementUnit_from_canon(WconOctError *err,
 
   if (PyCallable_Check(pFunc) == 1) {
     PyObject *pValue;
-    pValue = PyObject_CallFunctionObjArgs(pFunc, 
-					  PyFloat_FromDouble(val),
-					  NULL);
+    PyObject *pVal = PyFloat_FromDouble(val);
+    pValue = WCONOCT_PYTHON(PyObject_CallFunctionObjArgs(pFunc, pVal, NULL));
+    Py_XDECREF(pVal);
     Py_DECREF(pFunc);
     pErr = PyErr_Occurred();
     if (pErr != NULL) {
@@ -220,6 +230,7 @@ double wconOct_MeasurementUnit_from_canon(WconOctError *err,
 extern "C" 
 const char *wconOct_MeasurementUnit_unit_string(WconOctError *err,
 						const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_MU_UNIT_STRING, err, true);
   PyObject *MeasurementUnit_selfInstance=NULL;
   PyObject *pErr, *pAttr;
 
@@ -228,6 +239,7 @@ const char *wconOct_MeasurementUnit_unit_string(WconOctError *err,
     cerr << "Failed to initialize wrapper library." << endl;
     return NULL;
   }
+  WrapInternalGIL gil;
 
   MeasurementUnit_selfInstance = wrapInternalGetReference(selfHandle);
   if (MeasurementUnit_selfInstance == NULL) {
@@ -238,7 +250,8 @@ const char *wconOct_MeasurementUnit_unit_string(WconOctError *err,
   }
 
   pAttr = 
-    PyObject_GetAttrString(MeasurementUnit_selfInstance,"unit_string");
+    WCONOCT_PYTHON(PyObject_GetAttrString(MeasurementUnit_selfInstance,
+					  "unit_string"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -267,6 +280,7 @@ const char *wconOct_MeasurementUnit_unit_string(WconOctError *err,
 extern "C" 
 const char *wconOct_MeasurementUnit_canonical_unit_string(WconOctError *err,
 							  const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_MU_CANONICAL_UNIT_STRING, err, true);
   PyObject *MeasurementUnit_selfInstance=NULL;
   PyObject *pErr, *pAttr;
   
@@ -275,6 +289,7 @@ const char *wconOct_MeasurementUnit_canonical_unit_string(WconOctError *err,
     cerr << "Failed to initialize wrapper library." << endl;
     return NULL;
   }
+  WrapInternalGIL gil;
 
   MeasurementUnit_selfInstance = wrapInternalGetReference(selfHandle);
   if (MeasurementUnit_selfInstance == NULL) {
@@ -285,8 +300,8 @@ const char *wconOct_MeasurementUnit_canonical_unit_string(WconOctError *err,
   }
 
   pAttr = 
-    PyObject_GetAttrString(MeasurementUnit_selfInstance,
-			   "canonical_unit_string");
+    WCONOCT_PYTHON(PyObject_GetAttrString(MeasurementUnit_selfInstance,
+			   "canonical_unit_string"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -3,86 +3,291 @@
 #include <Python.h>
 
 #include <iostream>
+#include <errno.h>
+#include <stdio.h>
 #include <string.h>
+#include <map>
+#include <string>
+#include <vector>
 using namespace std;
 
+#include "wconCodec.h"
 #include "wrapperInternal.h"
+#include "wrapperStats.h"
+#include "wrapperLoadCache.h"
+#include "wrapperMemory.h"
+#include "wrapperSplit.h"
+#include "wrapperFeatures.h"
 
 extern PyObject *wrapperGlobalWCONWormsClassObj;
+extern PyObject *wrapperGlobalSplitChunkFunc;
+extern PyObject *wrapperGlobalResampleFunc;
+extern PyObject *wrapperGlobalWithFeaturesFunc;
+extern PyObject *wrapperGlobalLoadTextFunc;
 
 // *****************************************************************
 // ********************** WCONWorms Class
 
-extern "C" 
-WconOctHandle wconOct_static_WCONWorms_load_from_file(WconOctError *err,
-						     const char *wconpath) {
+// load_from_file of a gzip or zstd compressed file: the text is
+//   decompressed here and handed to WCONWorms.load. Called with the GIL.
+//   A new reference, or NULL with *err FAILED.
+static PyObject *wrapInternalLoadCompressed(WconOctError *err,
+					    const char *wconpath,
+					    WconCodec codec) {
+  string text;
+  try {
+    WconCodecSource source(wconpath, codec);
+    vector<char> buf(1 << 16);
+    size_t n;
+    while ((n = source.read(&buf[0], buf.size())) > 0) {
+      text.append(&buf[0], n);
+    }
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+    return NULL;
+  }
+  if (wrapperGlobalLoadTextFunc == NULL) {
+    cerr << "ERROR: No helper to load compressed text with" << endl;
+    *err = FAILED;
+    return NULL;
+  }
+
+  PyObject *pText = PyUnicode_DecodeUTF8(text.data(), text.size(), NULL);
+  PyObject *pValue = (pText == NULL) ? NULL :
+    WCONOCT_PYTHON(PyObject_CallFunctionObjArgs(wrapperGlobalLoadTextFunc,
+						wrapperGlobalWCONWormsClassObj,
+						pText, NULL));
+  Py_XDECREF(pText);
+  if (PyErr_Occurred() != NULL || pValue == NULL) {
+    PyErr_Print();
+    Py_XDECREF(pValue);
+    *err = FAILED;
+    return NULL;
+  }
+  *err = SUCCESS;
+  return pValue;
+}
+
+// A WCONWorms in the load cache, shared by the handles of its loads.
+//   The cache may let go of it on any thread, so it takes the GIL.
+class WrapInternalCachedLoad : public WconOctCachedLoad {
+ public:
+  explicit WrapInternalCachedLoad(PyObject *worms) : worms(worms) {
+    Py_INCREF(worms);
+  }
+  ~WrapInternalCachedLoad() {
+    WrapInternalGIL gil;
+    Py_DECREF(worms);
+  }
+  bool inUse() const { return Py_REFCNT(worms) > 1; }
+
+  PyObject *worms;
+};
+
+// WCONWorms.load_from_file, unless the load cache has the file (hit):
+//   a new reference, or NULL with *err FAILED. Called with the GIL.
+static PyObject *wrapInternalLoad(WconOctError *err, const char *wconpath,
+				  WconOctLoadCacheKey &key, bool &hit) {
   PyObject *pErr, *pFunc;
 
-  wconOct_initWrapper(err); // just hand off user error variable
-  if (*err == FAILED) {
-    cerr << "ERROR: Failed to initialize wrapper library." << endl;
-    return WCONOCT_NULL_HANDLE;
+  shared_ptr<WconOctCachedLoad> cached = wconOctLoadCacheFind(wconpath, key);
+  hit = (cached != NULL);
+  if (hit) {
+    PyObject *worms =
+      static_pointer_cast<WrapInternalCachedLoad>(cached)->worms;
+    Py_INCREF(worms);
+    *err = SUCCESS;
+    return worms;
+  }
+  if (!wconOctMemoryAdmit(wconOctMemoryFileSize(wconpath))) {
+    *err = FAILED;
+    return NULL;
+  }
+  WconCodec codec = wconCodecDetect(wconpath);
+  if (codec != WCON_CODEC_NONE) {
+    return wrapInternalLoadCompressed(err, wconpath, codec);
   }
 
   pFunc = 
-    PyObject_GetAttrString(wrapperGlobalWCONWormsClassObj,"load_from_file");
+    WCONOCT_PYTHON(PyObject_GetAttrString(wrapperGlobalWCONWormsClassObj,
+					  "load_from_file"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
     Py_XDECREF(pFunc);
     *err = FAILED;
-    return WCONOCT_NULL_HANDLE; // failure condition
+    return NULL; // failure condition
   }
-
-  if (PyCallable_Check(pFunc) == 1) {
-    PyObject *pValue;
-    pValue = PyObject_CallFunctionObjArgs(pFunc, 
-					  PyUnicode_FromString(wconpath), 
-					  NULL);
+  if (PyCallable_Check(pFunc) != 1) {
+    cerr << "ERROR: load_from_file not a callable python function" 
+	 << endl;
     Py_DECREF(pFunc);
-    pErr = PyErr_Occurred();
-    if (pErr != NULL) {
-      PyErr_Print();
-      Py_XDECREF(pValue);
-      *err = FAILED;
-      return WCONOCT_NULL_HANDLE;
+    *err = FAILED;
+    return NULL;
+  }
+
+  PyObject *pValue;
+  // The argument is ours to release once the call returns
+  PyObject *pPath = PyUnicode_FromString(wconpath);
+  pValue = WCONOCT_PYTHON(PyObject_CallFunctionObjArgs(pFunc, pPath, NULL));
+  Py_XDECREF(pPath);
+  Py_DECREF(pFunc);
+  pErr = PyErr_Occurred();
+  if (pErr != NULL) {
+    PyErr_Print();
+    Py_XDECREF(pValue);
+    *err = FAILED;
+    return NULL;
+  }
+  if (pValue == NULL) {
+    cerr << "ERROR: Null handle from load_from_file." << endl;
+    // No need to DECREF a NULL pValue
+    *err = FAILED;
+    return NULL;
+  }
+  *err = SUCCESS;
+  return pValue;
+}
+
+// A handle on what wrapInternalLoad gave, taking its reference. A new
+//   load goes into the cache once the handle holds it, so that the
+//   cache never sees it idle. Called with the GIL.
+static WconOctHandle wrapInternalStoreLoad(WconOctError *err,
+					   const WconOctLoadCacheKey &key,
+					   PyObject *pValue, bool hit) {
+  // do not DECREF pValue until it is no longer referenced in the
+  //   wrapper sublayer.
+  WconOctHandle result = wrapInternalStoreReference(pValue, false);
+  if (wconOct_isNullHandle(result)) {
+    cerr << "ERROR: Failed to store python object reference" << endl;
+    Py_DECREF(pValue);
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+  if (!hit) {
+    size_t bytes = wrapInternalSizeof(pValue);
+    shared_ptr<WconOctCachedLoad> value(new WrapInternalCachedLoad(pValue));
+    if (!wconOctLoadCacheInsert(key, value, bytes)) {
+      wconOctMemoryGrow(result, bytes);
     }
+  }
+  *err = SUCCESS;
+  return result;
+}
 
-    if (pValue != NULL) {
-      // do not DECREF pValue until it is no longer referenced in the
-      //   wrapper sublayer.
-      WconOctHandle result = wrapInternalStoreReference(pValue);
-      if (wconOct_isNullHandle(result)) {
-	cerr << "ERROR: Failed to store python object reference" 
-	     << endl;
-	Py_DECREF(pValue);
-	*err = FAILED;
-	return WCONOCT_NULL_HANDLE;
-      } else {
-	*err = SUCCESS;
-	return result;
+extern "C" 
+WconOctHandle wconOct_static_WCONWorms_load_from_file(WconOctError *err,
+						     const char *wconpath) {
+  WconOctStatScope stat(WCONOCT_STAT_LOAD_FROM_FILE, err);
+  wconOct_initWrapper(err); // just hand off user error variable
+  if (*err == FAILED) {
+    cerr << "ERROR: Failed to initialize wrapper library." << endl;
+    return WCONOCT_NULL_HANDLE;
+  }
+  WrapInternalGIL gil;
+  WconOctLoadCacheKey key;
+  bool hit = false;
+  PyObject *pValue = wrapInternalLoad(err, wconpath, key, hit);
+  if (pValue == NULL) {
+    return WCONOCT_NULL_HANDLE;
+  }
+  return wrapInternalStoreLoad(err, key, pValue, hit);
+}
+
+// Makes the units of a freshly loaded WCONWorms the ones in sharedUnits
+//   where their unit strings match, adding the others. sharedUnits owns
+//   a reference to each of its units.
+static void wrapInternalShareUnits(PyObject *WCONWorms_instance,
+				   map<string, PyObject *> &sharedUnits) {
+  PyObject *units = 
+    WCONOCT_PYTHON(PyObject_GetAttrString(WCONWorms_instance,"units"));
+  if (units == NULL || !PyDict_Check(units)) {
+    // Not sharing is no failure
+    PyErr_Clear();
+    Py_XDECREF(units);
+    return;
+  }
+  PyObject *key, *value;
+  Py_ssize_t pos = 0;
+  // Replacing the values of existing keys is allowed while iterating
+  while (PyDict_Next(units, &pos, &key, &value)) {
+    PyObject *unitString = 
+      WCONOCT_PYTHON(PyObject_GetAttrString(value,"unit_string"));
+    const char *unitStr = 
+      (unitString == NULL) ? NULL : PyUnicode_AsUTF8(unitString);
+    if (unitStr == NULL) {
+      PyErr_Clear();
+    } else {
+      map<string, PyObject *>::iterator found = sharedUnits.find(unitStr);
+      if (found == sharedUnits.end()) {
+	Py_INCREF(value);
+	sharedUnits[unitStr] = value;
+      } else if (found->second != value) {
+	PyDict_SetItem(units, key, found->second);
       }
+    }
+    Py_XDECREF(unitString);
+  }
+  Py_DECREF(units);
+}
+
+// The files are loaded one after the other: parsing happens in the
+//   interpreter, which would run one of them at a time anyway.
+extern "C"
+void wconOct_load_many(WconOctError *err, const char **paths, size_t n,
+		       WconOctHandle *out, WconOctError *per_file_err) {
+  WconOctStatScope stat(WCONOCT_STAT_LOAD_MANY, err);
+  wconOct_initWrapper(err);
+  if (*err == FAILED) {
+    cerr << "ERROR: Failed to initialize wrapper library." << endl;
+    return;
+  }
+  if (n > 0 && (paths == NULL || out == NULL || per_file_err == NULL)) {
+    cerr << "ERROR: load_many needs paths, out and per_file_err" << endl;
+    *err = FAILED;
+    return;
+  }
+  WrapInternalGIL gil;
+
+  map<string, PyObject *> sharedUnits;
+  *err = SUCCESS;
+  for (size_t i=0; i<n; i++) {
+    out[i] = WCONOCT_NULL_HANDLE;
+    per_file_err[i] = FAILED;
+    WconOctLoadCacheKey key;
+    bool hit = false;
+    PyObject *pValue = NULL;
+    if (paths[i] == NULL) {
+      cerr << "ERROR: load_many: path " << i << " is NULL" << endl;
     } else {
-      cerr << "ERROR: Null handle from load_from_file." << endl;
-      // No need to DECREF a NULL pValue
+      pValue = wrapInternalLoad(&per_file_err[i], paths[i], key, hit);
+    }
+    if (pValue == NULL) {
       *err = FAILED;
-      return WCONOCT_NULL_HANDLE;
+      continue;
     }
-  } else {
-    cerr << "ERROR: load_from_file not a callable python function" 
-	 << endl;
-    Py_DECREF(pFunc);
-    *err = FAILED;
-    return WCONOCT_NULL_HANDLE;
+    // Not those from the cache, which other handles hold
+    if (!hit) {
+      wrapInternalShareUnits(pValue, sharedUnits);
+    }
+    out[i] = wrapInternalStoreLoad(&per_file_err[i], key, pValue, hit);
+    if (per_file_err[i] == FAILED) {
+      *err = FAILED;
+    }
+  }
+  for (map<string, PyObject *>::iterator it = sharedUnits.begin();
+       it != sharedUnits.end(); ++it) {
+    Py_DECREF(it->second);
   }
 }
 
-extern "C" 
-void wconOct_WCONWorms_save_to_file(WconOctError *err,
-				    const WconOctHandle selfHandle,
-				    const char *output_path,
-				    int pretty_print,
-				    int compressed) {
+// WCONWorms.save_to_file
+static void wrapInternalPythonSave(WconOctError *err,
+				   const WconOctHandle selfHandle,
+				   const char *output_path,
+				   int pretty_print,
+				   int compressed) {
   PyObject *WCONWorms_instance=NULL;
   PyObject *pErr, *pFunc;
   
@@ -91,6 +296,7 @@ void wconOct_WCONWorms_save_to_file(WconOctError *err,
     cerr << "ERROR: Failed to initialize wrapper library." << endl;
     return;
   }
+  WrapInternalGIL gil;
 
   WCONWorms_instance = wrapInternalGetReference(selfHandle);
   if (WCONWorms_instance == NULL) {
@@ -101,7 +307,7 @@ void wconOct_WCONWorms_save_to_file(WconOctError *err,
   }
 
   pFunc = 
-    PyObject_GetAttrString(WCONWorms_instance,"save_to_file");
+    WCONOCT_PYTHON(PyObject_GetAttrString(WCONWorms_instance,"save_to_file"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -128,11 +334,13 @@ void wconOct_WCONWorms_save_to_file(WconOctError *err,
       Py_INCREF(Py_True);
       outputCompressed = Py_True;
     }
-    PyObject_CallFunctionObjArgs(pFunc, 
-				 PyUnicode_FromString(output_path),
-				 toPP,
-				 outputCompressed,
-				 NULL);
+    PyObject *pPath = PyUnicode_FromString(output_path);
+    PyObject *pValue = 
+      WCONOCT_PYTHON(PyObject_CallFunctionObjArgs(pFunc, pPath, toPP,
+						  outputCompressed, NULL));
+    // save_to_file returns None, which we hold a reference to as well
+    Py_XDECREF(pValue);
+    Py_XDECREF(pPath);
     Py_DECREF(toPP);
     Py_DECREF(outputCompressed);
     Py_DECREF(pFunc);
@@ -154,9 +362,181 @@ void wconOct_WCONWorms_save_to_file(WconOctError *err,
   }
 }
 
+// Compressed output other than zip: the interpreter writes the plain
+//   text next to output_path, and wconCodec compresses it from there
+static void wrapInternalSave(WconOctError *err,
+			     const WconOctHandle selfHandle,
+			     const char *output_path, int pretty_print,
+			     int compressed, int level, int numThreads) {
+  WconCodec codec = compressed ? wconCodecForName(output_path) :
+    WCON_CODEC_NONE;
+  if (codec == WCON_CODEC_NONE) {
+    wrapInternalPythonSave(err, selfHandle, output_path, pretty_print,
+			   compressed);
+    return;
+  }
+  string plain = string(output_path) + ".PLAIN";
+  wrapInternalPythonSave(err, selfHandle, plain.c_str(), pretty_print, 0);
+  if (*err == FAILED) {
+    remove(plain.c_str());
+    return;
+  }
+  FILE *fp = fopen(plain.c_str(), "rb");
+  try {
+    if (fp == NULL) {
+      throw WconCodecError("Cannot open " + plain + ": " + strerror(errno));
+    }
+    WconCodecSink sink(output_path, codec, level, numThreads);
+    vector<char> buf(1 << 16);
+    size_t n;
+    while ((n = fread(&buf[0], 1, buf.size(), fp)) > 0) {
+      sink.write(&buf[0], n);
+    }
+    if (ferror(fp)) {
+      throw WconCodecError("Cannot read " + plain + ": " + strerror(errno));
+    }
+    sink.close();
+    *err = SUCCESS;
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    *err = FAILED;
+  }
+  if (fp != NULL) {
+    fclose(fp);
+  }
+  remove(plain.c_str());
+}
+
+extern "C" 
+void wconOct_WCONWorms_save_to_file(WconOctError *err,
+				    const WconOctHandle selfHandle,
+				    const char *output_path,
+				    int pretty_print,
+				    int compressed) {
+  WconOctStatScope stat(WCONOCT_STAT_SAVE_TO_FILE, err);
+  wrapInternalSave(err, selfHandle, output_path, pretty_print, compressed,
+		   -1, 0);
+}
+
+extern "C"
+void wconOct_WCONWorms_save_compressed(WconOctError *err,
+				       const WconOctHandle selfHandle,
+				       const char *output_path,
+				       int pretty_print,
+				       int level, int numThreads) {
+  WconOctStatScope stat(WCONOCT_STAT_SAVE_COMPRESSED, err);
+  wrapInternalSave(err, selfHandle, output_path, pretty_print, 1, level,
+		   numThreads);
+}
+
+// The chunks go through the interpreter one at a time, under the GIL
+bool wconOctSplitWrite(WconOctHandle selfHandle,
+		       const vector<WconOctSplitChunk> &chunks,
+		       bool compressed) {
+  WrapInternalGIL gil;
+  PyObject *WCONWorms_instance = wrapInternalGetReference(selfHandle);
+  if (WCONWorms_instance == NULL || wrapperGlobalSplitChunkFunc == NULL) {
+    cerr << "ERROR: Failed to acquire object instance using handle "
+	 << selfHandle << endl;
+    return false;
+  }
+  for (size_t i=0; i<chunks.size(); i++) {
+    const WconOctSplitChunk &chunk = chunks[i];
+    PyObject *pValue =
+      WCONOCT_PYTHON(PyObject_CallFunction(wrapperGlobalSplitChunkFunc,
+					   "OddssssO", WCONWorms_instance,
+					   chunk.t0, chunk.t1,
+					   chunk.path.c_str(),
+					   chunk.current.c_str(),
+					   chunk.prev.c_str(),
+					   chunk.next.c_str(),
+					   compressed ? Py_True : Py_False));
+    Py_XDECREF(pValue);
+    if (PyErr_Occurred() != NULL) {
+      PyErr_Print();
+      return false;
+    }
+  }
+  return true;
+}
+
+static PyObject *wrapInternalStringList(const vector<string> &strings) {
+  PyObject *list = PyList_New((Py_ssize_t)strings.size());
+  for (size_t i=0; list != NULL && i<strings.size(); i++) {
+    // PyList_SetItem steals the reference
+    PyList_SetItem(list, (Py_ssize_t)i,
+		   PyUnicode_FromString(strings[i].c_str()));
+  }
+  return list;
+}
+
+// The feature columns go across as nested lists of floats
+WconOctHandle wconOctFeaturesAttach(WconOctError *err,
+				    WconOctHandle selfHandle,
+				    const WconOctFeatureSet &features) {
+  WrapInternalGIL gil;
+  PyObject *WCONWorms_instance = wrapInternalGetReference(selfHandle);
+  if (WCONWorms_instance == NULL || wrapperGlobalWithFeaturesFunc == NULL) {
+    cerr << "ERROR: Failed to acquire object instance using handle "
+	 << selfHandle << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+  if (!wconOctMemoryAdmit(wconOctMemoryBytes(selfHandle))) {
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  PyObject *pNames = wrapInternalStringList(features.names);
+  PyObject *pUnits = wrapInternalStringList(features.units);
+  PyObject *pColumns = PyList_New((Py_ssize_t)features.columns.size());
+  for (size_t w=0; pColumns != NULL && w<features.columns.size(); w++) {
+    const vector<vector<double> > &worm = features.columns[w];
+    PyObject *pWorm = PyList_New((Py_ssize_t)worm.size());
+    for (size_t f=0; pWorm != NULL && f<worm.size(); f++) {
+      PyObject *pColumn = PyList_New((Py_ssize_t)worm[f].size());
+      for (size_t i=0; pColumn != NULL && i<worm[f].size(); i++) {
+	PyList_SetItem(pColumn, (Py_ssize_t)i,
+		       PyFloat_FromDouble(worm[f][i]));
+      }
+      PyList_SetItem(pWorm, (Py_ssize_t)f, pColumn);
+    }
+    PyList_SetItem(pColumns, (Py_ssize_t)w, pWorm);
+  }
+  PyObject *pValue = NULL;
+  if (pNames != NULL && pUnits != NULL && pColumns != NULL &&
+      PyErr_Occurred() == NULL) {
+    pValue =
+      WCONOCT_PYTHON(PyObject_CallFunctionObjArgs(
+		       wrapperGlobalWithFeaturesFunc, WCONWorms_instance,
+		       pNames, pUnits, pColumns, NULL));
+  }
+  Py_XDECREF(pNames);
+  Py_XDECREF(pUnits);
+  Py_XDECREF(pColumns);
+  if (PyErr_Occurred() != NULL || pValue == NULL) {
+    PyErr_Print();
+    Py_XDECREF(pValue);
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+  // Do not DECREF stored pValue
+  WconOctHandle result = wrapInternalStoreReference(pValue);
+  if (result == WCONOCT_NULL_HANDLE) {
+    cerr << "ERROR: failed to store object reference in wrapper."
+	 << endl;
+    Py_DECREF(pValue);
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+  *err = SUCCESS;
+  return result;
+}
+
 extern "C" 
 WconOctHandle wconOct_WCONWorms_to_canon(WconOctError *err,
 					const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_TO_CANON, err);
   PyObject *WCONWorms_selfInstance=NULL;
   PyObject *pErr, *pAttr;
   
@@ -165,6 +545,7 @@ WconOctHandle wconOct_WCONWorms_to_canon(WconOctError *err,
     cerr << "Failed to initialize wrapper library." << endl;
     return WCONOCT_NULL_HANDLE;
   }
+  WrapInternalGIL gil;
 
   WCONWorms_selfInstance = wrapInternalGetReference(selfHandle);
   if (WCONWorms_selfInstance == NULL) {
@@ -173,10 +554,14 @@ WconOctHandle wconOct_WCONWorms_to_canon(WconOctError *err,
     *err = FAILED;
     return WCONOCT_NULL_HANDLE;
   }
+  if (!wconOctMemoryAdmit(wconOctMemoryBytes(selfHandle))) {
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
 
   // to_canon is implemented as an object property and not a function
   pAttr = 
-    PyObject_GetAttrString(WCONWorms_selfInstance,"to_canon");
+    WCONOCT_PYTHON(PyObject_GetAttrString(WCONWorms_selfInstance,"to_canon"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -207,6 +592,114 @@ WconOctHandle wconOct_WCONWorms_to_canon(WconOctError *err,
   }
 }
 
+// The Python objects hold their data already
+extern "C"
+WconOctHandle wconOct_WCONWorms_materialize(WconOctError *err,
+					    const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_MATERIALIZE, err);
+  PyObject *WCONWorms_selfInstance=NULL;
+
+  wconOct_initWrapper(err);
+  if (*err == FAILED) {
+    cerr << "Failed to initialize wrapper library." << endl;
+    return WCONOCT_NULL_HANDLE;
+  }
+  WrapInternalGIL gil;
+
+  WCONWorms_selfInstance = wrapInternalGetReference(selfHandle);
+  if (WCONWorms_selfInstance == NULL) {
+    cerr << "ERROR: Failed to acquire object instance using handle "
+	 << selfHandle << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  Py_INCREF(WCONWorms_selfInstance);
+  WconOctHandle result = wrapInternalStoreReference(WCONWorms_selfInstance,
+						    false);
+  if (wconOct_isNullHandle(result)) {
+    cerr << "ERROR: Failed to store python object reference" << endl;
+    Py_DECREF(WCONWorms_selfInstance);
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+  *err = SUCCESS;
+  return result;
+}
+
+extern "C"
+WconOctHandle wconOct_WCONWorms_resample(WconOctError *err,
+					 const WconOctHandle selfHandle,
+					 double dt,
+					 const double *times, long numTimes,
+					 WconOctInterpolation method,
+					 double maxGap) {
+  WconOctStatScope stat(WCONOCT_STAT_RESAMPLE, err);
+  PyObject *WCONWorms_selfInstance=NULL;
+
+  wconOct_initWrapper(err);
+  if (*err == FAILED) {
+    cerr << "Failed to initialize wrapper library." << endl;
+    return WCONOCT_NULL_HANDLE;
+  }
+  if (!(dt > 0) && (numTimes <= 0 || times == NULL)) {
+    cerr << "ERROR: Resampling needs a dt above 0 or target times" << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+  if (!(maxGap >= 0)) {
+    cerr << "ERROR: The largest gap to interpolate across may not be "
+	 << "negative" << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+  WrapInternalGIL gil;
+
+  WCONWorms_selfInstance = wrapInternalGetReference(selfHandle);
+  if (WCONWorms_selfInstance == NULL || wrapperGlobalResampleFunc == NULL) {
+    cerr << "ERROR: Failed to acquire object instance using handle "
+	 << selfHandle << endl;
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+  if (!wconOctMemoryAdmit(wconOctMemoryBytes(selfHandle))) {
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+
+  long n = (dt > 0) ? 0 : numTimes;
+  PyObject *pTimes = PyList_New(n);
+  for (long i=0; pTimes != NULL && i<n; i++) {
+    // PyList_SetItem steals the reference
+    PyList_SetItem(pTimes, i, PyFloat_FromDouble(times[i]));
+  }
+  PyObject *pValue = NULL;
+  if (pTimes != NULL) {
+    pValue =
+      WCONOCT_PYTHON(PyObject_CallFunction(wrapperGlobalResampleFunc,
+					   "OdOid", WCONWorms_selfInstance,
+					   dt, pTimes, (int)method, maxGap));
+    Py_DECREF(pTimes);
+  }
+  if (PyErr_Occurred() != NULL || pValue == NULL) {
+    PyErr_Print();
+    Py_XDECREF(pValue);
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+  // Do not DECREF stored pValue
+  WconOctHandle result = wrapInternalStoreReference(pValue);
+  if (result == WCONOCT_NULL_HANDLE) {
+    cerr << "ERROR: failed to store object reference in wrapper."
+	 << endl;
+    Py_DECREF(pValue);
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
+  *err = SUCCESS;
+  return result;
+}
+
 // NOTE: Current probable bug:
 //   x = y + z results in x == y; and
 //   x = z + y results in x == z
@@ -217,6 +710,7 @@ extern "C"
 WconOctHandle wconOct_WCONWorms_add(WconOctError *err,
 				    const WconOctHandle selfHandle, 
 				    const WconOctHandle handle) {
+  WconOctStatScope stat(WCONOCT_STAT_ADD, err);
   PyObject *WCONWorms_selfInstance=NULL;
   PyObject *WCONWorms_instance=NULL;
   PyObject *pErr, *pFunc;
@@ -226,6 +720,7 @@ WconOctHandle wconOct_WCONWorms_add(WconOctError *err,
     cerr << "Failed to initialize wrapper library." << endl;
     return WCONOCT_NULL_HANDLE;
   }
+  WrapInternalGIL gil;
 
   WCONWorms_selfInstance = wrapInternalGetReference(selfHandle);
   if (WCONWorms_selfInstance == NULL) {
@@ -242,9 +737,14 @@ WconOctHandle wconOct_WCONWorms_add(WconOctError *err,
     *err = FAILED;
     return WCONOCT_NULL_HANDLE;
   }
+  if (!wconOctMemoryAdmit(wconOctMemoryBytes(selfHandle) +
+			  wconOctMemoryBytes(handle))) {
+    *err = FAILED;
+    return WCONOCT_NULL_HANDLE;
+  }
 
   pFunc = 
-    PyObject_GetAttrString(WCONWorms_selfInstance,"__add__");
+    WCONOCT_PYTHON(PyObject_GetAttrString(WCONWorms_selfInstance,"__add__"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -255,9 +755,9 @@ WconOctHandle wconOct_WCONWorms_add(WconOctError *err,
 
   if (PyCallable_Check(pFunc) == 1) {
     PyObject *pValue;
-    pValue = PyObject_CallFunctionObjArgs(pFunc, 
+    pValue = WCONOCT_PYTHON(PyObject_CallFunctionObjArgs(pFunc, 
 					  WCONWorms_instance,
-					  NULL);
+					  NULL));
     Py_DECREF(pFunc);
     pErr = PyErr_Occurred();
     if (pErr != NULL) {
@@ -299,6 +799,7 @@ WconOctHandle wconOct_WCONWorms_add(WconOctError *err,
 extern "C" int wconOct_WCONWorms_eq(WconOctError *err,
 				    const WconOctHandle selfHandle, 
 				    const WconOctHandle handle) {
+  WconOctStatScope stat(WCONOCT_STAT_EQ, err);
   PyObject *WCONWorms_selfInstance=NULL;
   PyObject *WCONWorms_instance=NULL;
   PyObject *pErr, *pFunc;
@@ -308,6 +809,7 @@ extern "C" int wconOct_WCONWorms_eq(WconOctError *err,
     cerr << "Failed to initialize wrapper library." << endl;
     return 0;
   }
+  WrapInternalGIL gil;
 
   WCONWorms_selfInstance = wrapInternalGetReference(selfHandle);
   if (WCONWorms_selfInstance == NULL) {
@@ -326,7 +828,7 @@ extern "C" int wconOct_WCONWorms_eq(WconOctError *err,
   }
 
   pFunc = 
-    PyObject_GetAttrString(WCONWorms_selfInstance,"__eq__");
+    WCONOCT_PYTHON(PyObject_GetAttrString(WCONWorms_selfInstance,"__eq__"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -337,9 +839,9 @@ extern "C" int wconOct_WCONWorms_eq(WconOctError *err,
 
   if (PyCallable_Check(pFunc) == 1) {
     PyObject *pValue;
-    pValue = PyObject_CallFunctionObjArgs(pFunc, 
+    pValue = WCONOCT_PYTHON(PyObject_CallFunctionObjArgs(pFunc, 
 					  WCONWorms_instance,
-					  NULL);
+					  NULL));
     pErr = PyErr_Occurred();
     Py_DECREF(pFunc);
     if (pErr != NULL) {
@@ -380,6 +882,7 @@ extern "C" int wconOct_WCONWorms_eq(WconOctError *err,
 extern "C" 
 WconOctUnitsDict *wconOct_WCONWorms_units(WconOctError *err,
 					  const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_UNITS, err);
   PyObject *WCONWorms_selfInstance=NULL;
   PyObject *pErr, *pAttr;
   
@@ -388,6 +891,7 @@ WconOctUnitsDict *wconOct_WCONWorms_units(WconOctError *err,
     cerr << "Failed to initialize wrapper library." << endl;
     return NULL;
   }
+  WrapInternalGIL gil;
 
   WCONWorms_selfInstance = wrapInternalGetReference(selfHandle);
   if (WCONWorms_selfInstance == NULL) {
@@ -405,7 +909,7 @@ WconOctUnitsDict *wconOct_WCONWorms_units(WconOctError *err,
   //   or have a copy managed by C/C++ (loosely related to threading
   //   consistency issues.)
   pAttr = 
-    PyObject_GetAttrString(WCONWorms_selfInstance,"units");
+    WCONOCT_PYTHON(PyObject_GetAttrString(WCONWorms_selfInstance,"units"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -426,7 +930,7 @@ WconOctUnitsDict *wconOct_WCONWorms_units(WconOctError *err,
       while (PyDict_Next(pAttr, &pos, &key, &value)) {
 	WconOctHandle muHandle = wrapInternalStoreReference(value);
 	/* How does one construct a C string from a Python string? */
-	PyObject *keyAscii = PyObject_ASCII(key);
+	PyObject *keyAscii = WCONOCT_PYTHON(PyObject_ASCII(key));
 	/* don't deallocate this! */
 	if (muHandle == WCONOCT_NULL_HANDLE) {
 	  cerr << "ERROR: PyDict index " << pos 
@@ -437,7 +941,7 @@ WconOctUnitsDict *wconOct_WCONWorms_units(WconOctError *err,
 	  *err = FAILED;
 	  return NULL;
 	} else {
-	  char *newKey = PyUnicode_AsUTF8(keyAscii);
+	  const char *newKey = PyUnicode_AsUTF8(keyAscii);
 	  // cout << "Pair at idx " << idx << " (pos " << pos << ")" << endl;
 	  retKeyValueArray[idx].value = muHandle;
 	  retKeyValueArray[idx].key = new char[strlen(newKey)+1];
@@ -472,6 +976,7 @@ WconOctUnitsDict *wconOct_WCONWorms_units(WconOctError *err,
 extern "C" 
 WconOctHandle wconOct_WCONWorms_metadata(WconOctError *err,
 					const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_METADATA, err);
   PyObject *WCONWorms_selfInstance=NULL;
   PyObject *pErr, *pAttr;
 
@@ -480,6 +985,7 @@ WconOctHandle wconOct_WCONWorms_metadata(WconOctError *err,
     cerr << "Failed to initialize wrapper library." << endl;
     return WCONOCT_NULL_HANDLE;
   }
+  WrapInternalGIL gil;
 
   WCONWorms_selfInstance = wrapInternalGetReference(selfHandle);
   if (WCONWorms_selfInstance == NULL) {
@@ -491,7 +997,7 @@ WconOctHandle wconOct_WCONWorms_metadata(WconOctError *err,
 
   // Attribute is a Python dict (Dictionary) object with complex members
   pAttr = 
-    PyObject_GetAttrString(WCONWorms_selfInstance,"metadata");
+    WCONOCT_PYTHON(PyObject_GetAttrString(WCONWorms_selfInstance,"metadata"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -512,7 +1018,7 @@ WconOctHandle wconOct_WCONWorms_metadata(WconOctError *err,
       return WCONOCT_NONE_HANDLE;
     } else if (PyDict_Check(pAttr)) {
       Py_DECREF(Py_None);
-      WconOctHandle result = wrapInternalStoreReference(pAttr);
+      WconOctHandle result = wrapInternalStoreReference(pAttr, false);
       Py_DECREF(pAttr);
       if (result == WCONOCT_NULL_HANDLE) {
 	cerr << "ERROR: failed to store object reference in wrapper." 
@@ -542,6 +1048,7 @@ WconOctHandle wconOct_WCONWorms_metadata(WconOctError *err,
 extern "C" 
 WconOctHandle wconOct_WCONWorms_data(WconOctError *err,
 				    const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_DATA, err);
   PyObject *WCONWorms_selfInstance=NULL;
   PyObject *pErr, *pAttr;
 
@@ -550,6 +1057,7 @@ WconOctHandle wconOct_WCONWorms_data(WconOctError *err,
     cerr << "Failed to initialize wrapper library." << endl;
     return WCONOCT_NULL_HANDLE;
   }
+  WrapInternalGIL gil;
 
   WCONWorms_selfInstance = wrapInternalGetReference(selfHandle);
   if (WCONWorms_selfInstance == NULL) {
@@ -563,7 +1071,7 @@ WconOctHandle wconOct_WCONWorms_data(WconOctError *err,
   //   I currently have no clue what that is, so I'm leaving out
   //   any error checks until I figure it out.
   pAttr = 
-    PyObject_GetAttrString(WCONWorms_selfInstance,"data");
+    WCONOCT_PYTHON(PyObject_GetAttrString(WCONWorms_selfInstance,"data"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -573,7 +1081,7 @@ WconOctHandle wconOct_WCONWorms_data(WconOctError *err,
   }
 
   if (pAttr != NULL) {
-    WconOctHandle result = wrapInternalStoreReference(pAttr);
+    WconOctHandle result = wrapInternalStoreReference(pAttr, false);
     Py_DECREF(pAttr);
     if (result == WCONOCT_NULL_HANDLE) {
       cerr << "ERROR: failed to store object reference in wrapper." 
@@ -595,6 +1103,7 @@ WconOctHandle wconOct_WCONWorms_data(WconOctError *err,
 extern "C" 
 long wconOct_WCONWorms_num_worms(WconOctError *err,
 				 const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_NUM_WORMS, err);
   PyObject *WCONWorms_selfInstance=NULL;
   PyObject *pErr, *pAttr;
 
@@ -603,6 +1112,7 @@ long wconOct_WCONWorms_num_worms(WconOctError *err,
     cerr << "Failed to initialize wrapper library." << endl;
     return -1;
   }
+  WrapInternalGIL gil;
 
   WCONWorms_selfInstance = wrapInternalGetReference(selfHandle);
   if (WCONWorms_selfInstance == NULL) {
@@ -613,7 +1123,7 @@ long wconOct_WCONWorms_num_worms(WconOctError *err,
   }
 
   pAttr = 
-    PyObject_GetAttrString(WCONWorms_selfInstance,"num_worms");
+    WCONOCT_PYTHON(PyObject_GetAttrString(WCONWorms_selfInstance,"num_worms"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -647,6 +1157,7 @@ long wconOct_WCONWorms_num_worms(WconOctError *err,
 extern "C" 
 WconOctHandle wconOct_WCONWorms_worm_ids(WconOctError *err,
 					const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_WORM_IDS, err);
   PyObject *WCONWorms_selfInstance=NULL;
   PyObject *pErr, *pAttr;
 
@@ -655,6 +1166,7 @@ WconOctHandle wconOct_WCONWorms_worm_ids(WconOctError *err,
     cerr << "Failed to initialize wrapper library." << endl;
     return WCONOCT_NULL_HANDLE;
   }
+  WrapInternalGIL gil;
 
   WCONWorms_selfInstance = wrapInternalGetReference(selfHandle);
   if (WCONWorms_selfInstance == NULL) {
@@ -668,7 +1180,7 @@ WconOctHandle wconOct_WCONWorms_worm_ids(WconOctError *err,
   //   I've seen integers as well as strings, so that needs to be
   //   sorted out as well.
   pAttr = 
-    PyObject_GetAttrString(WCONWorms_selfInstance,"worm_ids");
+    WCONOCT_PYTHON(PyObject_GetAttrString(WCONWorms_selfInstance,"worm_ids"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -679,7 +1191,7 @@ WconOctHandle wconOct_WCONWorms_worm_ids(WconOctError *err,
 
   if (pAttr != NULL) {
     if (PyList_Check(pAttr)) {
-      WconOctHandle result = wrapInternalStoreReference(pAttr);
+      WconOctHandle result = wrapInternalStoreReference(pAttr, false);
       Py_DECREF(pAttr);
       if (result == WCONOCT_NULL_HANDLE) {
 	cerr << "ERROR: failed to store object reference in wrapper." 
@@ -707,6 +1219,7 @@ WconOctHandle wconOct_WCONWorms_worm_ids(WconOctError *err,
 extern "C" 
 WconOctHandle wconOct_WCONWorms_data_as_odict(WconOctError *err,
 					     const WconOctHandle selfHandle){
+  WconOctStatScope stat(WCONOCT_STAT_DATA_AS_ODICT, err);
   PyObject *WCONWorms_selfInstance=NULL;
   PyObject *pErr, *pAttr;
 
@@ -715,6 +1228,7 @@ WconOctHandle wconOct_WCONWorms_data_as_odict(WconOctError *err,
     cerr << "Failed to initialize wrapper library." << endl;
     return WCONOCT_NULL_HANDLE;
   }
+  WrapInternalGIL gil;
 
   WCONWorms_selfInstance = wrapInternalGetReference(selfHandle);
   if (WCONWorms_selfInstance == NULL) {
@@ -729,7 +1243,8 @@ WconOctHandle wconOct_WCONWorms_data_as_odict(WconOctError *err,
   //   be no harm checking and treating the object as a regular dict
   //   object.
   pAttr = 
-    PyObject_GetAttrString(WCONWorms_selfInstance,"data_as_odict");
+    WCONOCT_PYTHON(PyObject_GetAttrString(WCONWorms_selfInstance,
+					  "data_as_odict"));
   pErr = PyErr_Occurred();
   if (pErr != NULL) {
     PyErr_Print();
@@ -740,7 +1255,7 @@ WconOctHandle wconOct_WCONWorms_data_as_odict(WconOctError *err,
 
   if (pAttr != NULL) {
     if (PyDict_Check(pAttr)) {
-      WconOctHandle result = wrapInternalStoreReference(pAttr);
+      WconOctHandle result = wrapInternalStoreReference(pAttr, false);
       Py_DECREF(pAttr);
       if (result == WCONOCT_NULL_HANDLE) {
 	cerr << "ERROR: failed to store object reference in wrapper." 
@@ -767,3 +1282,417 @@ WconOctHandle wconOct_WCONWorms_data_as_odict(WconOctError *err,
 }
 
 
+
+extern PyObject *wrapperGlobalJsonDumpsFunc;
+
+extern "C" 
+char *wconOct_WCONWorms_metadata_json(WconOctError *err,
+				      const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_METADATA_JSON, err);
+  PyObject *WCONWorms_selfInstance=NULL;
+  PyObject *pErr, *pAttr;
+
+  wconOct_initWrapper(err);
+  if (*err == FAILED) {
+    cerr << "Failed to initialize wrapper library." << endl;
+    return NULL;
+  }
+  WrapInternalGIL gil;
+
+  WCONWorms_selfInstance = wrapInternalGetReference(selfHandle);
+  if (WCONWorms_selfInstance == NULL) {
+    cerr << "ERROR: Failed to acquire object instance using handle "
+	 << selfHandle << endl;
+    *err = FAILED;
+    return NULL;
+  }
+
+  pAttr = 
+    WCONOCT_PYTHON(PyObject_GetAttrString(WCONWorms_selfInstance,"metadata"));
+  pErr = PyErr_Occurred();
+  if (pErr != NULL) {
+    PyErr_Print();
+    Py_XDECREF(pAttr);
+    *err = FAILED;
+    return NULL;
+  }
+
+  if (pAttr == NULL) {
+    cerr << "ERROR: metadata is NULL" << endl;
+    *err = FAILED;
+    return NULL;
+  } else if (pAttr == Py_None) {
+    Py_DECREF(pAttr);
+    *err = SUCCESS;
+    return NULL;
+  }
+
+  PyObject *pValue = 
+    WCONOCT_PYTHON(PyObject_CallFunctionObjArgs(wrapperGlobalJsonDumpsFunc,
+						pAttr, NULL));
+  Py_DECREF(pAttr);
+  pErr = PyErr_Occurred();
+  if (pErr != NULL || pValue == NULL) {
+    PyErr_Print();
+    Py_XDECREF(pValue);
+    *err = FAILED;
+    return NULL;
+  }
+
+  const char *text = PyUnicode_AsUTF8(pValue);
+  if (text == NULL) {
+    PyErr_Print();
+    Py_DECREF(pValue);
+    *err = FAILED;
+    return NULL;
+  }
+  char *result = new char[strlen(text)+1];
+  strcpy(result,text);
+  Py_DECREF(pValue);
+  *err = SUCCESS;
+  return result;
+}
+
+// Python objects (and their buffers) backing the views of a
+//   WconOctWormData. Released together in wconOct_freeWormData.
+struct WrapInternalWormDataOwner {
+  vector<PyObject *> objects;
+  vector<Py_buffer *> buffers;
+};
+
+static void wrapInternalClearView(WconOctArrayView *view) {
+  view->data = NULL;
+  view->rows = 0;
+  view->cols = 0;
+  view->rowStride = 0;
+  view->colStride = 0;
+}
+
+// Exposes the numpy array behind arrayLike.values as a strided view,
+//   converting to float64 first only if it is not float64 already.
+//   Returns false with the Python error printed on failure.
+static bool wrapInternalExportValues(PyObject *arrayLike,
+				     WconOctArrayView *view,
+				     WrapInternalWormDataOwner *owner) {
+  PyObject *values = WCONOCT_PYTHON(PyObject_GetAttrString(arrayLike,"values"));
+  if (values == NULL) {
+    PyErr_Print();
+    return false;
+  }
+
+  Py_buffer *buf = new Py_buffer;
+  if (PyObject_GetBuffer(values, buf, PyBUF_RECORDS_RO) != 0 ||
+      buf->format == NULL || strcmp(buf->format,"d") != 0) {
+    // Typically object dtype columns from segments with 'head' or
+    //   'ventral'. Ask numpy for a float64 copy and try again.
+    if (PyErr_Occurred() != NULL) {
+      PyErr_Clear();
+    } else {
+      PyBuffer_Release(buf);
+    }
+    PyObject *converted =
+      WCONOCT_PYTHON(PyObject_CallMethod(values,"astype","s","float64"));
+    Py_DECREF(values);
+    if (converted == NULL) {
+      PyErr_Print();
+      delete buf;
+      return false;
+    }
+    values = converted;
+    if (PyObject_GetBuffer(values, buf, PyBUF_RECORDS_RO) != 0) {
+      PyErr_Print();
+      Py_DECREF(values);
+      delete buf;
+      return false;
+    }
+  }
+
+  if (buf->ndim < 1 || buf->ndim > 2) {
+    cerr << "ERROR: Unexpected array dimension " << buf->ndim << endl;
+    PyBuffer_Release(buf);
+    Py_DECREF(values);
+    delete buf;
+    return false;
+  }
+  view->data = (const double *)buf->buf;
+  view->rows = (long)buf->shape[0];
+  view->cols = (buf->ndim == 2) ? (long)buf->shape[1] : 1;
+  view->rowStride = (long)(buf->strides[0] / (Py_ssize_t)sizeof(double));
+  view->colStride = (buf->ndim == 2) ? 
+    (long)(buf->strides[1] / (Py_ssize_t)sizeof(double)) : 1;
+
+  owner->objects.push_back(values);
+  owner->buffers.push_back(buf);
+  return true;
+}
+
+// wormColumns is the DataFrame of a single worm indexed by key and
+//   aspect. Absent keys leave the view cleared and are not an error.
+static bool wrapInternalExportKey(PyObject *wormColumns, const char *key,
+				  WconOctArrayView *view,
+				  WrapInternalWormDataOwner *owner) {
+  wrapInternalClearView(view);
+  PyObject *pKey = PyUnicode_FromString(key);
+  PyObject *keyColumns = WCONOCT_PYTHON(PyObject_GetItem(wormColumns, pKey));
+  Py_DECREF(pKey);
+  if (keyColumns == NULL) {
+    if (PyErr_ExceptionMatches(PyExc_KeyError)) {
+      PyErr_Clear();
+      return true;
+    }
+    PyErr_Print();
+    return false;
+  }
+  bool result = wrapInternalExportValues(keyColumns, view, owner);
+  Py_DECREF(keyColumns);
+  return result;
+}
+
+extern "C"
+WconOctWormData *wconOct_WCONWorms_worm_data(WconOctError *err,
+					     const WconOctHandle selfHandle,
+					     long wormIndex) {
+  WconOctStatScope stat(WCONOCT_STAT_WORM_DATA, err);
+  PyObject *WCONWorms_selfInstance=NULL;
+  PyObject *pErr, *pAttr;
+
+  wconOct_initWrapper(err);
+  if (*err == FAILED) {
+    cerr << "Failed to initialize wrapper library." << endl;
+    return NULL;
+  }
+  WrapInternalGIL gil;
+
+  WCONWorms_selfInstance = wrapInternalGetReference(selfHandle);
+  if (WCONWorms_selfInstance == NULL) {
+    cerr << "ERROR: Failed to acquire object instance using handle "
+	 << selfHandle << endl;
+    *err = FAILED;
+    return NULL;
+  }
+
+  // data_as_odict is keyed by worm id in worm_ids order, with one
+  //   DataFrame per worm whose columns are (id, key, aspect).
+  pAttr = 
+    WCONOCT_PYTHON(PyObject_GetAttrString(WCONWorms_selfInstance,
+					  "data_as_odict"));
+  pErr = PyErr_Occurred();
+  if (pErr != NULL || pAttr == NULL) {
+    PyErr_Print();
+    Py_XDECREF(pAttr);
+    *err = FAILED;
+    return NULL;
+  }
+
+  PyObject *keys = WCONOCT_PYTHON(PyMapping_Keys(pAttr));
+  if (keys == NULL) {
+    PyErr_Print();
+    Py_DECREF(pAttr);
+    *err = FAILED;
+    return NULL;
+  }
+  if (wormIndex < 0 || wormIndex >= (long)PyList_Size(keys)) {
+    cerr << "ERROR: Worm index " << wormIndex << " out of range" << endl;
+    Py_DECREF(keys);
+    Py_DECREF(pAttr);
+    *err = FAILED;
+    return NULL;
+  }
+  PyObject *wormId = PyList_GetItem(keys, wormIndex); /* borrowed */
+  PyObject *wormFrame = WCONOCT_PYTHON(PyObject_GetItem(pAttr, wormId));
+  PyObject *wormColumns = NULL;
+  if (wormFrame != NULL) {
+    wormColumns = WCONOCT_PYTHON(PyObject_GetItem(wormFrame, wormId));
+  }
+  PyObject *idStr = WCONOCT_PYTHON(PyObject_Str(wormId));
+  Py_DECREF(pAttr);
+  if (wormFrame == NULL || wormColumns == NULL || idStr == NULL) {
+    PyErr_Print();
+    Py_XDECREF(wormFrame);
+    Py_XDECREF(wormColumns);
+    Py_XDECREF(idStr);
+    Py_DECREF(keys);
+    *err = FAILED;
+    return NULL;
+  }
+
+  WrapInternalWormDataOwner *owner = new WrapInternalWormDataOwner;
+  WconOctWormData *result = new WconOctWormData;
+  result->owner = owner;
+  const char *idText = PyUnicode_AsUTF8(idStr);
+  result->id = new char[strlen(idText)+1];
+  strcpy(result->id,idText);
+  Py_DECREF(idStr);
+  Py_DECREF(keys);
+
+  bool ok = true;
+  PyObject *index = WCONOCT_PYTHON(PyObject_GetAttrString(wormFrame,"index"));
+  if (index == NULL) {
+    PyErr_Print();
+    ok = false;
+  } else {
+    ok = wrapInternalExportValues(index, &(result->t), owner);
+    Py_DECREF(index);
+  }
+  ok = ok && wrapInternalExportKey(wormColumns,"x",&(result->x),owner);
+  ok = ok && wrapInternalExportKey(wormColumns,"y",&(result->y),owner);
+  ok = ok && wrapInternalExportKey(wormColumns,"cx",&(result->cx),owner);
+  ok = ok && wrapInternalExportKey(wormColumns,"cy",&(result->cy),owner);
+  ok = ok && wrapInternalExportKey(wormColumns,"aspect_size",
+				   &(result->aspectSize),owner);
+  Py_DECREF(wormColumns);
+  Py_DECREF(wormFrame);
+
+  if (!ok) {
+    cerr << "ERROR: Failed to export data of worm " << result->id << endl;
+    wconOct_freeWormData(result);
+    *err = FAILED;
+    return NULL;
+  }
+  result->numFrames = result->t.rows;
+  *err = SUCCESS;
+  return result;
+}
+
+extern "C" void wconOct_freeWormData(WconOctWormData *wormData) {
+  WconOctStatScope stat(WCONOCT_STAT_FREE_WORM_DATA, NULL, true);
+  if (wormData == NULL) {
+    return;
+  }
+  WrapInternalWormDataOwner *owner = 
+    (WrapInternalWormDataOwner *)wormData->owner;
+  if (owner != NULL) {
+    WrapInternalGIL gil;
+    for (size_t i=0; i<owner->buffers.size(); i++) {
+      PyBuffer_Release(owner->buffers[i]);
+      delete owner->buffers[i];
+    }
+    for (size_t i=0; i<owner->objects.size(); i++) {
+      Py_DECREF(owner->objects[i]);
+    }
+    delete owner;
+  }
+  delete [] wormData->id;
+  delete wormData;
+}
+
+// The spine points are pandas columns here, which have no compact form
+extern "C"
+WconOctHandle wconOct_WCONWorms_compact(WconOctError *err,
+					const WconOctHandle,
+					WconOctCompactMode,
+					double,
+					WconOctCompactInfo *) {
+  WconOctStatScope stat(WCONOCT_STAT_COMPACT, err);
+  cerr << "ERROR: Compact storage needs the native backend" << endl;
+  *err = FAILED;
+  return WCONOCT_NULL_HANDLE;
+}
+
+// Copied out of the worm_data views
+extern "C"
+long wconOct_WCONWorms_points(WconOctError *err,
+			      const WconOctHandle selfHandle,
+			      long wormIndex, long firstFrame, long numFrames,
+			      double *x, double *y) {
+  WconOctStatScope stat(WCONOCT_STAT_POINTS, err);
+  WconOctWormData *worm =
+    wconOct_WCONWorms_worm_data(err, selfHandle, wormIndex);
+  if (*err == FAILED) {
+    return 0;
+  }
+  if ((x == NULL) != (y == NULL) || firstFrame < 0 || numFrames < 0 ||
+      firstFrame + numFrames > worm->numFrames) {
+    cerr << "ERROR: points needs both x and y or neither, and frames "
+	 << "within the " << worm->numFrames << " of the worm" << endl;
+    wconOct_freeWormData(worm);
+    *err = FAILED;
+    return 0;
+  }
+  const WconOctArrayView &vx = worm->x, &vy = worm->y;
+  long numPoints = (vx.data == NULL || vy.data == NULL) ? 0 : vx.cols;
+  for (long i=0; x != NULL && i<numFrames; i++) {
+    long row = firstFrame + i;
+    for (long k=0; k<numPoints; k++) {
+      x[i * numPoints + k] = vx.data[row * vx.rowStride + k * vx.colStride];
+      y[i * numPoints + k] = vy.data[row * vy.rowStride + k * vy.colStride];
+    }
+  }
+  wconOct_freeWormData(worm);
+  *err = SUCCESS;
+  return numPoints;
+}
+
+extern "C"
+long wconOct_WCONWorms_num_frames(WconOctError *err,
+				  const WconOctHandle selfHandle,
+				  long wormIndex) {
+  WconOctStatScope stat(WCONOCT_STAT_NUM_FRAMES, err);
+  WconOctWormData *worm =
+    wconOct_WCONWorms_worm_data(err, selfHandle, wormIndex);
+  if (*err == FAILED) {
+    return -1;
+  }
+  long result = worm->numFrames;
+  wconOct_freeWormData(worm);
+  return result;
+}
+
+// The worm_data views, moved on to firstFrame
+extern "C"
+WconOctWormData *wconOct_WCONWorms_worm_frames(WconOctError *err,
+					       const WconOctHandle selfHandle,
+					       long wormIndex,
+					       long firstFrame,
+					       long numFrames) {
+  WconOctStatScope stat(WCONOCT_STAT_WORM_FRAMES, err);
+  WconOctWormData *worm =
+    wconOct_WCONWorms_worm_data(err, selfHandle, wormIndex);
+  if (*err == FAILED) {
+    return NULL;
+  }
+  if (firstFrame < 0 || numFrames < 0 ||
+      firstFrame + numFrames > worm->numFrames) {
+    cerr << "ERROR: worm_frames needs frames within the "
+	 << worm->numFrames << " of the worm" << endl;
+    wconOct_freeWormData(worm);
+    *err = FAILED;
+    return NULL;
+  }
+  WconOctArrayView *views[] = { &worm->t, &worm->x, &worm->y, &worm->cx,
+				&worm->cy, &worm->aspectSize };
+  for (size_t i=0; i<sizeof(views)/sizeof(views[0]); i++) {
+    if (views[i]->data != NULL) {
+      views[i]->data += firstFrame * views[i]->rowStride;
+      views[i]->rows = numFrames;
+    }
+  }
+  worm->numFrames = numFrames;
+  return worm;
+}
+
+extern "C"
+WconOctHandle wconOct_static_WCONWorms_load_paged(WconOctError *err,
+						  const char *) {
+  WconOctStatScope stat(WCONOCT_STAT_LOAD_PAGED, err);
+  cerr << "ERROR: Paged datasets need the native backend" << endl;
+  *err = FAILED;
+  return WCONOCT_NULL_HANDLE;
+}
+
+extern "C" void wconOct_setPageCache(WconOctError *err, double) {
+  if (err == NULL) {
+    return;
+  }
+  cerr << "ERROR: Paged datasets need the native backend" << endl;
+  *err = FAILED;
+}
+
+extern "C" void wconOct_pageCacheInfo(WconOctError *err,
+				      WconOctPageCacheInfo *) {
+  if (err == NULL) {
+    return;
+  }
+  cerr << "ERROR: Paged datasets need the native backend" << endl;
+  *err = FAILED;
+}
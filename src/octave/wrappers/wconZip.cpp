@@ -0,0 +1,423 @@
+#include "wconZip.h"
+
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+
+#include <zlib.h>
+using namespace std;
+
+#define ZIP_LOCAL_HEADER_SIG 0x04034b50UL
+#define ZIP_CENTRAL_HEADER_SIG 0x02014b50UL
+#define ZIP_END_SIG 0x06054b50UL
+#define ZIP_END_SIZE 22
+#define ZIP_MAX_COMMENT 65535
+
+namespace {
+
+struct ZipEntry {
+  string name;
+  unsigned method;
+  unsigned long crc;
+  unsigned long compressedSize;
+  unsigned long size;
+  unsigned long localOffset;
+};
+
+unsigned get16(const unsigned char *p) {
+  return p[0] | (p[1] << 8);
+}
+
+unsigned long get32(const unsigned char *p) {
+  return (unsigned long)p[0] | ((unsigned long)p[1] << 8) |
+    ((unsigned long)p[2] << 16) | ((unsigned long)p[3] << 24);
+}
+
+void put16(string &out, unsigned v) {
+  out += (char)(v & 0xFF);
+  out += (char)((v >> 8) & 0xFF);
+}
+
+void put32(string &out, unsigned long v) {
+  put16(out, v & 0xFFFF);
+  put16(out, (v >> 16) & 0xFFFF);
+}
+
+class ZipFile {
+ public:
+  ZipFile(const string &path, const char *mode) : path(path) {
+    fp = fopen(path.c_str(), mode);
+    if (fp == NULL) {
+      throw WconZipError("Cannot open " + path + ": " + strerror(errno));
+    }
+  }
+  ~ZipFile() { fclose(fp); }
+
+  void readAt(long offset, unsigned char *buf, size_t len) {
+    if (fseek(fp, offset, SEEK_SET) != 0 || fread(buf, 1, len, fp) != len) {
+      throw WconZipError("Truncated zip archive " + path);
+    }
+  }
+
+  void write(const string &data) {
+    if (fwrite(data.data(), 1, data.size(), fp) != data.size()) {
+      throw WconZipError("Cannot write " + path + ": " + strerror(errno));
+    }
+  }
+
+  FILE *fp;
+  string path;
+};
+
+// Locates the end of central directory record. Returns false if there
+//   is none, i.e. the file is not a zip archive.
+bool findEnd(ZipFile &zf, unsigned char *end) {
+  if (fseek(zf.fp, 0, SEEK_END) != 0) {
+    return false;
+  }
+  long size = ftell(zf.fp);
+  if (size < ZIP_END_SIZE) {
+    return false;
+  }
+  long tail = size < ZIP_END_SIZE + ZIP_MAX_COMMENT ?
+    size : ZIP_END_SIZE + ZIP_MAX_COMMENT;
+  string buf(tail, '\0');
+  zf.readAt(size - tail, (unsigned char *)&buf[0], tail);
+  const unsigned char *base = (const unsigned char *)buf.data();
+  for (long i = tail - ZIP_END_SIZE; i >= 0; i--) {
+    if (get32(base + i) == ZIP_END_SIG &&
+	i + ZIP_END_SIZE + (long)get16(base + i + 20) <= tail) {
+      memcpy(end, base + i, ZIP_END_SIZE);
+      return true;
+    }
+  }
+  return false;
+}
+
+void readDirectory(ZipFile &zf, vector<ZipEntry> &entries) {
+  unsigned char end[ZIP_END_SIZE];
+  if (!findEnd(zf, end)) {
+    throw WconZipError(zf.path + " is not a zip archive");
+  }
+  unsigned count = get16(end + 10);
+  unsigned long dirSize = get32(end + 12);
+  unsigned long dirOffset = get32(end + 16);
+  if (dirOffset == 0xFFFFFFFFUL || count == 0xFFFF) {
+    throw WconZipError("ZIP64 archives are not supported: " + zf.path);
+  }
+  string dir(dirSize, '\0');
+  if (dirSize > 0) {
+    zf.readAt(dirOffset, (unsigned char *)&dir[0], dirSize);
+  }
+  const unsigned char *p = (const unsigned char *)dir.data();
+  const unsigned char *limit = p + dirSize;
+  for (unsigned i=0; i<count; i++) {
+    if (p + 46 > limit || get32(p) != ZIP_CENTRAL_HEADER_SIG) {
+      throw WconZipError("Corrupt zip directory in " + zf.path);
+    }
+    ZipEntry e;
+    e.method = get16(p + 10);
+    e.crc = get32(p + 16);
+    e.compressedSize = get32(p + 20);
+    e.size = get32(p + 24);
+    unsigned nameLen = get16(p + 28);
+    unsigned extraLen = get16(p + 30);
+    unsigned commentLen = get16(p + 32);
+    e.localOffset = get32(p + 42);
+    if (p + 46 + nameLen > limit) {
+      throw WconZipError("Corrupt zip directory in " + zf.path);
+    }
+    e.name.assign((const char *)p + 46, nameLen);
+    entries.push_back(e);
+    p += 46 + nameLen + extraLen + commentLen;
+  }
+}
+
+// Where the data of an entry starts, past its local header
+long entryDataOffset(ZipFile &zf, const ZipEntry &e) {
+  unsigned char local[30];
+  zf.readAt(e.localOffset, local, sizeof(local));
+  if (get32(local) != ZIP_LOCAL_HEADER_SIG) {
+    throw WconZipError("Corrupt zip entry " + e.name + " in " + zf.path);
+  }
+  return e.localOffset + 30 + get16(local + 26) + get16(local + 28);
+}
+
+} // namespace
+
+bool wconZipIsArchive(const string &path) {
+  try {
+    ZipFile zf(path, "rb");
+    unsigned char end[ZIP_END_SIZE];
+    return findEnd(zf, end);
+  } catch (const WconZipError &e) {
+    return false;
+  }
+}
+
+void wconZipList(const string &path, vector<string> &names) {
+  ZipFile zf(path, "rb");
+  vector<ZipEntry> entries;
+  readDirectory(zf, entries);
+  names.clear();
+  for (size_t i=0; i<entries.size(); i++) {
+    names.push_back(entries[i].name);
+  }
+}
+
+void wconZipRead(const string &path, size_t index, string &contents) {
+  ZipFile zf(path, "rb");
+  vector<ZipEntry> entries;
+  readDirectory(zf, entries);
+  if (index >= entries.size()) {
+    throw WconZipError("No such entry in " + path);
+  }
+  const ZipEntry &e = entries[index];
+  long dataOffset = entryDataOffset(zf, e);
+  string compressed(e.compressedSize, '\0');
+  if (e.compressedSize > 0) {
+    zf.readAt(dataOffset, (unsigned char *)&compressed[0],
+	      e.compressedSize);
+  }
+
+  if (e.method == 0) {
+    contents.swap(compressed);
+  } else if (e.method == Z_DEFLATED) {
+    contents.assign(e.size, '\0');
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (inflateInit2(&strm, -MAX_WBITS) != Z_OK) {
+      throw WconZipError("zlib initialization failed");
+    }
+    strm.next_in = (Bytef *)compressed.data();
+    strm.avail_in = (uInt)compressed.size();
+    strm.next_out = (Bytef *)(contents.empty() ? NULL : &contents[0]);
+    strm.avail_out = (uInt)contents.size();
+    int rc = inflate(&strm, Z_FINISH);
+    inflateEnd(&strm);
+    if (rc != Z_STREAM_END || strm.total_out != e.size) {
+      throw WconZipError("Corrupt compressed data for " + e.name +
+			 " in " + path);
+    }
+  } else {
+    throw WconZipError("Unsupported compression method for " + e.name +
+		       " in " + path);
+  }
+
+  if (crc32(0L, (const Bytef *)contents.data(), (uInt)contents.size())
+      != e.crc) {
+    throw WconZipError("Bad CRC-32 for " + e.name + " in " + path);
+  }
+}
+
+struct WconZipEntryReader::State {
+  explicit State(const string &path)
+    : zf(path, "rb"), inflating(false), ended(false) {}
+
+  ZipFile zf;
+  ZipEntry entry;
+  // Compressed bytes not yet read from the file
+  unsigned long remaining;
+  unsigned long crc;
+  unsigned long produced;
+  bool inflating;
+  // inflate has seen the end of the deflate stream
+  bool ended;
+  bool done;
+  z_stream strm;
+  vector<unsigned char> input;
+};
+
+WconZipEntryReader::WconZipEntryReader(const string &path, size_t index)
+  : state(new State(path)) {
+  try {
+    vector<ZipEntry> entries;
+    readDirectory(state->zf, entries);
+    if (index >= entries.size()) {
+      throw WconZipError("No such entry in " + path);
+    }
+    state->entry = entries[index];
+    if (state->entry.method != 0 && state->entry.method != Z_DEFLATED) {
+      throw WconZipError("Unsupported compression method for " +
+			 state->entry.name + " in " + path);
+    }
+    long dataOffset = entryDataOffset(state->zf, state->entry);
+    if (fseek(state->zf.fp, dataOffset, SEEK_SET) != 0) {
+      throw WconZipError("Truncated zip archive " + path);
+    }
+    state->remaining = state->entry.compressedSize;
+    state->crc = crc32(0L, Z_NULL, 0);
+    state->produced = 0;
+    state->done = false;
+    if (state->entry.method == Z_DEFLATED) {
+      memset(&state->strm, 0, sizeof(state->strm));
+      if (inflateInit2(&state->strm, -MAX_WBITS) != Z_OK) {
+	throw WconZipError("zlib initialization failed");
+      }
+      state->inflating = true;
+      state->input.resize(1 << 16);
+    }
+  } catch (...) {
+    delete state;
+    throw;
+  }
+}
+
+WconZipEntryReader::~WconZipEntryReader() {
+  if (state->inflating) {
+    inflateEnd(&state->strm);
+  }
+  delete state;
+}
+
+size_t WconZipEntryReader::read(char *buf, size_t len) {
+  State &s = *state;
+  const ZipEntry &e = s.entry;
+  size_t n = 0;
+  if (s.done || len == 0) {
+    return 0;
+  }
+  if (!s.inflating) {
+    n = len < s.remaining ? len : s.remaining;
+    if (n > 0 && fread(buf, 1, n, s.zf.fp) != n) {
+      throw WconZipError("Truncated zip archive " + s.zf.path);
+    }
+    s.remaining -= n;
+  } else {
+    s.strm.next_out = (Bytef *)buf;
+    s.strm.avail_out = (uInt)len;
+    while (s.strm.avail_out > 0 && !s.ended) {
+      if (s.strm.avail_in == 0 && s.remaining > 0) {
+	size_t chunk = s.input.size() < s.remaining ?
+	  s.input.size() : s.remaining;
+	if (fread(&s.input[0], 1, chunk, s.zf.fp) != chunk) {
+	  throw WconZipError("Truncated zip archive " + s.zf.path);
+	}
+	s.remaining -= chunk;
+	s.strm.next_in = &s.input[0];
+	s.strm.avail_in = (uInt)chunk;
+      }
+      int rc = inflate(&s.strm, Z_NO_FLUSH);
+      if (rc == Z_STREAM_END) {
+	s.ended = true;
+      } else if (rc != Z_OK) {
+	throw WconZipError("Corrupt compressed data for " + e.name +
+			   " in " + s.zf.path);
+      }
+    }
+    n = len - s.strm.avail_out;
+  }
+  s.crc = crc32(s.crc, (const Bytef *)buf, (uInt)n);
+  s.produced += n;
+  // The end of the entry gets the checks of wconZipRead
+  if (n == 0) {
+    s.done = true;
+    if (s.produced != e.size) {
+      throw WconZipError("Corrupt compressed data for " + e.name +
+			 " in " + s.zf.path);
+    }
+    if (s.crc != e.crc) {
+      throw WconZipError("Bad CRC-32 for " + e.name + " in " + s.zf.path);
+    }
+  }
+  return n;
+}
+
+void wconZipWrite(const string &path, const string &entryName,
+		  const string &contents) {
+  time_t now = time(NULL);
+  struct tm local;
+  localtime_r(&now, &local);
+  wconZipWriteEntries(path, vector<string>(1, entryName),
+		      vector<string>(1, contents), local);
+}
+
+void wconZipWriteEntries(const string &path, const vector<string> &names,
+			 const vector<string> &contents,
+			 const struct tm &stamp) {
+  unsigned dosTime = (stamp.tm_hour << 11) | (stamp.tm_min << 5) |
+    (stamp.tm_sec / 2);
+  unsigned dosDate = ((stamp.tm_year - 80) << 9) |
+    ((stamp.tm_mon + 1) << 5) | stamp.tm_mday;
+  if (names.size() >= 0xFFFF) {
+    throw WconZipError("ZIP64 archives are not supported: " + path);
+  }
+
+  ZipFile zf(path, "wb");
+  string central;
+  unsigned long offset = 0;
+  for (size_t i=0; i<names.size(); i++) {
+    const string &entryName = names[i];
+    const string &data = contents[i];
+    string compressed(compressBound(data.size()) + 16, '\0');
+    z_stream strm;
+    memset(&strm, 0, sizeof(strm));
+    if (deflateInit2(&strm, Z_DEFAULT_COMPRESSION, Z_DEFLATED, -MAX_WBITS,
+		     8, Z_DEFAULT_STRATEGY) != Z_OK) {
+      throw WconZipError("zlib initialization failed");
+    }
+    strm.next_in = (Bytef *)data.data();
+    strm.avail_in = (uInt)data.size();
+    strm.next_out = (Bytef *)&compressed[0];
+    strm.avail_out = (uInt)compressed.size();
+    int rc = deflate(&strm, Z_FINISH);
+    compressed.resize(strm.total_out);
+    deflateEnd(&strm);
+    if (rc != Z_STREAM_END) {
+      throw WconZipError("Compression failed for " + path);
+    }
+    if (data.size() >= 0xFFFFFFFFUL || compressed.size() >= 0xFFFFFFFFUL ||
+	offset + compressed.size() + 30 + entryName.size() >= 0xFFFFFFFFUL) {
+      throw WconZipError("ZIP64 archives are not supported: " + path);
+    }
+    unsigned long crc = crc32(0L, (const Bytef *)data.data(),
+			      (uInt)data.size());
+
+    // Fields shared by the local and central headers, from "version
+    //   needed" through the extra field length
+    string common;
+    put16(common, 20);
+    put16(common, 0);
+    put16(common, Z_DEFLATED);
+    put16(common, dosTime);
+    put16(common, dosDate);
+    put32(common, crc);
+    put32(common, compressed.size());
+    put32(common, data.size());
+    put16(common, entryName.size());
+    put16(common, 0);
+
+    string local_header;
+    put32(local_header, ZIP_LOCAL_HEADER_SIG);
+    local_header += common;
+    local_header += entryName;
+
+    put32(central, ZIP_CENTRAL_HEADER_SIG);
+    put16(central, (3 << 8) | 20);	// made by unix, zip 2.0
+    central += common;
+    put16(central, 0);			// comment length
+    put16(central, 0);			// disk number
+    put16(central, 0);			// internal attributes
+    put32(central, 0100644UL << 16);	// external attributes
+    put32(central, offset);		// local header offset
+    central += entryName;
+
+    zf.write(local_header);
+    zf.write(compressed);
+    offset += local_header.size() + compressed.size();
+  }
+
+  string end;
+  put32(end, ZIP_END_SIG);
+  put16(end, 0);
+  put16(end, 0);
+  put16(end, names.size());
+  put16(end, names.size());
+  put32(end, central.size());
+  put32(end, offset);
+  put16(end, 0);
+
+  zf.write(central);
+  zf.write(end);
+}
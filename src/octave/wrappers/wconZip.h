@@ -0,0 +1,59 @@
+#ifndef __WCON_ZIP_H_
+#define __WCON_ZIP_H_
+// Just enough of the zip format for WCON files: the Python package
+//   reads any zip archive whose entries are stored or deflated, and
+//   writes single-entry deflated archives. Multi-entry archives can be
+//   written too, for generated test data. zlib does the compression.
+#include <time.h>
+
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+class WconZipError : public std::runtime_error {
+ public:
+  explicit WconZipError(const std::string &msg) : std::runtime_error(msg) {}
+};
+
+// zipfile.is_zipfile: true if the file ends with a zip directory.
+bool wconZipIsArchive(const std::string &path);
+
+// Names of the entries of an archive, in directory order.
+void wconZipList(const std::string &path, std::vector<std::string> &names);
+
+// Uncompressed contents of entry number index.
+void wconZipRead(const std::string &path, size_t index,
+		 std::string &contents);
+
+// Entry number index of an archive, inflated a buffer at a time, so that
+//   memory does not grow with the size of the entry. The CRC-32 is
+//   checked once the end of the entry has been read.
+class WconZipEntryReader {
+ public:
+  WconZipEntryReader(const std::string &path, size_t index);
+  ~WconZipEntryReader();
+
+  // Up to len bytes of the entry into buf; 0 at the end
+  size_t read(char *buf, size_t len);
+
+ private:
+  struct State;
+  State *state;
+
+  WconZipEntryReader(const WconZipEntryReader &);
+  WconZipEntryReader &operator=(const WconZipEntryReader &);
+};
+
+// Creates (or replaces) path with a single deflated entry.
+void wconZipWrite(const std::string &path, const std::string &entryName,
+		  const std::string &contents);
+
+// Creates (or replaces) path with one deflated entry per name, all
+//   stamped with the given local time; for archives that must come out
+//   the same every time.
+void wconZipWriteEntries(const std::string &path,
+			 const std::vector<std::string> &names,
+			 const std::vector<std::string> &contents,
+			 const struct tm &stamp);
+
+#endif /* __WCON_ZIP_H_ */
@@ -0,0 +1,315 @@
+// wcond: resident WCON service for the native backend.
+//
+// Keeps parsed datasets around as images in POSIX shared memory, so
+//   that every process loading the same file (an Octave session, a
+//   batch of scripts) gets it by mapping the image instead of parsing
+//   the file again. Images are read-only and shared by all clients;
+//   the least recently used ones are dropped once they take more than
+//   the memory budget. See wcondProtocol.h for the protocol.
+//
+// Usage: wcond [-s socket] [-m budget in MB]
+//
+// Runs in the foreground until it gets SIGINT, SIGTERM or a STOP
+//   request; start it with & or nohup to keep it around.
+#include "wcondProtocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <sstream>
+#include <thread>
+using namespace std;
+
+// What a cached image was made from; a file that changes on disk is
+//   loaded again. Only the named file is checked, not the other
+//   chunks it links to.
+struct FileIdentity {
+  dev_t dev;
+  ino_t ino;
+  off_t size;
+  struct timespec mtime;
+
+  bool operator==(const FileIdentity &other) const {
+    return dev == other.dev && ino == other.ino && size == other.size &&
+      mtime.tv_sec == other.mtime.tv_sec &&
+      mtime.tv_nsec == other.mtime.tv_nsec;
+  }
+};
+
+struct CacheEntry {
+  string path;
+  FileIdentity identity;
+  string shmName;
+  size_t size;
+};
+
+static mutex cacheLock;
+// Most recently used first
+static list<CacheEntry> cache;
+static map<string, list<CacheEntry>::iterator> cacheIndex;
+static size_t cacheBytes = 0;
+static size_t cacheBudget = 1024UL * 1024UL * 1024UL;
+static unsigned long cacheHits = 0;
+static unsigned long cacheMisses = 0;
+static unsigned long segmentCount = 0;
+
+static volatile sig_atomic_t stopRequested = 0;
+static int listenFd = -1;
+
+static void dropEntry(list<CacheEntry>::iterator entry) {
+  // Clients that mapped the segment keep their mapping
+  shm_unlink(entry->shmName.c_str());
+  cacheBytes -= entry->size;
+  cacheIndex.erase(entry->path);
+  cache.erase(entry);
+}
+
+// Drops the least recently used images until the rest fit the
+//   budget. The newest one stays, even if it alone is over budget.
+static void evict() {
+  while (cacheBytes > cacheBudget && cache.size() > 1) {
+    dropEntry(--cache.end());
+  }
+}
+
+static bool identify(const string &path, FileIdentity &id) {
+  struct stat st;
+  if (stat(path.c_str(), &st) != 0) {
+    return false;
+  }
+  id.dev = st.st_dev;
+  id.ino = st.st_ino;
+  id.size = st.st_size;
+  id.mtime = st.st_mtim;
+  return true;
+}
+
+// Publishes an image as a new read-only segment. Empty on failure.
+static string publish(const string &image) {
+  ostringstream name;
+  {
+    lock_guard<mutex> guard(cacheLock);
+    name << "/wcond." << getpid() << "." << segmentCount++;
+  }
+  int fd = shm_open(name.str().c_str(), O_CREAT | O_EXCL | O_RDWR, 0600);
+  if (fd < 0) {
+    return "";
+  }
+  bool ok = (ftruncate(fd, image.size()) == 0);
+  if (ok) {
+    void *mem = mmap(NULL, image.size(), PROT_READ | PROT_WRITE,
+		     MAP_SHARED, fd, 0);
+    if (mem == MAP_FAILED) {
+      ok = false;
+    } else {
+      memcpy(mem, image.data(), image.size());
+      munmap(mem, image.size());
+    }
+  }
+  close(fd);
+  if (!ok) {
+    shm_unlink(name.str().c_str());
+    return "";
+  }
+  return name.str();
+}
+
+static string okReply(const CacheEntry &entry) {
+  ostringstream reply;
+  reply << "OK " << entry.shmName << " " << entry.size << "\n";
+  return reply.str();
+}
+
+static string handleLoad(const string &path) {
+  FileIdentity id;
+  if (!identify(path, id)) {
+    return "ERR Cannot open " + path + ": " + strerror(errno) + "\n";
+  }
+
+  {
+    lock_guard<mutex> guard(cacheLock);
+    map<string, list<CacheEntry>::iterator>::iterator found =
+      cacheIndex.find(path);
+    if (found != cacheIndex.end()) {
+      if (found->second->identity == id) {
+	cache.splice(cache.begin(), cache, found->second);
+	cacheHits++;
+	return okReply(cache.front());
+      }
+      dropEntry(found->second);
+    }
+    cacheMisses++;
+  }
+
+  // Parse without holding the lock so other clients are served
+  //   meanwhile. Two clients asking for the same new file both parse
+  //   it; the later image replaces the earlier one.
+  string image;
+  try {
+    wcondImageWrite(*NativeWCONWorms::loadFromFile(path), image);
+  } catch (const exception &e) {
+    string msg = e.what();
+    replace(msg.begin(), msg.end(), '\n', ' ');
+    return "ERR " + msg + "\n";
+  }
+  string shmName = publish(image);
+  if (shmName.empty()) {
+    return string("ERR Cannot create shared memory: ") + strerror(errno) +
+      "\n";
+  }
+
+  lock_guard<mutex> guard(cacheLock);
+  map<string, list<CacheEntry>::iterator>::iterator found =
+    cacheIndex.find(path);
+  if (found != cacheIndex.end()) {
+    dropEntry(found->second);
+  }
+  CacheEntry entry;
+  entry.path = path;
+  entry.identity = id;
+  entry.shmName = shmName;
+  entry.size = image.size();
+  cache.push_front(entry);
+  cacheIndex[path] = cache.begin();
+  cacheBytes += entry.size;
+  evict();
+  return okReply(entry);
+}
+
+static string handleStatus() {
+  lock_guard<mutex> guard(cacheLock);
+  ostringstream reply;
+  reply << "OK entries=" << cache.size() << " bytes=" << cacheBytes
+	<< " budget=" << cacheBudget << " hits=" << cacheHits
+	<< " misses=" << cacheMisses << "\n";
+  return reply.str();
+}
+
+static void serve(int fd) {
+  string request;
+  if (wcondReadLine(fd, request)) {
+    string reply;
+    if (request.compare(0, 5, "LOAD ") == 0) {
+      reply = handleLoad(request.substr(5));
+    } else if (request == "STATUS") {
+      reply = handleStatus();
+    } else if (request == "STOP") {
+      // Answer first: main() exits as soon as accept() returns
+      wcondWriteAll(fd, "OK\n");
+      close(fd);
+      stopRequested = 1;
+      shutdown(listenFd, SHUT_RDWR);
+      return;
+    } else {
+      reply = "ERR Unknown request\n";
+    }
+    wcondWriteAll(fd, reply);
+  }
+  close(fd);
+}
+
+static void onSignal(int) {
+  stopRequested = 1;
+}
+
+static void usage() {
+  cerr << "Usage: wcond [-s socket] [-m budget in MB]" << endl;
+}
+
+int main(int argc, char **argv) {
+  string socketPath = wcondSocketPath();
+  int opt;
+  while ((opt = getopt(argc, argv, "s:m:")) != -1) {
+    switch (opt) {
+    case 's':
+      socketPath = optarg;
+      break;
+    case 'm':
+      cacheBudget = strtoul(optarg, NULL, 10) * 1024UL * 1024UL;
+      break;
+    default:
+      usage();
+      return -1;
+    }
+  }
+
+  struct sockaddr_un addr;
+  if (socketPath.size() >= sizeof(addr.sun_path)) {
+    cerr << "ERROR: Socket path too long: " << socketPath << endl;
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, socketPath.c_str(), socketPath.size() + 1);
+
+  listenFd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (listenFd < 0) {
+    cerr << "ERROR: socket: " << strerror(errno) << endl;
+    return -1;
+  }
+  // A socket left behind by a daemon that died is taken over; one
+  //   that still answers is not.
+  int probe = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (connect(probe, (struct sockaddr *)&addr, sizeof(addr)) == 0) {
+    cerr << "ERROR: wcond is already running on " << socketPath << endl;
+    return -1;
+  }
+  close(probe);
+  unlink(socketPath.c_str());
+
+  // Only the owner may talk to the daemon
+  mode_t oldMask = umask(0077);
+  int bound = bind(listenFd, (struct sockaddr *)&addr, sizeof(addr));
+  umask(oldMask);
+  if (bound != 0 || listen(listenFd, 64) != 0) {
+    cerr << "ERROR: Cannot listen on " << socketPath << ": "
+	 << strerror(errno) << endl;
+    return -1;
+  }
+
+  // No SA_RESTART, so that accept() returns on a signal
+  struct sigaction action;
+  memset(&action, 0, sizeof(action));
+  action.sa_handler = onSignal;
+  sigaction(SIGINT, &action, NULL);
+  sigaction(SIGTERM, &action, NULL);
+  signal(SIGPIPE, SIG_IGN);
+
+  cout << "wcond listening on " << socketPath << ", budget "
+       << cacheBudget / (1024 * 1024) << " MB" << endl;
+
+  while (!stopRequested) {
+    int fd = accept(listenFd, NULL, NULL);
+    if (fd < 0) {
+      if (errno == EINTR || stopRequested) {
+	continue;
+      }
+      cerr << "ERROR: accept: " << strerror(errno) << endl;
+      break;
+    }
+    thread(serve, fd).detach();
+  }
+
+  close(listenFd);
+  unlink(socketPath.c_str());
+  lock_guard<mutex> guard(cacheLock);
+  while (!cache.empty()) {
+    dropEntry(cache.begin());
+  }
+  return 0;
+}
@@ -0,0 +1,348 @@
+#include "wcondProtocol.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include <sstream>
+using namespace std;
+
+namespace {
+
+const char imageMagic[8] = { 'W', 'C', 'O', 'N', 'I', 'M', 'G', '1' };
+
+/*
+ * Image writing. Every field is a uint64 count followed by its
+ *   elements; strings are counts of bytes.
+ */
+
+void putCount(string &out, uint64_t n) {
+  out.append((const char *)&n, sizeof(n));
+}
+
+void putString(string &out, const string &s) {
+  putCount(out, s.size());
+  out.append(s);
+}
+
+void putNumbers(string &out, const vector<double> &values) {
+  putCount(out, values.size());
+  if (!values.empty()) {
+    out.append((const char *)&values[0], values.size() * sizeof(double));
+  }
+}
+
+void putStrings(string &out, const vector<string> &values) {
+  putCount(out, values.size());
+  for (size_t i=0; i<values.size(); i++) {
+    putString(out, values[i]);
+  }
+}
+
+/*
+ * Image reading
+ */
+
+class ImageReader {
+ public:
+  ImageReader(const char *data, size_t len) : data(data), len(len), pos(0) {}
+
+  uint64_t count() {
+    uint64_t n;
+    need(sizeof(n));
+    memcpy(&n, data + pos, sizeof(n));
+    pos += sizeof(n);
+    return n;
+  }
+
+  void str(string &s) {
+    uint64_t n = count();
+    need(n);
+    s.assign(data + pos, n);
+    pos += n;
+  }
+
+  void numbers(vector<double> &values) {
+    uint64_t n = count();
+    if (n > (len - pos) / sizeof(double)) {
+      damaged();
+    }
+    values.resize(n);
+    if (n > 0) {
+      memcpy(&values[0], data + pos, n * sizeof(double));
+    }
+    pos += n * sizeof(double);
+  }
+
+  void strings(vector<string> &values) {
+    uint64_t n = count();
+    // every string takes at least its count
+    if (n > (len - pos) / sizeof(uint64_t)) {
+      damaged();
+    }
+    values.resize(n);
+    for (uint64_t i=0; i<n; i++) {
+      str(values[i]);
+    }
+  }
+
+  void magic() {
+    need(sizeof(imageMagic));
+    if (memcmp(data, imageMagic, sizeof(imageMagic)) != 0) {
+      damaged();
+    }
+    pos += sizeof(imageMagic);
+  }
+
+  bool atEnd() const { return pos == len; }
+
+ private:
+  const char *data;
+  size_t len;
+  size_t pos;
+
+  void need(uint64_t n) {
+    if (n > len - pos) {
+      damaged();
+    }
+  }
+  void damaged() {
+    throw WconNativeError("Damaged dataset image from wcond");
+  }
+};
+
+// Seconds the client waits on the daemon for any one step ($WCOND_TIMEOUT
+//   if set) before it gives up and parses the file itself. A reply
+//   only comes once the daemon has parsed the file, so this is long.
+long clientTimeout() {
+  const char *env = getenv("WCOND_TIMEOUT");
+  long seconds = (env != NULL) ? strtol(env, NULL, 10) : 0;
+  return (seconds > 0) ? seconds : 60;
+}
+
+// Connects to the daemon; -1 if there is none or it does not answer.
+//   Reads and writes on the socket time out (clientTimeout), so a hung
+//   daemon cannot hang the client.
+int connectDaemon() {
+  string path = wcondSocketPath();
+  struct sockaddr_un addr;
+  if (path.size() >= sizeof(addr.sun_path)) {
+    return -1;
+  }
+  memset(&addr, 0, sizeof(addr));
+  addr.sun_family = AF_UNIX;
+  memcpy(addr.sun_path, path.c_str(), path.size() + 1);
+
+  int fd = socket(AF_UNIX, SOCK_STREAM, 0);
+  if (fd < 0) {
+    return -1;
+  }
+  struct timeval timeout;
+  timeout.tv_sec = clientTimeout();
+  timeout.tv_usec = 0;
+  if (setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &timeout,
+		 sizeof(timeout)) != 0 ||
+      setsockopt(fd, SOL_SOCKET, SO_SNDTIMEO, &timeout,
+		 sizeof(timeout)) != 0 ||
+      connect(fd, (struct sockaddr *)&addr, sizeof(addr)) != 0) {
+    close(fd);
+    return -1;
+  }
+  return fd;
+}
+
+} // namespace
+
+string wcondSocketPath() {
+  const char *env = getenv("WCOND_SOCKET");
+  if (env != NULL && *env != '\0') {
+    return env;
+  }
+  ostringstream path;
+  path << "/tmp/wcond-" << getuid() << ".sock";
+  return path.str();
+}
+
+void wcondImageWrite(const NativeWCONWorms &worms, string &out) {
+  out.assign(imageMagic, sizeof(imageMagic));
+
+  putCount(out, worms.units.size());
+  for (size_t i=0; i<worms.units.size(); i++) {
+    putString(out, worms.units[i].first);
+    putString(out, worms.units[i].second->unitString());
+  }
+
+  // Metadata goes as compact JSON; it is small and rarely read
+  putCount(out, worms.hasMetadata ? 1 : 0);
+  if (worms.hasMetadata) {
+    WconJsonWriter writer;
+    writer.writeValue(worms.metadata);
+    putString(out, writer.text());
+  }
+
+  putCount(out, worms.worms.size());
+  for (size_t i=0; i<worms.worms.size(); i++) {
+    const NativeWorm &w = worms.worms[i];
+    putString(out, w.id);
+    putCount(out, w.numFrames);
+    putCount(out, w.maxPoints);
+    putNumbers(out, w.t);
+    putNumbers(out, w.x);
+    putNumbers(out, w.y);
+    putNumbers(out, w.aspectSize);
+    putNumbers(out, w.cx);
+    putNumbers(out, w.cy);
+    putNumbers(out, w.ox);
+    putNumbers(out, w.oy);
+    putStrings(out, w.head);
+    putStrings(out, w.ventral);
+  }
+}
+
+shared_ptr<NativeWCONWorms> wcondImageRead(const char *data, size_t len) {
+  ImageReader in(data, len);
+  in.magic();
+
+  shared_ptr<NativeWCONWorms> result(new NativeWCONWorms());
+  uint64_t numUnits = in.count();
+  for (uint64_t i=0; i<numUnits; i++) {
+    string key, unitStr;
+    in.str(key);
+    in.str(unitStr);
+    result->units.push_back(make_pair(key,
+				      NativeMeasurementUnit::create(unitStr)));
+  }
+
+  result->hasMetadata = (in.count() != 0);
+  if (result->hasMetadata) {
+    string json;
+    in.str(json);
+    wconJsonParse(json.data(), json.size(), result->metadata);
+  }
+
+  uint64_t numWorms = in.count();
+  for (uint64_t i=0; i<numWorms; i++) {
+    result->worms.push_back(NativeWorm());
+    NativeWorm &w = result->worms.back();
+    in.str(w.id);
+    w.numFrames = (long)in.count();
+    w.maxPoints = (long)in.count();
+    in.numbers(w.t);
+    in.numbers(w.x);
+    in.numbers(w.y);
+    in.numbers(w.aspectSize);
+    in.numbers(w.cx);
+    in.numbers(w.cy);
+    in.numbers(w.ox);
+    in.numbers(w.oy);
+    in.strings(w.head);
+    in.strings(w.ventral);
+    if ((long)w.t.size() != w.numFrames ||
+	(long)w.x.size() != w.numFrames * w.maxPoints ||
+	w.y.size() != w.x.size()) {
+      throw WconNativeError("Damaged dataset image from wcond");
+    }
+  }
+  if (!in.atEnd()) {
+    throw WconNativeError("Damaged dataset image from wcond");
+  }
+  return result;
+}
+
+bool wcondReadLine(int fd, string &line) {
+  line.clear();
+  char c;
+  for (;;) {
+    ssize_t n = read(fd, &c, 1);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return false;
+    } else if (c == '\n') {
+      return true;
+    }
+    line += c;
+  }
+}
+
+bool wcondWriteAll(int fd, const string &s) {
+  size_t done = 0;
+  while (done < s.size()) {
+    ssize_t n = write(fd, s.data() + done, s.size() - done);
+    if (n < 0 && errno == EINTR) {
+      continue;
+    } else if (n <= 0) {
+      return false;
+    }
+    done += n;
+  }
+  return true;
+}
+
+bool wcondClientLoad(const string &path, shared_ptr<NativeWCONWorms> &out) {
+  const char *disable = getenv("WCOND_DISABLE");
+  if (disable != NULL && *disable != '\0' && strcmp(disable, "0") != 0) {
+    return false;
+  }
+
+  // The daemon has its own working directory. Paths it cannot be
+  //   given (missing files, newlines) are left to the local loader,
+  //   which reports them as usual.
+  char resolved[PATH_MAX];
+  if (realpath(path.c_str(), resolved) == NULL ||
+      strchr(resolved, '\n') != NULL) {
+    return false;
+  }
+
+  int fd = connectDaemon();
+  if (fd < 0) {
+    return false;
+  }
+  // Timed out or cut off: the caller parses the file itself
+  string reply;
+  bool ok = wcondWriteAll(fd, string("LOAD ") + resolved + "\n") &&
+    wcondReadLine(fd, reply);
+  close(fd);
+  if (!ok) {
+    return false;
+  }
+
+  if (reply.compare(0, 4, "ERR ") == 0) {
+    throw WconNativeError(reply.substr(4));
+  }
+  istringstream fields(reply);
+  string status, shmName;
+  size_t size = 0;
+  if (!(fields >> status >> shmName >> size) || status != "OK") {
+    return false;
+  }
+
+  // The segment may have been evicted since the reply was sent; the
+  //   caller then loads the file itself.
+  int shmFd = shm_open(shmName.c_str(), O_RDONLY, 0);
+  if (shmFd < 0) {
+    return false;
+  }
+  void *image = mmap(NULL, size, PROT_READ, MAP_SHARED, shmFd, 0);
+  close(shmFd);
+  if (image == MAP_FAILED) {
+    return false;
+  }
+  try {
+    out = wcondImageRead((const char *)image, size);
+  } catch (...) {
+    munmap(image, size);
+    throw;
+  }
+  munmap(image, size);
+  return true;
+}
@@ -0,0 +1,45 @@
+#ifndef __WCOND_PROTOCOL_H_
+#define __WCOND_PROTOCOL_H_
+// wcond, the resident WCON service, and the client side of it used by
+//   the native backend.
+//
+// Control plane: one request per connection on a Unix domain socket,
+//   as a line of text, answered by a line of text:
+//
+//     LOAD <absolute path>  ->  OK <shm name> <bytes> | ERR <message>
+//     STATUS                ->  OK <key>=<value> ...
+//     STOP                  ->  OK
+//
+// Data plane: a loaded dataset is published once, as an image in a
+//   POSIX shared memory segment that every client maps read-only.
+//   Images hold the columns as raw doubles in host byte order, so
+//   clients on the same machine only copy them, never parse.
+#include <memory>
+#include <string>
+
+#include "nativeDataset.h"
+
+// $WCOND_SOCKET if set, otherwise /tmp/wcond-<uid>.sock
+std::string wcondSocketPath();
+
+// Image of a dataset, and back. wcondImageRead throws WconNativeError
+//   if the image is damaged.
+void wcondImageWrite(const NativeWCONWorms &worms, std::string &out);
+std::shared_ptr<NativeWCONWorms> wcondImageRead(const char *data,
+						size_t len);
+
+// Reads one '\n' terminated line from fd (without the '\n'). false on
+//   EOF or error before the end of the line.
+bool wcondReadLine(int fd, std::string &line);
+// Writes all of s. false on error.
+bool wcondWriteAll(int fd, const std::string &s);
+
+// Has the daemon load path. Returns false, leaving out alone, when no
+//   daemon is running, it does not answer within $WCOND_TIMEOUT
+//   seconds (60 by default), or $WCOND_DISABLE is set, so that the
+//   caller can load the file itself; throws WconNativeError with the daemon's
+//   message when the daemon could not load the file.
+bool wcondClientLoad(const std::string &path,
+		     std::shared_ptr<NativeWCONWorms> &out);
+
+#endif /* __WCOND_PROTOCOL_H_ */
@@ -0,0 +1,509 @@
+// Hand-written Octave interface to the wrapper library.
+//
+// Unlike the SWIG generated wconoct module, which can only move ints
+//   and C strings across, this module fills Octave matrices and structs
+//   directly from the library's buffers, and reports failures as
+//   Octave errors rather than terminating the session.
+//
+// Usage:
+//   h = wcondirect('load', path)
+//   wcondirect('save', h, path [, pretty_print [, compressed]])
+//   c = wcondirect('to_canon', h)
+//   m = wcondirect('add', h1, h2)
+//   tf = wcondirect('eq', h1, h2)
+//   n = wcondirect('num_worms', h)
+//   ids = wcondirect('worm_ids', h)
+//   w = wcondirect('worm', h, k)    % all data of the k-th worm (1-based)
+//   [x, y, len] = wcondirect('spines', h, k, n)  % n points per spine
+//   ws = wcondirect('worms', h)     % struct array of every worm
+//   md = wcondirect('metadata', h)  % struct, or [] if there is none
+//   u = wcondirect('units', h)      % struct of unit strings
+#include <octave/oct.h>
+#include <octave/Cell.h>
+#include <octave/ov-struct.h>
+
+#include <string.h>
+
+#include <string>
+#include <vector>
+
+#include "octaveWconPythonWrapper.h"
+#include "wconJson.h"
+
+// Releases the worm data on every path out of the calling scope,
+//   including Octave errors, which unwind as C++ exceptions.
+class WormDataHolder {
+ public:
+  explicit WormDataHolder(WconOctWormData *data) : data(data) {}
+  ~WormDataHolder() { wconOct_freeWormData(data); }
+  WconOctWormData *get() const { return data; }
+ private:
+  WconOctWormData *data;
+  WormDataHolder(const WormDataHolder &);
+  WormDataHolder &operator=(const WormDataHolder &);
+};
+
+static WconOctHandle handleArg(const octave_value_list &args, int idx,
+			       const char *cmd) {
+  if (args.length() <= idx) {
+    error("wcondirect: '%s' requires a handle argument", cmd);
+  }
+  return (WconOctHandle)args(idx).int_value();
+}
+
+static std::string stringArg(const octave_value_list &args, int idx,
+			     const char *cmd) {
+  if (args.length() <= idx || !args(idx).is_string()) {
+    error("wcondirect: '%s' requires a string argument", cmd);
+  }
+  return args(idx).string_value();
+}
+
+static Matrix viewToMatrix(const WconOctArrayView &view) {
+  if (view.data == NULL) {
+    return Matrix();
+  }
+  Matrix result(view.rows, view.cols);
+  double *dst = result.fortran_vec();
+  // Octave is column major; the views are usually row major.
+  for (long j=0; j<view.cols; j++) {
+    const double *src = view.data + j*view.colStride;
+    for (long i=0; i<view.rows; i++) {
+      dst[i] = src[i*view.rowStride];
+    }
+    dst += view.rows;
+  }
+  return result;
+}
+
+#define WORM_NUM_FIELDS 7
+static const char *wormFields[WORM_NUM_FIELDS] = {
+  "id", "t", "x", "y", "cx", "cy", "npoints"
+};
+
+static void wormToValues(const WconOctWormData *worm, octave_value *values) {
+  values[0] = octave_value(std::string(worm->id));
+  values[1] = viewToMatrix(worm->t);
+  values[2] = viewToMatrix(worm->x);
+  values[3] = viewToMatrix(worm->y);
+  values[4] = viewToMatrix(worm->cx);
+  values[5] = viewToMatrix(worm->cy);
+  values[6] = viewToMatrix(worm->aspectSize);
+}
+
+static octave_value jsonToOctave(const WconJsonValue &value) {
+  switch (value.type) {
+  case WconJsonValue::JSON_NULL:
+    return Matrix();
+  case WconJsonValue::JSON_BOOL:
+    return octave_value(value.boolValue);
+  case WconJsonValue::JSON_NUMBER:
+    return octave_value(value.numValue);
+  case WconJsonValue::JSON_STRING:
+    return octave_value(value.strValue);
+  case WconJsonValue::JSON_ARRAY: {
+    bool numeric = true;
+    for (size_t i=0; i<value.items.size() && numeric; i++) {
+      numeric = value.items[i].isNumber() || value.items[i].isNull();
+    }
+    if (numeric && !value.items.empty()) {
+      RowVector row(value.items.size());
+      for (size_t i=0; i<value.items.size(); i++) {
+	row(i) = value.items[i].isNull() ?
+	  lo_ieee_nan_value() : value.items[i].numValue;
+      }
+      return row;
+    }
+    Cell cell(1, value.items.size());
+    for (size_t i=0; i<value.items.size(); i++) {
+      cell(i) = jsonToOctave(value.items[i]);
+    }
+    return cell;
+  }
+  case WconJsonValue::JSON_OBJECT: {
+    octave_scalar_map result;
+    for (size_t i=0; i<value.members.size(); i++) {
+      result.assign(value.members[i].first,
+		    jsonToOctave(value.members[i].second));
+    }
+    return result;
+  }
+  }
+  return Matrix();
+}
+
+static const char *futureStateName(WconOctFutureState state) {
+  switch (state) {
+  case WCONOCT_FUTURE_PENDING:
+    return "pending";
+  case WCONOCT_FUTURE_RUNNING:
+    return "running";
+  case WCONOCT_FUTURE_DONE:
+    return "done";
+  case WCONOCT_FUTURE_FAILED:
+    return "failed";
+  default:
+    return "cancelled";
+  }
+}
+
+// Converts and frees JSON text returned by the wrapper library
+static octave_value jsonTextToOctave(char *text) {
+  WconJsonValue value;
+  std::string parseError;
+  try {
+    wconJsonParse(text, strlen(text), value);
+  } catch (const WconJsonError &e) {
+    parseError = e.what();
+  }
+  wconOct_freeString(text);
+  if (!parseError.empty()) {
+    error("wcondirect: %s", parseError.c_str());
+  }
+  return jsonToOctave(value);
+}
+
+DEFUN_DLD (wcondirect, args, nargout,
+	   "-*- texinfo -*-\n\
+@deftypefn {} {@var{result} =} wcondirect (@var{cmd}, @dots{})\n\
+Direct access to WCON data through the wrapper library.\n\
+@var{cmd} is one of load, load_many, save, to_canon, add, eq, num_worms,\n\
+worm_ids, worm, worms, metadata, units, release, memory,\n\
+memory_cap, load_cache, load_async, save_async, poll, wait, cancel, result,\n\
+stats or stats_reset.\n\
+@end deftypefn")
+{
+  if (args.length() < 1 || !args(0).is_string()) {
+    print_usage();
+  }
+  std::string cmd = args(0).string_value();
+  WconOctError err;
+
+  if (cmd == "load") {
+    std::string path = stringArg(args, 1, "load");
+    WconOctHandle h = wconOct_static_WCONWorms_load_from_file(&err,
+							      path.c_str());
+    if (err == FAILED) {
+      error("wcondirect: failed to load '%s'", path.c_str());
+    }
+    return octave_value((double)h);
+
+  } else if (cmd == "load_many") {
+    // A cell array of paths; NaN for each file that failed
+    if (args.length() < 2 || !args(1).iscellstr()) {
+      error("wcondirect: 'load_many' requires a cell array of paths");
+    }
+    Array<std::string> paths = args(1).cellstr_value();
+    std::vector<const char *> cpaths(paths.numel());
+    for (octave_idx_type i=0; i<paths.numel(); i++) {
+      cpaths[i] = paths(i).c_str();
+    }
+    std::vector<WconOctHandle> handles(paths.numel());
+    std::vector<WconOctError> errs(paths.numel());
+    wconOct_load_many(&err, cpaths.data(), cpaths.size(), handles.data(),
+		      errs.data());
+    Matrix result(1, paths.numel());
+    for (octave_idx_type i=0; i<paths.numel(); i++) {
+      result(i) = (errs[i] == SUCCESS) ? (double)handles[i] :
+	lo_ieee_nan_value();
+    }
+    return octave_value(result);
+
+  } else if (cmd == "save") {
+    WconOctHandle h = handleArg(args, 1, "save");
+    std::string path = stringArg(args, 2, "save");
+    int pretty = (args.length() > 3) ? args(3).int_value() : 1;
+    int compressed = (args.length() > 4) ? args(4).int_value() : 0;
+    wconOct_WCONWorms_save_to_file(&err, h, path.c_str(),
+				   pretty, compressed);
+    if (err == FAILED) {
+      error("wcondirect: failed to save handle %d to '%s'", h,
+	    path.c_str());
+    }
+    return octave_value_list();
+
+  } else if (cmd == "to_canon") {
+    WconOctHandle h = handleArg(args, 1, "to_canon");
+    WconOctHandle result = wconOct_WCONWorms_to_canon(&err, h);
+    if (err == FAILED) {
+      error("wcondirect: to_canon failed for handle %d", h);
+    }
+    return octave_value((double)result);
+
+  } else if (cmd == "add") {
+    WconOctHandle h1 = handleArg(args, 1, "add");
+    WconOctHandle h2 = handleArg(args, 2, "add");
+    WconOctHandle result = wconOct_WCONWorms_add(&err, h1, h2);
+    if (err == FAILED) {
+      error("wcondirect: handles %d and %d could not be merged", h1, h2);
+    }
+    return octave_value((double)result);
+
+  } else if (cmd == "eq") {
+    WconOctHandle h1 = handleArg(args, 1, "eq");
+    WconOctHandle h2 = handleArg(args, 2, "eq");
+    int result = wconOct_WCONWorms_eq(&err, h1, h2);
+    if (err == FAILED) {
+      error("wcondirect: could not compare handles %d and %d", h1, h2);
+    }
+    return octave_value(result == 1);
+
+  } else if (cmd == "num_worms") {
+    WconOctHandle h = handleArg(args, 1, "num_worms");
+    long result = wconOct_WCONWorms_num_worms(&err, h);
+    if (err == FAILED) {
+      error("wcondirect: num_worms failed for handle %d", h);
+    }
+    return octave_value((double)result);
+
+  } else if (cmd == "worm_ids" || cmd == "worms") {
+    WconOctHandle h = handleArg(args, 1, cmd.c_str());
+    long numWorms = wconOct_WCONWorms_num_worms(&err, h);
+    if (err == FAILED) {
+      error("wcondirect: num_worms failed for handle %d", h);
+    }
+    Cell fields[WORM_NUM_FIELDS];
+    for (int f=0; f<WORM_NUM_FIELDS; f++) {
+      fields[f] = Cell(1, numWorms);
+    }
+    for (long k=0; k<numWorms; k++) {
+      WormDataHolder worm(wconOct_WCONWorms_worm_data(&err, h, k));
+      if (err == FAILED) {
+	error("wcondirect: could not read worm %ld of handle %d", k+1, h);
+      }
+      if (cmd == "worm_ids") {
+	fields[0](k) = octave_value(std::string(worm.get()->id));
+      } else {
+	octave_value values[WORM_NUM_FIELDS];
+	wormToValues(worm.get(), values);
+	for (int f=0; f<WORM_NUM_FIELDS; f++) {
+	  fields[f](k) = values[f];
+	}
+      }
+    }
+    if (cmd == "worm_ids") {
+      return octave_value(fields[0]);
+    }
+    octave_map worms(dim_vector(1, numWorms));
+    for (int f=0; f<WORM_NUM_FIELDS; f++) {
+      worms.setfield(wormFields[f], fields[f]);
+    }
+    return octave_value(worms);
+
+  } else if (cmd == "worm") {
+    WconOctHandle h = handleArg(args, 1, "worm");
+    if (args.length() < 3) {
+      error("wcondirect: 'worm' requires a worm index");
+    }
+    long k = args(2).long_value();
+    WormDataHolder worm(wconOct_WCONWorms_worm_data(&err, h, k-1));
+    if (err == FAILED) {
+      error("wcondirect: could not read worm %ld of handle %d", k, h);
+    }
+    octave_value values[WORM_NUM_FIELDS];
+    wormToValues(worm.get(), values);
+    octave_scalar_map result;
+    for (int f=0; f<WORM_NUM_FIELDS; f++) {
+      result.assign(wormFields[f], values[f]);
+    }
+    return octave_value(result);
+
+  } else if (cmd == "spines") {
+    WconOctHandle h = handleArg(args, 1, "spines");
+    if (args.length() < 4) {
+      error("wcondirect: 'spines' requires a worm index and a point count");
+    }
+    long k = args(2).long_value();
+    long n = args(3).long_value();
+    long numFrames = wconOct_WCONWorms_spines(&err, h, k-1, n, NULL, NULL,
+					      0, 0, NULL);
+    if (err == FAILED) {
+      error("wcondirect: could not resample worm %ld of handle %d", k, h);
+    }
+    // Written straight into the Octave matrices, column major
+    Matrix x(numFrames, n), y(numFrames, n), len(numFrames, 1);
+    wconOct_WCONWorms_spines(&err, h, k-1, n, x.fortran_vec(),
+			     y.fortran_vec(), 1, numFrames,
+			     len.fortran_vec());
+    if (err == FAILED) {
+      error("wcondirect: could not resample worm %ld of handle %d", k, h);
+    }
+    octave_value_list result;
+    result(0) = x;
+    result(1) = y;
+    result(2) = len;
+    return result;
+
+  } else if (cmd == "metadata") {
+    WconOctHandle h = handleArg(args, 1, "metadata");
+    char *text = wconOct_WCONWorms_metadata_json(&err, h);
+    if (err == FAILED) {
+      error("wcondirect: metadata failed for handle %d", h);
+    }
+    if (text == NULL) {
+      return octave_value(Matrix());
+    }
+    return jsonTextToOctave(text);
+
+  } else if (cmd == "units") {
+    WconOctHandle h = handleArg(args, 1, "units");
+    WconOctUnitsDict *dict = wconOct_WCONWorms_units(&err, h);
+    if (err == FAILED) {
+      error("wcondirect: units failed for handle %d", h);
+    }
+    octave_scalar_map result;
+    bool failed = false;
+    for (int i=0; i<dict->numElements && !failed; i++) {
+      // Keys come across in Python repr form, e.g. 't'
+      std::string key(dict->unitsDict[i].key);
+      if (key.size() >= 2 && key[0] == '\'' && key[key.size()-1] == '\'') {
+	key = key.substr(1, key.size()-2);
+      }
+      const char *unit =
+	wconOct_MeasurementUnit_unit_string(&err, dict->unitsDict[i].value);
+      if (err == FAILED) {
+	failed = true;
+      } else {
+	result.assign(key, octave_value(std::string(unit)));
+      }
+    }
+    // The unit handles were made for this call alone
+    for (int i=0; i<dict->numElements; i++) {
+      WconOctError releaseErr;
+      wconOct_releaseHandle(&releaseErr, dict->unitsDict[i].value);
+    }
+    wconOct_freeUnitsDict(dict);
+    if (failed) {
+      error("wcondirect: could not read units of handle %d", h);
+    }
+    return octave_value(result);
+
+  } else if (cmd == "release") {
+    WconOctHandle h = handleArg(args, 1, "release");
+    wconOct_releaseHandle(&err, h);
+    if (err == FAILED) {
+      error("wcondirect: could not release handle %d", h);
+    }
+    return octave_value_list();
+
+  } else if (cmd == "memory") {
+    // The largest live handles, 10 unless asked for more
+    int maxEntries = (args.length() > 1) ? args(1).int_value() : 10;
+    WconOctMemoryReport *report = wconOct_memoryReport(&err, maxEntries);
+    if (err == FAILED) {
+      error("wcondirect: memory report failed");
+    }
+    Cell handles(1, report->numEntries), bytes(1, report->numEntries);
+    Cell createdBy(1, report->numEntries), age(1, report->numEntries);
+    for (int i=0; i<report->numEntries; i++) {
+      handles(i) = octave_value((double)report->entries[i].handle);
+      bytes(i) = octave_value(report->entries[i].bytes);
+      createdBy(i) = octave_value(std::string(report->entries[i].createdBy));
+      age(i) = octave_value(report->entries[i].ageSeconds);
+    }
+    octave_map largest(dim_vector(1, report->numEntries));
+    largest.setfield("handle", handles);
+    largest.setfield("bytes", bytes);
+    largest.setfield("created_by", createdBy);
+    largest.setfield("age_seconds", age);
+    octave_scalar_map result;
+    result.assign("num_handles", octave_value((double)report->numHandles));
+    result.assign("total_bytes", octave_value(report->totalBytes));
+    result.assign("cap_bytes", octave_value(report->capBytes));
+    result.assign("num_cached", octave_value((double)report->numCached));
+    result.assign("cached_bytes", octave_value(report->cachedBytes));
+    result.assign("cache_budget_bytes",
+		  octave_value(report->cacheBudgetBytes));
+    result.assign("cache_hits", octave_value(report->cacheHits));
+    result.assign("cache_misses", octave_value(report->cacheMisses));
+    result.assign("largest", octave_value(largest));
+    wconOct_freeMemoryReport(report);
+    return octave_value(result);
+
+  } else if (cmd == "memory_cap") {
+    if (args.length() < 2) {
+      error("wcondirect: 'memory_cap' requires a size in MB");
+    }
+    wconOct_setMemoryCap(&err, args(1).double_value());
+    if (err == FAILED) {
+      error("wcondirect: could not set the memory cap");
+    }
+    return octave_value_list();
+
+  } else if (cmd == "load_cache") {
+    if (args.length() < 2) {
+      error("wcondirect: 'load_cache' requires a size in MB");
+    }
+    wconOct_setLoadCache(&err, args(1).double_value());
+    if (err == FAILED) {
+      error("wcondirect: could not set the load cache budget");
+    }
+    return octave_value_list();
+
+  } else if (cmd == "load_async") {
+    std::string path = stringArg(args, 1, "load_async");
+    WconOctFuture f = wconOct_load_async(&err, path.c_str());
+    if (err == FAILED) {
+      error("wcondirect: could not start loading '%s'", path.c_str());
+    }
+    return octave_value((double)f);
+
+  } else if (cmd == "save_async") {
+    WconOctHandle h = handleArg(args, 1, "save_async");
+    std::string path = stringArg(args, 2, "save_async");
+    int pretty = (args.length() > 3) ? args(3).int_value() : 1;
+    int compressed = (args.length() > 4) ? args(4).int_value() : 0;
+    WconOctFuture f = wconOct_save_async(&err, h, path.c_str(),
+					 pretty, compressed);
+    if (err == FAILED) {
+      error("wcondirect: could not start saving handle %d", h);
+    }
+    return octave_value((double)f);
+
+  } else if (cmd == "poll" || cmd == "wait") {
+    // Futures come back as the state: pending, running, done, failed
+    //   or cancelled
+    WconOctFuture f = handleArg(args, 1, cmd.c_str());
+    WconOctFutureState state;
+    if (cmd == "poll") {
+      state = wconOct_future_poll(&err, f);
+    } else {
+      double timeout = (args.length() > 2) ? args(2).double_value() : -1;
+      state = wconOct_future_wait(&err, f, timeout);
+    }
+    if (err == FAILED) {
+      error("wcondirect: no future %d", f);
+    }
+    return octave_value(std::string(futureStateName(state)));
+
+  } else if (cmd == "cancel") {
+    WconOctFuture f = handleArg(args, 1, "cancel");
+    int cancelled = wconOct_future_cancel(&err, f);
+    if (err == FAILED) {
+      error("wcondirect: no future %d", f);
+    }
+    return octave_value(cancelled != 0);
+
+  } else if (cmd == "result") {
+    WconOctFuture f = handleArg(args, 1, "result");
+    WconOctHandle h = wconOct_future_result(&err, f);
+    if (err == FAILED) {
+      error("wcondirect: future %d failed", f);
+    }
+    return octave_value((double)h);
+
+  } else if (cmd == "stats") {
+    char *text = wconOct_stats_snapshot_json(&err);
+    if (err == FAILED) {
+      error("wcondirect: stats failed");
+    }
+    return jsonTextToOctave(text);
+
+  } else if (cmd == "stats_reset") {
+    wconOct_stats_reset(&err);
+    return octave_value_list();
+  }
+
+  error("wcondirect: unknown command '%s'", cmd.c_str());
+  return octave_value_list();
+}
@@ -0,0 +1,542 @@
+// wcongen: writes synthetic WCON files of any size, for benchmarks and
+//   scaling tests. Worms crawl along random walks with an undulating
+//   spine; everything is drawn from a generator seeded with -s, so the
+//   same options always give byte-identical output.
+//
+// Usage: wcongen [options] output-base
+//   -s seed        random seed (default 1)
+//   -n worms       number of worms (default 10)
+//   -d seconds     duration of the recording (default 60)
+//   -r hertz       frame rate (default 25)
+//   -p points      mean number of spine points (default 49)
+//   -P spread      spine points vary uniformly by +-spread per frame
+//   -c seconds     split into chunks this long, linked through "files"
+//   -o             give positions relative to an origin (ox, oy)
+//   -m             add centroids (cx, cy)
+//   -e             add point perimeters (px, py, ptail)
+//   -k             add pixel-walk perimeters (walk)
+//   -a             add custom @ blocks, top level and per record
+//   -u             non-canonical units (ms and um)
+//   -z             package the output as output-base.wcon.zip
+//
+// Writes output-base.wcon, or output-base_0.wcon, output-base_1.wcon...
+//   when chunked. A zipped chunked recording is a single archive with
+//   the chunks in order, which the loaders unpack and follow.
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <exception>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "wconZip.h"
+using namespace std;
+
+struct GenOptions {
+  GenOptions() : seed(1), worms(10), duration(60.0), frameRate(25.0),
+		 points(49), pointSpread(0), chunkSeconds(0.0),
+		 origins(false), centroids(false), perimeters(false),
+		 walks(false), custom(false), nonCanonical(false),
+		 zip(false) {}
+
+  unsigned long seed;
+  long worms;
+  double duration;
+  double frameRate;
+  long points;
+  long pointSpread;
+  double chunkSeconds;
+  bool origins;
+  bool centroids;
+  bool perimeters;
+  bool walks;
+  bool custom;
+  bool nonCanonical;
+  bool zip;
+};
+
+// 64-bit linear congruential generator (Knuth's MMIX constants); rand()
+//   differs between C libraries.
+class GenRandom {
+ public:
+  explicit GenRandom(unsigned long long seed) : state(seed) { next(); }
+  // uniform in [0, 1)
+  double next() {
+    state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+    return (double)(state >> 11) / 9007199254740992.0;
+  }
+  long nextInt(long lo, long hi) {
+    return lo + (long)(next() * (hi - lo + 1));
+  }
+ private:
+  unsigned long long state;
+};
+
+// One frame of one worm, in mm and s
+struct GenFrame {
+  double t;
+  vector<double> x;
+  vector<double> y;
+  double ox, oy;
+  double cx, cy;
+  double speed;
+};
+
+// A worm's position and gait, carried from frame to frame (and chunk
+//   to chunk) so that chunking does not change the data.
+struct GenWorm {
+  GenWorm(unsigned long long seed) : random(seed) {}
+
+  GenRandom random;
+  string id;
+  long firstFrame;
+  long endFrame;
+  double length;
+  double headX, headY;
+  double heading;
+  double phase;
+};
+
+static const double pi = 3.14159265358979323846;
+
+static void initWorm(GenWorm &w, long index, long numFrames) {
+  ostringstream id;
+  id << index + 1;
+  w.id = id.str();
+  // Each worm is tracked for a random stretch of at least half of the
+  //   recording
+  long span = numFrames / 2 + w.random.nextInt(0, numFrames - numFrames / 2);
+  w.firstFrame = w.random.nextInt(0, numFrames - span);
+  w.endFrame = w.firstFrame + span;
+  w.length = 0.9 + 0.2 * w.random.next();
+  w.headX = 5.0 + 25.0 * w.random.next();
+  w.headY = 5.0 + 25.0 * w.random.next();
+  w.heading = 2 * pi * w.random.next();
+  w.phase = 2 * pi * w.random.next();
+}
+
+static void stepWorm(GenWorm &w, long frame, const GenOptions &opts,
+		     GenFrame &f) {
+  double dt = 1.0 / opts.frameRate;
+  f.speed = 0.1 + 0.1 * w.random.next();
+  w.heading += 0.3 * (w.random.next() - 0.5);
+  w.headX += f.speed * dt * cos(w.heading);
+  w.headY += f.speed * dt * sin(w.heading);
+  w.phase += 2 * pi * 0.5 * dt;
+
+  long n = opts.points;
+  if (opts.pointSpread > 0) {
+    n += w.random.nextInt(-opts.pointSpread, opts.pointSpread);
+  }
+  n = max(n, 2L);
+
+  f.t = frame * dt;
+  f.x.resize(n);
+  f.y.resize(n);
+  double ux = cos(w.heading), uy = sin(w.heading);
+  f.cx = f.cy = 0.0;
+  for (long i=0; i<n; i++) {
+    double s = w.length * i / (n - 1);
+    double bend = 0.06 * sin(w.phase - 2 * pi * s / w.length);
+    f.x[i] = w.headX - s * ux - bend * uy;
+    f.y[i] = w.headY - s * uy + bend * ux;
+    f.cx += f.x[i] / n;
+    f.cy += f.y[i] / n;
+  }
+  f.ox = opts.origins ? w.headX : 0.0;
+  f.oy = opts.origins ? w.headY : 0.0;
+}
+
+/*
+ * Output
+ */
+
+class GenWriter {
+ public:
+  GenWriter(const GenOptions &opts) :
+    timeScale(opts.nonCanonical ? 1000.0 : 1.0),
+    lengthScale(opts.nonCanonical ? 1000.0 : 1.0),
+    timeDigits(opts.nonCanonical ? 2 : 5),
+    lengthDigits(opts.nonCanonical ? 2 : 5) {}
+
+  string out;
+
+  void raw(const char *s) { out += s; }
+  void raw(const string &s) { out += s; }
+  void quoted(const string &s) { out += '"'; out += s; out += '"'; }
+  void number(double v, int digits) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.*f", digits, v);
+    out += buf;
+  }
+  void integer(long v) {
+    char buf[32];
+    snprintf(buf, sizeof(buf), "%ld", v);
+    out += buf;
+  }
+  void time(double v) { number(v * timeScale, timeDigits); }
+  void length(double v) { number(v * lengthScale, lengthDigits); }
+
+ private:
+  double timeScale;
+  double lengthScale;
+  int timeDigits;
+  int lengthDigits;
+};
+
+static const char *base64Chars =
+  "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+static string base64(const vector<unsigned char> &bytes) {
+  string result;
+  for (size_t i=0; i<bytes.size(); i+=3) {
+    unsigned long v = (unsigned long)bytes[i] << 16;
+    if (i + 1 < bytes.size()) v |= (unsigned long)bytes[i+1] << 8;
+    if (i + 2 < bytes.size()) v |= bytes[i+2];
+    result += base64Chars[(v >> 18) & 63];
+    result += base64Chars[(v >> 12) & 63];
+    result += (i + 1 < bytes.size()) ? base64Chars[(v >> 6) & 63] : '=';
+    result += (i + 2 < bytes.size()) ? base64Chars[v & 63] : '=';
+  }
+  return result;
+}
+
+// A 4-connected walk around the pixels bounding the spine, relative to
+//   the origin like every other position.
+static void writeWalk(GenWriter &out, const GenFrame &f) {
+  const double pixel = 0.02;
+  double minX = *min_element(f.x.begin(), f.x.end()) - f.ox;
+  double maxX = *max_element(f.x.begin(), f.x.end()) - f.ox;
+  double minY = *min_element(f.y.begin(), f.y.end()) - f.oy;
+  double maxY = *max_element(f.y.begin(), f.y.end()) - f.oy;
+  long width = max(1L, (long)ceil((maxX - minX) / pixel));
+  long height = max(1L, (long)ceil((maxY - minY) / pixel));
+
+  // Steps are 2 bits, lowest bits first: 00 -x, 01 +x, 10 -y, 11 +y
+  vector<unsigned char> bytes;
+  long numSteps = 0;
+  const int sides[4] = { 1, 3, 0, 2 };
+  for (int side=0; side<4; side++) {
+    long count = (side % 2 == 0) ? width : height;
+    for (long i=0; i<count; i++, numSteps++) {
+      if (numSteps % 4 == 0) {
+	bytes.push_back(0);
+      }
+      bytes.back() |= sides[side] << (2 * (numSteps % 4));
+    }
+  }
+
+  out.raw("{\"px\":[");
+  out.length(minX);
+  out.raw(",");
+  out.length(minY);
+  out.raw(",");
+  out.length(pixel);
+  out.raw("],\"n\":");
+  out.integer(numSteps);
+  out.raw(",\"4\":");
+  out.quoted(base64(bytes));
+  out.raw("}");
+}
+
+static void writeColumn(GenWriter &out, const char *key,
+			const vector<GenFrame> &frames, double GenFrame::*field,
+			bool isTime) {
+  out.raw(",\"");
+  out.raw(key);
+  out.raw("\":[");
+  for (size_t i=0; i<frames.size(); i++) {
+    if (i > 0) out.raw(",");
+    if (isTime) {
+      out.time(frames[i].*field);
+    } else {
+      out.length(frames[i].*field);
+    }
+  }
+  out.raw("]");
+}
+
+static void writeRecord(GenWriter &out, const GenWorm &w,
+			const vector<GenFrame> &frames,
+			const GenOptions &opts) {
+  out.raw("{\"id\":");
+  out.quoted(w.id);
+  writeColumn(out, "t", frames, &GenFrame::t, true);
+
+  for (int axis=0; axis<2; axis++) {
+    out.raw(axis == 0 ? ",\"x\":[" : ",\"y\":[");
+    for (size_t i=0; i<frames.size(); i++) {
+      const vector<double> &v = (axis == 0) ? frames[i].x : frames[i].y;
+      double o = (axis == 0) ? frames[i].ox : frames[i].oy;
+      out.raw(i > 0 ? ",[" : "[");
+      for (size_t j=0; j<v.size(); j++) {
+	if (j > 0) out.raw(",");
+	out.length(v[j] - o);
+      }
+      out.raw("]");
+    }
+    out.raw("]");
+  }
+
+  if (opts.origins) {
+    writeColumn(out, "ox", frames, &GenFrame::ox, false);
+    writeColumn(out, "oy", frames, &GenFrame::oy, false);
+  }
+  if (opts.centroids) {
+    // Relative to the origin, as spines are
+    out.raw(",\"cx\":[");
+    for (size_t i=0; i<frames.size(); i++) {
+      if (i > 0) out.raw(",");
+      out.length(frames[i].cx - frames[i].ox);
+    }
+    out.raw("],\"cy\":[");
+    for (size_t i=0; i<frames.size(); i++) {
+      if (i > 0) out.raw(",");
+      out.length(frames[i].cy - frames[i].oy);
+    }
+    out.raw("]");
+  }
+
+  if (opts.perimeters) {
+    // Down one side of the body from the head and back up the other,
+    //   so the tail is the last point of the first side
+    const double halfWidth = 0.03;
+    for (int axis=0; axis<2; axis++) {
+      out.raw(axis == 0 ? ",\"px\":[" : ",\"py\":[");
+      for (size_t i=0; i<frames.size(); i++) {
+	const GenFrame &f = frames[i];
+	long n = f.x.size();
+	out.raw(i > 0 ? ",[" : "[");
+	for (long k=0; k<2*n-2; k++) {
+	  long j = (k < n) ? k : 2*n-2-k;
+	  double side = (k < n) ? 1.0 : -1.0;
+	  long a = max(0L, j-1), b = min(n-1, j+1);
+	  double dx = f.x[b] - f.x[a], dy = f.y[b] - f.y[a];
+	  double norm = sqrt(dx * dx + dy * dy);
+	  double offset = (j == 0 || j == n-1) ? 0.0 : side * halfWidth / norm;
+	  double value = (axis == 0) ? f.x[j] - offset * dy - f.ox
+	    : f.y[j] + offset * dx - f.oy;
+	  if (k > 0) out.raw(",");
+	  out.length(value);
+	}
+	out.raw("]");
+      }
+      out.raw("]");
+    }
+    out.raw(",\"ptail\":[");
+    for (size_t i=0; i<frames.size(); i++) {
+      if (i > 0) out.raw(",");
+      out.integer(frames[i].x.size() - 1);
+    }
+    out.raw("]");
+  }
+
+  if (opts.walks) {
+    out.raw(",\"walk\":[");
+    for (size_t i=0; i<frames.size(); i++) {
+      if (i > 0) out.raw(",");
+      writeWalk(out, frames[i]);
+    }
+    out.raw("]");
+  }
+
+  if (opts.custom) {
+    out.raw(",\"@wcongen\":{\"speed\":[");
+    for (size_t i=0; i<frames.size(); i++) {
+      if (i > 0) out.raw(",");
+      out.number(frames[i].speed, 4);
+    }
+    out.raw("],\"gait\":\"crawl\"}");
+  }
+  out.raw("}");
+}
+
+static string chunkName(const string &base, long chunk, long numChunks) {
+  if (numChunks == 1) {
+    return base + ".wcon";
+  }
+  ostringstream name;
+  name << base << "_" << chunk << ".wcon";
+  return name.str();
+}
+
+static void writeHeader(GenWriter &out, const GenOptions &opts,
+			const string &base, long chunk, long numChunks) {
+  const char *t = opts.nonCanonical ? "ms" : "s";
+  const char *l = opts.nonCanonical ? "um" : "mm";
+  vector<string> lengthKeys;
+  lengthKeys.push_back("x");
+  lengthKeys.push_back("y");
+  if (opts.origins) {
+    lengthKeys.push_back("ox");
+    lengthKeys.push_back("oy");
+  }
+  if (opts.centroids) {
+    lengthKeys.push_back("cx");
+    lengthKeys.push_back("cy");
+  }
+  if (opts.perimeters || opts.walks) {
+    lengthKeys.push_back("px");
+    lengthKeys.push_back("py");
+  }
+  out.raw("{\"units\":{\"t\":");
+  out.quoted(t);
+  for (size_t i=0; i<lengthKeys.size(); i++) {
+    out.raw(",\"");
+    out.raw(lengthKeys[i]);
+    out.raw("\":");
+    out.quoted(l);
+  }
+  out.raw("},\"metadata\":{\"lab\":{\"name\":\"Synthetic worms\"},"
+	  "\"who\":\"wcongen\",\"timestamp\":\"2016-01-01T00:00:00\","
+	  "\"temperature\":20,"
+	  "\"software\":{\"tracker\":{\"name\":\"wcongen\","
+	  "\"version\":\"1.0\"}}}");
+
+  if (numChunks > 1) {
+    out.raw(",\"files\":{\"current\":");
+    // Links are relative to the directory of the chunk
+    string current = chunkName(base, chunk, numChunks);
+    size_t slash = current.rfind('/');
+    string dir = (slash == string::npos) ? "" : current.substr(0, slash + 1);
+    out.quoted(current.substr(dir.size()));
+    out.raw(",\"prev\":[");
+    if (chunk > 0) {
+      out.quoted(chunkName(base, chunk - 1, numChunks).substr(dir.size()));
+    }
+    out.raw("],\"next\":[");
+    if (chunk + 1 < numChunks) {
+      out.quoted(chunkName(base, chunk + 1, numChunks).substr(dir.size()));
+    }
+    out.raw("]}");
+  }
+
+  if (opts.custom) {
+    out.raw(",\"@wcongen\":{\"seed\":");
+    out.integer((long)opts.seed);
+    out.raw(",\"worms\":");
+    out.integer(opts.worms);
+    out.raw("}");
+  }
+}
+
+static bool writeFile(const string &path, const string &contents) {
+  FILE *fp = fopen(path.c_str(), "wb");
+  if (fp == NULL) {
+    return false;
+  }
+  size_t n = fwrite(contents.data(), 1, contents.size(), fp);
+  return fclose(fp) == 0 && n == contents.size();
+}
+
+static void usage() {
+  cerr << "Usage: wcongen [-s seed] [-n worms] [-d seconds] [-r hertz]"
+       << " [-p points] [-P spread]" << endl
+       << "               [-c chunk seconds] [-o] [-m] [-e] [-k] [-a] [-u]"
+       << " [-z] output-base" << endl;
+}
+
+int main(int argc, char **argv) {
+  GenOptions opts;
+  int opt;
+  while ((opt = getopt(argc, argv, "s:n:d:r:p:P:c:omekauz")) != -1) {
+    switch (opt) {
+    case 's': opts.seed = strtoul(optarg, NULL, 10); break;
+    case 'n': opts.worms = atol(optarg); break;
+    case 'd': opts.duration = atof(optarg); break;
+    case 'r': opts.frameRate = atof(optarg); break;
+    case 'p': opts.points = atol(optarg); break;
+    case 'P': opts.pointSpread = atol(optarg); break;
+    case 'c': opts.chunkSeconds = atof(optarg); break;
+    case 'o': opts.origins = true; break;
+    case 'm': opts.centroids = true; break;
+    case 'e': opts.perimeters = true; break;
+    case 'k': opts.walks = true; break;
+    case 'a': opts.custom = true; break;
+    case 'u': opts.nonCanonical = true; break;
+    case 'z': opts.zip = true; break;
+    default:
+      usage();
+      return -1;
+    }
+  }
+  if (optind != argc - 1 || opts.worms < 1 || opts.duration <= 0 ||
+      opts.frameRate <= 0 || opts.points < 1 || opts.pointSpread < 0) {
+    usage();
+    return -1;
+  }
+  string base = argv[optind];
+
+  long numFrames = max(1L, (long)floor(opts.duration * opts.frameRate + 0.5));
+  long chunkFrames = numFrames;
+  if (opts.chunkSeconds > 0) {
+    chunkFrames = max(1L, (long)floor(opts.chunkSeconds * opts.frameRate +
+				       0.5));
+  }
+  long numChunks = (numFrames + chunkFrames - 1) / chunkFrames;
+
+  vector<GenWorm> worms;
+  GenRandom seeder(opts.seed);
+  for (long i=0; i<opts.worms; i++) {
+    worms.push_back(GenWorm((unsigned long long)(seeder.next() * 9.0e15)));
+    initWorm(worms.back(), i, numFrames);
+  }
+
+  vector<string> names;
+  vector<string> contents;
+  try {
+    for (long c=0; c<numChunks; c++) {
+      long frame0 = c * chunkFrames;
+      long frame1 = min(numFrames, frame0 + chunkFrames);
+      GenWriter out(opts);
+      writeHeader(out, opts, base, c, numChunks);
+      out.raw(",\"data\":[");
+      bool first = true;
+      vector<GenFrame> frames;
+      for (size_t i=0; i<worms.size(); i++) {
+	GenWorm &w = worms[i];
+	long from = max(frame0, w.firstFrame);
+	long to = min(frame1, w.endFrame);
+	if (from >= to) {
+	  continue;
+	}
+	frames.resize(to - from);
+	for (long f=from; f<to; f++) {
+	  stepWorm(w, f, opts, frames[f - from]);
+	}
+	if (!first) out.raw(",");
+	writeRecord(out, w, frames, opts);
+	first = false;
+      }
+      out.raw("]}");
+
+      string name = chunkName(base, c, numChunks);
+      if (opts.zip) {
+	size_t slash = name.rfind('/');
+	names.push_back(slash == string::npos ? name : name.substr(slash + 1));
+	contents.push_back(out.out);
+      } else if (!writeFile(name, out.out)) {
+	cerr << "ERROR: Cannot write " << name << endl;
+	return -1;
+      }
+    }
+    if (opts.zip) {
+      // A fixed time stamp, so that archives are reproducible too
+      struct tm stamp;
+      memset(&stamp, 0, sizeof(stamp));
+      stamp.tm_year = 116;
+      stamp.tm_mday = 1;
+      wconZipWriteEntries(base + ".wcon.zip", names, contents, stamp);
+    }
+  } catch (const exception &e) {
+    cerr << "ERROR: " << e.what() << endl;
+    return -1;
+  }
+  return 0;
+}
@@ -0,0 +1,59 @@
+// wconsplit: re-chunks a WCON file, or a chunked recording, into linked
+//   chunks of bounded length or size (wconOct_WCONWorms_split).
+//
+// Usage: wconsplit [options] input output-base
+//   -t seconds     longest time span of a chunk
+//   -b megabytes   largest size of a chunk, approximately
+//   -z             zip each chunk (output-base_N.wcon.zip)
+//
+// Writes output-base_0.wcon, output-base_1.wcon... and prints the number
+//   of chunks. With neither -t nor -b the whole recording goes into one.
+#include <stdlib.h>
+#include <unistd.h>
+
+#include <iostream>
+
+#include "octaveWconPythonWrapper.h"
+using namespace std;
+
+static void usage() {
+  cerr << "Usage: wconsplit [-t seconds] [-b megabytes] [-z] input"
+       << " output-base" << endl;
+}
+
+int main(int argc, char **argv) {
+  double chunkSeconds = 0, chunkMegabytes = 0;
+  int compressed = 0;
+  int opt;
+  while ((opt = getopt(argc, argv, "t:b:z")) != -1) {
+    switch (opt) {
+    case 't': chunkSeconds = atof(optarg); break;
+    case 'b': chunkMegabytes = atof(optarg); break;
+    case 'z': compressed = 1; break;
+    default:
+      usage();
+      return -1;
+    }
+  }
+  if (optind != argc - 2 || chunkSeconds < 0 || chunkMegabytes < 0) {
+    usage();
+    return -1;
+  }
+
+  WconOctError err;
+  WconOctHandle worms =
+    wconOct_static_WCONWorms_load_from_file(&err, argv[optind]);
+  if (err == FAILED) {
+    cerr << "ERROR: Cannot load " << argv[optind] << endl;
+    return -1;
+  }
+  long numChunks =
+    wconOct_WCONWorms_split(&err, worms, argv[optind + 1], chunkSeconds,
+			    chunkMegabytes * 1024 * 1024, compressed);
+  if (err == FAILED) {
+    return -1;
+  }
+  cout << numChunks << endl;
+  wconOct_releaseHandle(&err, worms);
+  return 0;
+}
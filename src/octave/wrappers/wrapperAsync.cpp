@@ -0,0 +1,310 @@
+#include "octaveWconPythonWrapper.h"
+#include "wrapperStats.h"
+
+#include <stdlib.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Asynchronous load and save for both backends. The workers run the
+//   ordinary wconOct_* calls, which is what makes this shared: the
+//   native registry is locked, and the Python backend takes the GIL
+//   in every entry point.
+
+#define ASYNC_DEFAULT_WORKERS 2
+
+namespace {
+
+struct AsyncJob {
+  enum Operation {
+    LOAD,
+    SAVE
+  };
+
+  Operation op;
+  string path;
+  WconOctHandle self;
+  int prettyPrint;
+  int compressed;
+
+  WconOctFutureState state;
+  // Set by cancel on a running load; the result is released on arrival
+  bool discard;
+  WconOctHandle result;
+};
+
+bool isFinished(WconOctFutureState state) {
+  return state == WCONOCT_FUTURE_DONE || state == WCONOCT_FUTURE_FAILED ||
+    state == WCONOCT_FUTURE_CANCELLED;
+}
+
+class AsyncPool {
+ public:
+  AsyncPool() : nextFuture(1), stopping(false) {}
+
+  // Lets the workers finish what they are on and drops the rest
+  ~AsyncPool() {
+    {
+      lock_guard<mutex> guard(lock);
+      stopping = true;
+    }
+    workAvailable.notify_all();
+    for (size_t i=0; i<workers.size(); i++) {
+      workers[i].join();
+    }
+  }
+
+  WconOctFuture submit(const shared_ptr<AsyncJob> &job) {
+    lock_guard<mutex> guard(lock);
+    if (workers.empty()) {
+      start();
+    }
+    WconOctFuture future = nextFuture++;
+    futures[future] = job;
+    queue.push_back(job);
+    workAvailable.notify_one();
+    return future;
+  }
+
+  // NULL, with a message, for an unknown future. Use with lock held.
+  //   A copy, since waiting drops the lock and another thread may take
+  //   the result and forget the future meanwhile.
+  shared_ptr<AsyncJob> find(WconOctFuture future) {
+    unordered_map<WconOctFuture, shared_ptr<AsyncJob> >::iterator found =
+      futures.find(future);
+    if (found == futures.end()) {
+      cerr << "ERROR: No future with id " << future << endl;
+      return shared_ptr<AsyncJob>();
+    }
+    return found->second;
+  }
+
+  mutex lock;
+  condition_variable workAvailable;
+  condition_variable workDone;
+  unordered_map<WconOctFuture, shared_ptr<AsyncJob> > futures;
+
+ private:
+  void start() {
+    long count = ASYNC_DEFAULT_WORKERS;
+    const char *env = getenv("WCONOCT_ASYNC_WORKERS");
+    if (env != NULL && atol(env) > 0) {
+      count = atol(env);
+    }
+    for (long i=0; i<count; i++) {
+      workers.push_back(thread(&AsyncPool::work, this));
+    }
+  }
+
+  void work() {
+    unique_lock<mutex> guard(lock);
+    for (;;) {
+      while (!stopping && queue.empty()) {
+	workAvailable.wait(guard);
+      }
+      if (stopping) {
+	return;
+      }
+      shared_ptr<AsyncJob> job = queue.front();
+      queue.pop_front();
+      if (job->state == WCONOCT_FUTURE_CANCELLED) {
+	continue;
+      }
+      job->state = WCONOCT_FUTURE_RUNNING;
+      guard.unlock();
+
+      WconOctError err;
+      WconOctHandle result = wconOct_makeNullHandle();
+      if (job->op == AsyncJob::LOAD) {
+	result = wconOct_static_WCONWorms_load_from_file(&err,
+							 job->path.c_str());
+      } else {
+	wconOct_WCONWorms_save_to_file(&err, job->self, job->path.c_str(),
+				       job->prettyPrint, job->compressed);
+      }
+
+      guard.lock();
+      bool discard = job->discard;
+      if (discard) {
+	job->state = WCONOCT_FUTURE_CANCELLED;
+      } else {
+	job->state = (err == SUCCESS) ? WCONOCT_FUTURE_DONE :
+	  WCONOCT_FUTURE_FAILED;
+	job->result = result;
+      }
+      workDone.notify_all();
+      if (discard && err == SUCCESS) {
+	guard.unlock();
+	wconOct_releaseHandle(&err, result);
+	guard.lock();
+      }
+    }
+  }
+
+  WconOctFuture nextFuture;
+  bool stopping;
+  deque<shared_ptr<AsyncJob> > queue;
+  vector<thread> workers;
+};
+
+AsyncPool pool;
+
+WconOctFuture submitJob(WconOctError *err, AsyncJob *job) {
+  job->state = WCONOCT_FUTURE_PENDING;
+  job->discard = false;
+  job->result = wconOct_makeNullHandle();
+  // Initialize on this thread, so that the workers never have to
+  wconOct_initWrapper(err);
+  if (*err == FAILED) {
+    cerr << "ERROR: Failed to initialize wrapper library." << endl;
+    delete job;
+    return 0;
+  }
+  *err = SUCCESS;
+  return pool.submit(shared_ptr<AsyncJob>(job));
+}
+
+} // namespace
+
+extern "C"
+WconOctFuture wconOct_load_async(WconOctError *err, const char *wconpath) {
+  WconOctStatScope stat(WCONOCT_STAT_LOAD_ASYNC, err);
+  if (err == NULL || wconpath == NULL) {
+    cerr << "ERROR: load_async needs an error variable and a path" << endl;
+    if (err != NULL) {
+      *err = FAILED;
+    }
+    return 0;
+  }
+  AsyncJob *job = new AsyncJob;
+  job->op = AsyncJob::LOAD;
+  job->path = wconpath;
+  job->self = wconOct_makeNullHandle();
+  job->prettyPrint = 0;
+  job->compressed = 0;
+  return submitJob(err, job);
+}
+
+extern "C"
+WconOctFuture wconOct_save_async(WconOctError *err,
+				 const WconOctHandle selfHandle,
+				 const char *output_path,
+				 int pretty_print,
+				 int compressed) {
+  WconOctStatScope stat(WCONOCT_STAT_SAVE_ASYNC, err);
+  if (err == NULL || output_path == NULL) {
+    cerr << "ERROR: save_async needs an error variable and a path" << endl;
+    if (err != NULL) {
+      *err = FAILED;
+    }
+    return 0;
+  }
+  AsyncJob *job = new AsyncJob;
+  job->op = AsyncJob::SAVE;
+  job->path = output_path;
+  job->self = selfHandle;
+  job->prettyPrint = pretty_print;
+  job->compressed = compressed;
+  return submitJob(err, job);
+}
+
+extern "C"
+WconOctFutureState wconOct_future_poll(WconOctError *err,
+				       WconOctFuture future) {
+  WconOctStatScope stat(WCONOCT_STAT_FUTURE_POLL, err, true);
+  lock_guard<mutex> guard(pool.lock);
+  shared_ptr<AsyncJob> job = pool.find(future);
+  if (job == NULL) {
+    *err = FAILED;
+    return WCONOCT_FUTURE_FAILED;
+  }
+  *err = SUCCESS;
+  return job->state;
+}
+
+extern "C"
+WconOctFutureState wconOct_future_wait(WconOctError *err,
+				       WconOctFuture future,
+				       double timeoutSeconds) {
+  WconOctStatScope stat(WCONOCT_STAT_FUTURE_WAIT, err);
+  unique_lock<mutex> guard(pool.lock);
+  shared_ptr<AsyncJob> job = pool.find(future);
+  if (job == NULL) {
+    *err = FAILED;
+    return WCONOCT_FUTURE_FAILED;
+  }
+  if (timeoutSeconds < 0) {
+    while (!isFinished(job->state)) {
+      pool.workDone.wait(guard);
+    }
+  } else {
+    chrono::steady_clock::time_point deadline = chrono::steady_clock::now() +
+      chrono::duration_cast<chrono::steady_clock::duration>(
+	chrono::duration<double>(timeoutSeconds));
+    while (!isFinished(job->state)) {
+      if (pool.workDone.wait_until(guard, deadline) == cv_status::timeout) {
+	break;
+      }
+    }
+  }
+  *err = SUCCESS;
+  return job->state;
+}
+
+extern "C"
+int wconOct_future_cancel(WconOctError *err, WconOctFuture future) {
+  WconOctStatScope stat(WCONOCT_STAT_FUTURE_CANCEL, err);
+  lock_guard<mutex> guard(pool.lock);
+  shared_ptr<AsyncJob> job = pool.find(future);
+  if (job == NULL) {
+    *err = FAILED;
+    return 0;
+  }
+  *err = SUCCESS;
+  if (job->state == WCONOCT_FUTURE_PENDING) {
+    // The worker that dequeues it skips it
+    job->state = WCONOCT_FUTURE_CANCELLED;
+    pool.workDone.notify_all();
+    return 1;
+  }
+  if (job->state == WCONOCT_FUTURE_RUNNING && job->op == AsyncJob::LOAD) {
+    job->discard = true;
+    return 1;
+  }
+  // A save that has started may have written part of the file already
+  return 0;
+}
+
+extern "C"
+WconOctHandle wconOct_future_result(WconOctError *err, WconOctFuture future) {
+  WconOctStatScope stat(WCONOCT_STAT_FUTURE_RESULT, err);
+  unique_lock<mutex> guard(pool.lock);
+  shared_ptr<AsyncJob> job = pool.find(future);
+  if (job == NULL) {
+    *err = FAILED;
+    return wconOct_makeNullHandle();
+  }
+  while (!isFinished(job->state)) {
+    pool.workDone.wait(guard);
+  }
+  WconOctFutureState state = job->state;
+  WconOctHandle result = job->result;
+  pool.futures.erase(future);
+
+  if (state == WCONOCT_FUTURE_CANCELLED) {
+    cerr << "ERROR: Future " << future << " was cancelled" << endl;
+    *err = FAILED;
+    return wconOct_makeNullHandle();
+  }
+  *err = (state == WCONOCT_FUTURE_DONE) ? SUCCESS : FAILED;
+  return result;
+}
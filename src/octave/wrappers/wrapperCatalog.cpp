@@ -0,0 +1,792 @@
+#include "octaveWconPythonWrapper.h"
+#include "wconJson.h"
+#include "wrapperParse.h"
+#include "wrapperStats.h"
+
+#include <dirent.h>
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Catalog of WCON files for both backends, built from wconOctPeekFile
+//   so that no file is ever loaded.
+//
+// The index file is one JSON object, {"wconCatalog": 1, "entries": [...]},
+//   with for each file what a peek found in it (units, metadata and
+//   files as they are in the file) and the size and mtime it had then.
+//   A scan only peeks at the files whose size or mtime changed, on a
+//   few threads, and drops the entries of files that went away. Chunk
+//   chains are worked out from the "files" links whenever the entries
+//   change; they are not kept in the index.
+
+#define CATALOG_VERSION 1
+
+namespace {
+
+struct CatalogEntry {
+  CatalogEntry() : mtime(0), mtimeNsec(0), size(0), ok(false),
+		   numRecords(0), numWorms(0), numFrames(0), tMin(NAN),
+		   tMax(NAN), chainIndex(0) {}
+
+  long long mtime;
+  long mtimeNsec;
+  long long size;
+  // false if the peek failed: the entry is kept, so that the file is
+  //   not read again until it changes, but never selected
+  bool ok;
+  // JSON null where the file has none
+  WconJsonValue units;
+  WconJsonValue metadata;
+  WconJsonValue files;
+  long numRecords;
+  long numWorms;
+  long numFrames;
+  double tMin;
+  double tMax;
+
+  // Resolved chunk links, "" for none
+  string prev;
+  string next;
+  // First file of the chain and the place of this one in it
+  string chain;
+  long chainIndex;
+};
+
+// One file found on disk by a scan
+struct CatalogFile {
+  string path;
+  long long mtime;
+  long mtimeNsec;
+  long long size;
+};
+
+// One clause of a query: field, or field op value
+struct CatalogTerm {
+  string field;
+  // "" (the field exists), "==", "!=", "<", "<=", ">", ">=" or "~"
+  string op;
+  string text;
+  bool isNumber;
+  double number;
+};
+
+// A field value, as a number where it is one and as text always
+struct CatalogValue {
+  bool isNumber;
+  double number;
+  string text;
+};
+
+} // namespace
+
+struct wconOctCatalogStruct {
+  // "" to keep the catalog in memory only
+  string indexPath;
+  // By path, so selections come out in path order
+  map<string, CatalogEntry> entries;
+};
+
+namespace {
+
+bool catalogHasSuffix(const string &s, const string &suffix) {
+  return s.size() >= suffix.size() &&
+    s.compare(s.size() - suffix.size(), suffix.size(), suffix) == 0;
+}
+
+// Every WCON file (.wcon, .wcon.zip, .wcon.gz, .wcon.zst) under dir.
+//   Symbolic links to directories are not followed, so that there are
+//   no loops.
+void catalogFind(const string &dir, vector<CatalogFile> &found) {
+  DIR *d = opendir(dir.c_str());
+  if (d == NULL) {
+    return;
+  }
+  struct dirent *entry;
+  while ((entry = readdir(d)) != NULL) {
+    string name = entry->d_name;
+    if (name == "." || name == "..") {
+      continue;
+    }
+    string path = dir + "/" + name;
+    struct stat st;
+    if (lstat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+      catalogFind(path, found);
+    } else if ((catalogHasSuffix(name, ".wcon") ||
+		catalogHasSuffix(name, ".wcon.zip") ||
+		catalogHasSuffix(name, ".wcon.gz") ||
+		catalogHasSuffix(name, ".wcon.zst")) &&
+	       stat(path.c_str(), &st) == 0 && S_ISREG(st.st_mode)) {
+      CatalogFile file;
+      file.path = path;
+      file.mtime = (long long)st.st_mtime;
+#ifdef __APPLE__
+      file.mtimeNsec = (long)st.st_mtimespec.tv_nsec;
+#else
+      file.mtimeNsec = (long)st.st_mtim.tv_nsec;
+#endif
+      file.size = (long long)st.st_size;
+      found.push_back(file);
+    }
+  }
+  closedir(d);
+}
+
+void catalogParseJson(const char *text, WconJsonValue &out) {
+  out = WconJsonValue();
+  if (text != NULL) {
+    wconJsonParse(text, strlen(text), out);
+  }
+}
+
+// Peeks at one file into entry; messages for failures
+void catalogPeek(const CatalogFile &file, CatalogEntry &entry) {
+  entry.mtime = file.mtime;
+  entry.mtimeNsec = file.mtimeNsec;
+  entry.size = file.size;
+  WconOctPeek peek;
+  peek.unitsJson = peek.metadataJson = peek.filesJson = NULL;
+  peek.numRecords = peek.numWorms = peek.numFrames = 0;
+  peek.tMin = peek.tMax = NAN;
+  try {
+    wconOctPeekFile(file.path, peek);
+    catalogParseJson(peek.unitsJson, entry.units);
+    catalogParseJson(peek.metadataJson, entry.metadata);
+    catalogParseJson(peek.filesJson, entry.files);
+    wconOctPeekLinks(file.path, peek.filesJson, entry.prev, entry.next);
+    entry.numRecords = peek.numRecords;
+    entry.numWorms = peek.numWorms;
+    entry.numFrames = peek.numFrames;
+    entry.tMin = peek.tMin;
+    entry.tMax = peek.tMax;
+    entry.ok = true;
+  } catch (const exception &e) {
+    cerr << "ERROR: Cannot catalog " << file.path << ": " << e.what()
+	 << endl;
+    entry.ok = false;
+  }
+  delete [] peek.unitsJson;
+  delete [] peek.metadataJson;
+  delete [] peek.filesJson;
+}
+
+// Peeks at files[next..] on one thread of a scan
+void catalogPeekBatch(const vector<const CatalogFile *> *files,
+		      atomic<size_t> *next, vector<CatalogEntry> *entries) {
+  for (size_t i = (*next)++; i < files->size(); i = (*next)++) {
+    catalogPeek(*(*files)[i], (*entries)[i]);
+  }
+}
+
+// Works out the chains again: from each file that no other links to
+//   as next, along the next links
+void catalogChains(WconOctCatalog *catalog) {
+  map<string, CatalogEntry> &entries = catalog->entries;
+  map<string, CatalogEntry>::iterator it;
+  for (it = entries.begin(); it != entries.end(); ++it) {
+    it->second.chain.clear();
+    it->second.chainIndex = 0;
+  }
+  for (it = entries.begin(); it != entries.end(); ++it) {
+    if (!it->second.prev.empty() && entries.count(it->second.prev) != 0) {
+      continue;
+    }
+    long index = 0;
+    map<string, CatalogEntry>::iterator link = it;
+    while (link != entries.end() && link->second.chain.empty()) {
+      link->second.chain = it->first;
+      link->second.chainIndex = index++;
+      link = link->second.next.empty() ? entries.end() :
+	entries.find(link->second.next);
+    }
+  }
+  // Files in a loop of links are chains of their own
+  for (it = entries.begin(); it != entries.end(); ++it) {
+    if (it->second.chain.empty()) {
+      it->second.chain = it->first;
+    }
+  }
+}
+
+void catalogWriteEntry(WconJsonWriter &writer, const string &path,
+		       const CatalogEntry &entry) {
+  writer.beginObject();
+  writer.key("path");
+  writer.writeString(path);
+  writer.key("mtime");
+  writer.writeInteger(entry.mtime);
+  writer.key("mtimeNsec");
+  writer.writeInteger(entry.mtimeNsec);
+  writer.key("size");
+  writer.writeInteger(entry.size);
+  writer.key("ok");
+  writer.writeBool(entry.ok);
+  if (entry.ok) {
+    const char *keys[] = {"units", "metadata", "files"};
+    const WconJsonValue *values[] = {&entry.units, &entry.metadata,
+				     &entry.files};
+    for (int k=0; k<3; k++) {
+      if (!values[k]->isNull()) {
+	writer.key(keys[k]);
+	writer.writeValue(*values[k]);
+      }
+    }
+    writer.key("records");
+    writer.writeInteger(entry.numRecords);
+    writer.key("worms");
+    writer.writeInteger(entry.numWorms);
+    writer.key("frames");
+    writer.writeInteger(entry.numFrames);
+    writer.key("tMin");
+    if (isnan(entry.tMin)) {
+      writer.writeNull();
+    } else {
+      writer.writeNumber(entry.tMin);
+    }
+    writer.key("tMax");
+    if (isnan(entry.tMax)) {
+      writer.writeNull();
+    } else {
+      writer.writeNumber(entry.tMax);
+    }
+  }
+  writer.endObject();
+}
+
+// Writes the index next to where it goes, then moves it there, so that
+//   an interrupted save leaves the old index as it was
+void catalogSave(const WconOctCatalog *catalog) {
+  string temp = catalog->indexPath + ".TEMP";
+  FILE *fp = fopen(temp.c_str(), "w");
+  if (fp == NULL) {
+    throw runtime_error("Cannot open " + temp + ": " + strerror(errno));
+  }
+  try {
+    WconJsonWriter writer(fp);
+    writer.beginObject();
+    writer.key("wconCatalog");
+    writer.writeInteger(CATALOG_VERSION);
+    writer.key("entries");
+    writer.beginArray();
+    map<string, CatalogEntry>::const_iterator it;
+    for (it = catalog->entries.begin(); it != catalog->entries.end(); ++it) {
+      catalogWriteEntry(writer, it->first, it->second);
+    }
+    writer.endArray();
+    writer.endObject();
+    writer.flush();
+  } catch (...) {
+    fclose(fp);
+    remove(temp.c_str());
+    throw;
+  }
+  if (fclose(fp) != 0) {
+    remove(temp.c_str());
+    throw runtime_error("Cannot write " + temp + ": " + strerror(errno));
+  }
+  if (rename(temp.c_str(), catalog->indexPath.c_str()) != 0) {
+    throw runtime_error("Cannot rename " + temp + " to " +
+			catalog->indexPath + ": " + strerror(errno));
+  }
+}
+
+double catalogNumber(const WconJsonValue &v, const char *key) {
+  const WconJsonValue *member = v.find(key);
+  if (member == NULL || member->isNull()) {
+    return NAN;
+  } else if (!member->isNumber()) {
+    throw runtime_error(string(key) + " of an entry must be a number");
+  }
+  return member->numValue;
+}
+
+void catalogReadEntry(const WconJsonValue &v, WconOctCatalog *catalog) {
+  const WconJsonValue *path = v.find("path");
+  const WconJsonValue *ok = v.find("ok");
+  if (path == NULL || !path->isString() || ok == NULL ||
+      ok->type != WconJsonValue::JSON_BOOL) {
+    throw runtime_error("every entry needs a path and ok");
+  }
+  CatalogEntry &entry = catalog->entries[path->strValue];
+  entry.mtime = (long long)catalogNumber(v, "mtime");
+  entry.mtimeNsec = (long)catalogNumber(v, "mtimeNsec");
+  entry.size = (long long)catalogNumber(v, "size");
+  entry.ok = ok->boolValue;
+  if (!entry.ok) {
+    return;
+  }
+  const char *keys[] = {"units", "metadata", "files"};
+  WconJsonValue *values[] = {&entry.units, &entry.metadata, &entry.files};
+  for (int k=0; k<3; k++) {
+    const WconJsonValue *member = v.find(keys[k]);
+    if (member != NULL) {
+      *values[k] = *member;
+    }
+  }
+  entry.numRecords = (long)catalogNumber(v, "records");
+  entry.numWorms = (long)catalogNumber(v, "worms");
+  entry.numFrames = (long)catalogNumber(v, "frames");
+  entry.tMin = catalogNumber(v, "tMin");
+  entry.tMax = catalogNumber(v, "tMax");
+  if (!entry.files.isNull()) {
+    WconJsonWriter files;
+    files.writeValue(entry.files);
+    wconOctPeekLinks(path->strValue, files.text().c_str(), entry.prev,
+		     entry.next);
+  }
+}
+
+// Reads the index an entry at a time. A missing index is an empty one.
+void catalogLoad(WconOctCatalog *catalog) {
+  FILE *fp = fopen(catalog->indexPath.c_str(), "rb");
+  if (fp == NULL) {
+    if (errno == ENOENT) {
+      return;
+    }
+    throw runtime_error("Cannot open " + catalog->indexPath + ": " +
+			strerror(errno));
+  }
+  try {
+    WconJsonFileSource source(fp);
+    WconJsonReader reader(&source);
+    if (reader.peek() != WconJsonReader::TOKEN_OBJECT) {
+      throw runtime_error("the index must be an object");
+    }
+    reader.beginObject();
+    string key;
+    WconJsonValue v;
+    bool versioned = false;
+    while (reader.nextMember(key)) {
+      if (key == "wconCatalog") {
+	if (reader.peek() != WconJsonReader::TOKEN_NUMBER ||
+	    reader.readNumber() != CATALOG_VERSION) {
+	  throw runtime_error("unknown index version");
+	}
+	versioned = true;
+      } else if (key == "entries") {
+	if (reader.peek() != WconJsonReader::TOKEN_ARRAY) {
+	  throw runtime_error("entries must be an array");
+	}
+	reader.beginArray();
+	while (reader.nextItem()) {
+	  reader.readValue(v);
+	  catalogReadEntry(v, catalog);
+	}
+      } else {
+	reader.skipValue();
+      }
+    }
+    reader.expectEnd();
+    if (!versioned) {
+      throw runtime_error("not a WCON catalog");
+    }
+  } catch (...) {
+    fclose(fp);
+    throw;
+  }
+  fclose(fp);
+}
+
+// The value of a number or string, with its text as it would be
+//   written in a query
+void catalogValue(const string &text, CatalogValue &out) {
+  out.text = text;
+  char *end = NULL;
+  out.number = strtod(text.c_str(), &end);
+  out.isNumber = !text.empty() && *end == '\0';
+}
+
+// Every value reached by the dotted path from v, looking into each
+//   element of the arrays on the way; null counts as absent
+void catalogCollect(const WconJsonValue &v, const string &path, size_t at,
+		    vector<CatalogValue> &out) {
+  if (v.isArray()) {
+    for (size_t i=0; i<v.items.size(); i++) {
+      catalogCollect(v.items[i], path, at, out);
+    }
+    return;
+  }
+  if (at < path.size()) {
+    size_t dot = path.find('.', at);
+    if (dot == string::npos) {
+      dot = path.size();
+    }
+    const WconJsonValue *member = v.find(path.substr(at, dot - at));
+    if (member != NULL) {
+      catalogCollect(*member, path, dot + 1, out);
+    }
+    return;
+  }
+  CatalogValue value;
+  if (v.isNumber()) {
+    char buf[32];
+    wconJsonFormatDouble(v.numValue, buf);
+    value.isNumber = true;
+    value.number = v.numValue;
+    value.text = buf;
+  } else if (v.isString()) {
+    value.isNumber = false;
+    value.number = NAN;
+    value.text = v.strValue;
+  } else if (v.type == WconJsonValue::JSON_BOOL) {
+    value.isNumber = false;
+    value.number = NAN;
+    value.text = v.boolValue ? "true" : "false";
+  } else if (v.isObject()) {
+    // As JSON text, so that it exists and ~ looks inside it
+    WconJsonWriter writer;
+    writer.writeValue(v);
+    value.isNumber = false;
+    value.number = NAN;
+    value.text = writer.text();
+  } else {
+    return;
+  }
+  out.push_back(value);
+}
+
+void catalogNumberValue(double number, vector<CatalogValue> &out) {
+  if (isnan(number)) {
+    return;
+  }
+  char buf[32];
+  wconJsonFormatDouble(number, buf);
+  CatalogValue value;
+  value.isNumber = true;
+  value.number = number;
+  value.text = buf;
+  out.push_back(value);
+}
+
+void catalogTextValue(const string &text, vector<CatalogValue> &out) {
+  CatalogValue value;
+  value.isNumber = false;
+  value.number = NAN;
+  value.text = text;
+  out.push_back(value);
+}
+
+void catalogField(const string &path, const CatalogEntry &entry,
+		  const string &field, vector<CatalogValue> &out) {
+  out.clear();
+  if (field == "path") {
+    catalogTextValue(path, out);
+  } else if (field == "chain") {
+    catalogTextValue(entry.chain, out);
+  } else if (field == "chainIndex") {
+    catalogNumberValue((double)entry.chainIndex, out);
+  } else if (field == "numRecords") {
+    catalogNumberValue((double)entry.numRecords, out);
+  } else if (field == "numWorms") {
+    catalogNumberValue((double)entry.numWorms, out);
+  } else if (field == "numFrames") {
+    catalogNumberValue((double)entry.numFrames, out);
+  } else if (field == "tMin") {
+    catalogNumberValue(entry.tMin, out);
+  } else if (field == "tMax") {
+    catalogNumberValue(entry.tMax, out);
+  } else {
+    size_t dot = field.find('.');
+    string top = field.substr(0, dot);
+    const WconJsonValue *root = (top == "units") ? &entry.units :
+      (top == "metadata") ? &entry.metadata :
+      (top == "files") ? &entry.files : NULL;
+    if (root != NULL) {
+      catalogCollect(*root, field, (dot == string::npos) ? field.size() :
+		     dot + 1, out);
+    }
+  }
+}
+
+bool catalogHolds(const CatalogTerm &term, const CatalogValue &value) {
+  if (term.op.empty()) {
+    return true;
+  } else if (term.op == "~") {
+    return value.text.find(term.text) != string::npos;
+  }
+  int cmp;
+  if (term.isNumber && value.isNumber) {
+    cmp = (value.number < term.number) ? -1 :
+      (value.number > term.number) ? 1 : 0;
+  } else {
+    cmp = value.text.compare(term.text);
+  }
+  return (term.op == "==") ? cmp == 0 : (term.op == "!=") ? cmp != 0 :
+    (term.op == "<") ? cmp < 0 : (term.op == "<=") ? cmp <= 0 :
+    (term.op == ">") ? cmp > 0 : cmp >= 0;
+}
+
+string catalogTrim(const string &s) {
+  size_t begin = s.find_first_not_of(" \t\n\r");
+  if (begin == string::npos) {
+    return "";
+  }
+  size_t end = s.find_last_not_of(" \t\n\r");
+  return s.substr(begin, end - begin + 1);
+}
+
+// One clause, without the && around it
+CatalogTerm catalogParseTerm(const string &clause) {
+  static const char *ops[] = {"==", "!=", "<=", ">=", "<", ">", "~"};
+  CatalogTerm term;
+  term.isNumber = false;
+  term.number = NAN;
+  size_t at = string::npos;
+  for (size_t i=0; i<sizeof(ops)/sizeof(ops[0]); i++) {
+    size_t found = clause.find(ops[i]);
+    if (found != string::npos && (at == string::npos || found < at)) {
+      at = found;
+      term.op = ops[i];
+    }
+  }
+  term.field = catalogTrim(clause.substr(0, at));
+  if (term.field.empty() ||
+      term.field.find_first_of(" \t\n\r\"") != string::npos) {
+    throw runtime_error("No field in \"" + catalogTrim(clause) + "\"");
+  }
+  if (at == string::npos) {
+    return term;
+  }
+  string value = catalogTrim(clause.substr(at + term.op.size()));
+  if (value.empty()) {
+    throw runtime_error("No value in \"" + catalogTrim(clause) +
+			"\" (\"\" for empty text)");
+  }
+  if (value.size() >= 2 && value[0] == '"' &&
+      value[value.size() - 1] == '"') {
+    // Quoted: text even if it looks like a number
+    for (size_t i=1; i+1<value.size(); i++) {
+      if (value[i] == '\\' && i+2 < value.size()) {
+	i++;
+      }
+      term.text += value[i];
+    }
+    return term;
+  }
+  CatalogValue v;
+  catalogValue(value, v);
+  term.text = v.text;
+  term.isNumber = v.isNumber;
+  term.number = v.number;
+  return term;
+}
+
+// Clauses joined by &&, which may appear inside quotes
+vector<CatalogTerm> catalogParseQuery(const char *query) {
+  vector<CatalogTerm> terms;
+  string q = (query == NULL) ? "" : query;
+  if (catalogTrim(q).empty()) {
+    return terms;
+  }
+  string clause;
+  bool quoted = false;
+  for (size_t i=0; i<q.size(); i++) {
+    if (quoted && q[i] == '\\' && i+1 < q.size()) {
+      clause += q[i];
+      clause += q[++i];
+      continue;
+    } else if (q[i] == '"') {
+      quoted = !quoted;
+    } else if (!quoted && q.compare(i, 2, "&&") == 0) {
+      terms.push_back(catalogParseTerm(clause));
+      clause.clear();
+      i++;
+      continue;
+    }
+    clause += q[i];
+  }
+  if (quoted) {
+    throw runtime_error("Unterminated quote");
+  }
+  terms.push_back(catalogParseTerm(clause));
+  return terms;
+}
+
+} // namespace
+
+extern "C"
+WconOctCatalog *wconOct_catalog_open(WconOctError *err,
+				     const char *indexPath) {
+  WconOctStatScope stat(WCONOCT_STAT_CATALOG_OPEN, err);
+  WconOctCatalog *catalog = new WconOctCatalog;
+  catalog->indexPath = (indexPath == NULL) ? "" : indexPath;
+  if (catalog->indexPath.empty()) {
+    *err = SUCCESS;
+    return catalog;
+  }
+  try {
+    catalogLoad(catalog);
+    catalogChains(catalog);
+  } catch (const exception &e) {
+    cerr << "ERROR: Cannot read the catalog " << indexPath << ": "
+	 << e.what() << endl;
+    delete catalog;
+    *err = FAILED;
+    return NULL;
+  }
+  *err = SUCCESS;
+  return catalog;
+}
+
+extern "C"
+long wconOct_catalog_scan(WconOctError *err, WconOctCatalog *catalog,
+			  const char *root, int numThreads) {
+  WconOctStatScope stat(WCONOCT_STAT_CATALOG_SCAN, err);
+  if (catalog == NULL || root == NULL || root[0] == '\0') {
+    cerr << "ERROR: catalog_scan needs a catalog and a directory" << endl;
+    *err = FAILED;
+    return 0;
+  }
+  string dir = root;
+  while (dir.size() > 1 && dir[dir.size() - 1] == '/') {
+    dir.erase(dir.size() - 1);
+  }
+  struct stat st;
+  if (::stat(dir.c_str(), &st) != 0 || !S_ISDIR(st.st_mode)) {
+    cerr << "ERROR: Cannot scan " << root << ": not a directory" << endl;
+    *err = FAILED;
+    return 0;
+  }
+
+  vector<CatalogFile> found;
+  catalogFind(dir, found);
+  map<string, bool> present;
+  vector<const CatalogFile *> changed;
+  for (size_t i=0; i<found.size(); i++) {
+    const CatalogFile &file = found[i];
+    present[file.path] = true;
+    map<string, CatalogEntry>::const_iterator it =
+      catalog->entries.find(file.path);
+    if (it == catalog->entries.end() || it->second.mtime != file.mtime ||
+	it->second.mtimeNsec != file.mtimeNsec ||
+	it->second.size != file.size) {
+      changed.push_back(&file);
+    }
+  }
+
+  // One thread per core up to 8 unless told otherwise
+  size_t count = (numThreads > 0) ? (size_t)numThreads :
+    min(max(thread::hardware_concurrency(), 1u), 8u);
+  count = max((size_t)1, min(count, changed.size()));
+  vector<CatalogEntry> peeked(changed.size());
+  atomic<size_t> next(0);
+  vector<thread> threads;
+  for (size_t t=1; t<count; t++) {
+    threads.push_back(thread(catalogPeekBatch, &changed, &next, &peeked));
+  }
+  catalogPeekBatch(&changed, &next, &peeked);
+  for (size_t t=0; t<threads.size(); t++) {
+    threads[t].join();
+  }
+
+  // Files under dir that are gone
+  string prefix = (dir == "/") ? dir : dir + "/";
+  bool removed = false;
+  map<string, CatalogEntry>::iterator it = catalog->entries.begin();
+  while (it != catalog->entries.end()) {
+    if (it->first.compare(0, prefix.size(), prefix) == 0 &&
+	present.count(it->first) == 0) {
+      catalog->entries.erase(it++);
+      removed = true;
+    } else {
+      ++it;
+    }
+  }
+  for (size_t i=0; i<changed.size(); i++) {
+    catalog->entries[changed[i]->path] = peeked[i];
+  }
+  catalogChains(catalog);
+
+  if ((removed || !changed.empty()) && !catalog->indexPath.empty()) {
+    try {
+      catalogSave(catalog);
+    } catch (const exception &e) {
+      cerr << "ERROR: Cannot save the catalog: " << e.what() << endl;
+      *err = FAILED;
+      return (long)changed.size();
+    }
+  }
+  *err = SUCCESS;
+  return (long)changed.size();
+}
+
+extern "C"
+WconOctCatalogHits *wconOct_catalog_select(WconOctError *err,
+					   const WconOctCatalog *catalog,
+					   const char *query) {
+  WconOctStatScope stat(WCONOCT_STAT_CATALOG_SELECT, err);
+  if (catalog == NULL) {
+    cerr << "ERROR: catalog_select needs a catalog" << endl;
+    *err = FAILED;
+    return NULL;
+  }
+  vector<CatalogTerm> terms;
+  try {
+    terms = catalogParseQuery(query);
+  } catch (const exception &e) {
+    cerr << "ERROR: Bad catalog query \"" << query << "\": " << e.what()
+	 << endl;
+    *err = FAILED;
+    return NULL;
+  }
+
+  vector<WconOctCatalogEntry> found;
+  vector<CatalogValue> values;
+  map<string, CatalogEntry>::const_iterator it;
+  for (it = catalog->entries.begin(); it != catalog->entries.end(); ++it) {
+    const CatalogEntry &entry = it->second;
+    bool match = entry.ok;
+    for (size_t k=0; match && k<terms.size(); k++) {
+      catalogField(it->first, entry, terms[k].field, values);
+      match = false;
+      for (size_t v=0; !match && v<values.size(); v++) {
+	match = catalogHolds(terms[k], values[v]);
+      }
+    }
+    if (!match) {
+      continue;
+    }
+    WconOctCatalogEntry hit;
+    hit.path = it->first.c_str();
+    hit.chain = entry.chain.c_str();
+    hit.chainIndex = entry.chainIndex;
+    hit.numRecords = entry.numRecords;
+    hit.numWorms = entry.numWorms;
+    hit.numFrames = entry.numFrames;
+    hit.tMin = entry.tMin;
+    hit.tMax = entry.tMax;
+    found.push_back(hit);
+  }
+
+  WconOctCatalogHits *hits = new WconOctCatalogHits;
+  hits->numHits = (long)found.size();
+  hits->hits = new WconOctCatalogEntry[found.size()];
+  copy(found.begin(), found.end(), hits->hits);
+  *err = SUCCESS;
+  return hits;
+}
+
+extern "C" void wconOct_freeCatalogHits(WconOctCatalogHits *hits) {
+  if (hits == NULL) {
+    return;
+  }
+  delete[] hits->hits;
+  delete hits;
+}
+
+extern "C" void wconOct_catalog_close(WconOctCatalog *catalog) {
+  WconOctStatScope stat(WCONOCT_STAT_CATALOG_CLOSE, NULL);
+  delete catalog;
+}
@@ -0,0 +1,239 @@
+#include "octaveWconPythonWrapper.h"
+#include "wrapperStats.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <iostream>
+#include <string>
+using namespace std;
+
+// Frame cursor for both backends, built on wconOct_WCONWorms_worm_frames:
+//   one window of up to CURSOR_WINDOW frames of one worm is exported at
+//   a time, and frames are read straight out of its views. With the
+//   native backend the views of an in-memory dataset point into it, so
+//   nothing is copied at all; a paged dataset is read a window at a
+//   time, so a long worm is never in memory all at once.
+
+#define CURSOR_WINDOW 65536
+
+struct wconOctCursorStruct {
+  WconOctHandle worms;
+  bool allWorms;
+  string wormId;
+  double t0;
+  double t1;
+  long numWorms;
+  // The worm being read, and the window of it in worm, which is NULL
+  //   before the first and after the last
+  long wormIndex;
+  long numFrames;
+  WconOctWormData *worm;
+  long windowStart;
+  // Frames of the worm, not of the window
+  long frame;
+  long endFrame;
+  // Calls to cursor_next not counted in the stats yet; see below
+  unsigned long long uncounted;
+};
+
+static double cursorViewValue(const WconOctArrayView &view, long row) {
+  return view.data[row * view.rowStride];
+}
+
+// Replaces the window with frames [start, min(start + CURSOR_WINDOW,
+//   end)) of the worm
+static bool cursorLoadWindow(WconOctError *err, WconOctCursor *cursor,
+			     long start, long end) {
+  wconOct_freeWormData(cursor->worm);
+  cursor->windowStart = start;
+  long n = end - start < CURSOR_WINDOW ? end - start : CURSOR_WINDOW;
+  cursor->worm = wconOct_WCONWorms_worm_frames(err, cursor->worms,
+					       cursor->wormIndex, start, n);
+  return *err == SUCCESS;
+}
+
+// Time of frame i of the worm, from the window if it is there
+static bool cursorTime(WconOctError *err, const WconOctCursor *cursor,
+		       long i, double &t) {
+  const WconOctWormData *worm = cursor->worm;
+  if (i >= cursor->windowStart && i < cursor->windowStart + worm->numFrames) {
+    t = cursorViewValue(worm->t, i - cursor->windowStart);
+    return true;
+  }
+  WconOctWormData *one = wconOct_WCONWorms_worm_frames(err, cursor->worms,
+						       cursor->wormIndex, i, 1);
+  if (*err == FAILED) {
+    return false;
+  }
+  t = cursorViewValue(one->t, 0);
+  wconOct_freeWormData(one);
+  return true;
+}
+
+// First frame of the worm at (or, with after, after) t; the frames of a
+//   worm are in time order. -1 on failure.
+static long cursorFirstFrame(WconOctError *err, const WconOctCursor *cursor,
+			     double t, bool after) {
+  long lo = 0, hi = cursor->numFrames;
+  while (lo < hi) {
+    long mid = lo + (hi - lo) / 2;
+    double tm;
+    if (!cursorTime(err, cursor, mid, tm)) {
+      return -1;
+    }
+    if (after ? tm <= t : tm < t) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Moves on to the next worm with frames in range, with the window at
+//   its first. false at the end.
+static bool cursorNextWorm(WconOctError *err, WconOctCursor *cursor) {
+  for (;;) {
+    wconOct_freeWormData(cursor->worm);
+    cursor->worm = NULL;
+    cursor->wormIndex++;
+    if (cursor->wormIndex >= cursor->numWorms) {
+      return false;
+    }
+    cursor->numFrames = wconOct_WCONWorms_num_frames(err, cursor->worms,
+						     cursor->wormIndex);
+    if (*err == FAILED) {
+      return false;
+    }
+    // An empty window for the id, so that other worms are not read
+    if (!cursor->allWorms) {
+      if (!cursorLoadWindow(err, cursor, 0, 0)) {
+	return false;
+      }
+      if (cursor->wormId != cursor->worm->id) {
+	continue;
+      }
+    }
+    if (!cursorLoadWindow(err, cursor, 0, cursor->numFrames)) {
+      return false;
+    }
+    cursor->frame = cursorFirstFrame(err, cursor, cursor->t0, false);
+    // t1 itself is in range
+    cursor->endFrame = cursorFirstFrame(err, cursor, cursor->t1, true);
+    if (cursor->frame < 0 || cursor->endFrame < 0) {
+      return false;
+    }
+    if (cursor->frame < cursor->endFrame) {
+      return cursor->frame < cursor->worm->numFrames ||
+	cursorLoadWindow(err, cursor, cursor->frame, cursor->endFrame);
+    }
+  }
+}
+
+extern "C"
+WconOctCursor *wconOct_cursor_open(WconOctError *err,
+				   const WconOctHandle selfHandle,
+				   const char *wormId, double t0, double t1) {
+  WconOctStatScope stat(WCONOCT_STAT_CURSOR_OPEN, err);
+  long numWorms = wconOct_WCONWorms_num_worms(err, selfHandle);
+  if (*err == FAILED) {
+    cerr << "ERROR: Cannot open a cursor on handle " << selfHandle << endl;
+    return NULL;
+  }
+  if (isnan(t0) || isnan(t1)) {
+    cerr << "ERROR: Cursor time range may not be NaN" << endl;
+    *err = FAILED;
+    return NULL;
+  }
+
+  WconOctCursor *cursor = new WconOctCursor;
+  cursor->worms = selfHandle;
+  cursor->allWorms = (wormId == WCONOCT_ALL_WORMS);
+  if (!cursor->allWorms) {
+    cursor->wormId = wormId;
+  }
+  cursor->t0 = t0;
+  cursor->t1 = t1;
+  cursor->numWorms = numWorms;
+  cursor->wormIndex = -1;
+  cursor->numFrames = 0;
+  cursor->worm = NULL;
+  cursor->windowStart = 0;
+  cursor->frame = 0;
+  cursor->endFrame = 0;
+  cursor->uncounted = 0;
+  *err = SUCCESS;
+  return cursor;
+}
+
+// Called once per frame, so even a stats scope would cost more than the
+//   call itself: only the calls that move on to the next worm or window
+//   are timed, and the rest are counted when that happens.
+extern "C"
+int wconOct_cursor_next(WconOctError *err, WconOctCursor *cursor,
+			WconOctFrame *frame) {
+  if (cursor == NULL || frame == NULL) {
+    WconOctStatScope stat(WCONOCT_STAT_CURSOR_NEXT, err);
+    cerr << "ERROR: cursor_next needs a cursor and a frame" << endl;
+    *err = FAILED;
+    return 0;
+  }
+  *err = SUCCESS;
+  if (cursor->worm == NULL || cursor->frame >= cursor->endFrame) {
+    WconOctStatScope stat(WCONOCT_STAT_CURSOR_NEXT, err);
+    wconOctStatsCount(WCONOCT_STAT_CURSOR_NEXT, cursor->uncounted);
+    cursor->uncounted = 0;
+    if (cursor->wormIndex >= cursor->numWorms ||
+	!cursorNextWorm(err, cursor)) {
+      return 0;
+    }
+  } else if (cursor->frame >= cursor->windowStart + cursor->worm->numFrames) {
+    WconOctStatScope stat(WCONOCT_STAT_CURSOR_NEXT, err);
+    wconOctStatsCount(WCONOCT_STAT_CURSOR_NEXT, cursor->uncounted);
+    cursor->uncounted = 0;
+    if (!cursorLoadWindow(err, cursor, cursor->frame, cursor->endFrame)) {
+      return 0;
+    }
+  } else {
+    cursor->uncounted++;
+  }
+
+  const WconOctWormData *worm = cursor->worm;
+  long i = cursor->frame - cursor->windowStart;
+  frame->wormId = worm->id;
+  frame->wormIndex = cursor->wormIndex;
+  frame->frameIndex = cursor->frame++;
+  frame->t = cursorViewValue(worm->t, i);
+  if (worm->x.data == NULL || worm->y.data == NULL) {
+    frame->x = frame->y = NULL;
+    frame->pointStride = 0;
+    frame->numPoints = 0;
+  } else {
+    frame->x = worm->x.data + i * worm->x.rowStride;
+    frame->y = worm->y.data + i * worm->y.rowStride;
+    frame->pointStride = worm->x.colStride;
+    frame->numPoints = worm->x.cols;
+  }
+  if (frame->x != NULL && worm->aspectSize.data != NULL) {
+    double size = cursorViewValue(worm->aspectSize, i);
+    frame->numPoints = isnan(size) ? 0 : (long)size;
+  }
+  if (worm->cx.data != NULL) {
+    frame->cx = cursorViewValue(worm->cx, i);
+    frame->cy = cursorViewValue(worm->cy, i);
+  } else {
+    frame->cx = frame->cy = NAN;
+  }
+  return 1;
+}
+
+extern "C" void wconOct_cursor_close(WconOctCursor *cursor) {
+  WconOctStatScope stat(WCONOCT_STAT_CURSOR_CLOSE, NULL);
+  if (cursor == NULL) {
+    return;
+  }
+  wconOctStatsCount(WCONOCT_STAT_CURSOR_NEXT, cursor->uncounted);
+  wconOct_freeWormData(cursor->worm);
+  delete cursor;
+}
@@ -0,0 +1,276 @@
+#include "octaveWconPythonWrapper.h"
+#include "wrapperFeatures.h"
+#include "wrapperSpines.h"
+#include "wrapperStats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Locomotion features for both backends, from the worm_data views.
+//
+// The position of a worm is its centroid where it has one, otherwise
+//   the midpoint of its spine by arc length. The first point of a spine
+//   is taken to be the head, whatever "head" says.
+
+// Points the spines are resampled to; odd, so that one is the midpoint
+#define FEATURE_SPINE_POINTS 13
+#define FEATURE_MIDPOINT (FEATURE_SPINE_POINTS / 2)
+// The head is the first sixth of the body
+#define FEATURE_NECK (FEATURE_SPINE_POINTS / 6)
+
+namespace {
+
+enum FeatureId {
+  FEATURE_SPEED,
+  FEATURE_PATH_LENGTH,
+  FEATURE_ANGULAR_VELOCITY,
+  FEATURE_CURVATURE,
+  FEATURE_HEAD_SWING,
+  FEATURE_COUNT
+};
+
+// Data keys of the features, custom keys as WCON has them
+const char *const featureNames[FEATURE_COUNT] = {
+  "@wconoct_speed", "@wconoct_path_length", "@wconoct_angular_velocity",
+  "@wconoct_curvature", "@wconoct_head_swing"
+};
+
+// Into (-pi, pi]
+double wrapAngle(double a) {
+  while (a > M_PI) {
+    a -= 2 * M_PI;
+  }
+  while (a <= -M_PI) {
+    a += 2 * M_PI;
+  }
+  return a;
+}
+
+// Direction from point j to point k of a resampled spine
+double spineDirection(const double *sx, const double *sy, long j, long k) {
+  return atan2(sy[k] - sy[j], sx[k] - sx[j]);
+}
+
+// The frames either side of i, or i itself at the ends
+void neighbours(long i, long n, long &lo, long &hi) {
+  lo = (i > 0) ? i - 1 : i;
+  hi = (i + 1 < n) ? i + 1 : i;
+}
+
+// Every feature of one worm, each a column of numFrames values
+void wormFeatures(const WconOctWormData *worm,
+		  vector<vector<double> > &columns) {
+  long n = worm->numFrames;
+  const long p = FEATURE_SPINE_POINTS;
+  columns.assign(FEATURE_COUNT, vector<double>(n, NAN));
+  if (n == 0) {
+    return;
+  }
+  vector<double> sx(n * p), sy(n * p), length(n);
+  wconOctSpineResample(worm, 0, n, p, &sx[0], &sy[0], p, 1, &length[0]);
+
+  vector<double> t(n), px(n), py(n), heading(n);
+  for (long i=0; i<n; i++) {
+    t[i] = worm->t.data[i * worm->t.rowStride];
+    double cx = NAN, cy = NAN;
+    if (worm->cx.data != NULL && worm->cy.data != NULL) {
+      cx = worm->cx.data[i * worm->cx.rowStride];
+      cy = worm->cy.data[i * worm->cy.rowStride];
+    }
+    bool centroid = !isnan(cx) && !isnan(cy);
+    px[i] = centroid ? cx : sx[i * p + FEATURE_MIDPOINT];
+    py[i] = centroid ? cy : sy[i * p + FEATURE_MIDPOINT];
+    // From the tail to the head
+    heading[i] = spineDirection(&sx[i * p], &sy[i * p], p - 1, 0);
+  }
+
+  vector<double> &speed = columns[FEATURE_SPEED];
+  vector<double> &path = columns[FEATURE_PATH_LENGTH];
+  vector<double> &angular = columns[FEATURE_ANGULAR_VELOCITY];
+  vector<double> &curvature = columns[FEATURE_CURVATURE];
+  vector<double> &headSwing = columns[FEATURE_HEAD_SWING];
+  // Distance travelled up to each frame, across frames without a
+  //   position
+  double travelled = 0;
+  long last = -1;
+  for (long i=0; i<n; i++) {
+    long lo, hi;
+    neighbours(i, n, lo, hi);
+    double dt = t[hi] - t[lo];
+    if (dt > 0) {
+      speed[i] = hypot(px[hi] - px[lo], py[hi] - py[lo]) / dt;
+      angular[i] = wrapAngle(heading[hi] - heading[lo]) / dt;
+    }
+    if (!isnan(px[i]) && !isnan(py[i])) {
+      if (last >= 0) {
+	travelled += hypot(px[i] - px[last], py[i] - py[last]);
+      }
+      path[i] = travelled;
+      last = i;
+    }
+
+    // Mean turning angle per unit length along the spine
+    const double *x = &sx[i * p], *y = &sy[i * p];
+    if (length[i] > 0) {
+      double turning = 0;
+      for (long k=1; k+1<p; k++) {
+	turning += fabs(wrapAngle(spineDirection(x, y, k, k + 1) -
+				  spineDirection(x, y, k - 1, k)));
+      }
+      curvature[i] = turning / (p - 2) / (length[i] / (p - 1));
+      headSwing[i] =
+	fabs(wrapAngle(spineDirection(x, y, FEATURE_NECK, 0) -
+		       spineDirection(x, y, FEATURE_MIDPOINT,
+				      FEATURE_NECK)));
+    }
+  }
+}
+
+void featureBatch(const vector<WconOctWormData *> *worms,
+		  atomic<size_t> *next, WconOctFeatureSet *features) {
+  for (size_t i = (*next)++; i < worms->size(); i = (*next)++) {
+    wormFeatures((*worms)[i], features->columns[i]);
+  }
+}
+
+// $WCONOCT_FEATURE_THREADS, or one per core up to 8, for n worms
+size_t featureThreads(size_t n) {
+  size_t count = thread::hardware_concurrency();
+  count = (count == 0) ? 1 : min(count, (size_t)8);
+  const char *env = getenv("WCONOCT_FEATURE_THREADS");
+  if (env != NULL && atol(env) > 0) {
+    count = (size_t)atol(env);
+  }
+  return max((size_t)1, min(count, n));
+}
+
+// A unit string as one term of a product or quotient
+string unitTerm(const string &unit) {
+  return (unit.find_first_of("*/^ ") == string::npos) ? unit :
+    "(" + unit + ")";
+}
+
+// Unit strings of x and t, and whether x, y, cx and cy all have the
+//   same units, so that distances can be taken as they are
+bool featureUnits(WconOctError *err, WconOctHandle selfHandle,
+		  string &x, string &t, bool &sameUnits) {
+  WconOctUnitsDict *dict = wconOct_WCONWorms_units(err, selfHandle);
+  if (*err == FAILED) {
+    return false;
+  }
+  static const char *const keys[] = {"'x'", "'t'", "'y'", "'cx'", "'cy'"};
+  string found[5];
+  bool have[5] = {false, false, false, false, false};
+  for (int i=0; i<dict->numElements; i++) {
+    WconOctHandle unit = dict->unitsDict[i].value;
+    // Keys come across in Python repr form
+    for (int k=0; k<5; k++) {
+      if (strcmp(dict->unitsDict[i].key, keys[k]) == 0) {
+	const char *unitString =
+	  wconOct_MeasurementUnit_unit_string(err, unit);
+	if (*err == SUCCESS && unitString != NULL) {
+	  found[k] = unitString;
+	  have[k] = true;
+	}
+      }
+    }
+    WconOctError releaseErr;
+    wconOct_releaseHandle(&releaseErr, unit);
+  }
+  wconOct_freeUnitsDict(dict);
+  if (!have[0] || !have[1]) {
+    cerr << "ERROR: Cannot find the units of x and t of handle "
+	 << selfHandle << endl;
+    return false;
+  }
+  x = found[0];
+  t = found[1];
+  sameUnits = true;
+  for (int k=2; k<5; k++) {
+    sameUnits = sameUnits && (!have[k] || found[k] == x);
+  }
+  return true;
+}
+
+} // namespace
+
+// The views of every worm are taken first, one at a time, as the
+//   backends hand them out; only the arithmetic runs in parallel.
+//   Features come out in the units of x and t, unless x, y and the
+//   centroid differ in units, when they are computed on canonical
+//   units.
+extern "C"
+WconOctHandle wconOct_WCONWorms_features(WconOctError *err,
+					 const WconOctHandle selfHandle) {
+  WconOctStatScope stat(WCONOCT_STAT_FEATURES, err);
+  string x, t;
+  bool sameUnits;
+  if (!featureUnits(err, selfHandle, x, t, sameUnits)) {
+    *err = FAILED;
+    return wconOct_makeNullHandle();
+  }
+  WconOctHandle source = selfHandle;
+  WconOctHandle canonical = wconOct_makeNullHandle();
+  if (!sameUnits) {
+    canonical = wconOct_WCONWorms_to_canon(err, selfHandle);
+    if (*err == FAILED || !featureUnits(err, canonical, x, t, sameUnits)) {
+      WconOctError releaseErr;
+      wconOct_releaseHandle(&releaseErr, canonical);
+      *err = FAILED;
+      return wconOct_makeNullHandle();
+    }
+    source = canonical;
+  }
+
+  WconOctFeatureSet features;
+  features.names.assign(featureNames, featureNames + FEATURE_COUNT);
+  features.units.resize(FEATURE_COUNT);
+  features.units[FEATURE_SPEED] = unitTerm(x) + "/" + unitTerm(t);
+  features.units[FEATURE_PATH_LENGTH] = x;
+  features.units[FEATURE_ANGULAR_VELOCITY] = "rad/" + unitTerm(t);
+  features.units[FEATURE_CURVATURE] = "1/" + unitTerm(x);
+  features.units[FEATURE_HEAD_SWING] = "rad";
+
+  long numWorms = wconOct_WCONWorms_num_worms(err, source);
+  vector<WconOctWormData *> worms;
+  for (long i=0; *err == SUCCESS && i<numWorms; i++) {
+    worms.push_back(wconOct_WCONWorms_worm_data(err, source, i));
+    if (*err == FAILED) {
+      worms.pop_back();
+    }
+  }
+  if (*err == SUCCESS) {
+    features.columns.resize(worms.size());
+    atomic<size_t> next(0);
+    size_t numThreads = featureThreads(worms.size());
+    vector<thread> threads;
+    for (size_t i=1; i<numThreads; i++) {
+      threads.push_back(thread(featureBatch, &worms, &next, &features));
+    }
+    featureBatch(&worms, &next, &features);
+    for (size_t i=0; i<threads.size(); i++) {
+      threads[i].join();
+    }
+  }
+  for (size_t i=0; i<worms.size(); i++) {
+    wconOct_freeWormData(worms[i]);
+  }
+  if (!wconOct_isNullHandle(canonical)) {
+    WconOctError releaseErr;
+    wconOct_releaseHandle(&releaseErr, canonical);
+  }
+  if (*err == FAILED) {
+    cerr << "ERROR: Cannot read the worms of handle " << selfHandle << endl;
+    return wconOct_makeNullHandle();
+  }
+  return wconOctFeaturesAttach(err, selfHandle, features);
+}
@@ -0,0 +1,25 @@
+#ifndef __WRAPPER_FEATURES_H_
+#define __WRAPPER_FEATURES_H_
+// wconOct_WCONWorms_features: the features are computed once for both
+//   backends (wrapperFeatures.cpp, from worm_data), and each backend
+//   adds them to a copy of the dataset its own way.
+#include <string>
+#include <vector>
+
+#include "wrapperTypes.h"
+
+struct WconOctFeatureSet {
+  std::vector<std::string> names;
+  // Unit strings, in terms of the units of x and t of the dataset
+  std::vector<std::string> units;
+  // columns[w][f][i]: feature f at frame i of the worm at position w
+  //   of worm_ids, frames in the order of worm_data
+  std::vector<std::vector<std::vector<double> > > columns;
+};
+
+// A new handle: selfHandle with the features added as data keys with
+//   units, replacing any it had, which save_to_file writes out
+WconOctHandle wconOctFeaturesAttach(WconOctError *err,
+				    WconOctHandle selfHandle,
+				    const WconOctFeatureSet &features);
+#endif /* __WRAPPER_FEATURES_H_ */
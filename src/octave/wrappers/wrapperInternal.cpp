@@ -1,4 +1,7 @@
 #include "wrapperInternal.h"
+#include "wrapperMemory.h"
+#include "wrapperTimeMajor.h"
+#include "wrapperStats.h"
 
 #include <iostream>
 #include <unordered_map>
@@ -20,7 +23,31 @@ unsigned int totalActiveRefs = 0;
 //   random key or a sequential key, both of
 //   which have their problems.
 
-WconOctHandle wrapInternalStoreReference(PyObject *pythonRef) {
+extern PyObject *wrapperGlobalSizeofFunc;
+
+// What the memory report charges a new handle. Errors here are not the
+//   caller's concern, so they are cleared and the handle charged nothing.
+size_t wrapInternalSizeof(PyObject *pythonRef) {
+  if (wrapperGlobalSizeofFunc == NULL) {
+    return 0;
+  }
+  PyObject *pSize =
+    WCONOCT_PYTHON(PyObject_CallFunctionObjArgs(wrapperGlobalSizeofFunc,
+						pythonRef, NULL));
+  size_t bytes = 0;
+  if (pSize != NULL) {
+    bytes = PyLong_AsSize_t(pSize);
+    Py_DECREF(pSize);
+  }
+  if (PyErr_Occurred() != NULL) {
+    PyErr_Clear();
+    bytes = 0;
+  }
+  return bytes;
+}
+
+WconOctHandle wrapInternalStoreReference(PyObject *pythonRef,
+					 bool charged) {
 
   if (pythonRef == NULL) {
     cerr << "ERROR: NULL reference object supplied" << endl;
@@ -46,6 +73,8 @@ WconOctHandle wrapInternalStoreReference(PyObject *pythonRef) {
       pair<unsigned int,PyObject *> refKeyPair(randkey,pythonRef);
       refHandles.insert(refKeyPair);
       totalActiveRefs++;
+      wconOctMemoryTrack(randkey,
+			 charged ? wrapInternalSizeof(pythonRef) : 0);
       return randkey;
     }
     count--;
@@ -76,6 +105,23 @@ PyObject *wrapInternalGetReference(WconOctHandle handle) {
   }
 }
 
+bool wrapInternalReleaseReference(WconOctHandle handle) {
+  if (handle == WCONOCT_NULL_HANDLE || handle == WCONOCT_NONE_HANDLE) {
+    return false;
+  }
+  unordered_map<unsigned int,PyObject *>::iterator result =
+    refHandles.find((unsigned int)handle);
+  if (result == refHandles.end()) {
+    return false;
+  }
+  Py_DECREF(result->second);
+  refHandles.erase(result);
+  totalActiveRefs--;
+  wconOctMemoryUntrack(handle);
+  wconOctTimeMajorForget(handle);
+  return true;
+}
+
 void wrapInternalCheckErrorVariable(WconOctError *err) {
   // passing a NULL value is strictly forbidden. Shut the entire
   // code down if this is detected.
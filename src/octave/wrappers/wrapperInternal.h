@@ -9,9 +9,29 @@
 #define WCONOCT_NULL_HANDLE -1337
 #define WCONOCT_NONE_HANDLE -42
 
+// Holds the GIL to the end of the enclosing block. The interpreter runs
+//   with the GIL released between calls (see wconOct_initWrapper), so
+//   every entry point takes it after initializing, from whatever thread
+//   it is called on.
+class WrapInternalGIL {
+ public:
+  WrapInternalGIL() : state(PyGILState_Ensure()) {}
+  ~WrapInternalGIL() { PyGILState_Release(state); }
+ private:
+  PyGILState_STATE state;
+};
+
 // Internal functions
-WconOctHandle wrapInternalStoreReference(PyObject *pythonRef);
+// charged false leaves the handle charged nothing, for objects that the
+//   load cache or another handle is charged for (attributes of a
+//   dataset, or the dataset itself again)
+WconOctHandle wrapInternalStoreReference(PyObject *pythonRef,
+					 bool charged = true);
+// What the memory report charges for an object
+size_t wrapInternalSizeof(PyObject *pythonRef);
 PyObject *wrapInternalGetReference(WconOctHandle key);
+// Drops the wrapper's reference; false if there is no such handle
+bool wrapInternalReleaseReference(WconOctHandle handle);
 
 // Internal Checks
 void wrapInternalCheckErrorVariable(WconOctError *err);
@@ -0,0 +1,208 @@
+#include "octaveWconPythonWrapper.h"
+#include "wrapperLoadCache.h"
+#include "wrapperMemory.h"
+
+#include <limits.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <iostream>
+#include <list>
+#include <map>
+#include <mutex>
+#include <vector>
+using namespace std;
+
+#define LOAD_CACHE_MB (1024.0 * 1024.0)
+#define LOAD_CACHE_DEFAULT_MB 256.0
+
+namespace {
+
+struct LoadEntry {
+  WconOctLoadCacheKey key;
+  shared_ptr<WconOctCachedLoad> value;
+  size_t bytes;
+};
+
+// Never freed: with the Python backend the values hold Python objects,
+//   which must not be released after the interpreter has gone
+struct LoadCache {
+  LoadCache() : bytes(0), budget(-1.0), hits(0.0), misses(0.0) {}
+
+  // Most recently used first
+  list<LoadEntry> entries;
+  map<string, list<LoadEntry>::iterator> index;
+  // Out of the index (the file changed) but still held elsewhere, and
+  //   charged until they are not
+  list<LoadEntry> detached;
+  size_t bytes;
+  // Read from the environment on first use
+  double budget;
+  double hits;
+  double misses;
+};
+
+mutex cacheLock;
+LoadCache *cache = new LoadCache;
+
+// With cacheLock held
+double currentBudget() {
+  if (cache->budget < 0.0) {
+    const char *env = getenv("WCONOCT_LOAD_CACHE_MB");
+    cache->budget = ((env != NULL) ? atof(env) : LOAD_CACHE_DEFAULT_MB) *
+      LOAD_CACHE_MB;
+    if (cache->budget < 0.0) {
+      cache->budget = 0.0;
+    }
+  }
+  return cache->budget;
+}
+
+bool sameFile(const WconOctLoadCacheKey &a, const WconOctLoadCacheKey &b) {
+  return a.dev == b.dev && a.ino == b.ino && a.size == b.size &&
+    a.mtime == b.mtime && a.mtimeNsec == b.mtimeNsec;
+}
+
+// With cacheLock held
+void detach(list<LoadEntry>::iterator entry) {
+  cache->index.erase(entry->key.path);
+  cache->detached.splice(cache->detached.begin(), cache->entries, entry);
+}
+
+// With cacheLock held. Moves what nothing else holds into dropped, to
+//   be released once the lock is: detached entries, and the least
+//   recently used others while the cache is over its budget (all of
+//   them with all).
+void prune(vector<shared_ptr<WconOctCachedLoad> > &dropped, bool all) {
+  for (list<LoadEntry>::iterator it = cache->detached.begin();
+       it != cache->detached.end(); ) {
+    if (it->value->inUse()) {
+      ++it;
+    } else {
+      dropped.push_back(it->value);
+      cache->bytes -= it->bytes;
+      it = cache->detached.erase(it);
+    }
+  }
+  double budget = currentBudget();
+  list<LoadEntry>::iterator it = cache->entries.end();
+  while (it != cache->entries.begin() &&
+	 (all || (double)cache->bytes > budget)) {
+    --it;
+    if (!it->value->inUse()) {
+      dropped.push_back(it->value);
+      cache->bytes -= it->bytes;
+      cache->index.erase(it->key.path);
+      it = cache->entries.erase(it);
+    }
+  }
+  wconOctMemorySetCached(cache->bytes);
+}
+
+} // namespace
+
+shared_ptr<WconOctCachedLoad> wconOctLoadCacheFind(const char *path,
+						   WconOctLoadCacheKey &key) {
+  key = WconOctLoadCacheKey();
+  char resolved[PATH_MAX];
+  struct stat st;
+  if (path == NULL || realpath(path, resolved) == NULL ||
+      stat(resolved, &st) != 0 || !S_ISREG(st.st_mode)) {
+    return shared_ptr<WconOctCachedLoad>();
+  }
+  key.path = resolved;
+  key.dev = (long long)st.st_dev;
+  key.ino = (long long)st.st_ino;
+  key.size = (long long)st.st_size;
+  key.mtime = (long long)st.st_mtime;
+#ifdef __APPLE__
+  key.mtimeNsec = (long)st.st_mtimespec.tv_nsec;
+#else
+  key.mtimeNsec = (long)st.st_mtim.tv_nsec;
+#endif
+
+  shared_ptr<WconOctCachedLoad> result;
+  vector<shared_ptr<WconOctCachedLoad> > dropped;
+  lock_guard<mutex> guard(cacheLock);
+  if (currentBudget() <= 0.0) {
+    return result;
+  }
+  map<string, list<LoadEntry>::iterator>::iterator found =
+    cache->index.find(key.path);
+  if (found != cache->index.end()) {
+    if (sameFile(found->second->key, key)) {
+      cache->entries.splice(cache->entries.begin(), cache->entries,
+			    found->second);
+      result = cache->entries.front().value;
+    } else {
+      detach(found->second);
+    }
+  }
+  if (result != NULL) {
+    cache->hits++;
+  } else {
+    cache->misses++;
+  }
+  prune(dropped, false);
+  return result;
+}
+
+bool wconOctLoadCacheInsert(const WconOctLoadCacheKey &key,
+			    shared_ptr<WconOctCachedLoad> value,
+			    size_t bytes) {
+  if (key.path.empty() || value == NULL) {
+    return false;
+  }
+  vector<shared_ptr<WconOctCachedLoad> > dropped;
+  lock_guard<mutex> guard(cacheLock);
+  if (currentBudget() <= 0.0) {
+    return false;
+  }
+  map<string, list<LoadEntry>::iterator>::iterator found =
+    cache->index.find(key.path);
+  if (found != cache->index.end()) {
+    detach(found->second);
+  }
+  LoadEntry entry;
+  entry.key = key;
+  entry.value = value;
+  entry.bytes = bytes;
+  cache->entries.push_front(entry);
+  cache->index[key.path] = cache->entries.begin();
+  cache->bytes += bytes;
+  prune(dropped, false);
+  return true;
+}
+
+void wconOctLoadCacheDropIdle() {
+  vector<shared_ptr<WconOctCachedLoad> > dropped;
+  lock_guard<mutex> guard(cacheLock);
+  prune(dropped, true);
+}
+
+void wconOctLoadCacheGetTotals(WconOctLoadCacheTotals &totals) {
+  vector<shared_ptr<WconOctCachedLoad> > dropped;
+  lock_guard<mutex> guard(cacheLock);
+  prune(dropped, false);
+  totals.numEntries = (long)(cache->entries.size() + cache->detached.size());
+  totals.bytes = (double)cache->bytes;
+  totals.budgetBytes = currentBudget();
+  totals.hits = cache->hits;
+  totals.misses = cache->misses;
+}
+
+extern "C" void wconOct_setLoadCache(WconOctError *err, double megabytes) {
+  if (err == NULL) {
+    return;
+  }
+  if (megabytes < 0.0) {
+    cerr << "ERROR: Load cache budget may not be negative" << endl;
+    *err = FAILED;
+    return;
+  }
+  vector<shared_ptr<WconOctCachedLoad> > dropped;
+  lock_guard<mutex> guard(cacheLock);
+  cache->budget = megabytes * LOAD_CACHE_MB;
+  prune(dropped, false);
+  *err = SUCCESS;
+}
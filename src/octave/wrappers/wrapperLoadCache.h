@@ -0,0 +1,68 @@
+#ifndef __WRAPPER_LOAD_CACHE_H_
+#define __WRAPPER_LOAD_CACHE_H_
+// Datasets loaded by load_from_file, handed out again to later loads of
+//   the same file (wconOct_setLoadCache). Shared by both backends, like
+//   wrapperMemory: each one caches what its handles on a dataset share
+//   (a NativeWCONWorms, a Python WCONWorms), and stores a new handle on
+//   it for a hit instead of loading again.
+//
+// Nothing changes a loaded dataset in place (add, to_canon and the rest
+//   make new ones), so handles share it without copies. What does
+//   change a dataset it has just loaded, load_many sharing unit objects
+//   between files, does so before the dataset goes into the cache.
+//
+// Entries are keyed by the resolved path, and stay good while the file
+//   has the same device, inode, size and mtime; as in wcond, only the
+//   named file is checked, not the chunks it links to. A dataset is
+//   charged to the cache rather than to its handles, for as long as
+//   anything holds it. The least recently used entries that nothing
+//   else holds any more go once the cache is over its budget.
+#include <stddef.h>
+
+#include <memory>
+#include <string>
+
+// What the handles on a cached dataset share
+class WconOctCachedLoad {
+ public:
+  virtual ~WconOctCachedLoad() {}
+  // Whether anything besides the cache still holds the dataset
+  virtual bool inUse() const = 0;
+};
+
+// The file a load comes from, as it was before the load; path is empty
+//   if it cannot be cached
+struct WconOctLoadCacheKey {
+  WconOctLoadCacheKey() : dev(0), ino(0), size(0), mtime(0), mtimeNsec(0) {}
+
+  std::string path;
+  long long dev;
+  long long ino;
+  long long size;
+  long long mtime;
+  long mtimeNsec;
+};
+
+// The dataset cached for path, NULL on a miss or with the cache off.
+//   key is filled in for wconOctLoadCacheInsert either way.
+std::shared_ptr<WconOctCachedLoad>
+  wconOctLoadCacheFind(const char *path, WconOctLoadCacheKey &key);
+// Caches what the file of key was just loaded into, charged bytes.
+//   false if it was not cached, and is then the handle's to charge.
+bool wconOctLoadCacheInsert(const WconOctLoadCacheKey &key,
+			    std::shared_ptr<WconOctCachedLoad> value,
+			    size_t bytes);
+// Drops every entry nothing else holds, to make room under the
+//   memory cap
+void wconOctLoadCacheDropIdle();
+
+// For wconOct_memoryReport
+struct WconOctLoadCacheTotals {
+  long numEntries;
+  double bytes;
+  double budgetBytes;
+  double hits;
+  double misses;
+};
+void wconOctLoadCacheGetTotals(WconOctLoadCacheTotals &totals);
+#endif /* __WRAPPER_LOAD_CACHE_H_ */
@@ -0,0 +1,201 @@
+#include "octaveWconPythonWrapper.h"
+#include "wrapperLoadCache.h"
+#include "wrapperMemory.h"
+#include "wrapperStats.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/stat.h>
+
+#include <algorithm>
+#include <iostream>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+#define MEMORY_MB (1024.0 * 1024.0)
+
+namespace {
+
+struct HandleMemory {
+  size_t bytes;
+  const char *createdBy;
+  long long createdNs;
+};
+
+mutex memoryLock;
+unordered_map<WconOctHandle, HandleMemory> handleMemory;
+size_t totalBytes = 0;
+// Of the load cache, on top of totalBytes
+size_t cachedBytes = 0;
+// 0 for no cap; read from the environment on first use
+double capBytes = -1.0;
+
+// With memoryLock held
+double currentCap() {
+  if (capBytes < 0.0) {
+    const char *env = getenv("WCONOCT_MEMORY_CAP_MB");
+    capBytes = (env != NULL) ? atof(env) * MEMORY_MB : 0.0;
+    if (capBytes < 0.0) {
+      capBytes = 0.0;
+    }
+  }
+  return capBytes;
+}
+
+// With memoryLock held
+bool fitsCap(size_t estimate) {
+  double cap = currentCap();
+  return cap <= 0.0 ||
+    (double)totalBytes + (double)cachedBytes + (double)estimate <= cap;
+}
+
+bool largerFirst(const pair<WconOctHandle, HandleMemory> &a,
+		 const pair<WconOctHandle, HandleMemory> &b) {
+  return a.second.bytes > b.second.bytes;
+}
+
+} // namespace
+
+void wconOctMemoryTrack(WconOctHandle handle, size_t bytes) {
+  HandleMemory entry;
+  entry.bytes = bytes;
+  entry.createdBy = wconOctStatsCurrentCall();
+  if (entry.createdBy == NULL) {
+    entry.createdBy = "(unknown)";
+  }
+  entry.createdNs = wconOctStatsNow();
+  lock_guard<mutex> guard(memoryLock);
+  handleMemory[handle] = entry;
+  totalBytes += bytes;
+}
+
+void wconOctMemoryUntrack(WconOctHandle handle) {
+  lock_guard<mutex> guard(memoryLock);
+  unordered_map<WconOctHandle, HandleMemory>::iterator found =
+    handleMemory.find(handle);
+  if (found != handleMemory.end()) {
+    totalBytes -= found->second.bytes;
+    handleMemory.erase(found);
+  }
+}
+
+void wconOctMemoryGrow(WconOctHandle handle, size_t bytes) {
+  lock_guard<mutex> guard(memoryLock);
+  unordered_map<WconOctHandle, HandleMemory>::iterator found =
+    handleMemory.find(handle);
+  if (found != handleMemory.end()) {
+    found->second.bytes += bytes;
+    totalBytes += bytes;
+  }
+}
+
+void wconOctMemorySetCached(size_t bytes) {
+  lock_guard<mutex> guard(memoryLock);
+  cachedBytes = bytes;
+}
+
+size_t wconOctMemoryBytes(WconOctHandle handle) {
+  lock_guard<mutex> guard(memoryLock);
+  unordered_map<WconOctHandle, HandleMemory>::const_iterator found =
+    handleMemory.find(handle);
+  return (found == handleMemory.end()) ? 0 : found->second.bytes;
+}
+
+bool wconOctMemoryAdmit(size_t estimate) {
+  {
+    lock_guard<mutex> guard(memoryLock);
+    if (fitsCap(estimate)) {
+      return true;
+    }
+  }
+  // Not with memoryLock held, which the cache takes to report its bytes
+  wconOctLoadCacheDropIdle();
+  lock_guard<mutex> guard(memoryLock);
+  if (fitsCap(estimate)) {
+    return true;
+  }
+  char msg[256];
+  snprintf(msg, sizeof(msg),
+	   "ERROR: Memory cap of %.1f MB reached: %lu handles and the load "
+	   "cache hold %.1f MB and this needs about %.1f MB more.",
+	   currentCap() / MEMORY_MB, (unsigned long)handleMemory.size(),
+	   (totalBytes + cachedBytes) / MEMORY_MB, estimate / MEMORY_MB);
+  cerr << msg << endl
+       << "Release handles with wconOct_releaseHandle or raise the cap."
+       << endl;
+  return false;
+}
+
+size_t wconOctMemoryFileSize(const char *path) {
+  struct stat st;
+  if (path == NULL || stat(path, &st) != 0) {
+    return 0;
+  }
+  return (size_t)st.st_size;
+}
+
+extern "C"
+WconOctMemoryReport *wconOct_memoryReport(WconOctError *err,
+					  int maxEntries) {
+  if (err == NULL) {
+    return NULL;
+  }
+  vector<pair<WconOctHandle, HandleMemory> > entries;
+  WconOctMemoryReport *result = new WconOctMemoryReport;
+  // Before memoryLock, which the cache takes to report its bytes
+  WconOctLoadCacheTotals cacheTotals;
+  wconOctLoadCacheGetTotals(cacheTotals);
+  result->numCached = cacheTotals.numEntries;
+  result->cachedBytes = cacheTotals.bytes;
+  result->cacheBudgetBytes = cacheTotals.budgetBytes;
+  result->cacheHits = cacheTotals.hits;
+  result->cacheMisses = cacheTotals.misses;
+  {
+    lock_guard<mutex> guard(memoryLock);
+    entries.assign(handleMemory.begin(), handleMemory.end());
+    result->numHandles = (long)handleMemory.size();
+    result->totalBytes = (double)(totalBytes + cachedBytes);
+    result->capBytes = currentCap();
+  }
+  size_t shown = (maxEntries < 0) ? 0 : (size_t)maxEntries;
+  shown = min(shown, entries.size());
+  partial_sort(entries.begin(), entries.begin() + shown, entries.end(),
+	       largerFirst);
+
+  long long now = wconOctStatsNow();
+  result->numEntries = (int)shown;
+  result->entries = new WconOctHandleMemory[shown];
+  for (size_t i=0; i<shown; i++) {
+    result->entries[i].handle = entries[i].first;
+    result->entries[i].bytes = (double)entries[i].second.bytes;
+    result->entries[i].createdBy = entries[i].second.createdBy;
+    result->entries[i].ageSeconds =
+      (now - entries[i].second.createdNs) / 1e9;
+  }
+  *err = SUCCESS;
+  return result;
+}
+
+extern "C" void wconOct_freeMemoryReport(WconOctMemoryReport *report) {
+  if (report == NULL) {
+    return;
+  }
+  delete [] report->entries;
+  delete report;
+}
+
+extern "C" void wconOct_setMemoryCap(WconOctError *err, double megabytes) {
+  if (err == NULL) {
+    return;
+  }
+  if (megabytes < 0.0) {
+    cerr << "ERROR: Memory cap may not be negative" << endl;
+    *err = FAILED;
+    return;
+  }
+  lock_guard<mutex> guard(memoryLock);
+  capBytes = megabytes * MEMORY_MB;
+  *err = SUCCESS;
+}
@@ -0,0 +1,30 @@
+#ifndef __WRAPPER_MEMORY_H_
+#define __WRAPPER_MEMORY_H_
+// Bytes held by live handles, behind wconOct_memoryReport and the
+//   memory cap. Shared by both backends: each one measures what a
+//   handle keeps alive when it stores it, and calls
+//   wconOctMemoryUntrack when the handle is released.
+#include <stddef.h>
+
+#include "wrapperTypes.h"
+
+// Charges bytes to a new handle, along with the API call in progress
+void wconOctMemoryTrack(WconOctHandle handle, size_t bytes);
+void wconOctMemoryUntrack(WconOctHandle handle);
+// Charges bytes more to a tracked handle, for what is cached on it
+void wconOctMemoryGrow(WconOctHandle handle, size_t bytes);
+// Bytes charged to a handle, 0 if it is not tracked
+size_t wconOctMemoryBytes(WconOctHandle handle);
+// Bytes of the datasets in the load cache (wrapperLoadCache.h), which
+//   count towards the total and the cap as those of handles do
+void wconOctMemorySetCached(size_t bytes);
+
+// false, with a message, if a result of about estimate bytes would take
+//   the total over the cap, even after dropping what only the load
+//   cache holds. Approximate by nature: the real size is only known
+//   once the result exists.
+bool wconOctMemoryAdmit(size_t estimate);
+
+// Size of a file on disk, as the estimate for loading it; 0 if unknown
+size_t wconOctMemoryFileSize(const char *path);
+#endif /* __WRAPPER_MEMORY_H_ */
@@ -0,0 +1,636 @@
+#include "octaveWconPythonWrapper.h"
+#include "wconCodec.h"
+#include "wconJson.h"
+#include "wconZip.h"
+#include "wrapperParse.h"
+#include "wrapperStats.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <set>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+using namespace std;
+
+// Streaming parser and peek for both backends, on wconJson, wconZip and
+//   wconCodec alone: the input goes through WconJsonReader a buffer at
+//   a time (decompressed a buffer at a time when it is compressed), and
+//   only the data record being read is held, in buffers that are reused
+//   from one record to the next. The checks on the structure of a record are
+//   those of the native loader; the values themselves are passed on as
+//   they are.
+
+namespace {
+
+// A callback asked to stop
+struct ParseStopped {};
+
+class ZipEntrySource : public WconJsonSource {
+ public:
+  ZipEntrySource(const string &path, size_t index) : reader(path, index) {}
+  size_t read(char *buf, size_t max) { return reader.read(buf, max); }
+
+ private:
+  WconZipEntryReader reader;
+};
+
+// One file of the input: a file on disk, plain or a zip archive of one
+//   entry, or an entry of a multi-entry archive
+struct ParseInput {
+  ParseInput() : zipped(false), entry(0), codec(WCON_CODEC_NONE) {}
+  string path;
+  bool zipped;
+  size_t entry;
+  // Entries of a multi-entry archive; empty otherwise
+  vector<string> names;
+  // What "files" links are resolved against: path, or the entry name
+  string name;
+  // gzip or zstd compressed text
+  WconCodec codec;
+};
+
+// The text of an input, for a WconJsonReader
+class ParseSource {
+ public:
+  explicit ParseSource(const ParseInput &input) : fp(NULL), source(NULL) {
+    if (input.zipped) {
+      source = new ZipEntrySource(input.path, input.entry);
+    } else if (input.codec != WCON_CODEC_NONE) {
+      source = new WconCodecSource(input.path, input.codec);
+    } else {
+      fp = fopen(input.path.c_str(), "rb");
+      if (fp == NULL) {
+	throw runtime_error("Cannot open " + input.path);
+      }
+      source = new WconJsonFileSource(fp);
+    }
+  }
+  ~ParseSource() {
+    delete source;
+    if (fp != NULL) {
+      fclose(fp);
+    }
+  }
+
+  FILE *fp;
+  WconJsonSource *source;
+
+ private:
+  ParseSource(const ParseSource &);
+  ParseSource &operator=(const ParseSource &);
+};
+
+// The "files" object
+struct ParseLinks {
+  ParseLinks() : present(false) {}
+  bool present;
+  string current;
+  vector<string> prev;
+  vector<string> next;
+};
+
+ParseInput parseOpenInput(const string &path) {
+  ParseInput input;
+  input.path = input.name = path;
+  if (wconZipIsArchive(path)) {
+    input.zipped = true;
+    wconZipList(path, input.names);
+    if (input.names.empty()) {
+      throw runtime_error("Filename " + path + " is a zip archive, which "
+			  "is fine, but the archive does not contain any "
+			  "files.");
+    } else if (input.names.size() == 1) {
+      input.names.clear();
+    } else {
+      input.name = input.names[0];
+    }
+  } else {
+    input.codec = wconCodecDetect(path);
+  }
+  return input;
+}
+
+// Entry names as ZipFile.extract sees them: no empty parts, "." or ".."
+string parseEntryKey(const string &name) {
+  string result;
+  size_t start = 0;
+  while (start <= name.size()) {
+    size_t end = name.find('/', start);
+    if (end == string::npos) {
+      end = name.size();
+    }
+    string part = name.substr(start, end - start);
+    if (!part.empty() && part != "." && part != "..") {
+      result += (result.empty() ? "" : "/") + part;
+    }
+    start = end + 1;
+  }
+  return result;
+}
+
+// The chunk link names, resolved as load_from_file does: relative to
+//   the part of the name before files.current
+ParseInput parseResolve(const ParseInput &from, const ParseLinks &links,
+			const string &link) {
+  size_t nameOffset = from.name.find(links.current);
+  if (nameOffset == string::npos) {
+    throw runtime_error("Mismatch between the filename given in the file \""
+			+ links.current + "\" and the file we loaded from \""
+			+ from.name + "\".");
+  }
+  string target = from.name.substr(0, nameOffset) + link;
+  if (from.names.empty()) {
+    return parseOpenInput(target);
+  }
+  string key = parseEntryKey(target);
+  for (size_t i=0; i<from.names.size(); i++) {
+    if (parseEntryKey(from.names[i]) == key) {
+      ParseInput input = from;
+      input.entry = i;
+      input.name = from.names[i];
+      return input;
+    }
+  }
+  throw runtime_error("No chunk " + target + " in " + from.path);
+}
+
+void parseLinkNames(const WconJsonValue &v, const char *key,
+		    vector<string> &out) {
+  if (v.isString()) {
+    if (!v.strValue.empty()) {
+      out.push_back(v.strValue);
+    }
+  } else if (v.isArray()) {
+    for (size_t i=0; i<v.items.size(); i++) {
+      if (!v.items[i].isString() || v.items[i].strValue.empty()) {
+	throw runtime_error(string("files.") + key +
+			    " must hold non-empty strings");
+      }
+      out.push_back(v.items[i].strValue);
+    }
+  } else if (!v.isNull()) {
+    throw runtime_error(string("files.") + key +
+			" must be null, a string or an array of strings");
+  }
+}
+
+void parseLinks(const WconJsonValue &v, ParseLinks &links) {
+  const WconJsonValue *current = v.isObject() ? v.find("current") : NULL;
+  if (current == NULL || !current->isString()) {
+    throw runtime_error("files must be an object with a string for "
+			"current");
+  }
+  links.present = true;
+  links.current = current->strValue;
+  const WconJsonValue *prev = v.find("prev");
+  const WconJsonValue *next = v.find("next");
+  if (prev != NULL) {
+    parseLinkNames(*prev, "prev", links.prev);
+  }
+  if (next != NULL) {
+    parseLinkNames(*next, "next", links.next);
+  }
+}
+
+string parseJsonText(const WconJsonValue &v) {
+  WconJsonWriter writer;
+  writer.writeValue(v);
+  return writer.text();
+}
+
+class StreamParser {
+ public:
+  StreamParser(const WconOctParseCallbacks *callbacks, void *user)
+    : cb(callbacks), user(user), frames(0) {}
+
+  // One file, with its "files" links into links
+  void parseFile(const ParseInput &input, ParseLinks &links);
+
+  const WconOctParseCallbacks *cb;
+  void *user;
+  long frames;
+
+ private:
+  void call(int result) {
+    if (result != 0) {
+      throw ParseStopped();
+    }
+  }
+  void readRecord(WconJsonReader &reader);
+  void emitRecord();
+
+  // The record being read
+  string id;
+  vector<double> t, x, y, cx, cy, ox, oy;
+  vector<long> xLengths, yLengths;
+  vector<pair<string, string> > custom;
+  string customKey;
+  WconJsonValue customValue;
+};
+
+double parseNumber(WconJsonReader &reader, const string &where) {
+  WconJsonReader::Token tok = reader.peek();
+  if (tok == WconJsonReader::TOKEN_NUMBER) {
+    return reader.readNumber();
+  } else if (tok == WconJsonReader::TOKEN_NULL) {
+    reader.readNull();
+    return NAN;
+  }
+  throw runtime_error(where + " must hold numbers or null");
+}
+
+void parseNumbers(WconJsonReader &reader, const string &where,
+		  vector<double> &out) {
+  if (reader.peek() != WconJsonReader::TOKEN_ARRAY) {
+    throw runtime_error(where + " must be an array of numbers");
+  }
+  reader.beginArray();
+  while (reader.nextItem()) {
+    out.push_back(parseNumber(reader, where));
+  }
+}
+
+// An array of numbers (one point per frame) or of arrays of numbers
+void parseRows(WconJsonReader &reader, const string &where,
+	       vector<double> &values, vector<long> &lengths) {
+  if (reader.peek() != WconJsonReader::TOKEN_ARRAY) {
+    throw runtime_error(where + " must be an array");
+  }
+  reader.beginArray();
+  int nested = -1;
+  while (reader.nextItem()) {
+    bool isArray = (reader.peek() == WconJsonReader::TOKEN_ARRAY);
+    if (nested == -1) {
+      nested = isArray ? 1 : 0;
+    } else if (nested != (isArray ? 1 : 0)) {
+      throw runtime_error(where + " must be an array of numbers or an "
+			  "array of arrays");
+    }
+    size_t before = values.size();
+    if (isArray) {
+      parseNumbers(reader, where, values);
+    } else {
+      values.push_back(parseNumber(reader, where));
+    }
+    lengths.push_back((long)(values.size() - before));
+  }
+  if (nested == -1) {
+    throw runtime_error(where + " may not be empty");
+  }
+}
+
+void StreamParser::readRecord(WconJsonReader &reader) {
+  if (reader.peek() != WconJsonReader::TOKEN_OBJECT) {
+    throw runtime_error("data must hold objects");
+  }
+  t.clear();
+  x.clear();
+  y.clear();
+  cx.clear();
+  cy.clear();
+  ox.clear();
+  oy.clear();
+  xLengths.clear();
+  yLengths.clear();
+  custom.clear();
+
+  static const char *const known[] = {"id", "t", "x", "y", "cx", "cy",
+				      "ox", "oy", NULL};
+  bool seen[8] = {false, false, false, false, false, false, false, false};
+  vector<double> *scalars[] = {NULL, &t, NULL, NULL, &cx, &cy, &ox, &oy};
+  reader.beginObject();
+  while (reader.nextMember(customKey)) {
+    int k = 0;
+    while (known[k] != NULL && customKey != known[k]) {
+      k++;
+    }
+    if (known[k] == NULL) {
+      if (!customKey.empty() && customKey[0] == '@') {
+	reader.readValue(customValue);
+	custom.push_back(make_pair(customKey, parseJsonText(customValue)));
+      } else {
+	reader.skipValue();
+      }
+      continue;
+    }
+    if (seen[k]) {
+      throw runtime_error("Duplicate key: data." + customKey);
+    }
+    seen[k] = true;
+    string where = "data." + customKey;
+    if (k == 0) {
+      if (reader.peek() != WconJsonReader::TOKEN_STRING) {
+	throw runtime_error("data.id must be a string");
+      }
+      reader.readString(id);
+    } else if (k == 2) {
+      parseRows(reader, where, x, xLengths);
+    } else if (k == 3) {
+      parseRows(reader, where, y, yLengths);
+    } else {
+      parseNumbers(reader, where, *scalars[k]);
+    }
+  }
+  if (!seen[0] || !seen[1] || !seen[2] || !seen[3]) {
+    throw runtime_error("data records must have id, t, x and y");
+  }
+  if (seen[4] != seen[5]) {
+    throw runtime_error("cx and cy must be given together");
+  }
+  if (seen[6] != seen[7]) {
+    throw runtime_error("ox and oy must be given together");
+  }
+  size_t n = t.size();
+  for (int k=2; k<8; k++) {
+    size_t count = (k == 2) ? xLengths.size() : (k == 3) ? yLengths.size() :
+      scalars[k]->size();
+    if (k < 4 || seen[k]) {
+      if (count != n) {
+	throw runtime_error("Error: Elements must have all have the same "
+			    "number of timeframes.");
+      }
+    }
+  }
+  for (size_t i=0; i<n; i++) {
+    if (xLengths[i] != yLengths[i]) {
+      throw runtime_error("Error: Aspects x and y, etc. must have same "
+			  "length for data segment " + id);
+    }
+  }
+  emitRecord();
+}
+
+void StreamParser::emitRecord() {
+  long n = (long)t.size();
+  if (cb->recordBegin != NULL) {
+    call(cb->recordBegin(id.c_str(), n, user));
+  }
+  for (size_t i=0; cb->custom != NULL && i<custom.size(); i++) {
+    call(cb->custom(id.c_str(), custom[i].first.c_str(),
+		    custom[i].second.c_str(), user));
+  }
+  if (cb->frame != NULL) {
+    WconOctParseFrame frame;
+    frame.wormId = id.c_str();
+    size_t offset = 0;
+    for (long i=0; i<n; i++) {
+      frame.frameIndex = i;
+      frame.t = t[i];
+      frame.numPoints = xLengths[i];
+      frame.x = x.empty() ? NULL : &x[offset];
+      frame.y = y.empty() ? NULL : &y[offset];
+      frame.ox = ox.empty() ? NAN : ox[i];
+      frame.oy = oy.empty() ? NAN : oy[i];
+      frame.cx = cx.empty() ? NAN : cx[i];
+      frame.cy = cy.empty() ? NAN : cy[i];
+      offset += xLengths[i];
+      frames++;
+      call(cb->frame(&frame, user));
+    }
+  } else {
+    frames += n;
+  }
+  if (cb->recordEnd != NULL) {
+    call(cb->recordEnd(id.c_str(), user));
+  }
+}
+
+void StreamParser::parseFile(const ParseInput &input, ParseLinks &links) {
+  if (cb->file != NULL) {
+    call(cb->file(input.name.c_str(), user));
+  }
+  ParseSource text(input);
+  WconJsonReader reader(text.source);
+  if (reader.peek() != WconJsonReader::TOKEN_OBJECT) {
+    throw runtime_error("the root must be an object");
+  }
+  reader.beginObject();
+  set<string> seen;
+  string key;
+  WconJsonValue v;
+  while (reader.nextMember(key)) {
+    if (!seen.insert(key).second) {
+      throw runtime_error("Duplicate key: " + key);
+    }
+    if (key == "data") {
+      WconJsonReader::Token tok = reader.peek();
+      if (tok == WconJsonReader::TOKEN_OBJECT) {
+	readRecord(reader);
+      } else if (tok == WconJsonReader::TOKEN_ARRAY) {
+	reader.beginArray();
+	while (reader.nextItem()) {
+	  readRecord(reader);
+	}
+      } else {
+	throw runtime_error("data must be an object or an array");
+      }
+    } else if (key == "units" || key == "metadata") {
+      reader.readValue(v);
+      if (!v.isObject()) {
+	throw runtime_error(key + " must be an object");
+      }
+      int (*callback)(const char *, void *) =
+	(key == "units") ? cb->units : cb->metadata;
+      if (callback != NULL) {
+	call(callback(parseJsonText(v).c_str(), user));
+      }
+    } else if (key == "files") {
+      reader.readValue(v);
+      parseLinks(v, links);
+    } else if (!key.empty() && key[0] == '@' && cb->custom != NULL) {
+      reader.readValue(v);
+      call(cb->custom(NULL, key.c_str(), parseJsonText(v).c_str(), user));
+    } else {
+      reader.skipValue();
+    }
+  }
+  reader.expectEnd();
+  if (seen.count("units") == 0 || seen.count("data") == 0) {
+    throw runtime_error("units and data are required");
+  }
+}
+
+// The chunks before (prev) or after (next) the one read into links
+void parseChunks(StreamParser &parser, const ParseInput &first,
+		 const ParseLinks &firstLinks, bool prev,
+		 set<pair<string, string> > &visited) {
+  ParseInput input = first;
+  ParseLinks links = firstLinks;
+  while (links.present && !(prev ? links.prev : links.next).empty()) {
+    input = parseResolve(input, links, (prev ? links.prev : links.next)[0]);
+    if (!visited.insert(make_pair(input.path, input.name)).second) {
+      throw runtime_error("Chunk " + input.name + " is linked twice");
+    }
+    links = ParseLinks();
+    parser.parseFile(input, links);
+  }
+}
+
+// The id and time range of one record, skipping everything else
+void peekRecord(WconJsonReader &reader, WconOctPeek &peek,
+		set<string> &ids, string &key, string &id) {
+  if (reader.peek() != WconJsonReader::TOKEN_OBJECT) {
+    throw runtime_error("data must hold objects");
+  }
+  reader.beginObject();
+  while (reader.nextMember(key)) {
+    if (key == "id" && reader.peek() == WconJsonReader::TOKEN_STRING) {
+      reader.readString(id);
+      ids.insert(id);
+    } else if (key == "t" && reader.peek() == WconJsonReader::TOKEN_ARRAY) {
+      reader.beginArray();
+      while (reader.nextItem()) {
+	double t = parseNumber(reader, "data.t");
+	peek.numFrames++;
+	if (!isnan(t)) {
+	  peek.tMin = isnan(peek.tMin) ? t : min(peek.tMin, t);
+	  peek.tMax = isnan(peek.tMax) ? t : max(peek.tMax, t);
+	}
+      }
+    } else {
+      reader.skipValue();
+    }
+  }
+  peek.numRecords++;
+}
+
+char *peekCopyString(const string &s) {
+  char *result = new char[s.size() + 1];
+  memcpy(result, s.c_str(), s.size() + 1);
+  return result;
+}
+
+} // namespace
+
+void wconOctPeekFile(const string &path, WconOctPeek &peek) {
+  ParseSource text(parseOpenInput(path));
+  WconJsonReader reader(text.source);
+  if (reader.peek() != WconJsonReader::TOKEN_OBJECT) {
+    throw runtime_error("the root must be an object");
+  }
+  reader.beginObject();
+  set<string> ids;
+  string key, recordKey, id;
+  WconJsonValue v;
+  while (reader.nextMember(key)) {
+    char **json = (key == "units") ? &peek.unitsJson :
+      (key == "metadata") ? &peek.metadataJson :
+      (key == "files") ? &peek.filesJson : NULL;
+    if (json != NULL) {
+      if (*json != NULL) {
+	throw runtime_error("Duplicate key: " + key);
+      }
+      reader.readValue(v);
+      *json = peekCopyString(parseJsonText(v));
+    } else if (key == "data") {
+      WconJsonReader::Token tok = reader.peek();
+      if (tok == WconJsonReader::TOKEN_OBJECT) {
+	peekRecord(reader, peek, ids, recordKey, id);
+      } else if (tok == WconJsonReader::TOKEN_ARRAY) {
+	reader.beginArray();
+	while (reader.nextItem()) {
+	  peekRecord(reader, peek, ids, recordKey, id);
+	}
+      } else {
+	throw runtime_error("data must be an object or an array");
+      }
+    } else {
+      reader.skipValue();
+    }
+  }
+  reader.expectEnd();
+  peek.numWorms = (long)ids.size();
+}
+
+void wconOctPeekLinks(const string &path, const char *filesJson,
+		      string &prev, string &next) {
+  prev.clear();
+  next.clear();
+  // The chunks of a multi-entry archive link to each other, inside it
+  if (filesJson == NULL ||
+      (wconZipIsArchive(path) && !parseOpenInput(path).names.empty())) {
+    return;
+  }
+  WconJsonValue v;
+  wconJsonParse(filesJson, strlen(filesJson), v);
+  ParseLinks links;
+  parseLinks(v, links);
+  size_t nameOffset = path.find(links.current);
+  if (nameOffset == string::npos) {
+    throw runtime_error("Mismatch between the filename given in the file \""
+			+ links.current + "\" and the file \"" + path + "\".");
+  }
+  if (!links.prev.empty()) {
+    prev = path.substr(0, nameOffset) + links.prev[0];
+  }
+  if (!links.next.empty()) {
+    next = path.substr(0, nameOffset) + links.next[0];
+  }
+}
+
+long wconOct_parse_stream(WconOctError *err, const char *path,
+			  const WconOctParseCallbacks *callbacks,
+			  void *user) {
+  WconOctStatScope stat(WCONOCT_STAT_PARSE_STREAM, err);
+  if (path == NULL || path[0] == '\0' || callbacks == NULL) {
+    cerr << "ERROR: parse_stream needs a path and callbacks" << endl;
+    *err = FAILED;
+    return 0;
+  }
+  StreamParser parser(callbacks, user);
+  try {
+    ParseInput first = parseOpenInput(path);
+    set<pair<string, string> > visited;
+    visited.insert(make_pair(first.path, first.name));
+    ParseLinks links;
+    parser.parseFile(first, links);
+    parseChunks(parser, first, links, true, visited);
+    parseChunks(parser, first, links, false, visited);
+  } catch (const ParseStopped &) {
+    // A callback has all it wants
+  } catch (const exception &e) {
+    cerr << "ERROR: Cannot parse " << path << ": " << e.what() << endl;
+    *err = FAILED;
+    return parser.frames;
+  }
+  *err = SUCCESS;
+  return parser.frames;
+}
+
+WconOctPeek *wconOct_peek(WconOctError *err, const char *path) {
+  WconOctStatScope stat(WCONOCT_STAT_PEEK, err);
+  if (path == NULL || path[0] == '\0') {
+    cerr << "ERROR: peek needs a path" << endl;
+    *err = FAILED;
+    return NULL;
+  }
+  WconOctPeek *peek = new WconOctPeek;
+  peek->unitsJson = peek->metadataJson = peek->filesJson = NULL;
+  peek->numRecords = peek->numWorms = peek->numFrames = 0;
+  peek->tMin = peek->tMax = NAN;
+  try {
+    wconOctPeekFile(path, *peek);
+  } catch (const exception &e) {
+    cerr << "ERROR: Cannot peek at " << path << ": " << e.what() << endl;
+    wconOct_freePeek(peek);
+    *err = FAILED;
+    return NULL;
+  }
+  *err = SUCCESS;
+  return peek;
+}
+
+void wconOct_freePeek(WconOctPeek *peek) {
+  if (peek == NULL) {
+    return;
+  }
+  delete [] peek->unitsJson;
+  delete [] peek->metadataJson;
+  delete [] peek->filesJson;
+  delete peek;
+}
@@ -0,0 +1,16 @@
+#ifndef __WRAPPER_PARSE_H_
+#define __WRAPPER_PARSE_H_
+// The peek behind wconOct_peek, for the catalog (wrapperCatalog.cpp),
+//   which peeks at many files at once and keeps its own statistics.
+#include <string>
+
+#include "wrapperTypes.h"
+
+// Fills peek, which starts out empty, from path. Throws runtime_error.
+void wconOctPeekFile(const std::string &path, WconOctPeek &peek);
+// The chunks path links to through the "files" JSON of its peek, as
+//   load_from_file resolves them; "" where there is none. Throws
+//   runtime_error on a malformed "files".
+void wconOctPeekLinks(const std::string &path, const char *filesJson,
+		      std::string &prev, std::string &next);
+#endif /* __WRAPPER_PARSE_H_ */
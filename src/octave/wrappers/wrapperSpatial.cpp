@@ -0,0 +1,444 @@
+#include "octaveWconPythonWrapper.h"
+#include "wrapperSpines.h"
+#include "wrapperStats.h"
+
+#include <math.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <queue>
+#include <string>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Spatial index for both backends, built from wconOct_WCONWorms_worm_data.
+//
+// The position of a frame is its centroid, otherwise the midpoint of its
+//   spine by arc length; frames with neither are left out. Positions are
+//   copied into a uniform grid of square cells, one grid per time bucket,
+//   with the frames of a cell next to each other in one array. A query
+//   only looks at the cells it overlaps (or, for nearest, the rings of
+//   cells around the point until no closer frame can be left), so its
+//   cost follows the number of frames near it rather than the size of the
+//   dataset. The index keeps no reference to the handle.
+
+// Frames per cell the automatic sizes aim for
+#define SPATIAL_CELL_FRAMES 16
+// Frames of each worm per time bucket the automatic sizes aim for
+#define SPATIAL_BUCKET_FRAMES 64
+// Cells of the grid over the whole time span, at most
+#define SPATIAL_MAX_CELLS (1LL << 40)
+
+namespace {
+
+struct SpatialEntry {
+  double t;
+  double x;
+  double y;
+  long wormIndex;
+  long frameIndex;
+};
+
+} // namespace
+
+struct wconOctSpatialIndexStruct {
+  vector<string> wormIds;
+  vector<SpatialEntry> entries;
+  // Cell key to the entries [first, second) in it
+  unordered_map<long long, pair<size_t, size_t> > cells;
+  double cellSize;
+  double bucketSeconds;
+  double x0, y0, t0;
+  long long nx, ny, nt;
+};
+
+namespace {
+
+long long spatialCell(double v, double origin, double size, long long n) {
+  double c = floor((v - origin) / size);
+  return (c < 0) ? 0 : (c >= n) ? n - 1 : (long long)c;
+}
+
+long long spatialKey(const WconOctSpatialIndex *index, long long bucket,
+		     long long cy, long long cx) {
+  return (bucket * index->ny + cy) * index->nx + cx;
+}
+
+// The frames whose position can be indexed, with it
+void spatialWormEntries(const WconOctWormData *worm, long wormIndex,
+			vector<SpatialEntry> &entries) {
+  long n = worm->numFrames;
+  vector<double> sx(n * 3), sy(n * 3);
+  if (n > 0) {
+    wconOctSpineResample(worm, 0, n, 3, &sx[0], &sy[0], 3, 1, NULL);
+  }
+  for (long i=0; i<n; i++) {
+    SpatialEntry e;
+    e.t = worm->t.data[i * worm->t.rowStride];
+    e.x = e.y = NAN;
+    if (worm->cx.data != NULL && worm->cy.data != NULL) {
+      e.x = worm->cx.data[i * worm->cx.rowStride];
+      e.y = worm->cy.data[i * worm->cy.rowStride];
+    }
+    if (isnan(e.x) || isnan(e.y)) {
+      e.x = sx[i * 3 + 1];
+      e.y = sy[i * 3 + 1];
+    }
+    e.wormIndex = wormIndex;
+    e.frameIndex = i;
+    if (isfinite(e.x) && isfinite(e.y) && isfinite(e.t)) {
+      entries.push_back(e);
+    }
+  }
+}
+
+struct SpatialKeyOrder {
+  const WconOctSpatialIndex *index;
+  long long key(const SpatialEntry &e) const {
+    return spatialKey(index,
+		      spatialCell(e.t, index->t0, index->bucketSeconds,
+				  index->nt),
+		      spatialCell(e.y, index->y0, index->cellSize, index->ny),
+		      spatialCell(e.x, index->x0, index->cellSize, index->nx));
+  }
+  bool operator()(const SpatialEntry &a, const SpatialEntry &b) const {
+    long long ka = key(a), kb = key(b);
+    if (ka != kb) {
+      return ka < kb;
+    }
+    return (a.wormIndex != b.wormIndex) ? a.wormIndex < b.wormIndex :
+      a.frameIndex < b.frameIndex;
+  }
+};
+
+// Sizes the grid and sorts the entries into it. false if the grid
+//   would have too many cells.
+bool spatialBuild(WconOctSpatialIndex *index, double cellSize,
+		  double bucketSeconds) {
+  vector<SpatialEntry> &entries = index->entries;
+  double x1 = -INFINITY, y1 = -INFINITY, t1 = -INFINITY;
+  index->x0 = index->y0 = index->t0 = INFINITY;
+  for (size_t i=0; i<entries.size(); i++) {
+    index->x0 = min(index->x0, entries[i].x);
+    index->y0 = min(index->y0, entries[i].y);
+    index->t0 = min(index->t0, entries[i].t);
+    x1 = max(x1, entries[i].x);
+    y1 = max(y1, entries[i].y);
+    t1 = max(t1, entries[i].t);
+  }
+  if (entries.empty()) {
+    index->x0 = index->y0 = index->t0 = x1 = y1 = t1 = 0;
+  }
+  double numFrames = max((double)entries.size(), 1.0);
+  double numWorms = max((double)index->wormIds.size(), 1.0);
+  if (bucketSeconds <= 0) {
+    double buckets = numFrames / numWorms / SPATIAL_BUCKET_FRAMES;
+    bucketSeconds = (t1 - index->t0) / max(floor(buckets), 1.0);
+  }
+  if (!(bucketSeconds > 0)) {
+    bucketSeconds = 1;
+  }
+  index->nt = (long long)floor((t1 - index->t0) / bucketSeconds) + 1;
+  if (cellSize <= 0) {
+    double perBucket = numFrames / index->nt;
+    double area = max(x1 - index->x0, 0.0) * max(y1 - index->y0, 0.0);
+    cellSize = sqrt(area / max(perBucket / SPATIAL_CELL_FRAMES, 1.0));
+    if (!(cellSize > 0)) {
+      cellSize = max(max(x1 - index->x0, y1 - index->y0), 1.0);
+    }
+  }
+  index->cellSize = cellSize;
+  index->bucketSeconds = bucketSeconds;
+  double nx = floor((x1 - index->x0) / cellSize) + 1;
+  double ny = floor((y1 - index->y0) / cellSize) + 1;
+  if (nx * ny * index->nt > (double)SPATIAL_MAX_CELLS) {
+    return false;
+  }
+  index->nx = (long long)nx;
+  index->ny = (long long)ny;
+
+  SpatialKeyOrder order = {index};
+  sort(entries.begin(), entries.end(), order);
+  for (size_t i=0; i<entries.size(); ) {
+    long long key = order.key(entries[i]);
+    size_t j = i + 1;
+    while (j < entries.size() && order.key(entries[j]) == key) {
+      j++;
+    }
+    index->cells[key] = make_pair(i, j);
+    i = j;
+  }
+  return true;
+}
+
+// The buckets [b0, b1] that can hold frames in [t0, t1]; false if none
+bool spatialBuckets(const WconOctSpatialIndex *index, double t0, double t1,
+		    long long &b0, long long &b1) {
+  double last = index->t0 + index->nt * index->bucketSeconds;
+  if (index->entries.empty() || t1 < index->t0 || t0 > last) {
+    return false;
+  }
+  b0 = spatialCell(t0, index->t0, index->bucketSeconds, index->nt);
+  b1 = spatialCell(t1, index->t0, index->bucketSeconds, index->nt);
+  return true;
+}
+
+WconOctSpatialHit spatialHit(const WconOctSpatialIndex *index,
+			     const SpatialEntry &e, double distance) {
+  WconOctSpatialHit hit;
+  hit.wormId = index->wormIds[e.wormIndex].c_str();
+  hit.wormIndex = e.wormIndex;
+  hit.frameIndex = e.frameIndex;
+  hit.t = e.t;
+  hit.x = e.x;
+  hit.y = e.y;
+  hit.distance = distance;
+  return hit;
+}
+
+bool spatialFrameOrder(const WconOctSpatialHit &a,
+		       const WconOctSpatialHit &b) {
+  return (a.wormIndex != b.wormIndex) ? a.wormIndex < b.wormIndex :
+    a.frameIndex < b.frameIndex;
+}
+
+bool spatialDistanceOrder(const WconOctSpatialHit &a,
+			  const WconOctSpatialHit &b) {
+  return (a.distance != b.distance) ? a.distance < b.distance :
+    spatialFrameOrder(a, b);
+}
+
+WconOctSpatialHits *spatialHits(const vector<WconOctSpatialHit> &found) {
+  WconOctSpatialHits *hits = new WconOctSpatialHits;
+  hits->numHits = (long)found.size();
+  hits->hits = new WconOctSpatialHit[found.size()];
+  copy(found.begin(), found.end(), hits->hits);
+  return hits;
+}
+
+// Frames in the box and time range. With radius >= 0, only those that
+//   close to (cx, cy), with their distance.
+void spatialBox(const WconOctSpatialIndex *index, double xa, double xb,
+		double ya, double yb, double t0, double t1, double cx,
+		double cy, double radius, vector<WconOctSpatialHit> &found) {
+  long long b0, b1;
+  if (!spatialBuckets(index, t0, t1, b0, b1)) {
+    return;
+  }
+  long long x0 = spatialCell(xa, index->x0, index->cellSize, index->nx);
+  long long x1 = spatialCell(xb, index->x0, index->cellSize, index->nx);
+  long long y0 = spatialCell(ya, index->y0, index->cellSize, index->ny);
+  long long y1 = spatialCell(yb, index->y0, index->cellSize, index->ny);
+  for (long long b=b0; b<=b1; b++) {
+    for (long long j=y0; j<=y1; j++) {
+      for (long long i=x0; i<=x1; i++) {
+	unordered_map<long long, pair<size_t, size_t> >::const_iterator cell =
+	  index->cells.find(spatialKey(index, b, j, i));
+	if (cell == index->cells.end()) {
+	  continue;
+	}
+	for (size_t k=cell->second.first; k<cell->second.second; k++) {
+	  const SpatialEntry &e = index->entries[k];
+	  if (e.t < t0 || e.t > t1 || e.x < xa || e.x > xb || e.y < ya ||
+	      e.y > yb) {
+	    continue;
+	  }
+	  double distance = 0;
+	  if (radius >= 0) {
+	    distance = hypot(e.x - cx, e.y - cy);
+	    if (distance > radius) {
+	      continue;
+	    }
+	  }
+	  found.push_back(spatialHit(index, e, distance));
+	}
+      }
+    }
+  }
+}
+
+bool spatialCheck(WconOctError *err, const WconOctSpatialIndex *index,
+		  const char *what, bool valid) {
+  if (index == NULL || !valid) {
+    cerr << "ERROR: " << what << endl;
+    *err = FAILED;
+    return false;
+  }
+  return true;
+}
+
+} // namespace
+
+extern "C"
+WconOctSpatialIndex *wconOct_spatial_open(WconOctError *err,
+					  const WconOctHandle selfHandle,
+					  double cellSize,
+					  double bucketSeconds) {
+  WconOctStatScope stat(WCONOCT_STAT_SPATIAL_OPEN, err);
+  long numWorms = wconOct_WCONWorms_num_worms(err, selfHandle);
+  if (*err == FAILED) {
+    cerr << "ERROR: Cannot index handle " << selfHandle << endl;
+    return NULL;
+  }
+  if (isnan(cellSize) || isnan(bucketSeconds)) {
+    cerr << "ERROR: Spatial index sizes may not be NaN" << endl;
+    *err = FAILED;
+    return NULL;
+  }
+  WconOctSpatialIndex *index = new WconOctSpatialIndex;
+  for (long w=0; w<numWorms; w++) {
+    WconOctWormData *worm = wconOct_WCONWorms_worm_data(err, selfHandle, w);
+    if (*err == FAILED) {
+      cerr << "ERROR: Cannot read worm " << w << " of handle "
+	   << selfHandle << endl;
+      delete index;
+      return NULL;
+    }
+    index->wormIds.push_back(worm->id);
+    spatialWormEntries(worm, w, index->entries);
+    wconOct_freeWormData(worm);
+  }
+  if (!spatialBuild(index, cellSize, bucketSeconds)) {
+    cerr << "ERROR: Spatial index cells of " << cellSize << " and "
+	 << bucketSeconds << " s are too small for handle " << selfHandle
+	 << endl;
+    delete index;
+    *err = FAILED;
+    return NULL;
+  }
+  *err = SUCCESS;
+  return index;
+}
+
+extern "C"
+WconOctSpatialHits *wconOct_spatial_range(WconOctError *err,
+					  const WconOctSpatialIndex *index,
+					  double x0, double x1,
+					  double y0, double y1,
+					  double t0, double t1) {
+  WconOctStatScope stat(WCONOCT_STAT_SPATIAL_RANGE, err);
+  if (!spatialCheck(err, index, "spatial_range needs an index and a range",
+		    !isnan(x0) && !isnan(x1) && !isnan(y0) && !isnan(y1) &&
+		    !isnan(t0) && !isnan(t1))) {
+    return NULL;
+  }
+  vector<WconOctSpatialHit> found;
+  if (x0 <= x1 && y0 <= y1 && t0 <= t1) {
+    spatialBox(index, x0, x1, y0, y1, t0, t1, NAN, NAN, -1, found);
+  }
+  sort(found.begin(), found.end(), spatialFrameOrder);
+  *err = SUCCESS;
+  return spatialHits(found);
+}
+
+extern "C"
+WconOctSpatialHits *wconOct_spatial_radius(WconOctError *err,
+					   const WconOctSpatialIndex *index,
+					   double x, double y, double radius,
+					   double t0, double t1) {
+  WconOctStatScope stat(WCONOCT_STAT_SPATIAL_RADIUS, err);
+  if (!spatialCheck(err, index, "spatial_radius needs an index, a point "
+		    "and a radius of 0 or more",
+		    !isnan(x) && !isnan(y) && radius >= 0 && !isnan(t0) &&
+		    !isnan(t1))) {
+    return NULL;
+  }
+  vector<WconOctSpatialHit> found;
+  if (t0 <= t1) {
+    spatialBox(index, x - radius, x + radius, y - radius, y + radius, t0,
+	       t1, x, y, radius, found);
+  }
+  sort(found.begin(), found.end(), spatialFrameOrder);
+  *err = SUCCESS;
+  return spatialHits(found);
+}
+
+// Rings of cells outwards from the cell of the point (clamped to the
+//   grid). Every cell of ring r is at least (r - 1) cells away from the
+//   point, so once the k-th nearest frame is closer than that the rest
+//   can be left.
+extern "C"
+WconOctSpatialHits *wconOct_spatial_nearest(WconOctError *err,
+					    const WconOctSpatialIndex *index,
+					    double x, double y, long k,
+					    double t0, double t1) {
+  WconOctStatScope stat(WCONOCT_STAT_SPATIAL_NEAREST, err);
+  if (!spatialCheck(err, index, "spatial_nearest needs an index, a point "
+		    "and k of 0 or more",
+		    !isnan(x) && !isnan(y) && k >= 0 && !isnan(t0) &&
+		    !isnan(t1))) {
+    return NULL;
+  }
+  // Largest distance on top
+  priority_queue<WconOctSpatialHit, vector<WconOctSpatialHit>,
+		 bool (*)(const WconOctSpatialHit &,
+			  const WconOctSpatialHit &)>
+    best(spatialDistanceOrder);
+  long long b0, b1;
+  if (k > 0 && t0 <= t1 && spatialBuckets(index, t0, t1, b0, b1)) {
+    long long ci = spatialCell(x, index->x0, index->cellSize, index->nx);
+    long long cj = spatialCell(y, index->y0, index->cellSize, index->ny);
+    long long rings = max(max(ci, index->nx - 1 - ci),
+			  max(cj, index->ny - 1 - cj));
+    for (long long r=0; r<=rings; r++) {
+      if ((long)best.size() == k &&
+	  best.top().distance < (r - 1) * index->cellSize) {
+	break;
+      }
+      for (long long j=max(cj - r, 0LL); j<=min(cj + r, index->ny - 1); j++) {
+	bool edge = (j == cj - r || j == cj + r);
+	// Only the two ends of a row inside the ring
+	long long step = edge ? 1 : 2 * r;
+	for (long long i=ci - r; i<=ci + r; i+=max(step, 1LL)) {
+	  if (i < 0 || i >= index->nx) {
+	    continue;
+	  }
+	  for (long long b=b0; b<=b1; b++) {
+	    unordered_map<long long, pair<size_t, size_t> >::const_iterator
+	      cell = index->cells.find(spatialKey(index, b, j, i));
+	    if (cell == index->cells.end()) {
+	      continue;
+	    }
+	    for (size_t e=cell->second.first; e<cell->second.second; e++) {
+	      const SpatialEntry &entry = index->entries[e];
+	      if (entry.t < t0 || entry.t > t1) {
+		continue;
+	      }
+	      WconOctSpatialHit hit =
+		spatialHit(index, entry, hypot(entry.x - x, entry.y - y));
+	      if ((long)best.size() < k) {
+		best.push(hit);
+	      } else if (spatialDistanceOrder(hit, best.top())) {
+		best.pop();
+		best.push(hit);
+	      }
+	    }
+	  }
+	}
+      }
+    }
+  }
+  vector<WconOctSpatialHit> found;
+  for (; !best.empty(); best.pop()) {
+    found.push_back(best.top());
+  }
+  reverse(found.begin(), found.end());
+  *err = SUCCESS;
+  return spatialHits(found);
+}
+
+extern "C" void wconOct_freeSpatialHits(WconOctSpatialHits *hits) {
+  if (hits == NULL) {
+    return;
+  }
+  delete[] hits->hits;
+  delete hits;
+}
+
+extern "C" void wconOct_spatial_close(WconOctSpatialIndex *index) {
+  WconOctStatScope stat(WCONOCT_STAT_SPATIAL_CLOSE, NULL);
+  delete index;
+}
@@ -0,0 +1,172 @@
+#include "octaveWconPythonWrapper.h"
+#include "wrapperSpines.h"
+#include "wrapperStats.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <iostream>
+#include <thread>
+#include <vector>
+using namespace std;
+
+// Frames a thread is given at least; below that starting one costs more
+//   than the work
+#define SPINE_THREAD_FRAMES 4096
+
+namespace {
+
+void spineNaN(long numPoints, double *x, double *y, long colStride) {
+  for (long k=0; k<numPoints; k++) {
+    x[k * colStride] = y[k * colStride] = NAN;
+  }
+}
+
+// One spine of m points, at px[j*stride], py[j*stride]. s is scratch
+//   space for the cumulative lengths.
+double spineFrame(const double *px, const double *py, long stride, long m,
+		  long numPoints, double *x, double *y, long colStride,
+		  vector<double> &s) {
+  if (m <= 0) {
+    spineNaN(numPoints, x, y, colStride);
+    return NAN;
+  }
+  s.resize(m);
+  s[0] = 0;
+  for (long j=1; j<m; j++) {
+    s[j] = s[j - 1] + hypot(px[j * stride] - px[(j - 1) * stride],
+			    py[j * stride] - py[(j - 1) * stride]);
+  }
+  // NaN anywhere after the first point ends up in the length
+  double total = s[m - 1];
+  if (isnan(total) || isnan(px[0]) || isnan(py[0])) {
+    spineNaN(numPoints, x, y, colStride);
+    return NAN;
+  }
+  if (total == 0) {
+    for (long k=0; k<numPoints; k++) {
+      x[k * colStride] = px[0];
+      y[k * colStride] = py[0];
+    }
+    return 0;
+  }
+
+  // The targets only go up, so the segment they are in only moves on
+  long j = 0;
+  double step = total / (numPoints - 1);
+  for (long k=0; k+1<numPoints; k++) {
+    double target = k * step;
+    while (j + 2 < m && s[j + 1] <= target) {
+      j++;
+    }
+    double segment = s[j + 1] - s[j];
+    double u = (segment > 0) ? (target - s[j]) / segment : 0;
+    const double *p0x = px + j * stride, *p0y = py + j * stride;
+    x[k * colStride] = *p0x + u * (p0x[stride] - *p0x);
+    y[k * colStride] = *p0y + u * (p0y[stride] - *p0y);
+  }
+  // The last point exactly, whatever the rounding of the lengths
+  x[(numPoints - 1) * colStride] = px[(m - 1) * stride];
+  y[(numPoints - 1) * colStride] = py[(m - 1) * stride];
+  return total;
+}
+
+struct SpineJob {
+  const WconOctWormData *worm;
+  long begin;
+  long end;
+  long numPoints;
+  double *x;
+  double *y;
+  long rowStride;
+  long colStride;
+  double *length;
+};
+
+void spineJob(SpineJob job) {
+  wconOctSpineResample(job.worm, job.begin, job.end, job.numPoints, job.x,
+		       job.y, job.rowStride, job.colStride, job.length);
+}
+
+// $WCONOCT_SPINE_THREADS, or one per core up to 8, and no more than the
+//   frames keep busy
+size_t spineThreads(long numFrames) {
+  size_t count = thread::hardware_concurrency();
+  count = (count == 0) ? 1 : min(count, (size_t)8);
+  const char *env = getenv("WCONOCT_SPINE_THREADS");
+  if (env != NULL && atol(env) > 0) {
+    count = (size_t)atol(env);
+  }
+  size_t useful = (size_t)(numFrames / SPINE_THREAD_FRAMES);
+  return max((size_t)1, min(count, useful));
+}
+
+} // namespace
+
+void wconOctSpineResample(const WconOctWormData *worm, long begin, long end,
+			  long numPoints, double *x, double *y,
+			  long rowStride, long colStride, double *length) {
+  const WconOctArrayView &vx = worm->x, &vy = worm->y;
+  const WconOctArrayView &sizes = worm->aspectSize;
+  vector<double> s;
+  for (long i=begin; i<end; i++) {
+    long m = (vx.data == NULL || vy.data == NULL) ? 0 : vx.cols;
+    if (m > 0 && sizes.data != NULL) {
+      double size = sizes.data[i * sizes.rowStride];
+      m = isnan(size) ? 0 : min(m, (long)size);
+    }
+    double total = (m == 0) ?
+      spineFrame(NULL, NULL, 0, 0, numPoints, x + i * rowStride,
+		 y + i * rowStride, colStride, s) :
+      spineFrame(vx.data + i * vx.rowStride, vy.data + i * vy.rowStride,
+		 vx.colStride, m, numPoints, x + i * rowStride,
+		 y + i * rowStride, colStride, s);
+    if (length != NULL) {
+      length[i] = total;
+    }
+  }
+}
+
+extern "C"
+long wconOct_WCONWorms_spines(WconOctError *err,
+			      const WconOctHandle selfHandle,
+			      long wormIndex, long numPoints,
+			      double *x, double *y,
+			      long rowStride, long colStride,
+			      double *length) {
+  WconOctStatScope stat(WCONOCT_STAT_SPINES, err);
+  if (numPoints < 2 || (x == NULL) != (y == NULL)) {
+    cerr << "ERROR: spines needs 2 or more points, and both x and y or "
+	 << "neither" << endl;
+    *err = FAILED;
+    return 0;
+  }
+  WconOctWormData *worm =
+    wconOct_WCONWorms_worm_data(err, selfHandle, wormIndex);
+  if (*err == FAILED) {
+    return 0;
+  }
+  long numFrames = worm->numFrames;
+  if (x != NULL) {
+    size_t numThreads = spineThreads(numFrames);
+    vector<thread> threads;
+    SpineJob job = {worm, 0, 0, numPoints, x, y, rowStride, colStride,
+		    length};
+    for (size_t t=0; t<numThreads; t++) {
+      job.begin = (long)(numFrames * t / numThreads);
+      job.end = (long)(numFrames * (t + 1) / numThreads);
+      if (t + 1 < numThreads) {
+	threads.push_back(thread(spineJob, job));
+      } else {
+	spineJob(job);
+      }
+    }
+    for (size_t t=0; t<threads.size(); t++) {
+      threads[t].join();
+    }
+  }
+  wconOct_freeWormData(worm);
+  *err = SUCCESS;
+  return numFrames;
+}
@@ -0,0 +1,19 @@
+#ifndef __WRAPPER_SPINES_H_
+#define __WRAPPER_SPINES_H_
+// Arc-length spine resampling, behind wconOct_WCONWorms_spines, for
+//   both backends: it works on the views of wconOct_WCONWorms_worm_data.
+#include "wrapperTypes.h"
+
+// Resamples frames [begin, end) of worm to numPoints (2 or more) points
+//   equally spaced along the arc length of each spine, the first and
+//   last on the ends of the spine. Point k of frame i goes to
+//   x[i*rowStride + k*colStride] and y[...], and the length of the
+//   spine to length[i] unless length is NULL.
+//
+// Frames without points, or with a NaN among them, come out as NaN; a
+//   spine of one point, or of no length, as that point repeated.
+void wconOctSpineResample(const WconOctWormData *worm, long begin, long end,
+			  long numPoints, double *x, double *y,
+			  long rowStride, long colStride, double *length);
+
+#endif /* __WRAPPER_SPINES_H_ */
@@ -0,0 +1,189 @@
+#include "octaveWconPythonWrapper.h"
+#include "wrapperSplit.h"
+#include "wrapperStats.h"
+
+#include <math.h>
+#include <string.h>
+
+#include <algorithm>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Bytes of a number as written out, with its separator; the size limit
+//   is met on this estimate of a chunk's size
+#define SPLIT_NUMBER_BYTES 20
+// Frames of a worm read at a time while planning
+#define SPLIT_WINDOW 65536
+
+namespace {
+
+struct SplitFrame {
+  double t;
+  double bytes;
+};
+
+bool earlierFrame(const SplitFrame &a, const SplitFrame &b) {
+  return a.t < b.t;
+}
+
+// Length of chunkSeconds in the time units of the dataset
+bool splitTimeLength(WconOctError *err, WconOctHandle selfHandle,
+		     double chunkSeconds, double &length) {
+  WconOctUnitsDict *units = wconOct_WCONWorms_units(err, selfHandle);
+  if (*err == FAILED) {
+    return false;
+  }
+  bool found = false;
+  for (int i=0; i<units->numElements; i++) {
+    WconOctHandle unit = units->unitsDict[i].value;
+    // Keys come across in Python repr form
+    if (!found && strcmp(units->unitsDict[i].key, "'t'") == 0) {
+      length = wconOct_MeasurementUnit_from_canon(err, unit, chunkSeconds) -
+	wconOct_MeasurementUnit_from_canon(err, unit, 0.0);
+      found = (*err == SUCCESS);
+    }
+    WconOctError releaseErr;
+    wconOct_releaseHandle(&releaseErr, unit);
+  }
+  wconOct_freeUnitsDict(units);
+  if (!found) {
+    cerr << "ERROR: Cannot convert the chunk length to the time units "
+	 << "of handle " << selfHandle << endl;
+  }
+  return found;
+}
+
+// Every frame of every worm, with an estimate of its size on disk. The
+//   worms are read SPLIT_WINDOW frames at a time, so that a paged
+//   handle is never read in whole.
+bool splitFrames(WconOctError *err, WconOctHandle selfHandle,
+		 vector<SplitFrame> &frames) {
+  long numWorms = wconOct_WCONWorms_num_worms(err, selfHandle);
+  if (*err == FAILED) {
+    return false;
+  }
+  for (long i=0; i<numWorms; i++) {
+    long numFrames = wconOct_WCONWorms_num_frames(err, selfHandle, i);
+    if (*err == FAILED) {
+      return false;
+    }
+    for (long start=0; start<numFrames; start+=SPLIT_WINDOW) {
+      WconOctWormData *worm =
+	wconOct_WCONWorms_worm_frames(err, selfHandle, i, start,
+				      min(numFrames - start,
+					  (long)SPLIT_WINDOW));
+      if (*err == FAILED) {
+	return false;
+      }
+      double scalars = (worm->cx.data != NULL) ? 3 : 1;
+      for (long r=0; r<worm->numFrames; r++) {
+	SplitFrame frame;
+	frame.t = worm->t.data[r * worm->t.rowStride];
+	double points = (worm->aspectSize.data == NULL) ? 0 :
+	  worm->aspectSize.data[r * worm->aspectSize.rowStride];
+	if (isnan(points)) {
+	  points = 0;
+	}
+	frame.bytes = (scalars + 2 * points) * SPLIT_NUMBER_BYTES;
+	frames.push_back(frame);
+      }
+      wconOct_freeWormData(worm);
+    }
+  }
+  stable_sort(frames.begin(), frames.end(), earlierFrame);
+  return true;
+}
+
+// base_N.wcon, or base_N.wcon.zip
+string splitChunkPath(const string &base, size_t chunk, bool compressed) {
+  ostringstream path;
+  path << base << "_" << chunk << ".wcon";
+  if (compressed) {
+    path << ".zip";
+  }
+  return path.str();
+}
+
+} // namespace
+
+// Chunks are cut at the first frame that would take them over either
+//   limit, never between two frames at the same time, so that each
+//   covers a time range of its own.
+extern "C"
+long wconOct_WCONWorms_split(WconOctError *err,
+			     const WconOctHandle selfHandle,
+			     const char *outputBase,
+			     double chunkSeconds,
+			     double chunkBytes,
+			     int compressed) {
+  WconOctStatScope stat(WCONOCT_STAT_SPLIT, err);
+  if (outputBase == NULL || outputBase[0] == '\0' ||
+      !(chunkSeconds >= 0) || !(chunkBytes >= 0)) {
+    cerr << "ERROR: split needs an output base and limits of 0 or more"
+	 << endl;
+    *err = FAILED;
+    return 0;
+  }
+  double timeLength = 0;
+  if (chunkSeconds > 0 &&
+      !splitTimeLength(err, selfHandle, chunkSeconds, timeLength)) {
+    *err = FAILED;
+    return 0;
+  }
+  vector<SplitFrame> frames;
+  if (!splitFrames(err, selfHandle, frames)) {
+    cerr << "ERROR: Cannot split handle " << selfHandle << endl;
+    *err = FAILED;
+    return 0;
+  }
+
+  // Start times of the chunks after the first
+  vector<double> starts;
+  double chunkStart = frames.empty() ? 0 : frames[0].t;
+  double bytes = 0;
+  for (size_t i=0; i<frames.size(); i++) {
+    const SplitFrame &frame = frames[i];
+    bool newTime = (i > 0 && frame.t != frames[i - 1].t);
+    if (newTime &&
+	((timeLength > 0 && frame.t >= chunkStart + timeLength) ||
+	 (chunkBytes > 0 && bytes + frame.bytes > chunkBytes))) {
+      starts.push_back(frame.t);
+      chunkStart = frame.t;
+      bytes = 0;
+    }
+    bytes += frame.bytes;
+  }
+
+  string base = outputBase;
+  size_t slash = base.rfind('/');
+  size_t dirLength = (slash == string::npos) ? 0 : slash + 1;
+  vector<WconOctSplitChunk> chunks(starts.size() + 1);
+  for (size_t i=0; i<chunks.size(); i++) {
+    WconOctSplitChunk &chunk = chunks[i];
+    chunk.t0 = (i == 0) ? -INFINITY : starts[i - 1];
+    chunk.t1 = (i == starts.size()) ? INFINITY : starts[i];
+    chunk.path = splitChunkPath(base, i, compressed != 0);
+    // Links are relative to the directory of the chunk
+    chunk.current = chunk.path.substr(dirLength);
+    if (i > 0) {
+      chunk.prev = splitChunkPath(base, i - 1, compressed != 0)
+	.substr(dirLength);
+    }
+    if (i + 1 < chunks.size()) {
+      chunk.next = splitChunkPath(base, i + 1, compressed != 0)
+	.substr(dirLength);
+    }
+  }
+
+  if (!wconOctSplitWrite(selfHandle, chunks, compressed != 0)) {
+    cerr << "ERROR: Failed to write the chunks of handle " << selfHandle
+	 << endl;
+    *err = FAILED;
+    return 0;
+  }
+  *err = SUCCESS;
+  return (long)chunks.size();
+}
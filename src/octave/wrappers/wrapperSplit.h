@@ -0,0 +1,27 @@
+#ifndef __WRAPPER_SPLIT_H_
+#define __WRAPPER_SPLIT_H_
+// wconOct_WCONWorms_split: the chunks are planned once for both
+//   backends (wrapperSplit.cpp, from worm_frames), and each backend
+//   writes them its own way.
+#include <string>
+#include <vector>
+
+#include "wrapperTypes.h"
+
+// The frames with t0 <= t < t1, in the time units of the dataset, go
+//   to path. current, prev and next are the file names for the "files"
+//   object, with "" for no prev or next.
+struct WconOctSplitChunk {
+  double t0;
+  double t1;
+  std::string path;
+  std::string current;
+  std::string prev;
+  std::string next;
+};
+
+// Writes every chunk; false, with a message, if any of them failed
+bool wconOctSplitWrite(WconOctHandle selfHandle,
+		       const std::vector<WconOctSplitChunk> &chunks,
+		       bool compressed);
+#endif /* __WRAPPER_SPLIT_H_ */
@@ -0,0 +1,378 @@
+#include "octaveWconPythonWrapper.h"
+#include "wrapperStats.h"
+
+#include <string.h>
+
+#include <atomic>
+#include <string>
+
+#include "wconJson.h"
+using namespace std;
+
+// Log-linear buckets, as in HdrHistogram: values below 16 ns have a
+//   bucket each, and every power of two above that is split into 16
+//   buckets, so a bucket is never wider than 1/16 of its values.
+//   Anything beyond 2^48 ns (3 days) goes into the last bucket.
+#define STATS_SUB_BITS 4
+#define STATS_SUB (1 << STATS_SUB_BITS)
+#define STATS_MAX_EXPONENT 47
+#define STATS_BUCKETS (STATS_SUB + \
+		       (STATS_MAX_EXPONENT - STATS_SUB_BITS + 1) * STATS_SUB)
+#define STATS_SAMPLE_MASK 63
+
+namespace {
+
+struct StatsHistogram {
+  atomic<unsigned long long> counts[STATS_BUCKETS];
+  atomic<long long> total;
+  atomic<long long> max;
+};
+
+struct FunctionStats {
+  atomic<unsigned long long> calls;
+  atomic<unsigned long long> errors;
+  atomic<unsigned long long> timed;
+  StatsHistogram native;
+  StatsHistogram python;
+};
+
+// Zero-initialized, being static
+FunctionStats stats[WCONOCT_STAT_COUNT];
+
+const char *statNames[WCONOCT_STAT_COUNT] = {
+  "wconOct_initWrapper",
+  "wconOct_isNullHandle",
+  "wconOct_makeNullHandle",
+  "wconOct_isNoneHandle",
+  "wconOct_freeString",
+  "wconOct_freeUnitsDict",
+  "wconOct_freeWormData",
+  "wconOct_static_WCONWorms_load_from_file",
+  "wconOct_load_many",
+  "wconOct_static_WCONWorms_load_paged",
+  "wconOct_WCONWorms_save_to_file",
+  "wconOct_WCONWorms_save_compressed",
+  "wconOct_WCONWorms_to_canon",
+  "wconOct_WCONWorms_materialize",
+  "wconOct_WCONWorms_add",
+  "wconOct_WCONWorms_eq",
+  "wconOct_WCONWorms_units",
+  "wconOct_WCONWorms_metadata",
+  "wconOct_WCONWorms_data",
+  "wconOct_WCONWorms_num_worms",
+  "wconOct_WCONWorms_worm_ids",
+  "wconOct_WCONWorms_data_as_odict",
+  "wconOct_WCONWorms_metadata_json",
+  "wconOct_WCONWorms_worm_data",
+  "wconOct_WCONWorms_num_frames",
+  "wconOct_WCONWorms_worm_frames",
+  "wconOct_WCONWorms_compact",
+  "wconOct_WCONWorms_points",
+  "wconOct_WCONWorms_split",
+  "wconOct_WCONWorms_resample",
+  "wconOct_WCONWorms_spines",
+  "wconOct_WCONWorms_features",
+  "wconOct_cursor_open",
+  "wconOct_cursor_next",
+  "wconOct_cursor_close",
+  "wconOct_timecursor_open",
+  "wconOct_timecursor_seek",
+  "wconOct_timecursor_next",
+  "wconOct_timecursor_close",
+  "wconOct_spatial_open",
+  "wconOct_spatial_range",
+  "wconOct_spatial_radius",
+  "wconOct_spatial_nearest",
+  "wconOct_spatial_close",
+  "wconOct_writer_open",
+  "wconOct_writer_append",
+  "wconOct_writer_close",
+  "wconOct_parse_stream",
+  "wconOct_peek",
+  "wconOct_catalog_open",
+  "wconOct_catalog_scan",
+  "wconOct_catalog_select",
+  "wconOct_catalog_close",
+  "wconOct_static_MeasurementUnit_create",
+  "wconOct_MeasurementUnit_to_canon",
+  "wconOct_MeasurementUnit_from_canon",
+  "wconOct_MeasurementUnit_unit_string",
+  "wconOct_MeasurementUnit_canonical_unit_string",
+  "wconOct_releaseHandle",
+  "wconOct_load_async",
+  "wconOct_save_async",
+  "wconOct_future_poll",
+  "wconOct_future_wait",
+  "wconOct_future_cancel",
+  "wconOct_future_result"
+};
+
+// Python time of the innermost open scope of this thread
+thread_local long long pythonNs = 0;
+thread_local unsigned int sampleCounter = 0;
+thread_local int currentCall = -1;
+
+int bucketOf(long long ns) {
+  unsigned long long v = (ns < 0) ? 0 : (unsigned long long)ns;
+  if (v < STATS_SUB) {
+    return (int)v;
+  }
+  int e = 63 - __builtin_clzll(v);
+  if (e > STATS_MAX_EXPONENT) {
+    return STATS_BUCKETS - 1;
+  }
+  return STATS_SUB + (e - STATS_SUB_BITS) * STATS_SUB +
+    (int)((v >> (e - STATS_SUB_BITS)) - STATS_SUB);
+}
+
+// Smallest value that falls into bucket b
+double bucketLow(int b) {
+  if (b < STATS_SUB) {
+    return b;
+  }
+  int e = (b - STATS_SUB) / STATS_SUB + STATS_SUB_BITS;
+  int sub = (b - STATS_SUB) % STATS_SUB;
+  return (double)((unsigned long long)(STATS_SUB + sub) <<
+		  (e - STATS_SUB_BITS));
+}
+
+double bucketMid(int b) {
+  if (b < STATS_SUB) {
+    return b;
+  }
+  int e = (b - STATS_SUB) / STATS_SUB + STATS_SUB_BITS;
+  return bucketLow(b) + (double)(1ULL << (e - STATS_SUB_BITS)) / 2;
+}
+
+void record(StatsHistogram &h, long long ns) {
+  h.counts[bucketOf(ns)].fetch_add(1, memory_order_relaxed);
+  h.total.fetch_add(ns, memory_order_relaxed);
+  long long old = h.max.load(memory_order_relaxed);
+  while (ns > old &&
+	 !h.max.compare_exchange_weak(old, ns, memory_order_relaxed)) {
+  }
+}
+
+void reset(StatsHistogram &h) {
+  for (int b=0; b<STATS_BUCKETS; b++) {
+    h.counts[b].store(0, memory_order_relaxed);
+  }
+  h.total.store(0, memory_order_relaxed);
+  h.max.store(0, memory_order_relaxed);
+}
+
+// Copies a histogram out, with p50 and p99 at bucket midpoints
+void summarize(const StatsHistogram &h, unsigned long long *counts,
+	       double *total, double *p50, double *p99, double *max) {
+  unsigned long long n = 0;
+  for (int b=0; b<STATS_BUCKETS; b++) {
+    counts[b] = h.counts[b].load(memory_order_relaxed);
+    n += counts[b];
+  }
+  *total = (double)h.total.load(memory_order_relaxed);
+  *max = (double)h.max.load(memory_order_relaxed);
+  *p50 = *p99 = 0.0;
+  if (n == 0) {
+    return;
+  }
+  unsigned long long seen = 0;
+  unsigned long long rank50 = (n + 1) / 2, rank99 = n - n / 100;
+  bool have50 = false;
+  for (int b=0; b<STATS_BUCKETS; b++) {
+    seen += counts[b];
+    if (!have50 && seen >= rank50) {
+      *p50 = bucketMid(b);
+      have50 = true;
+    }
+    if (seen >= rank99) {
+      *p99 = bucketMid(b);
+      break;
+    }
+  }
+}
+
+void fillStats(int id, WconOctFunctionStats &out,
+	       unsigned long long *nativeCounts,
+	       unsigned long long *pythonCounts) {
+  const FunctionStats &s = stats[id];
+  out.name = statNames[id];
+  out.calls = s.calls.load(memory_order_relaxed);
+  out.errors = s.errors.load(memory_order_relaxed);
+  out.timedCalls = s.timed.load(memory_order_relaxed);
+  summarize(s.native, nativeCounts, &out.nativeTotalNs, &out.nativeP50Ns,
+	    &out.nativeP99Ns, &out.nativeMaxNs);
+  summarize(s.python, pythonCounts, &out.pythonTotalNs, &out.pythonP50Ns,
+	    &out.pythonP99Ns, &out.pythonMaxNs);
+}
+
+void writeHistogram(WconJsonWriter &json, double total, double p50,
+		    double p99, double max, const unsigned long long *counts) {
+  json.beginObject();
+  json.key("total");
+  json.writeNumber(total);
+  json.key("p50");
+  json.writeNumber(p50);
+  json.key("p99");
+  json.writeNumber(p99);
+  json.key("max");
+  json.writeNumber(max);
+  // Non-empty buckets only, as [lowest value, count]
+  json.key("histogram");
+  json.beginArray();
+  for (int b=0; b<STATS_BUCKETS; b++) {
+    if (counts[b] > 0) {
+      json.beginArray();
+      json.writeNumber(bucketLow(b));
+      json.writeInteger((long long)counts[b]);
+      json.endArray();
+    }
+  }
+  json.endArray();
+  json.endObject();
+}
+
+} // namespace
+
+long long wconOctStatsNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+void wconOctStatsAddPython(long long ns) {
+  pythonNs += ns;
+}
+
+bool wconOctStatsSample() {
+  return ((++sampleCounter) & STATS_SAMPLE_MASK) == 0;
+}
+
+long long wconOctStatsEnterScope() {
+  long long saved = pythonNs;
+  pythonNs = 0;
+  return saved;
+}
+
+// Python time of the scope being left; it counts for the enclosing
+//   scope too.
+long long wconOctStatsLeaveScope(long long saved) {
+  long long inner = pythonNs;
+  pythonNs = saved + inner;
+  return inner;
+}
+
+const char *wconOctStatsCurrentCall() {
+  return (currentCall < 0) ? NULL : statNames[currentCall];
+}
+
+int wconOctStatsPushCall(WconOctStatId id) {
+  int previous = currentCall;
+  currentCall = id;
+  return previous;
+}
+
+void wconOctStatsPopCall(int previous) {
+  currentCall = previous;
+}
+
+void wconOctStatsRecord(WconOctStatId id, bool failed, bool timed,
+			long long totalNs, long long pythonNs) {
+  FunctionStats &s = stats[id];
+  s.calls.fetch_add(1, memory_order_relaxed);
+  if (failed) {
+    s.errors.fetch_add(1, memory_order_relaxed);
+  }
+  if (timed) {
+    s.timed.fetch_add(1, memory_order_relaxed);
+    record(s.native, totalNs - pythonNs);
+    // Only calls that went into the interpreter
+    if (pythonNs > 0) {
+      record(s.python, pythonNs);
+    }
+  }
+}
+
+void wconOctStatsCount(WconOctStatId id, unsigned long long calls) {
+  stats[id].calls.fetch_add(calls, memory_order_relaxed);
+}
+
+extern "C"
+WconOctStats *wconOct_stats_snapshot(WconOctError *err) {
+  if (err == NULL) {
+    return NULL;
+  }
+  WconOctStats *result = new WconOctStats;
+  result->numFunctions = WCONOCT_STAT_COUNT;
+  result->functions = new WconOctFunctionStats[WCONOCT_STAT_COUNT];
+  unsigned long long nativeCounts[STATS_BUCKETS];
+  unsigned long long pythonCounts[STATS_BUCKETS];
+  for (int id=0; id<WCONOCT_STAT_COUNT; id++) {
+    fillStats(id, result->functions[id], nativeCounts, pythonCounts);
+  }
+  *err = SUCCESS;
+  return result;
+}
+
+extern "C"
+char *wconOct_stats_snapshot_json(WconOctError *err) {
+  if (err == NULL) {
+    return NULL;
+  }
+  unsigned long long nativeCounts[STATS_BUCKETS];
+  unsigned long long pythonCounts[STATS_BUCKETS];
+  WconJsonWriter json;
+  json.beginObject();
+  json.key("functions");
+  json.beginArray();
+  for (int id=0; id<WCONOCT_STAT_COUNT; id++) {
+    WconOctFunctionStats s;
+    fillStats(id, s, nativeCounts, pythonCounts);
+    json.beginObject();
+    json.key("name");
+    json.writeString(s.name);
+    json.key("calls");
+    json.writeInteger((long long)s.calls);
+    json.key("errors");
+    json.writeInteger((long long)s.errors);
+    json.key("timed_calls");
+    json.writeInteger((long long)s.timedCalls);
+    json.key("native_ns");
+    writeHistogram(json, s.nativeTotalNs, s.nativeP50Ns, s.nativeP99Ns,
+		   s.nativeMaxNs, nativeCounts);
+    json.key("python_ns");
+    writeHistogram(json, s.pythonTotalNs, s.pythonP50Ns, s.pythonP99Ns,
+		   s.pythonMaxNs, pythonCounts);
+    json.endObject();
+  }
+  json.endArray();
+  json.endObject();
+
+  const string &text = json.text();
+  char *result = new char[text.size() + 1];
+  memcpy(result, text.c_str(), text.size() + 1);
+  *err = SUCCESS;
+  return result;
+}
+
+extern "C"
+void wconOct_stats_reset(WconOctError *err) {
+  if (err == NULL) {
+    return;
+  }
+  for (int id=0; id<WCONOCT_STAT_COUNT; id++) {
+    stats[id].calls.store(0, memory_order_relaxed);
+    stats[id].errors.store(0, memory_order_relaxed);
+    stats[id].timed.store(0, memory_order_relaxed);
+    reset(stats[id].native);
+    reset(stats[id].python);
+  }
+  *err = SUCCESS;
+}
+
+extern "C" void wconOct_freeStats(WconOctStats *snapshot) {
+  if (snapshot == NULL) {
+    return;
+  }
+  delete [] snapshot->functions;
+  delete snapshot;
+}
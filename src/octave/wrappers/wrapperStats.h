@@ -0,0 +1,156 @@
+#ifndef __WRAPPER_STATS_H_
+#define __WRAPPER_STATS_H_
+// Call counters and latency histograms behind wconOct_stats_snapshot.
+//   Shared by both backends; every API function opens a
+//   WconOctStatScope on entry.
+//
+// Counts are exact. Latencies are taken with two clock reads per call,
+//   except for the functions marked sampled (the scalar
+//   MeasurementUnit calls, the handle helpers, writer_append and
+//   future_poll), which are timed on one call in 64 so that counting
+//   is all they pay for on the others. cursor_next, called once per
+//   frame, does not even count each call: it adds them up itself
+//   (wconOctStatsCount).
+#include <time.h>
+
+#include "wrapperTypes.h"
+
+enum WconOctStatId {
+  WCONOCT_STAT_INIT_WRAPPER,
+  WCONOCT_STAT_IS_NULL_HANDLE,
+  WCONOCT_STAT_MAKE_NULL_HANDLE,
+  WCONOCT_STAT_IS_NONE_HANDLE,
+  WCONOCT_STAT_FREE_STRING,
+  WCONOCT_STAT_FREE_UNITS_DICT,
+  WCONOCT_STAT_FREE_WORM_DATA,
+  WCONOCT_STAT_LOAD_FROM_FILE,
+  WCONOCT_STAT_LOAD_MANY,
+  WCONOCT_STAT_LOAD_PAGED,
+  WCONOCT_STAT_SAVE_TO_FILE,
+  WCONOCT_STAT_SAVE_COMPRESSED,
+  WCONOCT_STAT_TO_CANON,
+  WCONOCT_STAT_MATERIALIZE,
+  WCONOCT_STAT_ADD,
+  WCONOCT_STAT_EQ,
+  WCONOCT_STAT_UNITS,
+  WCONOCT_STAT_METADATA,
+  WCONOCT_STAT_DATA,
+  WCONOCT_STAT_NUM_WORMS,
+  WCONOCT_STAT_WORM_IDS,
+  WCONOCT_STAT_DATA_AS_ODICT,
+  WCONOCT_STAT_METADATA_JSON,
+  WCONOCT_STAT_WORM_DATA,
+  WCONOCT_STAT_NUM_FRAMES,
+  WCONOCT_STAT_WORM_FRAMES,
+  WCONOCT_STAT_COMPACT,
+  WCONOCT_STAT_POINTS,
+  WCONOCT_STAT_SPLIT,
+  WCONOCT_STAT_RESAMPLE,
+  WCONOCT_STAT_SPINES,
+  WCONOCT_STAT_FEATURES,
+  WCONOCT_STAT_CURSOR_OPEN,
+  WCONOCT_STAT_CURSOR_NEXT,
+  WCONOCT_STAT_CURSOR_CLOSE,
+  WCONOCT_STAT_TIMECURSOR_OPEN,
+  WCONOCT_STAT_TIMECURSOR_SEEK,
+  WCONOCT_STAT_TIMECURSOR_NEXT,
+  WCONOCT_STAT_TIMECURSOR_CLOSE,
+  WCONOCT_STAT_SPATIAL_OPEN,
+  WCONOCT_STAT_SPATIAL_RANGE,
+  WCONOCT_STAT_SPATIAL_RADIUS,
+  WCONOCT_STAT_SPATIAL_NEAREST,
+  WCONOCT_STAT_SPATIAL_CLOSE,
+  WCONOCT_STAT_WRITER_OPEN,
+  WCONOCT_STAT_WRITER_APPEND,
+  WCONOCT_STAT_WRITER_CLOSE,
+  WCONOCT_STAT_PARSE_STREAM,
+  WCONOCT_STAT_PEEK,
+  WCONOCT_STAT_CATALOG_OPEN,
+  WCONOCT_STAT_CATALOG_SCAN,
+  WCONOCT_STAT_CATALOG_SELECT,
+  WCONOCT_STAT_CATALOG_CLOSE,
+  WCONOCT_STAT_MU_CREATE,
+  WCONOCT_STAT_MU_TO_CANON,
+  WCONOCT_STAT_MU_FROM_CANON,
+  WCONOCT_STAT_MU_UNIT_STRING,
+  WCONOCT_STAT_MU_CANONICAL_UNIT_STRING,
+  WCONOCT_STAT_RELEASE_HANDLE,
+  WCONOCT_STAT_LOAD_ASYNC,
+  WCONOCT_STAT_SAVE_ASYNC,
+  WCONOCT_STAT_FUTURE_POLL,
+  WCONOCT_STAT_FUTURE_WAIT,
+  WCONOCT_STAT_FUTURE_CANCEL,
+  WCONOCT_STAT_FUTURE_RESULT,
+  WCONOCT_STAT_COUNT
+};
+
+long long wconOctStatsNow();
+// Adds the time of a call into the interpreter to the enclosing scope
+void wconOctStatsAddPython(long long ns);
+void wconOctStatsRecord(WconOctStatId id, bool failed, bool timed,
+			long long totalNs, long long pythonNs);
+bool wconOctStatsSample();
+// Adds calls that were neither timed nor failed
+void wconOctStatsCount(WconOctStatId id, unsigned long long calls);
+long long wconOctStatsEnterScope();
+long long wconOctStatsLeaveScope(long long saved);
+// The innermost API call in progress on this thread, for telling where
+//   a handle came from. NULL outside of any call.
+const char *wconOctStatsCurrentCall();
+int wconOctStatsPushCall(WconOctStatId id);
+void wconOctStatsPopCall(int previous);
+
+// Times a call from its construction to the end of the enclosing
+//   block, and counts it as an error if *err is FAILED by then.
+class WconOctStatScope {
+ public:
+  WconOctStatScope(WconOctStatId id, const WconOctError *err,
+		   bool sampled = false)
+    : id(id), err(err), timed(!sampled || wconOctStatsSample()),
+      start(0), savedPython(0), previousCall(wconOctStatsPushCall(id)) {
+    if (timed) {
+      savedPython = wconOctStatsEnterScope();
+      start = wconOctStatsNow();
+    }
+  }
+  ~WconOctStatScope() {
+    long long total = 0, python = 0;
+    if (timed) {
+      total = wconOctStatsNow() - start;
+      python = wconOctStatsLeaveScope(savedPython);
+    }
+    wconOctStatsRecord(id, err != NULL && *err == FAILED, timed, total,
+		       python);
+    wconOctStatsPopCall(previousCall);
+  }
+
+ private:
+  WconOctStatId id;
+  const WconOctError *err;
+  bool timed;
+  long long start;
+  long long savedPython;
+  int previousCall;
+};
+
+// Counts the time to the end of the enclosing block as Python time
+class WconOctPythonTimer {
+ public:
+  WconOctPythonTimer() : start(wconOctStatsNow()) {}
+  ~WconOctPythonTimer() { wconOctStatsAddPython(wconOctStatsNow() - start); }
+ private:
+  long long start;
+};
+
+// Evaluates a call into the Python interpreter, counting its time as
+//   Python time: WCONOCT_PYTHON(PyObject_GetAttrString(obj, "name"))
+template <typename F>
+auto wconOctStatsPython(F call) -> decltype(call()) {
+  long long start = wconOctStatsNow();
+  auto result = call();
+  wconOctStatsAddPython(wconOctStatsNow() - start);
+  return result;
+}
+#define WCONOCT_PYTHON(call) wconOctStatsPython([&]() { return (call); })
+
+#endif /* __WRAPPER_STATS_H_ */
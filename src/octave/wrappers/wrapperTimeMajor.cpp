@@ -0,0 +1,366 @@
+#include "octaveWconPythonWrapper.h"
+#include "wrapperMemory.h"
+#include "wrapperStats.h"
+#include "wrapperTimeMajor.h"
+
+#include <math.h>
+#include <stdlib.h>
+
+#include <algorithm>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+using namespace std;
+
+// Time-major layout for both backends, built from
+//   wconOct_WCONWorms_worm_data.
+//
+// The data of a WCONWorms is worm-major, so going frame by frame across
+//   all worms means one strided gather per worm and frame. The layout
+//   holds the same frames transposed: every distinct time, in order, then
+//   the worms present at it, with their centroids and spines packed one
+//   after the other. A scan over time then reads memory front to back.
+//   It is built the first time a cursor is opened on a handle, on
+//   several threads, and kept (and charged to the handle in the memory
+//   report) until the handle is released. Frames with a NaN time are
+//   left out.
+
+// Time steps a thread is given at least
+#define TIME_MAJOR_THREAD_STEPS 256
+
+namespace {
+
+struct TimeMajorLayout {
+  vector<string> wormIds;
+  vector<double> times;
+  // Rows [rowStart[k], rowStart[k+1]) are the worms at times[k]
+  vector<long> rowStart;
+  vector<const char *> rowIds;
+  vector<long> wormIndex;
+  vector<long> frameIndex;
+  vector<double> cx;
+  vector<double> cy;
+  vector<long> pointStart;
+  vector<long> numPoints;
+  vector<double> x;
+  vector<double> y;
+
+  size_t byteSize() const {
+    size_t rows = wormIndex.size();
+    return times.size() * sizeof(double) + rowStart.size() * sizeof(long) +
+      rows * (sizeof(const char *) + 4 * sizeof(long) + 2 * sizeof(double)) +
+      (x.size() + y.size()) * sizeof(double);
+  }
+};
+
+mutex timeMajorLock;
+unordered_map<WconOctHandle, shared_ptr<const TimeMajorLayout> >
+  timeMajorCache;
+
+double viewValue(const WconOctArrayView &view, long row) {
+  return view.data[row * view.rowStride];
+}
+
+// Spine points of frame i, as wconOct_cursor_next counts them
+long framePoints(const WconOctWormData *worm, long i) {
+  if (worm->x.data == NULL || worm->y.data == NULL) {
+    return 0;
+  }
+  long m = worm->x.cols;
+  if (worm->aspectSize.data != NULL) {
+    double size = viewValue(worm->aspectSize, i);
+    m = isnan(size) ? 0 : min(m, (long)size);
+  }
+  return m;
+}
+
+// First frame of the worm at or after t; NaN times sort last
+long firstFrame(const WconOctWormData *worm, double t) {
+  long lo = 0, hi = worm->numFrames;
+  while (lo < hi) {
+    long mid = lo + (hi - lo) / 2;
+    if (viewValue(worm->t, mid) < t) {
+      lo = mid + 1;
+    } else {
+      hi = mid;
+    }
+  }
+  return lo;
+}
+
+// Walks the frames of every worm at times [k0, k1), in worm order. With
+//   fill false, counts the rows and points of each time step into
+//   rowStart[k+1] and pointCount[k+1]; with fill true, copies them to the
+//   places the prefix sums left in rowStart and pointCount.
+void timeMajorPass(const vector<WconOctWormData *> *worms,
+		   TimeMajorLayout *layout, vector<long> *pointCount,
+		   long k0, long k1, bool fill) {
+  if (k0 >= k1) {
+    return;
+  }
+  const vector<double> &times = layout->times;
+  vector<long> rowNext, pointNext;
+  if (fill) {
+    rowNext.assign(layout->rowStart.begin() + k0,
+		   layout->rowStart.begin() + k1);
+    pointNext.assign(pointCount->begin() + k0, pointCount->begin() + k1);
+  }
+  for (size_t w=0; w<worms->size(); w++) {
+    const WconOctWormData *worm = (*worms)[w];
+    long k = k0;
+    for (long i=firstFrame(worm, times[k0]); i<worm->numFrames; i++) {
+      double t = viewValue(worm->t, i);
+      if (!(t <= times[k1 - 1])) {
+	break;
+      }
+      k = lower_bound(times.begin() + k, times.begin() + k1, t) -
+	times.begin();
+      long m = framePoints(worm, i);
+      if (!fill) {
+	layout->rowStart[k + 1]++;
+	(*pointCount)[k + 1] += m;
+	continue;
+      }
+      long row = rowNext[k - k0]++;
+      long point = pointNext[k - k0];
+      pointNext[k - k0] += m;
+      layout->rowIds[row] = layout->wormIds[w].c_str();
+      layout->wormIndex[row] = (long)w;
+      layout->frameIndex[row] = i;
+      if (worm->cx.data != NULL && worm->cy.data != NULL) {
+	layout->cx[row] = viewValue(worm->cx, i);
+	layout->cy[row] = viewValue(worm->cy, i);
+      } else {
+	layout->cx[row] = layout->cy[row] = NAN;
+      }
+      layout->pointStart[row] = point;
+      layout->numPoints[row] = m;
+      for (long j=0; j<m; j++) {
+	layout->x[point + j] =
+	  worm->x.data[i * worm->x.rowStride + j * worm->x.colStride];
+	layout->y[point + j] =
+	  worm->y.data[i * worm->y.rowStride + j * worm->y.colStride];
+      }
+    }
+  }
+}
+
+// $WCONOCT_TIME_MAJOR_THREADS, or one per core up to 8, and no more
+//   than the time steps keep busy
+size_t timeMajorThreads(size_t numTimes) {
+  size_t count = thread::hardware_concurrency();
+  count = (count == 0) ? 1 : min(count, (size_t)8);
+  const char *env = getenv("WCONOCT_TIME_MAJOR_THREADS");
+  if (env != NULL && atol(env) > 0) {
+    count = (size_t)atol(env);
+  }
+  return max((size_t)1, min(count, numTimes / TIME_MAJOR_THREAD_STEPS));
+}
+
+// Both passes split the time steps into the same ranges, one per thread
+void timeMajorPasses(const vector<WconOctWormData *> &worms,
+		     TimeMajorLayout &layout, vector<long> &pointCount,
+		     bool fill) {
+  long numTimes = (long)layout.times.size();
+  size_t numThreads = timeMajorThreads(layout.times.size());
+  vector<thread> threads;
+  for (size_t i=0; i<numThreads; i++) {
+    long k0 = (long)(numTimes * i / numThreads);
+    long k1 = (long)(numTimes * (i + 1) / numThreads);
+    if (i + 1 < numThreads) {
+      threads.push_back(thread(timeMajorPass, &worms, &layout, &pointCount,
+			       k0, k1, fill));
+    } else {
+      timeMajorPass(&worms, &layout, &pointCount, k0, k1, fill);
+    }
+  }
+  for (size_t i=0; i<threads.size(); i++) {
+    threads[i].join();
+  }
+}
+
+shared_ptr<const TimeMajorLayout>
+  timeMajorBuild(const vector<WconOctWormData *> &worms) {
+  shared_ptr<TimeMajorLayout> layout(new TimeMajorLayout);
+  for (size_t w=0; w<worms.size(); w++) {
+    layout->wormIds.push_back(worms[w]->id);
+    for (long i=0; i<worms[w]->numFrames; i++) {
+      double t = viewValue(worms[w]->t, i);
+      if (!isnan(t)) {
+	layout->times.push_back(t);
+      }
+    }
+  }
+  vector<double> &times = layout->times;
+  sort(times.begin(), times.end());
+  times.erase(unique(times.begin(), times.end()), times.end());
+
+  size_t numTimes = times.size();
+  vector<long> pointCount(numTimes + 1, 0);
+  layout->rowStart.assign(numTimes + 1, 0);
+  timeMajorPasses(worms, *layout, pointCount, false);
+  for (size_t k=0; k<numTimes; k++) {
+    layout->rowStart[k + 1] += layout->rowStart[k];
+    pointCount[k + 1] += pointCount[k];
+  }
+  size_t rows = (size_t)layout->rowStart[numTimes];
+  layout->rowIds.resize(rows);
+  layout->wormIndex.resize(rows);
+  layout->frameIndex.resize(rows);
+  layout->cx.resize(rows);
+  layout->cy.resize(rows);
+  layout->pointStart.resize(rows);
+  layout->numPoints.resize(rows);
+  layout->x.resize(pointCount[numTimes]);
+  layout->y.resize(pointCount[numTimes]);
+  timeMajorPasses(worms, *layout, pointCount, true);
+  return layout;
+}
+
+// The layout of a handle, built and cached on first use. NULL (with
+//   *err FAILED) if the worms of the handle cannot be read.
+shared_ptr<const TimeMajorLayout> timeMajorLayout(WconOctError *err,
+						  WconOctHandle selfHandle) {
+  {
+    lock_guard<mutex> guard(timeMajorLock);
+    unordered_map<WconOctHandle,
+		  shared_ptr<const TimeMajorLayout> >::const_iterator found =
+      timeMajorCache.find(selfHandle);
+    if (found != timeMajorCache.end()) {
+      *err = SUCCESS;
+      return found->second;
+    }
+  }
+  long numWorms = wconOct_WCONWorms_num_worms(err, selfHandle);
+  vector<WconOctWormData *> worms;
+  for (long i=0; *err == SUCCESS && i<numWorms; i++) {
+    worms.push_back(wconOct_WCONWorms_worm_data(err, selfHandle, i));
+    if (*err == FAILED) {
+      worms.pop_back();
+    }
+  }
+  shared_ptr<const TimeMajorLayout> layout;
+  if (*err == SUCCESS) {
+    layout = timeMajorBuild(worms);
+  }
+  for (size_t i=0; i<worms.size(); i++) {
+    wconOct_freeWormData(worms[i]);
+  }
+  if (*err == FAILED) {
+    return shared_ptr<const TimeMajorLayout>();
+  }
+
+  // Another thread may have built it meanwhile; the first one is kept
+  bool inserted;
+  {
+    lock_guard<mutex> guard(timeMajorLock);
+    pair<unordered_map<WconOctHandle,
+		       shared_ptr<const TimeMajorLayout> >::iterator, bool>
+      result = timeMajorCache.insert(make_pair(selfHandle, layout));
+    layout = result.first->second;
+    inserted = result.second;
+  }
+  if (inserted) {
+    wconOctMemoryGrow(selfHandle, layout->byteSize());
+  }
+  return layout;
+}
+
+} // namespace
+
+struct wconOctTimeCursorStruct {
+  shared_ptr<const TimeMajorLayout> layout;
+  // Time steps [begin, end) are in range; next is the one to hand out
+  long begin;
+  long end;
+  long next;
+};
+
+// Open cursors keep the layout alive after this
+void wconOctTimeMajorForget(WconOctHandle handle) {
+  lock_guard<mutex> guard(timeMajorLock);
+  timeMajorCache.erase(handle);
+}
+
+extern "C"
+WconOctTimeCursor *wconOct_timecursor_open(WconOctError *err,
+					   const WconOctHandle selfHandle,
+					   double t0, double t1) {
+  WconOctStatScope stat(WCONOCT_STAT_TIMECURSOR_OPEN, err);
+  if (isnan(t0) || isnan(t1)) {
+    cerr << "ERROR: Time cursor range may not be NaN" << endl;
+    *err = FAILED;
+    return NULL;
+  }
+  shared_ptr<const TimeMajorLayout> layout =
+    timeMajorLayout(err, selfHandle);
+  if (*err == FAILED) {
+    cerr << "ERROR: Cannot open a time cursor on handle " << selfHandle
+	 << endl;
+    return NULL;
+  }
+  const vector<double> &times = layout->times;
+  WconOctTimeCursor *cursor = new WconOctTimeCursor;
+  cursor->layout = layout;
+  cursor->begin = lower_bound(times.begin(), times.end(), t0) - times.begin();
+  cursor->end = upper_bound(times.begin(), times.end(), t1) - times.begin();
+  cursor->end = max(cursor->begin, cursor->end);
+  cursor->next = cursor->begin;
+  *err = SUCCESS;
+  return cursor;
+}
+
+extern "C"
+void wconOct_timecursor_seek(WconOctError *err, WconOctTimeCursor *cursor,
+			     double t) {
+  WconOctStatScope stat(WCONOCT_STAT_TIMECURSOR_SEEK, err, true);
+  if (cursor == NULL || isnan(t)) {
+    cerr << "ERROR: timecursor_seek needs a cursor and a time" << endl;
+    *err = FAILED;
+    return;
+  }
+  const vector<double> &times = cursor->layout->times;
+  long k = lower_bound(times.begin(), times.end(), t) - times.begin();
+  cursor->next = min(max(k, cursor->begin), cursor->end);
+  *err = SUCCESS;
+}
+
+extern "C"
+int wconOct_timecursor_next(WconOctError *err, WconOctTimeCursor *cursor,
+			    WconOctTimeSlice *slice) {
+  WconOctStatScope stat(WCONOCT_STAT_TIMECURSOR_NEXT, err, true);
+  if (cursor == NULL || slice == NULL) {
+    cerr << "ERROR: timecursor_next needs a cursor and a slice" << endl;
+    *err = FAILED;
+    return 0;
+  }
+  *err = SUCCESS;
+  if (cursor->next >= cursor->end) {
+    return 0;
+  }
+  const TimeMajorLayout &layout = *(cursor->layout);
+  long k = cursor->next++;
+  long row = layout.rowStart[k];
+  slice->t = layout.times[k];
+  slice->timeIndex = k;
+  slice->numWorms = layout.rowStart[k + 1] - row;
+  slice->wormIds = layout.rowIds.data() + row;
+  slice->wormIndex = layout.wormIndex.data() + row;
+  slice->frameIndex = layout.frameIndex.data() + row;
+  slice->cx = layout.cx.data() + row;
+  slice->cy = layout.cy.data() + row;
+  slice->pointStart = layout.pointStart.data() + row;
+  slice->numPoints = layout.numPoints.data() + row;
+  slice->x = layout.x.data();
+  slice->y = layout.y.data();
+  return 1;
+}
+
+extern "C" void wconOct_timecursor_close(WconOctTimeCursor *cursor) {
+  WconOctStatScope stat(WCONOCT_STAT_TIMECURSOR_CLOSE, NULL);
+  delete cursor;
+}
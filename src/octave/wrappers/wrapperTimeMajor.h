@@ -0,0 +1,10 @@
+#ifndef __WRAPPER_TIME_MAJOR_H_
+#define __WRAPPER_TIME_MAJOR_H_
+// The time-major layout behind wconOct_timecursor_open is built once per
+//   handle and cached on it. Shared by both backends: each one calls
+//   wconOctTimeMajorForget when a handle is released, as it does
+//   wconOctMemoryUntrack.
+#include "wrapperTypes.h"
+
+void wconOctTimeMajorForget(WconOctHandle handle);
+#endif /* __WRAPPER_TIME_MAJOR_H_ */
@@ -6,6 +6,36 @@ typedef enum WconOctErrCodes {
   SUCCESS,
   FAILED
 } WconOctError;
+/* An asynchronous load or save, see wconOct_load_async. */
+typedef int WconOctFuture;
+typedef enum WconOctFutureStates {
+  WCONOCT_FUTURE_PENDING,   /* queued */
+  WCONOCT_FUTURE_RUNNING,
+  WCONOCT_FUTURE_DONE,
+  WCONOCT_FUTURE_FAILED,
+  WCONOCT_FUTURE_CANCELLED
+} WconOctFutureState;
+/* How wconOct_WCONWorms_resample fills frames in between. */
+typedef enum WconOctInterpolations {
+  WCONOCT_INTERP_FROM_METADATA, /* as metadata "interpolate" says */
+  WCONOCT_INTERP_LINEAR,
+  WCONOCT_INTERP_CUBIC
+} WconOctInterpolation;
+/* How wconOct_WCONWorms_compact stores spine points. */
+typedef enum WconOctCompactModes {
+  WCONOCT_COMPACT_FLOAT32,  /* single precision */
+  WCONOCT_COMPACT_QUANTIZED /* fixed point deltas along the spine */
+} WconOctCompactMode;
+/* What wconOct_WCONWorms_compact did. Errors are in canonical units:
+   maxError is the largest difference between a decoded point and the
+   original, errorBound what the mode guarantees. */
+typedef struct compactInfoStruct {
+  double bytesBefore; /* of the spine points */
+  double bytesAfter;
+  double maxErrorX;
+  double maxErrorY;
+  double errorBound;
+} WconOctCompactInfo;
 typedef struct unitskeyValuePair {
   char *key;
   WconOctHandle value;
@@ -14,4 +44,239 @@ typedef struct unitsDictStruct {
   int numElements;
   WconOctUnitsKeyValue *unitsDict;
 } WconOctUnitsDict;
+
+/* A borrowed, strided view of a 2-D block of doubles. Element (i,j)
+   is data[i*rowStride + j*colStride]. data is NULL when the
+   quantity is absent. */
+typedef struct arrayViewStruct {
+  const double *data;
+  long rows;
+  long cols;
+  long rowStride;
+  long colStride;
+} WconOctArrayView;
+
+/* All of the time series of one worm. Rows are frames. x and y have one
+   column per spine point, padded with NaN up to the longest spine of
+   the worm; aspectSize holds the real number of points per frame.
+   The views stay valid until the struct is passed to
+   wconOct_freeWormData. */
+typedef struct wormDataStruct {
+  char *id;
+  long numFrames;
+  WconOctArrayView t;
+  WconOctArrayView x;
+  WconOctArrayView y;
+  WconOctArrayView cx;
+  WconOctArrayView cy;
+  WconOctArrayView aspectSize;
+  void *owner; /* private to the wrapper library */
+} WconOctWormData;
+
+/* A cursor over the frames of a dataset, see wconOct_cursor_open. */
+typedef struct wconOctCursorStruct WconOctCursor;
+#define WCONOCT_ALL_WORMS ((const char *)0)
+
+/* One frame of one worm, as handed out by wconOct_cursor_next. The
+   pointers borrow from the dataset and stay valid until the next call
+   on the cursor. Point k of the spine is x[k*pointStride],
+   y[k*pointStride] for k < numPoints. Offsets in the file are folded
+   into the coordinates when it is loaded, so they are not repeated
+   here; cx and cy are NaN when the worm has no centroid. */
+typedef struct frameStruct {
+  const char *wormId;
+  long wormIndex;
+  long frameIndex;
+  double t;
+  long numPoints;
+  const double *x;
+  const double *y;
+  long pointStride;
+  double cx;
+  double cy;
+} WconOctFrame;
+
+/* A cursor over the time steps of a dataset, see
+   wconOct_timecursor_open. */
+typedef struct wconOctTimeCursorStruct WconOctTimeCursor;
+
+/* Every worm present at one time step, as handed out by
+   wconOct_timecursor_next: for j < numWorms, the worm at position
+   wormIndex[j] of worm_ids (wormIds[j]) has frame frameIndex[j] at t,
+   its centroid at cx[j], cy[j] (NaN if it has none) and its spine at
+   x[pointStart[j] + k], y[pointStart[j] + k] for k < numPoints[j].
+   Worms come in worm_ids order. The arrays are contiguous, borrow from
+   the time-major layout and stay valid until the cursor is closed. */
+typedef struct timeSliceStruct {
+  double t;
+  long timeIndex;
+  long numWorms;
+  const char *const *wormIds;
+  const long *wormIndex;
+  const long *frameIndex;
+  const double *cx;
+  const double *cy;
+  const long *pointStart;
+  const long *numPoints;
+  const double *x;
+  const double *y;
+} WconOctTimeSlice;
+
+/* A spatial index over the positions of a dataset, see
+   wconOct_spatial_open. */
+typedef struct wconOctSpatialIndexStruct WconOctSpatialIndex;
+
+/* One frame found by a spatial query. wormId borrows from the index.
+   x and y are the position the frame was indexed at; distance is from
+   the query point (0 for range queries). */
+typedef struct spatialHitStruct {
+  const char *wormId;
+  long wormIndex;
+  long frameIndex;
+  double t;
+  double x;
+  double y;
+  double distance;
+} WconOctSpatialHit;
+typedef struct spatialHitsStruct {
+  long numHits;
+  WconOctSpatialHit *hits;
+} WconOctSpatialHits;
+
+/* One frame of a data record, as handed to the frame callback of
+   wconOct_parse_stream. Values are as written in the file, in its
+   units: the spine is x[k], y[k] for k < numPoints, and the origin
+   ox, oy (NaN where the record has none) is not folded in. cx and cy
+   are NaN where the record has no centroid. The pointers borrow from
+   the parser and are only good during the callback. */
+typedef struct parseFrameStruct {
+  const char *wormId;
+  long frameIndex; /* within the record */
+  double t;
+  long numPoints;
+  const double *x;
+  const double *y;
+  double ox;
+  double oy;
+  double cx;
+  double cy;
+} WconOctParseFrame;
+
+/* Callbacks of wconOct_parse_stream, each of them optional (NULL).
+   JSON arguments are compact JSON text; wormId is NULL for top-level
+   custom fields. A callback returns 0 to go on, anything else to stop
+   the parse there. */
+typedef struct parseCallbacksStruct {
+  int (*file)(const char *path, void *user);
+  int (*units)(const char *unitsJson, void *user);
+  int (*metadata)(const char *metadataJson, void *user);
+  int (*recordBegin)(const char *wormId, long numFrames, void *user);
+  int (*frame)(const WconOctParseFrame *frame, void *user);
+  int (*recordEnd)(const char *wormId, void *user);
+  int (*custom)(const char *wormId, const char *key, const char *valueJson,
+		void *user);
+} WconOctParseCallbacks;
+
+/* What wconOct_peek finds at the top level of a WCON file. The JSON
+   members are compact JSON text, NULL where the file has no such key.
+   Counts and times are in the units of the file and cover this file
+   only, not the chunks it links to; tMin and tMax are NaN if it has
+   no frames. */
+typedef struct peekStruct {
+  char *unitsJson;
+  char *metadataJson;
+  char *filesJson;
+  long numRecords;
+  long numWorms; /* distinct ids */
+  long numFrames; /* over all records */
+  double tMin;
+  double tMax;
+} WconOctPeek;
+
+/* A catalog of WCON files, see wconOct_catalog_open. */
+typedef struct wconOctCatalogStruct WconOctCatalog;
+
+/* One file selected from a catalog. The strings borrow from the
+   catalog. chain is the first file of the chunks the file belongs to
+   (path itself if it is not chunked), and chainIndex its place among
+   them. Counts and times are those of wconOct_peek, for this file
+   only, in its units. */
+typedef struct catalogEntryStruct {
+  const char *path;
+  const char *chain;
+  long chainIndex;
+  long numRecords;
+  long numWorms;
+  long numFrames;
+  double tMin;
+  double tMax;
+} WconOctCatalogEntry;
+typedef struct catalogHitsStruct {
+  long numHits;
+  WconOctCatalogEntry *hits;
+} WconOctCatalogHits;
+
+/* A streaming writer, see wconOct_writer_open. */
+typedef struct wconOctWriterStruct WconOctWriter;
+
+/* Call statistics of one API function. Latencies are in nanoseconds,
+   split into time spent in the Python interpreter and the rest
+   (native); the native backend has no Python time, and the Python
+   figures only cover calls that entered the interpreter. Totals and
+   percentiles are over the timed calls, which are all calls except for
+   the cheap scalar functions, timed one call in 64. Percentiles come
+   from log-linear histograms and are within about 3%. */
+typedef struct functionStatsStruct {
+  const char *name;
+  unsigned long long calls;
+  unsigned long long errors;
+  unsigned long long timedCalls;
+  double nativeTotalNs;
+  double nativeP50Ns;
+  double nativeP99Ns;
+  double nativeMaxNs;
+  double pythonTotalNs;
+  double pythonP50Ns;
+  double pythonP99Ns;
+  double pythonMaxNs;
+} WconOctFunctionStats;
+typedef struct statsStruct {
+  int numFunctions;
+  WconOctFunctionStats *functions;
+} WconOctStats;
+
+/* One live handle in a memory report. bytes is an estimate of what the
+   handle keeps alive; objects shared by several handles are counted
+   for each of them. createdBy is the API function that handed it out. */
+typedef struct handleMemoryStruct {
+  WconOctHandle handle;
+  double bytes;
+  const char *createdBy;
+  double ageSeconds;
+} WconOctHandleMemory;
+/* The page cache of out-of-core datasets, see wconOct_pageCacheInfo.
+   Pages being read count in bytes even past the budget. */
+typedef struct pageCacheInfoStruct {
+  double capBytes;
+  double bytes;
+  long numPages;
+  double diskBytes; /* spill files of the live paged datasets */
+  double hits;
+  double misses;
+} WconOctPageCacheInfo;
+/* totalBytes includes cachedBytes, the datasets in the load cache
+   (wconOct_setLoadCache), which are charged there instead of to the
+   handles that share them. */
+typedef struct memoryReportStruct {
+  long numHandles;
+  double totalBytes;
+  double capBytes; /* 0 if there is no cap */
+  long numCached;
+  double cachedBytes;
+  double cacheBudgetBytes;
+  double cacheHits;
+  double cacheMisses;
+  int numEntries;
+  WconOctHandleMemory *entries; /* largest first */
+} WconOctMemoryReport;
 #endif /* __WRAPPER_TYPES_H_ */
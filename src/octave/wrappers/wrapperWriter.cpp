@@ -0,0 +1,376 @@
+#include "octaveWconPythonWrapper.h"
+#include "wconJson.h"
+#include "wrapperStats.h"
+
+#include <errno.h>
+#include <math.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+using namespace std;
+
+// Streaming writer for both backends. Frames never go through a
+//   WCONWorms: they are written straight out as WCON text, a data
+//   record at a time, with wconJson.
+//
+// A chunk is laid out as {"units": ..., "metadata": ..., "data": [...]}
+//   with the "files" links, if any, last, as they are only known when
+//   the chunk is closed.
+
+// Frames of one worm that go into one data record
+#define WRITER_BLOCK_FRAMES 64
+// Frames held in all blocks together before every block is written out,
+//   which bounds memory however many worms come and go
+#define WRITER_PENDING_FRAMES 1024
+
+namespace {
+
+struct WriterBlock {
+  vector<double> t;
+  // Number of points of each frame; x and y hold them one after another
+  vector<long> sizes;
+  vector<double> x;
+  vector<double> y;
+};
+
+} // namespace
+
+struct wconOctWriterStruct {
+  // Chunk 0 goes to path, chunk N to dir + stem + "_N" + ext
+  string path;
+  string dir;
+  string stem;
+  string ext;
+  size_t maxChunkBytes;
+  // Everything up to the opening bracket of "data"
+  string header;
+
+  long chunk;
+  FILE *fp;
+  size_t chunkBytes;
+  long chunkRecords;
+
+  map<string, WriterBlock> blocks;
+  long pendingFrames;
+  // Set after an I/O error; the writer can only be closed then
+  bool failed;
+};
+
+static string writerChunkName(const WconOctWriter *writer, long chunk) {
+  if (chunk == 0) {
+    return writer->path.substr(writer->dir.size());
+  }
+  ostringstream name;
+  name << writer->stem << "_" << chunk << writer->ext;
+  return name.str();
+}
+
+// What closes a chunk: the end of "data", and the links to the chunks
+//   around it when there is more than one
+static string writerChunkTail(const WconOctWriter *writer, bool hasNext) {
+  if (writer->chunk == 0 && !hasNext) {
+    return "]}";
+  }
+  WconJsonWriter json;
+  json.beginObject();
+  json.key("current");
+  json.writeString(writerChunkName(writer, writer->chunk));
+  json.key("prev");
+  json.beginArray();
+  if (writer->chunk > 0) {
+    json.writeString(writerChunkName(writer, writer->chunk - 1));
+  }
+  json.endArray();
+  json.key("next");
+  json.beginArray();
+  if (hasNext) {
+    json.writeString(writerChunkName(writer, writer->chunk + 1));
+  }
+  json.endArray();
+  json.endObject();
+  return "], \"files\": " + json.text() + "}";
+}
+
+// false, with a message, on an I/O error
+static bool writerPut(WconOctWriter *writer, const string &text) {
+  if (fwrite(text.data(), 1, text.size(), writer->fp) != text.size()) {
+    cerr << "ERROR: Cannot write "
+	 << writer->dir + writerChunkName(writer, writer->chunk) << ": "
+	 << strerror(errno) << endl;
+    writer->failed = true;
+    return false;
+  }
+  writer->chunkBytes += text.size();
+  return true;
+}
+
+static bool writerOpenChunk(WconOctWriter *writer) {
+  string path = writer->dir + writerChunkName(writer, writer->chunk);
+  writer->fp = fopen(path.c_str(), "w");
+  if (writer->fp == NULL) {
+    cerr << "ERROR: Cannot open " << path << ": " << strerror(errno) << endl;
+    writer->failed = true;
+    return false;
+  }
+  writer->chunkBytes = 0;
+  writer->chunkRecords = 0;
+  return writerPut(writer, writer->header);
+}
+
+static bool writerCloseChunk(WconOctWriter *writer, bool hasNext) {
+  bool ok = writerPut(writer, writerChunkTail(writer, hasNext));
+  if (fclose(writer->fp) != 0 && ok) {
+    cerr << "ERROR: Cannot write "
+	 << writer->dir + writerChunkName(writer, writer->chunk) << ": "
+	 << strerror(errno) << endl;
+    writer->failed = true;
+    ok = false;
+  }
+  writer->fp = NULL;
+  return ok;
+}
+
+static void writerPoints(WconJsonWriter &json, const WriterBlock &block,
+			 const vector<double> &values) {
+  json.beginArray();
+  size_t offset = 0;
+  for (size_t i=0; i<block.sizes.size(); i++) {
+    json.beginArray();
+    for (long k=0; k<block.sizes[i]; k++) {
+      json.writeNumber(values[offset + k]);
+    }
+    json.endArray();
+    offset += block.sizes[i];
+  }
+  json.endArray();
+}
+
+// Writes the frames of a block as one data record, into a new chunk if
+//   it would take this one over the limit
+static bool writerFlushBlock(WconOctWriter *writer, const string &id,
+			     WriterBlock &block) {
+  if (block.t.empty()) {
+    return true;
+  }
+  WconJsonWriter json;
+  json.beginObject();
+  json.key("id");
+  json.writeString(id);
+  json.key("t");
+  json.beginArray();
+  for (size_t i=0; i<block.t.size(); i++) {
+    json.writeNumber(block.t[i]);
+  }
+  json.endArray();
+  json.key("x");
+  writerPoints(json, block, block.x);
+  json.key("y");
+  writerPoints(json, block, block.y);
+  json.endObject();
+  const string &record = json.text();
+
+  if (writer->maxChunkBytes > 0 && writer->chunkRecords > 0 &&
+      writer->chunkBytes + 2 + record.size() +
+      writerChunkTail(writer, true).size() > writer->maxChunkBytes) {
+    if (!writerCloseChunk(writer, true)) {
+      return false;
+    }
+    writer->chunk++;
+    if (!writerOpenChunk(writer)) {
+      return false;
+    }
+  }
+  if ((writer->chunkRecords > 0 && !writerPut(writer, ", ")) ||
+      !writerPut(writer, record)) {
+    return false;
+  }
+  writer->chunkRecords++;
+  // Each record is on disk as soon as it is complete
+  fflush(writer->fp);
+
+  writer->pendingFrames -= (long)block.t.size();
+  block.t.clear();
+  block.sizes.clear();
+  block.x.clear();
+  block.y.clear();
+  return true;
+}
+
+static bool writerFlushAll(WconOctWriter *writer) {
+  for (map<string, WriterBlock>::iterator it = writer->blocks.begin();
+       it != writer->blocks.end(); ++it) {
+    if (!writerFlushBlock(writer, it->first, it->second)) {
+      return false;
+    }
+  }
+  writer->blocks.clear();
+  return true;
+}
+
+// The unit strings are checked by creating the MeasurementUnits
+static bool writerCheckUnits(WconOctError *err, const WconJsonValue &units) {
+  if (!units.isObject()) {
+    cerr << "ERROR: Writer units must be a JSON object" << endl;
+    return false;
+  }
+  static const char *const required[] = {"t", "x", "y", NULL};
+  for (const char *const *k = required; *k != NULL; k++) {
+    if (units.find(*k) == NULL) {
+      cerr << "ERROR: Writer units must have an entry for " << *k << endl;
+      return false;
+    }
+  }
+  for (size_t i=0; i<units.members.size(); i++) {
+    const WconJsonValue &u = units.members[i].second;
+    if (!u.isString()) {
+      cerr << "ERROR: Writer unit for " << units.members[i].first
+	   << " must be a string" << endl;
+      return false;
+    }
+    WconOctHandle unit =
+      wconOct_static_MeasurementUnit_create(err, u.strValue.c_str());
+    if (*err == FAILED) {
+      cerr << "ERROR: Bad writer unit for " << units.members[i].first
+	   << endl;
+      return false;
+    }
+    wconOct_releaseHandle(err, unit);
+  }
+  return true;
+}
+
+extern "C"
+WconOctWriter *wconOct_writer_open(WconOctError *err, const char *path,
+				   const char *unitsJson,
+				   const char *metadataJson,
+				   size_t maxChunkBytes) {
+  WconOctStatScope stat(WCONOCT_STAT_WRITER_OPEN, err);
+  if (path == NULL || path[0] == '\0' || unitsJson == NULL) {
+    cerr << "ERROR: writer_open needs a path and units" << endl;
+    *err = FAILED;
+    return NULL;
+  }
+  WconJsonValue units, metadata;
+  try {
+    wconJsonParse(unitsJson, strlen(unitsJson), units);
+    if (metadataJson != NULL && metadataJson[0] != '\0') {
+      wconJsonParse(metadataJson, strlen(metadataJson), metadata);
+    }
+  } catch (const WconJsonError &e) {
+    cerr << "ERROR: Bad writer units or metadata: " << e.what() << endl;
+    *err = FAILED;
+    return NULL;
+  }
+  if (!writerCheckUnits(err, units)) {
+    *err = FAILED;
+    return NULL;
+  }
+  if (!metadata.isNull() && !metadata.isObject()) {
+    cerr << "ERROR: Writer metadata must be a JSON object" << endl;
+    *err = FAILED;
+    return NULL;
+  }
+
+  WconOctWriter *writer = new WconOctWriter;
+  writer->path = path;
+  size_t slash = writer->path.rfind('/');
+  writer->dir = (slash == string::npos) ? "" :
+    writer->path.substr(0, slash + 1);
+  string name = writer->path.substr(writer->dir.size());
+  size_t dot = name.rfind('.');
+  writer->stem = (dot == string::npos) ? name : name.substr(0, dot);
+  writer->ext = (dot == string::npos) ? "" : name.substr(dot);
+  writer->maxChunkBytes = maxChunkBytes;
+
+  // Empty metadata is left out, as save_to_file does
+  WconJsonWriter json;
+  json.beginObject();
+  json.key("units");
+  json.writeValue(units, true);
+  if (metadata.isObject() && !metadata.members.empty()) {
+    json.key("metadata");
+    json.writeValue(metadata, true);
+  }
+  json.key("data");
+  json.beginArray();
+  writer->header = json.text();
+
+  writer->chunk = 0;
+  writer->fp = NULL;
+  writer->pendingFrames = 0;
+  writer->failed = false;
+  if (!writerOpenChunk(writer)) {
+    if (writer->fp != NULL) {
+      fclose(writer->fp);
+    }
+    delete writer;
+    *err = FAILED;
+    return NULL;
+  }
+  *err = SUCCESS;
+  return writer;
+}
+
+extern "C"
+void wconOct_writer_append(WconOctError *err, WconOctWriter *writer,
+			   const char *wormId, double t,
+			   const double *x, const double *y, long n) {
+  WconOctStatScope stat(WCONOCT_STAT_WRITER_APPEND, err, true);
+  if (writer == NULL || wormId == NULL || wormId[0] == '\0' || n < 0 ||
+      (n > 0 && (x == NULL || y == NULL))) {
+    cerr << "ERROR: writer_append needs a writer, a worm id and n points"
+	 << endl;
+    *err = FAILED;
+    return;
+  }
+  if (writer->failed) {
+    cerr << "ERROR: Writer failed earlier and can only be closed" << endl;
+    *err = FAILED;
+    return;
+  }
+  if (isnan(t)) {
+    cerr << "ERROR: Frame time may not be NaN" << endl;
+    *err = FAILED;
+    return;
+  }
+
+  WriterBlock &block = writer->blocks[wormId];
+  block.t.push_back(t);
+  block.sizes.push_back(n);
+  block.x.insert(block.x.end(), x, x + n);
+  block.y.insert(block.y.end(), y, y + n);
+  writer->pendingFrames++;
+
+  bool ok = true;
+  if (block.t.size() >= WRITER_BLOCK_FRAMES) {
+    ok = writerFlushBlock(writer, wormId, block);
+    writer->blocks.erase(wormId);
+  }
+  if (ok && writer->pendingFrames >= WRITER_PENDING_FRAMES) {
+    ok = writerFlushAll(writer);
+  }
+  *err = ok ? SUCCESS : FAILED;
+}
+
+extern "C"
+void wconOct_writer_close(WconOctError *err, WconOctWriter *writer) {
+  WconOctStatScope stat(WCONOCT_STAT_WRITER_CLOSE, err);
+  if (writer == NULL) {
+    *err = SUCCESS;
+    return;
+  }
+  bool ok = !writer->failed && writerFlushAll(writer);
+  if (writer->fp != NULL) {
+    ok = writerCloseChunk(writer, false) && ok;
+  }
+  if (writer->failed) {
+    cerr << "ERROR: " << writer->path << " is incomplete" << endl;
+  }
+  delete writer;
+  *err = ok ? SUCCESS : FAILED;
+}